@@ -0,0 +1,107 @@
+/**
+ ******************************************************************************
+ * @file           : backup.h
+ * @brief          : Header for backup.c file.
+ *                   Backups of the installed firmware images.
+ *
+ *                   A backup holds only the programmed part of an image,
+ *                   up to its last non-erased flash word, after a header
+ *                   (all fields little-endian):
+ *                     "BKUP"              magic
+ *                     u16 format          2
+ *                     u16 header_size     32
+ *                     u32 flash_address   start of the image in flash
+ *                     u32 region_size     size of the image region
+ *                     u32 image_length    bytes of the image
+ *                     u32 image_crc       CRC-32 of the image
+ *                     u8 compression      BACKUP_COMPRESSION_xxx
+ *                     u8[3] reserved
+ *                     u32 header_crc      CRC-32 of the previous 28 bytes
+ *                   The image follows, as is or as an LZ4 frame (see
+ *                   compressor.h). Format 1 is format 2 without compression.
+ *                   Backups without a header, a raw copy of the whole
+ *                   region, are still accepted.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+#ifndef BACKUP_H
+#define BACKUP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "ff.h"       // For FatFS types
+
+#include "progress.h"
+#include "stream_writer.h"
+#include "decompressor.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define BACKUP_HEADER_SIZE      32
+
+/* Storage of the image */
+#define BACKUP_COMPRESSION_NONE 0
+#define BACKUP_COMPRESSION_LZ4  1
+
+/* Custom return type for backup operations ----------------------------------*/
+typedef enum {
+    BACKUP_OK = 0,
+	BACKUP_ERROR = 1
+} backup_StatusTypeDef;
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+    uint32_t format;                // 1 or 2, 0 for a backup without header
+    uint32_t flashAddress;
+    uint32_t regionSize;
+    uint32_t imageLength;           // Bytes of the image
+    uint32_t imageCRC;              // CRC-32 of the image (format 1 and later)
+    uint32_t compression;           // BACKUP_COMPRESSION_xxx
+    uint32_t imageOffset;           // Position of the image in the file
+    uint32_t storedLength;          // Bytes of the image in the file
+} Backup_Header;
+
+/* State of a source producing the image of a backup */
+typedef struct
+{
+    StreamWriter_FileSource file;
+    StreamWriter_Source stored;
+    Decompressor decompressor;
+} Backup_Reader;
+
+/* Position in the image of a backup, to read it again from there */
+typedef struct
+{
+    Backup_Reader reader;
+    FSIZE_t filePosition;
+} Backup_Mark;
+
+/* Exported functions --------------------------------------------------------*/
+
+uint32_t backup_imageLength(uint32_t flashStartAddr, uint32_t regionSize);
+backup_StatusTypeDef backup_create(uint32_t flashStartAddr, uint32_t regionSize, const char *backupFilePath, bool compress,
+                                   ProgressManager *progressManager, uint32_t step_number);
+backup_StatusTypeDef backup_open(FIL *file, const char *backupFilePath, Backup_Header *header);
+backup_StatusTypeDef backup_source(StreamWriter_Source *source, Backup_Reader *reader, FIL *file, const Backup_Header *header);
+void backup_mark(const Backup_Reader *reader, FIL *file, Backup_Mark *mark);
+backup_StatusTypeDef backup_rewind(Backup_Reader *reader, FIL *file, const Backup_Mark *mark);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BACKUP_H */
@@ -0,0 +1,98 @@
+/**
+ ******************************************************************************
+ * @file           : boot_info.h
+ * @brief          : Header for boot_info.c file.
+ *                   Boot information handed to the firmware in RAM_SHARED
+ *                   (see STM32H745IIKX_FLASH.ld), written right before the
+ *                   jump. The firmware may include this header to read it
+ *                   instead of deriving the same facts again; it must copy
+ *                   the block before using RAM_SHARED for anything else.
+ *
+ *                   The block is valid when its magic, version, size and
+ *                   CRC-32 (zlib convention, over the bytes before `crc`)
+ *                   match. Later versions only append fields before `crc`.
+ *                   The configuration snapshot of file_manager.h follows,
+ *                   at CONFIG_SNAPSHOT_ADDRESS.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+#ifndef BOOT_INFO_H
+#define BOOT_INFO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+#define BOOT_INFO_ADDRESS       0x24000000U     // RAM_SHARED
+#define BOOT_INFO_MAGIC         0x4F464E49U     // "INFO"
+#define BOOT_INFO_VERSION       1U
+
+#define BOOT_INFO_MAX_STEPS     12U
+#define BOOT_INFO_VERSION_SIZE  16U
+
+/* Outcome of the update run by the previous boot */
+#define BOOT_INFO_UPDATE_NONE       0U      // No update report for the current state
+#define BOOT_INFO_UPDATE_INSTALLED  1U      // A package was installed, the firmware is on trial
+#define BOOT_INFO_UPDATE_FAILED     2U      // A package install failed, the firmware may be incomplete
+#define BOOT_INFO_UPDATE_RESTORED   3U      // The previous firmware was restored from its backups
+
+/* State of the configuration snapshot (file_manager.h) that follows the block */
+#define BOOT_INFO_CONFIG_UNKNOWN    0U      // Not checked by the bootloader
+#define BOOT_INFO_CONFIG_NONE       1U      // No valid snapshot, the file is to be parsed
+#define BOOT_INFO_CONFIG_SNAPSHOT   2U      // Valid snapshot, still to be matched with the file
+
+/* Exported types ------------------------------------------------------------*/
+
+/* Report of an update, kept over the reboot that follows it */
+typedef struct
+{
+    uint32_t result;                            // BOOT_INFO_UPDATE_xxx
+    uint32_t imageAddress;                      // CM7 image the length and CRC apply to
+    uint32_t imageLength;                       // Up to the last programmed flash word
+    uint32_t imageCRC;                          // CRC-32 of imageLength bytes
+    uint32_t updateTime;                        // Milliseconds of the whole update
+    uint32_t stepTime[BOOT_INFO_MAX_STEPS];     // Milliseconds of each update step, 0 if skipped
+} BootInfo_Update;
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;                              // sizeof(BootInfo)
+    uint32_t resetFlags;                        // RCC->RSR, left uncleared
+    uint32_t updateState;                       // FW_UPDATE_NONE, or FW_UPDATE_TESTING for a trial to confirm
+    uint32_t activeSlot;                        // BOOT_SLOT_x, STM32FLASH_NO_SLOT without A/B slots
+    uint32_t imageAddress;                      // CM7 image started
+    uint32_t bootCount;                         // Boots since the backup domain was reset
+    uint32_t stateBoots;                        // Boots since the last state change
+    uint32_t bootCycles;                        // Core cycles from main() to the jump
+    uint32_t configStatus;                      // BOOT_INFO_CONFIG_xxx
+    char bootloaderVersion[BOOT_INFO_VERSION_SIZE];
+    BootInfo_Update update;
+    uint32_t crc;
+} BootInfo;
+
+/* Exported functions --------------------------------------------------------*/
+
+void bootInfo_init(void);
+void bootInfo_write(uint32_t updateState, uint32_t activeSlot, uint32_t imageAddress, uint32_t bootCount,
+                    uint32_t stateBoots, const BootInfo_Update *update);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BOOT_INFO_H */
@@ -0,0 +1,72 @@
+/**
+ ******************************************************************************
+ * @file           : boot_slot.h
+ * @brief          : Header for boot_slot.c file.
+ *                   A/B firmware slots, enabled by defining BOOT_AB_SLOTS
+ *                   in boot_config.h or on the compiler command line.
+ *
+ *                   Each image region is split in two slots: slot A starts
+ *                   at FW_CMx_START_ADDR, slot B right after it. A slot holds
+ *                   a CM7 and a CM4 image linked for its addresses; a package
+ *                   carries one section per slot and image, told apart by
+ *                   their target address.
+ *
+ *                   The boot slot is the CM4 boot address option byte: the
+ *                   CM4 boots from it, and the bootloader jumps to the CM7
+ *                   image of the same slot. An update is installed into the
+ *                   other slot, then tried by switching the option byte;
+ *                   a rollback switches it back, nothing is reflashed.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+#ifndef BOOT_SLOT_H
+#define BOOT_SLOT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "main.h"
+#include "boot_config.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define BOOT_SLOT_A             0U
+#define BOOT_SLOT_B             1U
+
+/* Size of a slot, whole sectors so that each slot is erased on its own */
+#define BOOT_SLOT_CM7_SIZE      ((FW_CM7_MAX_SIZE / 2U) & ~(FLASH_SECTOR_SIZE - 1U))
+#define BOOT_SLOT_CM4_SIZE      ((FW_CM4_MAX_SIZE / 2U) & ~(FLASH_SECTOR_SIZE - 1U))
+
+/* Custom return type for boot slot operations -------------------------------*/
+typedef enum {
+    BOOTSLOT_OK = 0,
+    BOOTSLOT_ERROR = 1
+} bootSlot_StatusTypeDef;
+
+/* Exported functions --------------------------------------------------------*/
+
+uint32_t bootSlot_active(void);
+uint32_t bootSlot_other(uint32_t slot);
+bool bootSlot_isValid(uint32_t slot);
+uint32_t bootSlot_cm7Address(uint32_t slot);
+uint32_t bootSlot_cm4Address(uint32_t slot);
+bootSlot_StatusTypeDef bootSlot_select(uint32_t slot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BOOT_SLOT_H */
@@ -0,0 +1,82 @@
+/**
+ ******************************************************************************
+ * @file           : boot_state.h
+ * @brief          : Header for boot_state.c file.
+ *                   Update state seen by the boot sequence, kept in two tiers:
+ *
+ *                   - FLASH_DATA holds the durable milestones, written with
+ *                     STM32Flash_writePersistentData() and
+ *                     STM32Flash_writePersistentTrial().
+ *                   - The 4 KB backup SRAM holds the boot counters and the
+ *                     handoffs that only need to survive a reset, such as
+ *                     TO_TEST -> TESTING when a trial boot is launched, so
+ *                     that they cost no flash write, and the report of the
+ *                     last update for boot_info.h.
+ *
+ *                   A handed-off state never reaches the flash: during such
+ *                   a trial the flash still reads TO_TEST, and the firmware
+ *                   learns of the trial from BootInfo.updateState only.
+ *                   Handoffs are therefore only made with
+ *                   BOOT_PERSISTENT_LOG_ONLY, once the firmware reads the
+ *                   boot information; before that TESTING is written to
+ *                   flash, where older firmware reads it from word 0.
+ *
+ *                   A handoff applies to the flash record it was made over
+ *                   and is ignored once a new state is written to flash. If
+ *                   the backup SRAM is lost (power cut without VBAT), the
+ *                   flash state is seen again: a trial boot is retried.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+#ifndef BOOT_STATE_H
+#define BOOT_STATE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stm32_flash.h"
+#include "boot_info.h"
+
+/* Custom return type for boot state operations ------------------------------*/
+typedef enum {
+    BOOTSTATE_OK = 0,
+    BOOTSTATE_ERROR = 1
+} bootState_StatusTypeDef;
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+    FW_UpdateState updateState;
+    uint32_t trialSlot;             // STM32FLASH_NO_SLOT outside an A/B trial
+    uint32_t bootCount;             // Boots since the backup domain was reset
+    uint32_t stateBoots;            // Boots since the last state change
+} BootState;
+
+/* Exported functions --------------------------------------------------------*/
+
+void bootState_init(void);
+void bootState_read(const STM32Flash_PersistentState *flash, BootState *state);
+void bootState_recordBoot(const STM32Flash_PersistentState *flash);
+bootState_StatusTypeDef bootState_handoff(const STM32Flash_PersistentState *flash, FW_UpdateState state, uint32_t trialSlot);
+bootState_StatusTypeDef bootState_writeReport(const STM32Flash_PersistentState *flash, const BootInfo_Update *update);
+bootState_StatusTypeDef bootState_readReport(const STM32Flash_PersistentState *flash, BootInfo_Update *update);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BOOT_STATE_H */
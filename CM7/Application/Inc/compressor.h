@@ -0,0 +1,49 @@
+/**
+ ******************************************************************************
+ * @file           : compressor.h
+ * @brief          : Header for compressor.c file.
+ *                   LZ4 encoder for firmware backups.
+ *
+ *                   Produces standard LZ4 frames readable by decompressor.c
+ *                   and by the lz4 tool: independent blocks of at most
+ *                   64 KB, content size field set, no checksums. The caller
+ *                   writes the frame header, then each block as a u32
+ *                   length (bit 31 set for a stored block) followed by its
+ *                   bytes, then a zero end mark.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Exported constants --------------------------------------------------------*/
+#define COMPRESSOR_FRAME_HEADER_SIZE    15
+#define COMPRESSOR_BLOCK_SIZE           65536
+
+/* Exported functions --------------------------------------------------------*/
+
+uint32_t compressor_frameHeader(uint8_t *buffer, uint32_t contentSize);
+uint32_t compressor_compressBlock(const uint8_t *src, uint32_t srcLength, uint8_t *dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COMPRESSOR_H */
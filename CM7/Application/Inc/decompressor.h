@@ -0,0 +1,75 @@
+/**
+ ******************************************************************************
+ * @file           : decompressor.h
+ * @brief          : Header for decompressor.c file.
+ *                   Streaming decoder for compressed package sections.
+ *
+ *                   A compressed section is a standard LZ4 frame with
+ *                   independent blocks of at most 64 KB and the content size
+ *                   field set, as produced by:
+ *                       lz4 -B4 -BI --content-size <section> <section>.lz4
+ *                   Block and content checksums are accepted and skipped,
+ *                   the package CRC already covers the compressed bytes.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+#ifndef DECOMPRESSOR_H
+#define DECOMPRESSOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "ff.h"       // For FatFS types
+
+#include "stream_writer.h"
+
+/* Exported constants --------------------------------------------------------*/
+
+/* Largest block accepted, LZ4 frame block maximum size 4 (64 KB) */
+#define DECOMPRESSOR_BLOCK_SIZE     65536
+
+/* Custom return type for decompressor operations ----------------------------*/
+typedef enum {
+    DECOMPRESSOR_OK = 0,
+	DECOMPRESSOR_ERROR = 1
+} decompressor_StatusTypeDef;
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+    StreamWriter_Source input;  // Compressed bytes of the section
+    uint32_t remaining;         // Compressed bytes left in the section
+    uint32_t contentSize;       // Size of the decoded section
+    uint32_t produced;          // Decoded bytes handed out so far
+    bool blockChecksum;
+    bool contentChecksum;
+    bool ended;                 // EndMark reached
+    uint32_t blockLength;       // Decoded bytes in the block buffer
+    uint32_t blockOffset;       // Bytes of the block buffer already handed out
+} Decompressor;
+
+/* Exported functions --------------------------------------------------------*/
+
+decompressor_StatusTypeDef decompressor_open(Decompressor *decompressor, const StreamWriter_Source *input, uint32_t compressedSize);
+decompressor_StatusTypeDef decompressor_read(Decompressor *decompressor, uint8_t *buffer, uint32_t length, uint32_t *bytesRead);
+void decompressor_source(StreamWriter_Source *source, Decompressor *decompressor);
+int32_t decompressor_decodeBlock(const uint8_t *src, uint32_t srcLength, uint8_t *dst, uint32_t dstCapacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DECOMPRESSOR_H */
@@ -0,0 +1,86 @@
+/**
+ ******************************************************************************
+ * @file           : delta.h
+ * @brief          : Header for delta.c file.
+ *                   Block-copy + literal patch applied against a base image.
+ *
+ *                   Delta stream layout (all fields little-endian):
+ *                     "DLTA"              magic
+ *                     u32 base_size       bytes of the base image covered by base_crc
+ *                     u32 base_crc        CRC-32 of those bytes (same as the package CRC)
+ *                     u32 target_size     size of the rebuilt image
+ *                   followed by commands:
+ *                     0x01 u32 offset u32 length   copy from the base image
+ *                     0x02 u32 length <bytes>      literal bytes
+ *                     0x00                         end of stream
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+#ifndef DELTA_H
+#define DELTA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "ff.h"       // For FatFS types
+
+#include "stream_writer.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define DELTA_HEADER_SIZE   16
+
+/* Bytes of the base image read at a time by delta_checkBase() */
+#define DELTA_BASE_CHUNK    2048
+
+/* Custom return type for delta operations -----------------------------------*/
+typedef enum {
+    DELTA_OK = 0,
+	DELTA_ERROR = 1
+} delta_StatusTypeDef;
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+    uint32_t baseSize;
+    uint32_t baseCRC;
+    uint32_t targetSize;
+} Delta_Header;
+
+typedef struct
+{
+    StreamWriter_Source input;  // Delta stream, raw or decompressed
+    FIL *base;                  // Open base image
+    uint32_t baseOffset;        // Position of the image in the base file
+    Delta_Header header;
+    uint32_t produced;          // Target bytes produced so far
+    uint8_t command;            // Command in progress
+    uint32_t remaining;         // Bytes left in the command in progress
+    bool ended;
+} Delta;
+
+/* Exported functions --------------------------------------------------------*/
+
+delta_StatusTypeDef delta_readHeader(const StreamWriter_Source *input, Delta_Header *header);
+delta_StatusTypeDef delta_checkBase(FIL *base, const Delta_Header *header);
+delta_StatusTypeDef delta_open(Delta *delta, const StreamWriter_Source *input, FIL *base, uint32_t baseOffset);
+delta_StatusTypeDef delta_read(Delta *delta, uint8_t *buffer, uint32_t length, uint32_t *bytesRead);
+void delta_source(StreamWriter_Source *source, Delta *delta);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DELTA_H */
@@ -0,0 +1,132 @@
+/**
+ ******************************************************************************
+ * @file           : package.h
+ * @brief          : Header for package.c file.
+ *                   Update package manifest parser.
+ *
+ *                   Package v2 layout (all fields little-endian):
+ *                     "BOT2"              magic
+ *                     u16 format          2
+ *                     u16 manifest_size   bytes of the manifest, this header included
+ *                     u32 manifest_crc    CRC-32 of the manifest bytes after this field
+ *                   followed by TLV records (u8 tag, u8 length, value):
+ *                     0x01 VERSION        version string, up to 8 characters
+ *                     0x02 SECTION        u8 type, u8 encoding, u8 align_log2, u8 reserved,
+ *                                         u32 target, u32 offset, u32 length, u32 crc
+ *                     0x03 BLOCKS         u8 type, u8 block_log2 (12), u16 reserved,
+ *                                         u32 table_offset, u32 table_crc
+ *                   Unknown tags are skipped. Each section starts on a
+ *                   (1 << align_log2) boundary, at least a flash word, and
+ *                   carries the CRC-32 of its stored bytes, so sections may
+ *                   be stored in any order, left out, and verified one by one.
+ *
+ *                   A BLOCKS record, after the SECTION record of the same
+ *                   type, points to a table of CRC-32, one per 4 KB block of
+ *                   the stored section, itself covered by table_crc. Such a
+ *                   section is verified block by block while it is read
+ *                   instead of in a separate pass.
+ *
+ *                   Sections of the same type must differ by their target,
+ *                   e.g. one firmware image per A/B slot (see boot_slot.h).
+ *
+ *                   Package v1 ("BOOT", three sizes, version, footer CRC)
+ *                   is still accepted and mapped onto the same manifest.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+#ifndef PACKAGE_H
+#define PACKAGE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "ff.h"       // For FatFS types
+
+#include "progress.h"
+#include "stream_writer.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define PACKAGE_MAX_SECTIONS        8
+#define PACKAGE_VERSION_STR_SIZE    9
+
+/* Block digests: block size and largest table (8 MB sections) */
+#define PACKAGE_BLOCK_SIZE          4096
+#define PACKAGE_MAX_BLOCKS          2048
+
+/* Section types */
+#define PACKAGE_SECTION_CM7         1
+#define PACKAGE_SECTION_CM4         2
+#define PACKAGE_SECTION_EXTERNAL    3
+
+/* Section encoding flags */
+#define PACKAGE_ENCODING_LZ4        0x01    // LZ4 frame, see decompressor.h
+#define PACKAGE_ENCODING_DELTA      0x02    // Delta against the installed image, see delta.h
+
+/* Custom return type for package operations ---------------------------------*/
+typedef enum {
+    PACKAGE_OK = 0,
+	PACKAGE_ERROR = 1
+} package_StatusTypeDef;
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+    uint8_t type;                   // PACKAGE_SECTION_xxx
+    uint8_t encoding;               // PACKAGE_ENCODING_xxx flags
+    uint32_t target;                // Flash address, 0 for the default of the type
+    uint32_t offset;                // Position in the package
+    uint32_t length;                // Bytes stored in the package
+    uint32_t crc;                   // CRC-32 of the stored bytes (v2 only)
+    uint32_t blockTable;            // Offset of the block digests, 0 if none
+    uint32_t blockTableCRC;         // CRC-32 of the block digests (root)
+} Package_Section;
+
+typedef struct
+{
+    uint32_t format;                // 1 or 2
+    char version[PACKAGE_VERSION_STR_SIZE];
+    uint32_t identity;              // v1 footer CRC or v2 manifest CRC
+    uint32_t numSections;
+    Package_Section sections[PACKAGE_MAX_SECTIONS];
+} Package_Manifest;
+
+/* Reader of the stored bytes of one section, checking each block against its
+ * digest as it goes. Only one reader may be open at a time. */
+typedef struct
+{
+    FIL *file;
+    uint32_t remaining;             // Stored bytes not read from the file yet
+    bool verified;                  // Section has block digests
+    uint32_t block;                 // Index of the next block to read
+    uint32_t blockLength;           // Bytes of the block buffer in use
+    uint32_t blockOffset;           // Bytes of the block buffer already handed out
+} Package_Reader;
+
+/* Exported functions --------------------------------------------------------*/
+
+package_StatusTypeDef package_readManifest(FIL *file, Package_Manifest *manifest);
+const Package_Section *package_findSection(const Package_Manifest *manifest, uint8_t type);
+const Package_Section *package_findTarget(const Package_Manifest *manifest, uint8_t type, uint32_t target);
+package_StatusTypeDef package_verifySection(FIL *file, const Package_Section *section, ProgressManager *progressManager,
+                                            uint32_t step_number, uint32_t *bytesDone, uint32_t totalBytes);
+package_StatusTypeDef package_openReader(Package_Reader *reader, FIL *file, const Package_Section *section);
+void package_readerSource(StreamWriter_Source *source, Package_Reader *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PACKAGE_H */
@@ -0,0 +1,88 @@
+/**
+ ******************************************************************************
+ * @file           : profiler.h
+ * @brief          : Header for profiler.c file.
+ *                   Boot and update phase timing on the DWT cycle counter,
+ *                   enabled by defining BOOT_PROFILING in boot_config.h or
+ *                   on the compiler command line. Without it every PROFILE_xxx
+ *                   macro expands to nothing.
+ *
+ *                   Events go to a ring buffer in RAM, the oldest ones being
+ *                   overwritten, and are dumped with PROFILE_DUMP() to the
+ *                   UART and to a text file. Short repeated phases, such as a
+ *                   display refresh, are summed into totals instead.
+ *                   Event names must be string literals: only the pointer
+ *                   is kept.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+#include "boot_config.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define PROFILER_MAX_EVENTS     64
+#define PROFILER_MAX_TOTALS     4
+
+/* Exported macro ------------------------------------------------------------*/
+#ifdef BOOT_PROFILING
+#define PROFILE_INIT()              profiler_init()
+#define PROFILE_MARK(name)          profiler_event(name, PROFILER_EVENT_MARK)
+#define PROFILE_BEGIN(name)         profiler_event(name, PROFILER_EVENT_BEGIN)
+#define PROFILE_END(name)           profiler_event(name, PROFILER_EVENT_END)
+#define PROFILE_TOTAL_BEGIN(name)   profiler_totalBegin(name)
+#define PROFILE_TOTAL_END(name)     profiler_totalEnd(name)
+#define PROFILE_DUMP(path)          profiler_dump(path)
+#define PROFILE_CLOCK_CHANGED()     profiler_clockChanged()
+#else
+#define PROFILE_INIT()              ((void)0)
+#define PROFILE_MARK(name)          ((void)0)
+#define PROFILE_BEGIN(name)         ((void)0)
+#define PROFILE_END(name)           ((void)0)
+#define PROFILE_TOTAL_BEGIN(name)   ((void)0)
+#define PROFILE_TOTAL_END(name)     ((void)0)
+#define PROFILE_DUMP(path)          ((void)0)
+#define PROFILE_CLOCK_CHANGED()     ((void)0)
+#endif
+
+/* Exported types ------------------------------------------------------------*/
+typedef enum {
+    PROFILER_EVENT_MARK = 0,        // A point in time
+    PROFILER_EVENT_BEGIN,           // Start of a phase, phases may overlap
+    PROFILER_EVENT_END              // End of the last phase begun with the same name
+} Profiler_EventKind;
+
+/* Exported functions --------------------------------------------------------*/
+#ifdef BOOT_PROFILING
+
+void profiler_init(void);
+void profiler_clockChanged(void);
+void profiler_event(const char *name, Profiler_EventKind kind);
+void profiler_totalBegin(const char *name);
+void profiler_totalEnd(const char *name);
+void profiler_dump(const char *path);
+
+#endif /* BOOT_PROFILING */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROFILER_H */
@@ -20,11 +20,15 @@
 
 #include <stdint.h>
 
+/* Maximum number of steps tracked by a progress manager */
+#define PROGRESS_MAX_STEPS 16
+
 typedef struct
 {
     int num_steps;
     int current_step;
     int last_progress;
+    uint8_t step_percent[PROGRESS_MAX_STEPS]; // Completion of each step, steps may run concurrently
 } ProgressManager;
 
 /**
@@ -43,4 +47,11 @@ void progress_init(ProgressManager* pm, uint32_t num_steps);
  */
 void progress_update(ProgressManager* pm, uint32_t step_number, uint32_t current_value, uint32_t total_value);
 
+/**
+ * @brief Marks a step as fully completed.
+ * @param pm Pointer to the ProgressManager structure.
+ * @param step_number Step number (starting from 1).
+ */
+void progress_complete(ProgressManager* pm, uint32_t step_number);
+
 #endif // PROGRESS_H
@@ -0,0 +1,111 @@
+/**
+ ******************************************************************************
+ * @file           : stream_writer.h
+ * @brief          : Header for stream_writer.c file.
+ *                   Double-buffered read/program pipeline used to stream a
+ *                   firmware image from a source (package or backup file)
+ *                   into a sink (internal flash).
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+#ifndef STREAM_WRITER_H
+#define STREAM_WRITER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "ff.h"       // For FatFS types
+
+#include "progress.h"
+
+/* Exported constants --------------------------------------------------------*/
+
+/* Number of buffers in the pipeline, at least 2 (one filling, one draining) */
+#define STREAMWRITER_NUM_BUFFERS     2
+
+/* Size of each buffer, a multiple of the FatFs sector size so that aligned
+ * reads go straight from the disk into the buffer */
+#define STREAMWRITER_BUFFER_SIZE     4096
+
+/* Internal flash programming granularity (one 256-bit flash word) */
+#define STREAMWRITER_FLASH_WORD_SIZE 32
+
+/* Custom return type for stream writer operations ---------------------------*/
+typedef enum {
+    STREAMWRITER_OK = 0,
+	STREAMWRITER_ERROR = 1
+} streamWriter_StatusTypeDef;
+
+/* Exported types ------------------------------------------------------------*/
+
+/**
+ * @brief Producer side of the pipeline.
+ *        read() fills up to `length` bytes into `buffer` and reports how many
+ *        bytes were actually produced.
+ */
+typedef struct
+{
+    streamWriter_StatusTypeDef (*read)(void *context, uint8_t *buffer, uint32_t length, uint32_t *bytesRead);
+    void *context;
+} StreamWriter_Source;
+
+/**
+ * @brief Consumer side of the pipeline.
+ *        start() begins draining `length` bytes of `data` to `address` and may
+ *        return before the operation has completed; wait() blocks until the
+ *        last started operation is finished and returns its status.
+ *        `length` is always padded to a whole number of flash words.
+ */
+typedef struct
+{
+    streamWriter_StatusTypeDef (*start)(void *context, uint32_t address, const uint8_t *data, uint32_t length);
+    streamWriter_StatusTypeDef (*wait)(void *context);
+    void *context;
+} StreamWriter_Sink;
+
+/**
+ * @brief Source context reading a fixed number of bytes from an open file.
+ */
+typedef struct
+{
+    FIL *file;
+    uint32_t remaining;
+} StreamWriter_FileSource;
+
+typedef struct
+{
+    StreamWriter_Source source;
+    StreamWriter_Sink sink;
+    uint32_t address;                 // Next destination address
+    uint32_t size;                    // Total number of payload bytes
+    ProgressManager* progressManager; // Optional, may be NULL
+    uint32_t step_number;
+} StreamWriter;
+
+/* Exported functions --------------------------------------------------------*/
+
+void streamWriter_init(StreamWriter *writer, const StreamWriter_Source *source, const StreamWriter_Sink *sink,
+                       uint32_t address, uint32_t size, ProgressManager* progressManager, uint32_t step_number);
+streamWriter_StatusTypeDef streamWriter_run(StreamWriter *writer);
+
+void streamWriter_fileSource(StreamWriter_Source *source, StreamWriter_FileSource *context, FIL *file, uint32_t size);
+void streamWriter_flashSink(StreamWriter_Sink *sink, uint32_t skipSectors);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STREAM_WRITER_H */
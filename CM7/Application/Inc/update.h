@@ -27,6 +27,8 @@ extern "C" {
 #include <stdbool.h>
 #include "ff.h"       // For FatFS types
 
+#include "boot_info.h"
+
 
 /* Private define ------------------------------------------------------------*/
 
@@ -44,8 +46,8 @@ typedef enum {
 /* Exported functions --------------------------------------------------------*/
 
 fwupdate_StatusTypeDef update_findPackageFile(char *packageFilePath, size_t maxLen);
-fwupdate_StatusTypeDef update_restoreBackupFirmwares(void);
-fwupdate_StatusTypeDef update_processPackageFile(const TCHAR* packageFilePath);
+fwupdate_StatusTypeDef update_restoreBackupFirmwares(BootInfo_Update *report);
+fwupdate_StatusTypeDef update_processPackageFile(const TCHAR* packageFilePath, BootInfo_Update *report);
 
 /* Exported macros -----------------------------------------------------------*/
 /* Add any necessary macros here */
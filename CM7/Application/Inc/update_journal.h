@@ -0,0 +1,70 @@
+/**
+ ******************************************************************************
+ * @file           : update_journal.h
+ * @brief          : Header for update_journal.c file.
+ *                   Power-loss journal of an update in progress.
+ *
+ *                   Records are appended, one flash word each, to the
+ *                   persistent data log in FLASH_DATA (see stm32_flash.c),
+ *                   interleaved with its state records. Each record carries
+ *                   the session of the persistent state: every state change
+ *                   opens a new one, so a new update always starts with an
+ *                   empty journal.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+#ifndef UPDATE_JOURNAL_H
+#define UPDATE_JOURNAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Exported constants --------------------------------------------------------*/
+
+/* Firmware images tracked by the journal */
+#define UPDATE_JOURNAL_IMAGE_CM7    0
+#define UPDATE_JOURNAL_IMAGE_CM4    1
+#define UPDATE_JOURNAL_NUM_IMAGES   2
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+    uint32_t packageSize;           // Identity of the package being installed
+    uint32_t packageCRC;
+    uint32_t session;               // Persistent data session of the update
+    uint32_t doneSteps;             // Completed update steps (bit = step number)
+    bool compared[UPDATE_JOURNAL_NUM_IMAGES];
+    uint32_t changedSectors[UPDATE_JOURNAL_NUM_IMAGES];    // Result of the compare step
+    uint32_t programmedSectors[UPDATE_JOURNAL_NUM_IMAGES]; // Sectors fully programmed and verified
+    uint32_t nextRecord;            // Flash address of the next free record
+    bool resumed;                   // Records of this package were found
+} UpdateJournal;
+
+/* Exported functions --------------------------------------------------------*/
+
+void updateJournal_open(UpdateJournal *journal, uint32_t packageSize, uint32_t packageCRC);
+bool updateJournal_close(UpdateJournal *journal);
+bool updateJournal_isStepDone(const UpdateJournal *journal, uint32_t step);
+void updateJournal_stepDone(UpdateJournal *journal, uint32_t step);
+void updateJournal_compareDone(UpdateJournal *journal, uint32_t image, uint32_t changedSectors);
+void updateJournal_sectorDone(UpdateJournal *journal, uint32_t image, uint32_t sector);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UPDATE_JOURNAL_H */
@@ -0,0 +1,91 @@
+/**
+ ******************************************************************************
+ * @file           : update_scheduler.h
+ * @brief          : Header for update_scheduler.c file.
+ *                   Runs the steps of an update as a dependency graph, each
+ *                   step being tagged with the hardware resources it uses.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+#ifndef UPDATE_SCHEDULER_H
+#define UPDATE_SCHEDULER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "progress.h"
+#include "update.h"
+
+/* Exported constants --------------------------------------------------------*/
+
+/* Maximum number of tasks in a graph (dependencies are stored as a bitmask) */
+#define UPDATE_SCHEDULER_MAX_TASKS  16
+
+/* Hardware resources a task holds while it runs */
+#define UPDATE_RES_BANK1    (1U << 0)   // Internal flash bank 1 controller
+#define UPDATE_RES_BANK2    (1U << 1)   // Internal flash bank 2 controller
+#define UPDATE_RES_QSPI     (1U << 2)   // External NOR flash (FatFs volume)
+#define UPDATE_RES_CRC      (1U << 3)   // CRC calculation unit
+
+/* Dependency on the task at index `i` of the table */
+#define UPDATE_DEP(i)       (1U << (i))
+
+/* Exported types ------------------------------------------------------------*/
+typedef enum {
+    UPDATE_TASK_PENDING = 0,
+    UPDATE_TASK_RUNNING,
+    UPDATE_TASK_DONE,
+    UPDATE_TASK_FAILED
+} UpdateTask_State;
+
+/**
+ * @brief One node of the update graph.
+ *        A foreground task provides run(), which blocks until the work is
+ *        done. A background task provides start() and poll(): start() hands
+ *        the work to the hardware and returns, poll() reports progress and
+ *        returns true once the work has finished, with its status.
+ */
+typedef struct
+{
+    const char *name;
+    uint32_t step_number;             // Progress step of the task
+    uint32_t resources;               // UPDATE_RES_xxx mask
+    uint32_t dependencies;            // UPDATE_DEP(i) mask
+
+    fwupdate_StatusTypeDef (*run)(void *context, ProgressManager *progressManager, uint32_t step_number);
+    fwupdate_StatusTypeDef (*start)(void *context, ProgressManager *progressManager, uint32_t step_number);
+    bool (*poll)(void *context, fwupdate_StatusTypeDef *status);
+    void *context;
+
+    UpdateTask_State state;           // Set to UPDATE_TASK_DONE by the caller to skip the task
+    uint32_t startTick;
+    uint32_t elapsed;                 // Milliseconds the task ran, set by the scheduler
+} UpdateTask;
+
+/* Called each time a task completes successfully, e.g. to journal it */
+typedef void (*UpdateScheduler_Callback)(const UpdateTask *task, void *context);
+
+/* Exported functions --------------------------------------------------------*/
+
+fwupdate_StatusTypeDef updateScheduler_run(UpdateTask *tasks, uint32_t numTasks, ProgressManager *progressManager,
+                                           UpdateScheduler_Callback onTaskDone, void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UPDATE_SCHEDULER_H */
@@ -0,0 +1,526 @@
+/**
+ ******************************************************************************
+ * @file           : backup.c
+ * @brief          : Backups of the installed firmware images.
+ *                   Only the programmed part of an image is saved: the
+ *                   erased tail of the region is left out of the file, and
+ *                   out of the erase and programming of a restore.
+ *                   The image is LZ4-compressed straight from the flash, so
+ *                   a fraction of its size is programmed into the QSPI NOR,
+ *                   unless the backup is the base of a delta, which needs
+ *                   random access.
+ *                   A backup is only written when its header does not match
+ *                   the length and CRC-32 of the installed image; an
+ *                   uncompressed one is then refreshed in place, chunk by
+ *                   chunk, rewriting only the chunks that differ.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+#include "boot_config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "stm32_flash.h"
+#include "stm32_crc.h"
+#include "file_manager.h"
+#include "compressor.h"
+
+#include "backup.h"
+
+/* Private define ------------------------------------------------------------*/
+#define BACKUP_FORMAT           2
+
+/* Private variables ---------------------------------------------------------*/
+
+/* One compressed block, or raw chunk, and the end mark of the frame.
+ * Also holds the chunk of an existing backup being compared. */
+static uint8_t writeBuffer[COMPRESSOR_BLOCK_SIZE + 8] __attribute__((aligned(32)));
+
+/* Private function prototypes -----------------------------------------------*/
+static void backup_buildHeader(uint8_t *header, uint32_t flashStartAddr, uint32_t regionSize, uint32_t imageLength,
+                               uint32_t imageCRC, uint8_t compression);
+static backup_StatusTypeDef backup_write(uint32_t flashStartAddr, uint32_t regionSize, uint32_t imageLength, uint32_t imageCRC,
+                                         const char *backupFilePath, bool compress, bool replace,
+                                         ProgressManager *progressManager, uint32_t step_number);
+static backup_StatusTypeDef backup_refresh(uint32_t flashStartAddr, uint32_t regionSize, uint32_t imageLength, uint32_t imageCRC,
+                                           const char *backupFilePath, uint32_t storedLength,
+                                           ProgressManager *progressManager, uint32_t step_number);
+static uint32_t backup_readUint32LE(const uint8_t *buffer);
+static void backup_writeUint32LE(uint8_t *buffer, uint32_t value);
+
+/**
+ * @brief  Returns the length of the programmed part of an image region.
+ *         The region is scanned down from its end to the last flash word
+ *         that is not erased; images are programmed by whole flash words.
+ * @param  flashStartAddr Start of the region.
+ * @param  regionSize     Size of the region, a multiple of the flash word.
+ * @return Length in bytes, a multiple of the flash word, 0 if the region is erased.
+ */
+uint32_t backup_imageLength(uint32_t flashStartAddr, uint32_t regionSize)
+{
+    const uint32_t *words = (const uint32_t *)(uintptr_t)flashStartAddr;
+    uint32_t length = regionSize / sizeof(uint32_t);
+
+    while ((length > 0) && (words[length - 1] == 0xFFFFFFFFU))
+    {
+        length--;
+    }
+
+    length *= sizeof(uint32_t);
+
+    return (length + STM32FLASH_WORD_SIZE - 1) & ~(STM32FLASH_WORD_SIZE - 1);
+}
+
+/**
+ * @brief  Backs up the image of a flash region to a file.
+ *         Nothing is written if the backup already holds the installed
+ *         image, identified by its length and CRC-32.
+ * @param  flashStartAddr  Start of the region.
+ * @param  regionSize      Size of the region.
+ * @param  backupFilePath  Path of the backup file.
+ * @param  compress        Store the image as an LZ4 frame. An uncompressed
+ *                         backup is required as the base of a delta.
+ * @param  progressManager Pointer to the progress manager for updates.
+ * @param  step_number     Step number for the progress manager.
+ * @return BACKUP_OK if the backup is up to date, BACKUP_ERROR otherwise.
+ */
+backup_StatusTypeDef backup_create(uint32_t flashStartAddr, uint32_t regionSize, const char *backupFilePath, bool compress,
+                                   ProgressManager *progressManager, uint32_t step_number)
+{
+    // Check flash memory boundaries
+    if ((flashStartAddr + regionSize) > FLASH_END_ADDR)
+    {
+        printf("Error: Flash address out of range\n");
+        return BACKUP_ERROR;
+    }
+
+    // Identity of the installed image, the CRC unit reads the flash by MDMA
+    uint32_t imageLength = backup_imageLength(flashStartAddr, regionSize);
+    uint32_t imageCRC = STM32Crc_compute((const uint8_t *)(uintptr_t)flashStartAddr, imageLength);
+
+    FILINFO fileInfo;
+    if (f_stat(backupFilePath, &fileInfo) != FR_OK)
+    {
+        return backup_write(flashStartAddr, regionSize, imageLength, imageCRC, backupFilePath, compress, false,
+                            progressManager, step_number);
+    }
+
+    FIL file;
+    Backup_Header header;
+    bool valid = (backup_open(&file, backupFilePath, &header) == BACKUP_OK);
+    if (valid)
+    {
+        f_close(&file);
+    }
+
+    // Compressed where the base of a delta needs random access, or written
+    // by an older bootloader without an image CRC
+    bool usable = valid && (header.format >= 1) && (compress || (header.compression == BACKUP_COMPRESSION_NONE));
+
+    if (usable && (header.flashAddress == flashStartAddr) && (header.imageLength == imageLength) &&
+        (header.imageCRC == imageCRC))
+    {
+        printf("Backup %s is up to date (CRC 0x%08lX). Skipping backup.\n", backupFilePath, (unsigned long)imageCRC);
+        progress_update(progressManager, step_number, 1, 1);
+        return BACKUP_OK;
+    }
+
+    if (usable && (header.compression == BACKUP_COMPRESSION_NONE) && !compress)
+    {
+        printf("Backup %s is stale, refreshing it\n", backupFilePath);
+        return backup_refresh(flashStartAddr, regionSize, imageLength, imageCRC, backupFilePath, header.storedLength,
+                              progressManager, step_number);
+    }
+
+    printf("Backup %s is stale, writing it again\n", backupFilePath);
+    return backup_write(flashStartAddr, regionSize, imageLength, imageCRC, backupFilePath, compress, true,
+                        progressManager, step_number);
+}
+
+/**
+ * @brief  Writes a whole backup under a temporary name, then renames it.
+ * @param  replace An older backup exists and is replaced.
+ */
+static backup_StatusTypeDef backup_write(uint32_t flashStartAddr, uint32_t regionSize, uint32_t imageLength, uint32_t imageCRC,
+                                         const char *backupFilePath, bool compress, bool replace,
+                                         ProgressManager *progressManager, uint32_t step_number)
+{
+    uint8_t header[BACKUP_HEADER_SIZE + COMPRESSOR_FRAME_HEADER_SIZE] __attribute__((aligned(32)));
+    uint32_t headerLength = BACKUP_HEADER_SIZE;
+
+    backup_buildHeader(header, flashStartAddr, regionSize, imageLength, imageCRC,
+                       compress ? BACKUP_COMPRESSION_LZ4 : BACKUP_COMPRESSION_NONE);
+
+    if (compress)
+    {
+        headerLength += compressor_frameHeader(header + BACKUP_HEADER_SIZE, imageLength);
+    }
+
+    printf("Backing up %lu of %lu bytes at 0x%08lX\n", (unsigned long)imageLength, (unsigned long)regionSize,
+           (unsigned long)flashStartAddr);
+
+    // Build a temporary file name by appending ".tmp"
+    char tmpFilePath[256];
+    snprintf(tmpFilePath, sizeof(tmpFilePath), "%s.tmp", backupFilePath);
+
+    // Remove any existing temporary file
+    f_unlink(tmpFilePath);
+
+    // Open the temporary backup file
+    FIL backupFile;
+    FRESULT res = f_open(&backupFile, tmpFilePath, FA_WRITE | FA_READ | FA_CREATE_ALWAYS);
+    if (res != FR_OK)
+    {
+        printf("Error: Cannot open temporary backup file %s\n", tmpFilePath);
+        return BACKUP_ERROR;
+    }
+
+    if (file_reliableWrite(&backupFile, header, headerLength, 5) != FILEMANAGER_OK)
+    {
+        printf("Error: Reliable write failed in temporary file %s\n", tmpFilePath);
+        f_close(&backupFile);
+        return BACKUP_ERROR;
+    }
+
+    uint32_t bytesRemaining = imageLength;
+    uint32_t flashAddress = flashStartAddr;
+    uint32_t totalBytesRead = 0;
+    uint32_t storedLength = 0;
+
+    do
+    {
+        uint32_t chunkSize = (bytesRemaining > COMPRESSOR_BLOCK_SIZE) ? COMPRESSOR_BLOCK_SIZE : bytesRemaining;
+        uint32_t writeLength = chunkSize;
+
+        if (compress)
+        {
+            // Compressed from the flash, the last block carries the end mark
+            writeLength = (chunkSize > 0) ? compressor_compressBlock((const uint8_t *)(uintptr_t)flashAddress, chunkSize, writeBuffer) : 0;
+            if (chunkSize == bytesRemaining)
+            {
+                memset(writeBuffer + writeLength, 0, 4);
+                writeLength += 4;
+            }
+        }
+        else
+        {
+            // Read from flash memory
+            memcpy(writeBuffer, (const uint8_t *)(uintptr_t)flashAddress, chunkSize);
+        }
+
+        // Write to the temporary file
+        if ((writeLength > 0) && (file_reliableWrite(&backupFile, writeBuffer, writeLength, 5) != FILEMANAGER_OK))
+        {
+            printf("Error: Reliable write failed in temporary file %s\n", tmpFilePath);
+            f_close(&backupFile);
+            return BACKUP_ERROR;
+        }
+
+        flashAddress += chunkSize;
+        bytesRemaining -= chunkSize;
+        totalBytesRead += chunkSize;
+        storedLength += writeLength;
+
+        // Update progress
+        progress_update(progressManager, step_number, totalBytesRead, imageLength);
+    } while (bytesRemaining > 0);
+
+    // Close the temporary file
+    f_close(&backupFile);
+
+    if (compress)
+    {
+        printf("Backup compressed to %lu bytes\n", (unsigned long)storedLength);
+    }
+
+    // The flash still holds the image if power is lost before the rename
+    if (replace)
+    {
+        f_unlink(backupFilePath);
+    }
+
+    // Rename the temporary file to the final backup file
+    res = f_rename(tmpFilePath, backupFilePath);
+    if (res != FR_OK)
+    {
+        printf("Error: Failed to rename %s to %s\n", tmpFilePath, backupFilePath);
+        return BACKUP_ERROR;
+    }
+
+    return BACKUP_OK;
+}
+
+/**
+ * @brief  Opens a backup and reads its header.
+ *         On success the file is left open and positioned at the image.
+ * @param  file           File object to open.
+ * @param  backupFilePath Path of the backup file.
+ * @param  header         Header to fill.
+ * @return BACKUP_OK if the backup is usable, BACKUP_ERROR otherwise (file closed).
+ */
+backup_StatusTypeDef backup_open(FIL *file, const char *backupFilePath, Backup_Header *header)
+{
+    uint8_t buffer[BACKUP_HEADER_SIZE];
+    UINT bytesRead = 0;
+
+    FRESULT res = f_open(file, backupFilePath, FA_READ);
+    if (res != FR_OK)
+    {
+        printf("No backup found for %s (fres=%d)\n", backupFilePath, res);
+        return BACKUP_ERROR;
+    }
+
+    memset(header, 0, sizeof(*header));
+
+    if ((f_read(file, buffer, sizeof(buffer), &bytesRead) != FR_OK) || (bytesRead != sizeof(buffer)) ||
+        (memcmp(buffer, "BKUP", 4) != 0))
+    {
+        // Raw copy of the region, written before backups had a header
+        header->imageLength = (uint32_t)f_size(file);
+        header->storedLength = header->imageLength;
+        if (f_lseek(file, 0) != FR_OK)
+        {
+            f_close(file);
+            return BACKUP_ERROR;
+        }
+        return BACKUP_OK;
+    }
+
+    // Format 1 has no compression, its compression byte is zero
+    if ((buffer[4] < 1) || (buffer[4] > BACKUP_FORMAT) || (buffer[6] != BACKUP_HEADER_SIZE) ||
+        (buffer[24] > BACKUP_COMPRESSION_LZ4) || (STM32Crc_compute(buffer, 28) != backup_readUint32LE(buffer + 28)))
+    {
+        printf("Error: Invalid backup header in %s\n", backupFilePath);
+        f_close(file);
+        return BACKUP_ERROR;
+    }
+
+    header->format = buffer[4];
+    header->flashAddress = backup_readUint32LE(buffer + 8);
+    header->regionSize = backup_readUint32LE(buffer + 12);
+    header->imageLength = backup_readUint32LE(buffer + 16);
+    header->imageCRC = backup_readUint32LE(buffer + 20);
+    header->compression = buffer[24];
+    header->imageOffset = BACKUP_HEADER_SIZE;
+    header->storedLength = (uint32_t)f_size(file) - BACKUP_HEADER_SIZE;
+
+    if ((header->compression == BACKUP_COMPRESSION_NONE) && (header->storedLength < header->imageLength))
+    {
+        printf("Error: Backup %s is truncated\n", backupFilePath);
+        f_close(file);
+        return BACKUP_ERROR;
+    }
+
+    return BACKUP_OK;
+}
+
+/**
+ * @brief  Builds a source producing the image of an open backup.
+ *         A compressed image is decoded on the fly.
+ * @param  source Source to initialize.
+ * @param  reader Storage for the source state, must outlive the source.
+ * @param  file   Backup opened by backup_open().
+ * @param  header Header read by backup_open().
+ * @return BACKUP_OK if the image can be read, BACKUP_ERROR otherwise.
+ */
+backup_StatusTypeDef backup_source(StreamWriter_Source *source, Backup_Reader *reader, FIL *file, const Backup_Header *header)
+{
+    if (header->compression == BACKUP_COMPRESSION_NONE)
+    {
+        streamWriter_fileSource(source, &reader->file, file, header->imageLength);
+        return BACKUP_OK;
+    }
+
+    streamWriter_fileSource(&reader->stored, &reader->file, file, header->storedLength);
+
+    if ((decompressor_open(&reader->decompressor, &reader->stored, header->storedLength) != DECOMPRESSOR_OK) ||
+        (reader->decompressor.contentSize != header->imageLength))
+    {
+        printf("Error: Invalid compressed backup\n");
+        return BACKUP_ERROR;
+    }
+
+    decompressor_source(source, &reader->decompressor);
+    return BACKUP_OK;
+}
+
+/**
+ * @brief  Records the position of a backup source.
+ *         A compressed image can only be marked between two blocks, at an
+ *         offset of the image that is a multiple of COMPRESSOR_BLOCK_SIZE:
+ *         the decoded block is not part of the mark.
+ * @param  reader Reader of the source, see backup_source().
+ * @param  file   Open backup file.
+ * @param  mark   Mark to fill.
+ */
+void backup_mark(const Backup_Reader *reader, FIL *file, Backup_Mark *mark)
+{
+    mark->reader = *reader;
+    mark->filePosition = f_tell(file);
+}
+
+/**
+ * @brief  Moves a backup source back to a mark.
+ * @param  reader Reader the mark was taken from.
+ * @param  file   Open backup file.
+ * @param  mark   Position to return to.
+ * @return BACKUP_OK on success, BACKUP_ERROR if the file cannot be seeked.
+ */
+backup_StatusTypeDef backup_rewind(Backup_Reader *reader, FIL *file, const Backup_Mark *mark)
+{
+    *reader = mark->reader;
+
+    if (f_lseek(file, mark->filePosition) != FR_OK)
+    {
+        printf("Error: Failed to seek in backup file\n");
+        return BACKUP_ERROR;
+    }
+
+    return BACKUP_OK;
+}
+
+/**
+ * @brief  Rewrites the chunks of an uncompressed backup that differ from the
+ *         installed image, then its header.
+ *         The header is invalidated first, so a refresh torn by a power loss
+ *         leaves a backup that is rejected, then written again, instead of
+ *         a mix of two images taken as valid.
+ * @param  storedLength Bytes of image in the existing backup.
+ */
+static backup_StatusTypeDef backup_refresh(uint32_t flashStartAddr, uint32_t regionSize, uint32_t imageLength, uint32_t imageCRC,
+                                           const char *backupFilePath, uint32_t storedLength,
+                                           ProgressManager *progressManager, uint32_t step_number)
+{
+    uint8_t header[BACKUP_HEADER_SIZE] __attribute__((aligned(32)));
+    uint32_t chunksWritten = 0;
+    FIL backupFile;
+
+    if (f_open(&backupFile, backupFilePath, FA_READ | FA_WRITE) != FR_OK)
+    {
+        printf("Error: Cannot open backup file %s\n", backupFilePath);
+        return BACKUP_ERROR;
+    }
+
+    memset(header, 0, sizeof(header));
+    if (file_reliableWrite(&backupFile, header, 4, 5) != FILEMANAGER_OK)
+    {
+        printf("Error: Reliable write failed in backup file %s\n", backupFilePath);
+        f_close(&backupFile);
+        return BACKUP_ERROR;
+    }
+
+    for (uint32_t offset = 0; offset < imageLength; offset += COMPRESSOR_BLOCK_SIZE)
+    {
+        const uint8_t *flashData = (const uint8_t *)(uintptr_t)(flashStartAddr + offset);
+        uint32_t chunkSize = ((imageLength - offset) > COMPRESSOR_BLOCK_SIZE) ? COMPRESSOR_BLOCK_SIZE : (imageLength - offset);
+        UINT bytesRead = 0;
+
+        if (f_lseek(&backupFile, BACKUP_HEADER_SIZE + offset) != FR_OK)
+        {
+            printf("Error: Failed to seek in backup file %s\n", backupFilePath);
+            f_close(&backupFile);
+            return BACKUP_ERROR;
+        }
+
+        // Reading the NOR is much faster than programming it
+        if ((offset + chunkSize) <= storedLength)
+        {
+            if ((f_read(&backupFile, writeBuffer, chunkSize, &bytesRead) == FR_OK) && (bytesRead == chunkSize) &&
+                (memcmp(writeBuffer, flashData, chunkSize) == 0))
+            {
+                progress_update(progressManager, step_number, offset + chunkSize, imageLength);
+                continue;
+            }
+            f_lseek(&backupFile, BACKUP_HEADER_SIZE + offset);
+        }
+
+        memcpy(writeBuffer, flashData, chunkSize);
+        if (file_reliableWrite(&backupFile, writeBuffer, chunkSize, 5) != FILEMANAGER_OK)
+        {
+            printf("Error: Reliable write failed in backup file %s\n", backupFilePath);
+            f_close(&backupFile);
+            return BACKUP_ERROR;
+        }
+        chunksWritten++;
+
+        progress_update(progressManager, step_number, offset + chunkSize, imageLength);
+    }
+
+    // Drop what is left of a longer image, then validate the backup
+    if ((f_lseek(&backupFile, BACKUP_HEADER_SIZE + imageLength) != FR_OK) || (f_truncate(&backupFile) != FR_OK) ||
+        (f_lseek(&backupFile, 0) != FR_OK))
+    {
+        printf("Error: Failed to truncate backup file %s\n", backupFilePath);
+        f_close(&backupFile);
+        return BACKUP_ERROR;
+    }
+
+    backup_buildHeader(header, flashStartAddr, regionSize, imageLength, imageCRC, BACKUP_COMPRESSION_NONE);
+    if (file_reliableWrite(&backupFile, header, sizeof(header), 5) != FILEMANAGER_OK)
+    {
+        printf("Error: Reliable write failed in backup file %s\n", backupFilePath);
+        f_close(&backupFile);
+        return BACKUP_ERROR;
+    }
+
+    f_close(&backupFile);
+
+    printf("Backup refreshed, %lu of %lu chunks rewritten\n", (unsigned long)chunksWritten,
+           (unsigned long)((imageLength + COMPRESSOR_BLOCK_SIZE - 1) / COMPRESSOR_BLOCK_SIZE));
+
+    return BACKUP_OK;
+}
+
+/**
+ * @brief  Fills the header of a backup.
+ * @param  header Destination, BACKUP_HEADER_SIZE bytes.
+ */
+static void backup_buildHeader(uint8_t *header, uint32_t flashStartAddr, uint32_t regionSize, uint32_t imageLength,
+                               uint32_t imageCRC, uint8_t compression)
+{
+    memset(header, 0, BACKUP_HEADER_SIZE);
+    memcpy(header, "BKUP", 4);
+    header[4] = BACKUP_FORMAT;
+    header[6] = BACKUP_HEADER_SIZE;
+    backup_writeUint32LE(header + 8, flashStartAddr);
+    backup_writeUint32LE(header + 12, regionSize);
+    backup_writeUint32LE(header + 16, imageLength);
+    backup_writeUint32LE(header + 20, imageCRC);
+    header[24] = compression;
+    backup_writeUint32LE(header + 28, STM32Crc_compute(header, 28));
+}
+
+/**
+ * @brief Reads a 32-bit unsigned integer from a buffer in little-endian format.
+ */
+static uint32_t backup_readUint32LE(const uint8_t *buffer)
+{
+    return ((uint32_t)buffer[0]) |
+           ((uint32_t)buffer[1] << 8) |
+           ((uint32_t)buffer[2] << 16) |
+           ((uint32_t)buffer[3] << 24);
+}
+
+/**
+ * @brief Writes a 32-bit unsigned integer to a buffer in little-endian format.
+ */
+static void backup_writeUint32LE(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = (uint8_t)value;
+    buffer[1] = (uint8_t)(value >> 8);
+    buffer[2] = (uint8_t)(value >> 16);
+    buffer[3] = (uint8_t)(value >> 24);
+}
@@ -0,0 +1,100 @@
+/**
+ ******************************************************************************
+ * @file           : boot_info.c
+ * @brief          : Boot information handed to the firmware, see boot_info.h.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
+#include <string.h>
+
+#include "main.h"
+#include "boot_config.h"
+
+#include "file_manager.h"
+#include "stm32_crc.h"
+
+#include "boot_info.h"
+
+/* The block and the configuration snapshot share the 256 bytes of RAM_SHARED */
+_Static_assert(BOOT_INFO_ADDRESS + sizeof(BootInfo) <= CONFIG_SNAPSHOT_ADDRESS, "BootInfo overlaps the config snapshot");
+_Static_assert(CONFIG_SNAPSHOT_ADDRESS + sizeof(file_ConfigSnapshot) <= BOOT_INFO_ADDRESS + 256U, "Config snapshot exceeds RAM_SHARED");
+
+/* Private function prototypes -----------------------------------------------*/
+static uint32_t bootInfo_configStatus(void);
+
+/**
+ * @brief  Starts the cycle counter timing the boot, also used by the profiler.
+ *         Usable right after reset, before HAL_Init().
+ */
+void bootInfo_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xC5ACCE55U;         // Unlock the DWT registers of the Cortex-M7
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/**
+ * @brief  Writes the boot information to RAM_SHARED, through the cache.
+ * @param  update  Report of the update run by the previous boot, NULL if none.
+ */
+void bootInfo_write(uint32_t updateState, uint32_t activeSlot, uint32_t imageAddress, uint32_t bootCount,
+                    uint32_t stateBoots, const BootInfo_Update *update)
+{
+    BootInfo *info = (BootInfo *)BOOT_INFO_ADDRESS;
+
+    memset(info, 0, sizeof(BootInfo));
+
+    info->magic = BOOT_INFO_MAGIC;
+    info->version = BOOT_INFO_VERSION;
+    info->size = sizeof(BootInfo);
+    info->resetFlags = RCC->RSR;
+    info->updateState = updateState;
+    info->activeSlot = activeSlot;
+    info->imageAddress = imageAddress;
+    info->bootCount = bootCount;
+    info->stateBoots = stateBoots;
+    info->bootCycles = DWT->CYCCNT;
+    info->configStatus = bootInfo_configStatus();
+    strncpy(info->bootloaderVersion, BL_VERSION, sizeof(info->bootloaderVersion) - 1);
+
+    if (update != NULL)
+    {
+        info->update = *update;
+    }
+
+    info->crc = STM32Crc_computeSoftware(info, offsetof(BootInfo, crc));
+
+    SCB_CleanDCache_by_Addr((void *)BOOT_INFO_ADDRESS, sizeof(BootInfo));
+}
+
+/**
+ * @brief  Tells whether RAM_SHARED holds a valid configuration snapshot.
+ *         Whether it matches the file is only known once the file system
+ *         is mounted, which the firmware does anyway.
+ */
+static uint32_t bootInfo_configStatus(void)
+{
+    const file_ConfigSnapshot *snapshot = (const file_ConfigSnapshot *)CONFIG_SNAPSHOT_ADDRESS;
+
+    SCB_InvalidateDCache_by_Addr((void *)CONFIG_SNAPSHOT_ADDRESS, sizeof(file_ConfigSnapshot));
+
+    if ((snapshot->magic != CONFIG_SNAPSHOT_MAGIC) || (snapshot->size != sizeof(file_ConfigSnapshot)) ||
+        (snapshot->crc != STM32Crc_computeSoftware(snapshot, offsetof(file_ConfigSnapshot, crc))))
+    {
+        return BOOT_INFO_CONFIG_NONE;
+    }
+
+    return BOOT_INFO_CONFIG_SNAPSHOT;
+}
@@ -0,0 +1,108 @@
+/**
+ ******************************************************************************
+ * @file           : boot_slot.c
+ * @brief          : A/B firmware slots, see boot_slot.h.
+ *                   The slot pointer lives in the option bytes rather than in
+ *                   FLASH_DATA: the firmware acknowledges an update by
+ *                   erasing the persistent state, which must not lose it.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+
+#include "boot_slot.h"
+
+#ifdef BOOT_AB_SLOTS
+
+/**
+ * @brief  Returns the slot both cores boot from.
+ *         A CM4 boot address outside slot B is taken as slot A.
+ */
+uint32_t bootSlot_active(void)
+{
+    FLASH_OBProgramInitTypeDef ob = {0};
+
+    HAL_FLASHEx_OBGetConfig(&ob);
+
+    return (ob.CM4BootAddr0 == bootSlot_cm4Address(BOOT_SLOT_B)) ? BOOT_SLOT_B : BOOT_SLOT_A;
+}
+
+/**
+ * @brief  Returns the slot that is not `slot`.
+ */
+uint32_t bootSlot_other(uint32_t slot)
+{
+    return (slot == BOOT_SLOT_A) ? BOOT_SLOT_B : BOOT_SLOT_A;
+}
+
+/**
+ * @brief  Tells whether a value read back from flash names a slot.
+ */
+bool bootSlot_isValid(uint32_t slot)
+{
+    return (slot == BOOT_SLOT_A) || (slot == BOOT_SLOT_B);
+}
+
+/**
+ * @brief  Returns the start of the CM7 image of a slot.
+ */
+uint32_t bootSlot_cm7Address(uint32_t slot)
+{
+    return FW_CM7_START_ADDR + ((slot == BOOT_SLOT_B) ? BOOT_SLOT_CM7_SIZE : 0U);
+}
+
+/**
+ * @brief  Returns the start of the CM4 image of a slot.
+ */
+uint32_t bootSlot_cm4Address(uint32_t slot)
+{
+    return FW_CM4_START_ADDR + ((slot == BOOT_SLOT_B) ? BOOT_SLOT_CM4_SIZE : 0U);
+}
+
+/**
+ * @brief  Makes a slot the boot slot of both cores.
+ *         The option bytes are reloaded; the caller resets the system
+ *         before either core runs the slot.
+ * @return BOOTSLOT_OK on success, BOOTSLOT_ERROR otherwise.
+ */
+bootSlot_StatusTypeDef bootSlot_select(uint32_t slot)
+{
+    FLASH_OBProgramInitTypeDef ob = {0};
+    bootSlot_StatusTypeDef status = BOOTSLOT_OK;
+
+    HAL_FLASHEx_OBGetConfig(&ob);
+    if (ob.CM4BootAddr0 == bootSlot_cm4Address(slot))
+    {
+        return BOOTSLOT_OK;
+    }
+
+    HAL_FLASH_Unlock();
+    HAL_FLASH_OB_Unlock();
+
+    memset(&ob, 0, sizeof(ob));
+    ob.OptionType = OPTIONBYTE_CM4_BOOTADD;
+    ob.CM4BootConfig = OB_BOOT_ADD0;
+    ob.CM4BootAddr0 = bootSlot_cm4Address(slot);
+
+    if ((HAL_FLASHEx_OBProgram(&ob) != HAL_OK) || (HAL_FLASH_OB_Launch() != HAL_OK))
+    {
+        status = BOOTSLOT_ERROR;
+    }
+
+    HAL_FLASH_OB_Lock();
+    HAL_FLASH_Lock();
+
+    return status;
+}
+
+#endif /* BOOT_AB_SLOTS */
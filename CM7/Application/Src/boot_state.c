@@ -0,0 +1,241 @@
+/**
+ ******************************************************************************
+ * @file           : boot_state.c
+ * @brief          : Update state seen by the boot sequence, see boot_state.h.
+ *                   The backup SRAM is write-back cached like the other
+ *                   SRAMs: each write is cleaned to it before a reset can
+ *                   drop the cache.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
+#include <string.h>
+
+#include "main.h"
+
+#include "stm32_crc.h"
+
+#include "boot_state.h"
+
+/* Private define ------------------------------------------------------------*/
+#define BOOT_STATE_ADDRESS      D3_BKPSRAM_BASE
+#define BOOT_STATE_MAGIC        0x54534B42U     // "BKST"
+#define BOOT_REPORT_ADDRESS     (D3_BKPSRAM_BASE + sizeof(BootState_Record))
+#define BOOT_REPORT_MAGIC       0x54505242U     // "BRPT"
+
+/* Polls of the backup regulator ready flag, a few ms at the 64 MHz reset clock */
+#define BOOT_STATE_BRRDY_POLLS  50000U
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Record in the backup SRAM, one cache line */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t flashSequence;         // Flash record the handoff and stateBoots apply to
+    uint32_t hasHandoff;            // updateState and trialSlot override the flash state
+    FW_UpdateState updateState;
+    uint32_t trialSlot;
+    uint32_t bootCount;
+    uint32_t stateBoots;
+    uint32_t crc;                   // CRC-32 of the previous 28 bytes
+} BootState_Record;
+
+/* Update report in the backup SRAM, right after the state record */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t flashSequence;         // Flash record the report applies to
+    BootInfo_Update update;
+    uint32_t crc;
+} BootState_Report;
+
+/* Private function prototypes -----------------------------------------------*/
+static void bootState_load(BootState_Record *record, const STM32Flash_PersistentState *flash);
+static void bootState_store(BootState_Record *record);
+
+/**
+ * @brief  Gives access to the backup SRAM and keeps it powered from VBAT.
+ *         To call before any other function of this module. Usable right
+ *         after reset, before HAL_Init(): the backup regulator is polled a
+ *         bounded number of times instead of against the SysTick, which is
+ *         not running yet. Without a ready regulator (no VBAT) the backup
+ *         SRAM still works, it is just lost with the main supply.
+ */
+void bootState_init(void)
+{
+    __HAL_RCC_BKPRAM_CLK_ENABLE();
+    HAL_PWR_EnableBkUpAccess();
+
+    SET_BIT(PWR->CR2, PWR_CR2_BREN);
+    for (uint32_t i = 0; (i < BOOT_STATE_BRRDY_POLLS) && ((PWR->CR2 & PWR_CR2_BRRDY) == 0U); i++)
+    {
+    }
+}
+
+/**
+ * @brief  Reads the update state: the flash state, unless a handoff was made
+ *         over it, and the boot counters.
+ * @param  flash Current flash state, from STM32Flash_readPersistentState().
+ * @param  state Filled.
+ */
+void bootState_read(const STM32Flash_PersistentState *flash, BootState *state)
+{
+    BootState_Record record;
+
+    bootState_load(&record, flash);
+
+    state->updateState = record.hasHandoff ? record.updateState : flash->updateState;
+    state->trialSlot = record.hasHandoff ? record.trialSlot : flash->trialSlot;
+    state->bootCount = record.bootCount;
+    state->stateBoots = record.stateBoots;
+}
+
+/**
+ * @brief  Counts one boot, the state is unchanged.
+ * @param  flash Current flash state, from STM32Flash_readPersistentState().
+ */
+void bootState_recordBoot(const STM32Flash_PersistentState *flash)
+{
+    BootState_Record record;
+
+    bootState_load(&record, flash);
+
+    record.bootCount++;
+    record.stateBoots++;
+
+    bootState_store(&record);
+}
+
+/**
+ * @brief  Hands a state over to the next boot without writing the flash.
+ *         Only for states that may be lost with the backup SRAM: the flash
+ *         state is then seen again. A handoff needs a flash record to apply
+ *         to, one written by this bootloader, and a firmware that takes the
+ *         state from the boot information: while word 0 of the flash is
+ *         mirrored for older firmware (BOOT_PERSISTENT_LOG_ONLY not defined,
+ *         see persistent_data.h), the state must be written to flash.
+ * @param  flash Current flash state, from STM32Flash_readPersistentState().
+ * @retval BOOTSTATE_ERROR if the state is to be written to flash instead.
+ */
+bootState_StatusTypeDef bootState_handoff(const STM32Flash_PersistentState *flash, FW_UpdateState state, uint32_t trialSlot)
+{
+    BootState_Record record;
+
+#ifndef BOOT_PERSISTENT_LOG_ONLY
+    return BOOTSTATE_ERROR;
+#endif
+
+    if (flash->sequence == 0)
+    {
+        return BOOTSTATE_ERROR;
+    }
+
+    bootState_load(&record, flash);
+
+    record.hasHandoff = 1;
+    record.updateState = state;
+    record.trialSlot = trialSlot;
+    record.stateBoots = 0;
+
+    bootState_store(&record);
+
+    return BOOTSTATE_OK;
+}
+
+/**
+ * @brief  Keeps the report of an update for the boots of the state written
+ *         after it: call once the new state is in flash.
+ * @param  flash  Flash state read after the new state was written.
+ * @param  update Report to keep.
+ * @retval bootState_StatusTypeDef.
+ */
+bootState_StatusTypeDef bootState_writeReport(const STM32Flash_PersistentState *flash, const BootInfo_Update *update)
+{
+    BootState_Report report;
+
+    if (flash->sequence == 0)
+    {
+        return BOOTSTATE_ERROR;
+    }
+
+    report.magic = BOOT_REPORT_MAGIC;
+    report.flashSequence = flash->sequence;
+    report.update = *update;
+    report.crc = STM32Crc_computeSoftware(&report, offsetof(BootState_Report, crc));
+
+    memcpy((void *)BOOT_REPORT_ADDRESS, &report, sizeof(BootState_Report));
+    SCB_CleanDCache_by_Addr((void *)BOOT_REPORT_ADDRESS, sizeof(BootState_Report));
+
+    return BOOTSTATE_OK;
+}
+
+/**
+ * @brief  Reads the report of the update that led to the current state.
+ * @param  flash  Current flash state, from STM32Flash_readPersistentState().
+ * @param  update Filled.
+ * @retval BOOTSTATE_ERROR if there is none, or it was made for another state.
+ */
+bootState_StatusTypeDef bootState_readReport(const STM32Flash_PersistentState *flash, BootInfo_Update *update)
+{
+    BootState_Report report;
+
+    SCB_InvalidateDCache_by_Addr((void *)BOOT_REPORT_ADDRESS, sizeof(BootState_Report));
+    memcpy(&report, (const void *)BOOT_REPORT_ADDRESS, sizeof(BootState_Report));
+
+    if ((report.magic != BOOT_REPORT_MAGIC) || (report.crc != STM32Crc_computeSoftware(&report, offsetof(BootState_Report, crc))) ||
+        (flash->sequence == 0) || (report.flashSequence != flash->sequence))
+    {
+        return BOOTSTATE_ERROR;
+    }
+
+    *update = report.update;
+
+    return BOOTSTATE_OK;
+}
+
+/**
+ * @brief  Reads the record of the backup SRAM for the current flash record.
+ *         A corrupted record restarts the counters; a record made over an
+ *         older flash record keeps only the boot count.
+ */
+static void bootState_load(BootState_Record *record, const STM32Flash_PersistentState *flash)
+{
+    SCB_InvalidateDCache_by_Addr((void *)BOOT_STATE_ADDRESS, sizeof(BootState_Record));
+    memcpy(record, (const void *)BOOT_STATE_ADDRESS, sizeof(BootState_Record));
+
+    if ((record->magic != BOOT_STATE_MAGIC) || (record->crc != STM32Crc_computeSoftware(record, offsetof(BootState_Record, crc))))
+    {
+        memset(record, 0, sizeof(BootState_Record));
+        record->flashSequence = flash->sequence;
+    }
+
+    if ((record->flashSequence != flash->sequence) || (flash->sequence == 0))
+    {
+        record->flashSequence = flash->sequence;
+        record->hasHandoff = 0;
+        record->stateBoots = 0;
+    }
+}
+
+/**
+ * @brief  Writes a record to the backup SRAM, through the cache.
+ */
+static void bootState_store(BootState_Record *record)
+{
+    record->magic = BOOT_STATE_MAGIC;
+    record->crc = STM32Crc_computeSoftware(record, offsetof(BootState_Record, crc));
+
+    memcpy((void *)BOOT_STATE_ADDRESS, record, sizeof(BootState_Record));
+    SCB_CleanDCache_by_Addr((void *)BOOT_STATE_ADDRESS, sizeof(BootState_Record));
+}
@@ -0,0 +1,295 @@
+/**
+ ******************************************************************************
+ * @file           : compressor.c
+ * @brief          : LZ4 encoder for firmware backups.
+ *                   A greedy single-pass match finder with a 4096-entry hash
+ *                   table, as in the reference LZ4 fast mode. A block is
+ *                   compressed straight from its source, the memory-mapped
+ *                   flash for a backup, and is stored as is when it does
+ *                   not shrink.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include <stdbool.h>
+
+#include "compressor.h"
+
+/* Private define ------------------------------------------------------------*/
+#define LZ4_FRAME_MAGIC         0x184D2204U
+#define LZ4_FLG                 0x68U       // Version 01, independent blocks, content size
+#define LZ4_BD_64KB             0x40U
+#define LZ4_BLOCK_UNCOMPRESSED  0x80000000U
+
+#define LZ4_MIN_MATCH           4U
+#define LZ4_LAST_LITERALS       5U          // The block ends with at least 5 literals
+#define LZ4_MF_LIMIT            12U         // No match starts in the last 12 bytes
+#define LZ4_MAX_OFFSET          65535U
+
+#define HASH_LOG                12U
+#define SKIP_TRIGGER            6U          // Search step grows every 64 misses
+
+#define XXH_PRIME32_1           0x9E3779B1U
+#define XXH_PRIME32_2           0x85EBCA77U
+#define XXH_PRIME32_3           0xC2B2AE3DU
+#define XXH_PRIME32_4           0x27D4EB2FU
+#define XXH_PRIME32_5           0x165667B1U
+
+/* Private variables ---------------------------------------------------------*/
+
+/* Last position of each hashed sequence, blocks are at most 64 KB */
+static uint16_t hashTable[1U << HASH_LOG];
+
+/* Private function prototypes -----------------------------------------------*/
+static uint32_t compressor_read32(const uint8_t *p);
+static void compressor_writeUint32LE(uint8_t *buffer, uint32_t value);
+static uint32_t compressor_hash(uint32_t sequence);
+static uint8_t *compressor_writeLength(uint8_t *op, const uint8_t *oend, uint32_t length);
+static uint8_t *compressor_writeSequence(uint8_t *op, const uint8_t *oend, const uint8_t *literals,
+                                         uint32_t literalLength, uint32_t offset, uint32_t matchLength);
+static uint32_t compressor_descriptorChecksum(const uint8_t *descriptor, uint32_t length);
+
+/**
+ * @brief  Writes the header of an LZ4 frame.
+ * @param  buffer      Destination, COMPRESSOR_FRAME_HEADER_SIZE bytes.
+ * @param  contentSize Size of the uncompressed content.
+ * @return Number of bytes written.
+ */
+uint32_t compressor_frameHeader(uint8_t *buffer, uint32_t contentSize)
+{
+    compressor_writeUint32LE(buffer, LZ4_FRAME_MAGIC);
+    buffer[4] = LZ4_FLG;
+    buffer[5] = LZ4_BD_64KB;
+    compressor_writeUint32LE(buffer + 6, contentSize);
+    compressor_writeUint32LE(buffer + 10, 0);
+    buffer[14] = (uint8_t)(compressor_descriptorChecksum(buffer + 4, 10) >> 8);
+
+    return COMPRESSOR_FRAME_HEADER_SIZE;
+}
+
+/**
+ * @brief  Encodes one block of a frame, with its length prefix.
+ * @param  src       Block content, at most COMPRESSOR_BLOCK_SIZE bytes.
+ * @param  srcLength Size of the block content.
+ * @param  dst       Destination, at least srcLength + 4 bytes.
+ * @return Number of bytes written.
+ */
+uint32_t compressor_compressBlock(const uint8_t *src, uint32_t srcLength, uint8_t *dst)
+{
+    uint8_t *op = dst + 4;
+    uint8_t *const oend = op + srcLength;
+    uint32_t anchor = 0;
+
+    memset(hashTable, 0, sizeof(hashTable));
+
+    if (srcLength > LZ4_MF_LIMIT)
+    {
+        const uint32_t matchStartLimit = srcLength - LZ4_MF_LIMIT;
+        const uint32_t matchEndLimit = srcLength - LZ4_LAST_LITERALS;
+        uint32_t ip = 1;
+        uint32_t misses = 1U << SKIP_TRIGGER;
+
+        while ((op != NULL) && (ip < matchStartLimit))
+        {
+            uint32_t sequence = compressor_read32(src + ip);
+            uint32_t hash = compressor_hash(sequence);
+            uint32_t ref = hashTable[hash];
+
+            hashTable[hash] = (uint16_t)ip;
+
+            if ((ref >= ip) || ((ip - ref) > LZ4_MAX_OFFSET) || (compressor_read32(src + ref) != sequence))
+            {
+                ip += misses++ >> SKIP_TRIGGER;
+                continue;
+            }
+
+            // Extend the match backwards over pending literals, then forwards
+            while ((ip > anchor) && (ref > 0) && (src[ip - 1] == src[ref - 1]))
+            {
+                ip--;
+                ref--;
+            }
+
+            uint32_t length = LZ4_MIN_MATCH;
+            while (((ip + length) < matchEndLimit) && (src[ip + length] == src[ref + length]))
+            {
+                length++;
+            }
+
+            op = compressor_writeSequence(op, oend, src + anchor, ip - anchor, ip - ref, length);
+
+            ip += length;
+            anchor = ip;
+            misses = 1U << SKIP_TRIGGER;
+
+            if (ip < matchStartLimit)
+            {
+                hashTable[compressor_hash(compressor_read32(src + ip - 2))] = (uint16_t)(ip - 2);
+            }
+        }
+    }
+
+    // Last literals, as a sequence without a match
+    if (op != NULL)
+    {
+        op = compressor_writeSequence(op, oend, src + anchor, srcLength - anchor, 0, 0);
+    }
+
+    if (op == NULL)
+    {
+        compressor_writeUint32LE(dst, srcLength | LZ4_BLOCK_UNCOMPRESSED);
+        memcpy(dst + 4, src, srcLength);
+        return srcLength + 4;
+    }
+
+    compressor_writeUint32LE(dst, (uint32_t)(op - (dst + 4)));
+    return (uint32_t)(op - dst);
+}
+
+/**
+ * @brief  Writes one sequence: token, literals and, if `matchLength` is not
+ *         zero, the match offset and length.
+ * @return Next output position, or NULL if the output would not shrink.
+ */
+static uint8_t *compressor_writeSequence(uint8_t *op, const uint8_t *oend, const uint8_t *literals,
+                                         uint32_t literalLength, uint32_t offset, uint32_t matchLength)
+{
+    uint32_t matchCode = (matchLength != 0) ? (matchLength - LZ4_MIN_MATCH) : 0;
+
+    if ((op == NULL) || (op >= oend))
+    {
+        return NULL;
+    }
+
+    uint8_t *token = op++;
+    *token = (uint8_t)((((literalLength < 15) ? literalLength : 15) << 4) | ((matchCode < 15) ? matchCode : 15));
+
+    if (literalLength >= 15)
+    {
+        op = compressor_writeLength(op, oend, literalLength - 15);
+    }
+
+    if ((op == NULL) || ((uint32_t)(oend - op) < literalLength))
+    {
+        return NULL;
+    }
+
+    memcpy(op, literals, literalLength);
+    op += literalLength;
+
+    if (matchLength == 0)
+    {
+        return op;
+    }
+
+    if ((oend - op) < 2)
+    {
+        return NULL;
+    }
+
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+
+    if (matchCode >= 15)
+    {
+        op = compressor_writeLength(op, oend, matchCode - 15);
+    }
+
+    return op;
+}
+
+/**
+ * @brief  Writes the extension bytes of a literal or match length.
+ * @return Next output position, or NULL if the output is full.
+ */
+static uint8_t *compressor_writeLength(uint8_t *op, const uint8_t *oend, uint32_t length)
+{
+    while (length >= 255)
+    {
+        if (op >= oend)
+        {
+            return NULL;
+        }
+        *op++ = 255;
+        length -= 255;
+    }
+
+    if (op >= oend)
+    {
+        return NULL;
+    }
+    *op++ = (uint8_t)length;
+
+    return op;
+}
+
+/**
+ * @brief  Hashes the four bytes at a position (Knuth multiplicative hash).
+ */
+static uint32_t compressor_hash(uint32_t sequence)
+{
+    return (sequence * 2654435761U) >> (32U - HASH_LOG);
+}
+
+/**
+ * @brief  Reads 4 bytes at any alignment.
+ */
+static uint32_t compressor_read32(const uint8_t *p)
+{
+    uint32_t value;
+
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Writes a 32-bit unsigned integer to a buffer in little-endian format.
+ */
+static void compressor_writeUint32LE(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = (uint8_t)value;
+    buffer[1] = (uint8_t)(value >> 8);
+    buffer[2] = (uint8_t)(value >> 16);
+    buffer[3] = (uint8_t)(value >> 24);
+}
+
+/**
+ * @brief  XXH32 with seed 0 of a frame descriptor (shorter than 16 bytes).
+ */
+static uint32_t compressor_descriptorChecksum(const uint8_t *descriptor, uint32_t length)
+{
+    uint32_t h = XXH_PRIME32_5 + length;
+    uint32_t i = 0;
+
+    for (; (i + 4) <= length; i += 4)
+    {
+        uint32_t word = (uint32_t)descriptor[i] | ((uint32_t)descriptor[i + 1] << 8) |
+                        ((uint32_t)descriptor[i + 2] << 16) | ((uint32_t)descriptor[i + 3] << 24);
+        h += word * XXH_PRIME32_3;
+        h = ((h << 17) | (h >> 15)) * XXH_PRIME32_4;
+    }
+
+    for (; i < length; i++)
+    {
+        h += descriptor[i] * XXH_PRIME32_5;
+        h = ((h << 11) | (h >> 21)) * XXH_PRIME32_1;
+    }
+
+    h ^= h >> 15;
+    h *= XXH_PRIME32_2;
+    h ^= h >> 13;
+    h *= XXH_PRIME32_3;
+    h ^= h >> 16;
+
+    return h;
+}
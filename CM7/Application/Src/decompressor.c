@@ -0,0 +1,393 @@
+/**
+ ******************************************************************************
+ * @file           : decompressor.c
+ * @brief          : Streaming LZ4 frame decoder for compressed package sections.
+ *                   The section is read from the package one block at a time
+ *                   and decoded into a 64 KB buffer, so RAM use is bounded
+ *                   whatever the size of the image. The decoder is exposed as
+ *                   a stream writer source and feeds the flash programming
+ *                   path directly.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "decompressor.h"
+
+/* Private define ------------------------------------------------------------*/
+#define LZ4_FRAME_MAGIC         0x184D2204U
+#define LZ4_FLG_VERSION_MASK    0xC0U
+#define LZ4_FLG_VERSION         0x40U
+#define LZ4_FLG_BLOCK_INDEP     0x20U
+#define LZ4_FLG_BLOCK_CHECKSUM  0x10U
+#define LZ4_FLG_CONTENT_SIZE    0x08U
+#define LZ4_FLG_CONTENT_CHECKSUM 0x04U
+#define LZ4_FLG_DICT_ID         0x01U
+#define LZ4_BD_MAX_SIZE_MASK    0x70U
+#define LZ4_BD_MAX_SIZE_64KB    0x40U
+#define LZ4_BLOCK_UNCOMPRESSED  0x80000000U
+
+#define LZ4_MIN_MATCH           4U
+
+/* Private variables ---------------------------------------------------------*/
+
+/* Shared by all decoders: sections are decoded one at a time */
+static uint8_t compressedBlock[DECOMPRESSOR_BLOCK_SIZE] __attribute__((aligned(32)));
+static uint8_t decodedBlock[DECOMPRESSOR_BLOCK_SIZE] __attribute__((aligned(32)));
+
+/* Private function prototypes -----------------------------------------------*/
+static decompressor_StatusTypeDef decompressor_fetch(Decompressor *decompressor, uint8_t *buffer, uint32_t length);
+static decompressor_StatusTypeDef decompressor_nextBlock(Decompressor *decompressor);
+static streamWriter_StatusTypeDef decompressor_sourceRead(void *context, uint8_t *buffer, uint32_t length, uint32_t *bytesRead);
+
+/**
+ * @brief  Reads the frame header of a compressed section.
+ * @param  decompressor   Decoder to initialize.
+ * @param  input          Compressed bytes of the section, from its start.
+ * @param  compressedSize Size of the section in the package.
+ * @return DECOMPRESSOR_OK if the frame can be decoded with bounded memory.
+ */
+decompressor_StatusTypeDef decompressor_open(Decompressor *decompressor, const StreamWriter_Source *input, uint32_t compressedSize)
+{
+    uint8_t header[15];
+
+    memset(decompressor, 0, sizeof(*decompressor));
+    decompressor->input = *input;
+    decompressor->remaining = compressedSize;
+
+    // Magic, FLG and BD are always present
+    if (decompressor_fetch(decompressor, header, 6) != DECOMPRESSOR_OK)
+    {
+        return DECOMPRESSOR_ERROR;
+    }
+
+    uint32_t magic = (uint32_t)header[0] | ((uint32_t)header[1] << 8) | ((uint32_t)header[2] << 16) | ((uint32_t)header[3] << 24);
+    uint8_t flg = header[4];
+    uint8_t bd = header[5];
+
+    if (magic != LZ4_FRAME_MAGIC || (flg & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION)
+    {
+        printf("Error: Compressed section is not an LZ4 frame\n");
+        return DECOMPRESSOR_ERROR;
+    }
+
+    // Linked blocks would need the previous block as history, and the
+    // content size is needed up front to size the erase
+    if (!(flg & LZ4_FLG_BLOCK_INDEP) || !(flg & LZ4_FLG_CONTENT_SIZE) || (flg & LZ4_FLG_DICT_ID) ||
+        (bd & LZ4_BD_MAX_SIZE_MASK) > LZ4_BD_MAX_SIZE_64KB)
+    {
+        printf("Error: Unsupported LZ4 frame options (FLG 0x%02x, BD 0x%02x)\n", flg, bd);
+        return DECOMPRESSOR_ERROR;
+    }
+
+    decompressor->blockChecksum = (flg & LZ4_FLG_BLOCK_CHECKSUM) != 0;
+    decompressor->contentChecksum = (flg & LZ4_FLG_CONTENT_CHECKSUM) != 0;
+
+    // Content size (8 bytes) and header checksum (1 byte)
+    if (decompressor_fetch(decompressor, header + 6, 9) != DECOMPRESSOR_OK)
+    {
+        return DECOMPRESSOR_ERROR;
+    }
+
+    if (header[10] | header[11] | header[12] | header[13])
+    {
+        printf("Error: Compressed section too large\n");
+        return DECOMPRESSOR_ERROR;
+    }
+
+    decompressor->contentSize = (uint32_t)header[6] | ((uint32_t)header[7] << 8) |
+                                ((uint32_t)header[8] << 16) | ((uint32_t)header[9] << 24);
+
+    return DECOMPRESSOR_OK;
+}
+
+/**
+ * @brief  Decodes up to `length` bytes of the section.
+ * @param  decompressor Open decoder.
+ * @param  buffer       Destination buffer.
+ * @param  length       Number of bytes requested.
+ * @param  bytesRead    Number of bytes produced, less than `length` only at the end of the section.
+ * @return DECOMPRESSOR_OK, or DECOMPRESSOR_ERROR on a read error or corrupted data.
+ */
+decompressor_StatusTypeDef decompressor_read(Decompressor *decompressor, uint8_t *buffer, uint32_t length, uint32_t *bytesRead)
+{
+    *bytesRead = 0;
+
+    while (length > 0)
+    {
+        if (decompressor->blockOffset == decompressor->blockLength)
+        {
+            if (decompressor->ended)
+            {
+                break;
+            }
+            if (decompressor_nextBlock(decompressor) != DECOMPRESSOR_OK)
+            {
+                return DECOMPRESSOR_ERROR;
+            }
+            continue;
+        }
+
+        uint32_t chunk = decompressor->blockLength - decompressor->blockOffset;
+        if (chunk > length)
+        {
+            chunk = length;
+        }
+
+        memcpy(buffer, &decodedBlock[decompressor->blockOffset], chunk);
+        decompressor->blockOffset += chunk;
+        buffer += chunk;
+        length -= chunk;
+        *bytesRead += chunk;
+    }
+
+    return DECOMPRESSOR_OK;
+}
+
+/**
+ * @brief  Builds a stream writer source producing the decoded section.
+ * @param  source       Source to initialize.
+ * @param  decompressor Open decoder, must outlive the writer.
+ */
+void decompressor_source(StreamWriter_Source *source, Decompressor *decompressor)
+{
+    source->read = decompressor_sourceRead;
+    source->context = decompressor;
+}
+
+/**
+ * @brief  Decodes one LZ4 block.
+ *         Every length and offset is checked against the input and output
+ *         bounds, so corrupted data cannot write outside `dst`.
+ * @param  src         Compressed block.
+ * @param  srcLength   Size of the compressed block.
+ * @param  dst         Output buffer.
+ * @param  dstCapacity Size of the output buffer.
+ * @return Number of decoded bytes, or -1 if the block is corrupted.
+ */
+int32_t decompressor_decodeBlock(const uint8_t *src, uint32_t srcLength, uint8_t *dst, uint32_t dstCapacity)
+{
+    const uint8_t *ip = src;
+    const uint8_t *const iend = src + srcLength;
+    uint8_t *op = dst;
+    uint8_t *const oend = dst + dstCapacity;
+
+    while (ip < iend)
+    {
+        uint32_t token = *ip++;
+        uint32_t length = token >> 4;
+
+        // Literals
+        if (length == 15)
+        {
+            uint32_t b;
+            do
+            {
+                if (ip >= iend)
+                {
+                    return -1;
+                }
+                b = *ip++;
+                length += b;
+            } while (b == 255);
+        }
+
+        if (length > (uint32_t)(iend - ip) || length > (uint32_t)(oend - op))
+        {
+            return -1;
+        }
+
+        memcpy(op, ip, length);
+        op += length;
+        ip += length;
+
+        // The last sequence has no match part
+        if (ip == iend)
+        {
+            break;
+        }
+
+        // Match
+        if ((iend - ip) < 2)
+        {
+            return -1;
+        }
+
+        uint32_t offset = (uint32_t)ip[0] | ((uint32_t)ip[1] << 8);
+        ip += 2;
+
+        if (offset == 0 || offset > (uint32_t)(op - dst))
+        {
+            return -1;
+        }
+
+        length = token & 0x0F;
+        if (length == 15)
+        {
+            uint32_t b;
+            do
+            {
+                if (ip >= iend)
+                {
+                    return -1;
+                }
+                b = *ip++;
+                length += b;
+            } while (b == 255);
+        }
+        length += LZ4_MIN_MATCH;
+
+        if (length > (uint32_t)(oend - op))
+        {
+            return -1;
+        }
+
+        const uint8_t *match = op - offset;
+        if (offset >= length)
+        {
+            memcpy(op, match, length);
+            op += length;
+        }
+        else
+        {
+            // Overlapping copy repeats the last `offset` bytes
+            while (length--)
+            {
+                *op++ = *match++;
+            }
+        }
+    }
+
+    return (int32_t)(op - dst);
+}
+
+/**
+ * @brief  Reads raw bytes of the section from the package.
+ */
+static decompressor_StatusTypeDef decompressor_fetch(Decompressor *decompressor, uint8_t *buffer, uint32_t length)
+{
+    uint32_t br = 0;
+
+    if (length > decompressor->remaining)
+    {
+        printf("Error: Compressed section truncated\n");
+        return DECOMPRESSOR_ERROR;
+    }
+
+    if ((decompressor->input.read(decompressor->input.context, buffer, length, &br) != STREAMWRITER_OK) || (br != length))
+    {
+        printf("Error: Failed to read compressed data\n");
+        return DECOMPRESSOR_ERROR;
+    }
+
+    decompressor->remaining -= length;
+    return DECOMPRESSOR_OK;
+}
+
+/**
+ * @brief  Reads and decodes the next block of the frame.
+ */
+static decompressor_StatusTypeDef decompressor_nextBlock(Decompressor *decompressor)
+{
+    uint8_t word[4];
+
+    decompressor->blockLength = 0;
+    decompressor->blockOffset = 0;
+
+    if (decompressor_fetch(decompressor, word, 4) != DECOMPRESSOR_OK)
+    {
+        return DECOMPRESSOR_ERROR;
+    }
+
+    uint32_t blockSize = (uint32_t)word[0] | ((uint32_t)word[1] << 8) | ((uint32_t)word[2] << 16) | ((uint32_t)word[3] << 24);
+
+    // EndMark
+    if (blockSize == 0)
+    {
+        decompressor->ended = true;
+
+        if (decompressor->contentChecksum && (decompressor_fetch(decompressor, word, 4) != DECOMPRESSOR_OK))
+        {
+            return DECOMPRESSOR_ERROR;
+        }
+        if (decompressor->produced != decompressor->contentSize)
+        {
+            printf("Error: Decoded %lu bytes, expected %lu\n", (unsigned long)decompressor->produced,
+                   (unsigned long)decompressor->contentSize);
+            return DECOMPRESSOR_ERROR;
+        }
+        return DECOMPRESSOR_OK;
+    }
+
+    bool uncompressed = (blockSize & LZ4_BLOCK_UNCOMPRESSED) != 0;
+    blockSize &= ~LZ4_BLOCK_UNCOMPRESSED;
+
+    if (blockSize > DECOMPRESSOR_BLOCK_SIZE)
+    {
+        printf("Error: Compressed block too large (%lu bytes)\n", (unsigned long)blockSize);
+        return DECOMPRESSOR_ERROR;
+    }
+
+    if (uncompressed)
+    {
+        if (decompressor_fetch(decompressor, decodedBlock, blockSize) != DECOMPRESSOR_OK)
+        {
+            return DECOMPRESSOR_ERROR;
+        }
+        decompressor->blockLength = blockSize;
+    }
+    else
+    {
+        if (decompressor_fetch(decompressor, compressedBlock, blockSize) != DECOMPRESSOR_OK)
+        {
+            return DECOMPRESSOR_ERROR;
+        }
+
+        int32_t decoded = decompressor_decodeBlock(compressedBlock, blockSize, decodedBlock, DECOMPRESSOR_BLOCK_SIZE);
+        if (decoded < 0)
+        {
+            printf("Error: Corrupted compressed block\n");
+            return DECOMPRESSOR_ERROR;
+        }
+        decompressor->blockLength = (uint32_t)decoded;
+    }
+
+    if (decompressor->blockChecksum && (decompressor_fetch(decompressor, word, 4) != DECOMPRESSOR_OK))
+    {
+        return DECOMPRESSOR_ERROR;
+    }
+
+    decompressor->produced += decompressor->blockLength;
+    if (decompressor->produced > decompressor->contentSize)
+    {
+        printf("Error: Compressed section larger than its content size\n");
+        return DECOMPRESSOR_ERROR;
+    }
+
+    return DECOMPRESSOR_OK;
+}
+
+/**
+ * @brief  Stream writer source callback.
+ */
+static streamWriter_StatusTypeDef decompressor_sourceRead(void *context, uint8_t *buffer, uint32_t length, uint32_t *bytesRead)
+{
+    if (decompressor_read((Decompressor *)context, buffer, length, bytesRead) != DECOMPRESSOR_OK)
+    {
+        return STREAMWRITER_ERROR;
+    }
+
+    return STREAMWRITER_OK;
+}
@@ -0,0 +1,306 @@
+/**
+ ******************************************************************************
+ * @file           : delta.c
+ * @brief          : Rebuilds a firmware image from a delta section and the
+ *                   installed image. The delta is a list of copies from the
+ *                   base image and literal runs; it is applied as a stream
+ *                   writer source, so the rebuilt image goes straight into
+ *                   the flash programming pipeline.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "stm32_crc.h"
+
+#include "delta.h"
+
+/* Private define ------------------------------------------------------------*/
+#define DELTA_CMD_END       0x00
+#define DELTA_CMD_COPY      0x01
+#define DELTA_CMD_LITERAL   0x02
+
+/* Private function prototypes -----------------------------------------------*/
+static delta_StatusTypeDef delta_fetch(const StreamWriter_Source *input, uint8_t *buffer, uint32_t length);
+static delta_StatusTypeDef delta_nextCommand(Delta *delta);
+static uint32_t delta_readUint32LE(const uint8_t *buffer);
+static streamWriter_StatusTypeDef delta_sourceRead(void *context, uint8_t *buffer, uint32_t length, uint32_t *bytesRead);
+
+/**
+ * @brief  Reads the header of a delta stream.
+ * @param  input  Delta stream, positioned at its start.
+ * @param  header Header to fill.
+ * @return DELTA_OK if the stream starts with a valid header.
+ */
+delta_StatusTypeDef delta_readHeader(const StreamWriter_Source *input, Delta_Header *header)
+{
+    uint8_t buffer[DELTA_HEADER_SIZE];
+
+    if (delta_fetch(input, buffer, sizeof(buffer)) != DELTA_OK)
+    {
+        return DELTA_ERROR;
+    }
+
+    if (memcmp(buffer, "DLTA", 4) != 0)
+    {
+        printf("Error: Invalid delta magic number\n");
+        return DELTA_ERROR;
+    }
+
+    header->baseSize = delta_readUint32LE(buffer + 4);
+    header->baseCRC = delta_readUint32LE(buffer + 8);
+    header->targetSize = delta_readUint32LE(buffer + 12);
+
+    return DELTA_OK;
+}
+
+/**
+ * @brief  Checks that a base image is the one a delta was built against.
+ * @param  base   Base image, positioned at its start.
+ * @param  header Header of the delta.
+ * @return DELTA_OK if the CRC of the first `baseSize` bytes matches.
+ */
+delta_StatusTypeDef delta_checkBase(FIL *base, const Delta_Header *header)
+{
+    uint8_t buffer[DELTA_BASE_CHUNK] __attribute__((aligned(32)));
+    uint32_t checked = 0;
+    STM32Crc_Context crc;
+
+    STM32Crc_begin(&crc);
+
+    while (checked < header->baseSize)
+    {
+        uint32_t chunk = (header->baseSize - checked > DELTA_BASE_CHUNK) ? DELTA_BASE_CHUNK : (header->baseSize - checked);
+        UINT bytesRead = 0;
+
+        if (f_read(base, buffer, chunk, &bytesRead) != FR_OK || bytesRead != chunk)
+        {
+            printf("Error: Failed to read the delta base image\n");
+            return DELTA_ERROR;
+        }
+
+        STM32Crc_update(&crc, buffer, chunk);
+        checked += chunk;
+    }
+
+    uint32_t value = STM32Crc_value(&crc);
+    if (value != header->baseCRC)
+    {
+        printf("Delta base mismatch: calculated 0x%08lX, expected 0x%08lX\n", (unsigned long)value,
+               (unsigned long)header->baseCRC);
+        return DELTA_ERROR;
+    }
+
+    return DELTA_OK;
+}
+
+/**
+ * @brief  Prepares a delta to be applied.
+ *         The base image must already have been checked against the
+ *         header CRC, see update.c.
+ * @param  delta Delta state to initialize.
+ * @param  input Delta stream, positioned at its start.
+ * @param  base       Open base image.
+ * @param  baseOffset Position of the image in the base file.
+ * @return DELTA_OK if the header is valid.
+ */
+delta_StatusTypeDef delta_open(Delta *delta, const StreamWriter_Source *input, FIL *base, uint32_t baseOffset)
+{
+    memset(delta, 0, sizeof(*delta));
+    delta->input = *input;
+    delta->base = base;
+    delta->baseOffset = baseOffset;
+
+    return delta_readHeader(&delta->input, &delta->header);
+}
+
+/**
+ * @brief  Produces up to `length` bytes of the rebuilt image.
+ * @param  delta     Open delta.
+ * @param  buffer    Destination buffer.
+ * @param  length    Number of bytes requested.
+ * @param  bytesRead Number of bytes produced, less than `length` only at the end of the image.
+ * @return DELTA_OK, or DELTA_ERROR on a read error or an invalid command.
+ */
+delta_StatusTypeDef delta_read(Delta *delta, uint8_t *buffer, uint32_t length, uint32_t *bytesRead)
+{
+    *bytesRead = 0;
+
+    while (length > 0)
+    {
+        if (delta->remaining == 0)
+        {
+            if (delta->ended)
+            {
+                break;
+            }
+            if (delta_nextCommand(delta) != DELTA_OK)
+            {
+                return DELTA_ERROR;
+            }
+            continue;
+        }
+
+        uint32_t chunk = (delta->remaining < length) ? delta->remaining : length;
+
+        if (delta->command == DELTA_CMD_COPY)
+        {
+            UINT br = 0;
+            FRESULT res = f_read(delta->base, buffer, chunk, &br);
+            if (res != FR_OK || br != chunk)
+            {
+                printf("Error: Failed to read the delta base image (f_read returned %d)\n", res);
+                return DELTA_ERROR;
+            }
+        }
+        else if (delta_fetch(&delta->input, buffer, chunk) != DELTA_OK)
+        {
+            return DELTA_ERROR;
+        }
+
+        delta->remaining -= chunk;
+        delta->produced += chunk;
+        buffer += chunk;
+        length -= chunk;
+        *bytesRead += chunk;
+    }
+
+    return DELTA_OK;
+}
+
+/**
+ * @brief  Builds a stream writer source producing the rebuilt image.
+ * @param  source Source to initialize.
+ * @param  delta  Open delta, must outlive the writer.
+ */
+void delta_source(StreamWriter_Source *source, Delta *delta)
+{
+    source->read = delta_sourceRead;
+    source->context = delta;
+}
+
+/**
+ * @brief  Decodes the next command of the delta stream.
+ *         Copies are limited to the part of the base covered by the CRC, and
+ *         no command may produce more than the announced target size.
+ */
+static delta_StatusTypeDef delta_nextCommand(Delta *delta)
+{
+    uint8_t buffer[8];
+
+    if (delta_fetch(&delta->input, buffer, 1) != DELTA_OK)
+    {
+        return DELTA_ERROR;
+    }
+
+    delta->command = buffer[0];
+
+    switch (delta->command)
+    {
+    case DELTA_CMD_END:
+        delta->ended = true;
+        if (delta->produced != delta->header.targetSize)
+        {
+            printf("Error: Delta produced %lu bytes, expected %lu\n", (unsigned long)delta->produced,
+                   (unsigned long)delta->header.targetSize);
+            return DELTA_ERROR;
+        }
+        return DELTA_OK;
+
+    case DELTA_CMD_COPY:
+    {
+        if (delta_fetch(&delta->input, buffer, 8) != DELTA_OK)
+        {
+            return DELTA_ERROR;
+        }
+
+        uint32_t offset = delta_readUint32LE(buffer);
+        delta->remaining = delta_readUint32LE(buffer + 4);
+
+        if ((offset > delta->header.baseSize) || (delta->remaining > (delta->header.baseSize - offset)))
+        {
+            printf("Error: Delta copy outside of the base image (offset %lu)\n", (unsigned long)offset);
+            return DELTA_ERROR;
+        }
+
+        if (f_lseek(delta->base, delta->baseOffset + offset) != FR_OK)
+        {
+            printf("Error: Failed to seek in the delta base image\n");
+            return DELTA_ERROR;
+        }
+        break;
+    }
+
+    case DELTA_CMD_LITERAL:
+        if (delta_fetch(&delta->input, buffer, 4) != DELTA_OK)
+        {
+            return DELTA_ERROR;
+        }
+        delta->remaining = delta_readUint32LE(buffer);
+        break;
+
+    default:
+        printf("Error: Invalid delta command 0x%02x\n", delta->command);
+        return DELTA_ERROR;
+    }
+
+    if (delta->remaining > (delta->header.targetSize - delta->produced))
+    {
+        printf("Error: Delta overflows the target image\n");
+        return DELTA_ERROR;
+    }
+
+    return DELTA_OK;
+}
+
+/**
+ * @brief  Reads exactly `length` bytes of the delta stream.
+ */
+static delta_StatusTypeDef delta_fetch(const StreamWriter_Source *input, uint8_t *buffer, uint32_t length)
+{
+    uint32_t bytesRead = 0;
+
+    if ((input->read(input->context, buffer, length, &bytesRead) != STREAMWRITER_OK) || (bytesRead != length))
+    {
+        printf("Error: Delta stream truncated\n");
+        return DELTA_ERROR;
+    }
+
+    return DELTA_OK;
+}
+
+/**
+ * @brief Reads a 32-bit unsigned integer from a buffer in little-endian format.
+ */
+static uint32_t delta_readUint32LE(const uint8_t *buffer)
+{
+    return ((uint32_t)buffer[0]) |
+           ((uint32_t)buffer[1] << 8) |
+           ((uint32_t)buffer[2] << 16) |
+           ((uint32_t)buffer[3] << 24);
+}
+
+/**
+ * @brief  Stream writer source callback.
+ */
+static streamWriter_StatusTypeDef delta_sourceRead(void *context, uint8_t *buffer, uint32_t length, uint32_t *bytesRead)
+{
+    if (delta_read((Delta *)context, buffer, length, bytesRead) != DELTA_OK)
+    {
+        return STREAMWRITER_ERROR;
+    }
+
+    return STREAMWRITER_OK;
+}
@@ -0,0 +1,605 @@
+/**
+ ******************************************************************************
+ * @file           : package.c
+ * @brief          : Update package manifest parser.
+ *                   Reads the v2 TLV manifest, or the fixed v1 header, into
+ *                   a section table, and verifies sections one at a time,
+ *                   either in a separate pass or block by block as they are
+ *                   streamed into the flash.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "stm32_crc.h"
+
+#include "package.h"
+
+/* Private define ------------------------------------------------------------*/
+#define PACKAGE_V1_HEADER_SIZE      24
+#define PACKAGE_V2_HEADER_SIZE      12
+#define PACKAGE_MAX_MANIFEST_SIZE   512
+#define PACKAGE_VERIFY_BUFFER_SIZE  4096
+
+/* v1 section size fields: bit 31 flags an LZ4-compressed section,
+ * bit 30 a delta against the installed image */
+#define PACKAGE_V1_COMPRESSED       0x80000000U
+#define PACKAGE_V1_DELTA            0x40000000U
+#define PACKAGE_V1_SIZE_MASK        0x3FFFFFFFU
+
+/* v2 manifest records */
+#define PACKAGE_TAG_END             0x00
+#define PACKAGE_TAG_VERSION         0x01
+#define PACKAGE_TAG_SECTION         0x02
+#define PACKAGE_TAG_BLOCKS          0x03
+#define PACKAGE_SECTION_RECORD_SIZE 20
+#define PACKAGE_BLOCKS_RECORD_SIZE  12
+#define PACKAGE_BLOCK_SIZE_LOG2     12
+
+/* Sections are at least aligned on a flash word */
+#define PACKAGE_MIN_ALIGN_LOG2      5
+#define PACKAGE_MAX_ALIGN_LOG2      16
+
+/* Private variables ---------------------------------------------------------*/
+
+/* Digests and partial block of the open reader */
+static uint32_t blockDigests[PACKAGE_MAX_BLOCKS];
+static uint8_t blockBuffer[PACKAGE_BLOCK_SIZE] __attribute__((aligned(32)));
+
+/* Private function prototypes -----------------------------------------------*/
+static package_StatusTypeDef package_readManifestV1(FIL *file, const uint8_t *header, Package_Manifest *manifest);
+static package_StatusTypeDef package_readManifestV2(FIL *file, uint8_t *manifestBuffer, Package_Manifest *manifest);
+static package_StatusTypeDef package_addSection(FIL *file, Package_Manifest *manifest, const Package_Section *section);
+static package_StatusTypeDef package_addBlocks(FIL *file, Package_Manifest *manifest, const uint8_t *value);
+static package_StatusTypeDef package_readBlock(Package_Reader *reader, uint8_t *buffer, uint32_t length);
+static streamWriter_StatusTypeDef package_readerRead(void *context, uint8_t *buffer, uint32_t length, uint32_t *bytesRead);
+static package_StatusTypeDef package_read(FIL *file, uint32_t offset, uint8_t *buffer, uint32_t length);
+static uint32_t package_crc(const uint8_t *buffer, uint32_t length);
+static uint32_t package_readUint32LE(const uint8_t *buffer);
+static uint16_t package_readUint16LE(const uint8_t *buffer);
+
+/**
+ * @brief  Reads the manifest of an update package.
+ * @param  file     Open package file.
+ * @param  manifest Manifest to fill.
+ * @return PACKAGE_OK if the package is a valid v1 or v2 package.
+ */
+package_StatusTypeDef package_readManifest(FIL *file, Package_Manifest *manifest)
+{
+    uint8_t header[PACKAGE_MAX_MANIFEST_SIZE] __attribute__((aligned(4)));
+
+    memset(manifest, 0, sizeof(*manifest));
+
+    if (package_read(file, 0, header, PACKAGE_V2_HEADER_SIZE) != PACKAGE_OK)
+    {
+        printf("Error: Failed to read the package header\n");
+        return PACKAGE_ERROR;
+    }
+
+    if (memcmp(header, "BOT2", 4) == 0)
+    {
+        return package_readManifestV2(file, header, manifest);
+    }
+
+    if (memcmp(header, "BOOT", 4) == 0)
+    {
+        if (package_read(file, 0, header, PACKAGE_V1_HEADER_SIZE) != PACKAGE_OK)
+        {
+            printf("Error: Failed to read the package header\n");
+            return PACKAGE_ERROR;
+        }
+        return package_readManifestV1(file, header, manifest);
+    }
+
+    printf("Error: Invalid package magic number\n");
+    return PACKAGE_ERROR;
+}
+
+/**
+ * @brief  Looks up a section by type.
+ * @return The section, or NULL if the package does not carry one.
+ */
+const Package_Section *package_findSection(const Package_Manifest *manifest, uint8_t type)
+{
+    for (uint32_t i = 0; i < manifest->numSections; i++)
+    {
+        if (manifest->sections[i].type == type)
+        {
+            return &manifest->sections[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief  Looks up a section by type and target address. A package for A/B
+ *         slots carries one image of each type per slot.
+ * @param  target Flash address of the section, 0 for the default of the type.
+ * @return The section, or NULL if the package does not carry one.
+ */
+const Package_Section *package_findTarget(const Package_Manifest *manifest, uint8_t type, uint32_t target)
+{
+    for (uint32_t i = 0; i < manifest->numSections; i++)
+    {
+        if ((manifest->sections[i].type == type) && (manifest->sections[i].target == target))
+        {
+            return &manifest->sections[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief  Checks the stored bytes of a v2 section against its CRC.
+ * @param  file            Open package file.
+ * @param  section         Section to verify.
+ * @param  progressManager Pointer to the progress manager.
+ * @param  step_number     Step number for the progress manager.
+ * @param  bytesDone       Bytes verified so far in the step, updated.
+ * @param  totalBytes      Bytes to verify in the whole step.
+ * @return PACKAGE_OK if the CRC matches.
+ */
+package_StatusTypeDef package_verifySection(FIL *file, const Package_Section *section, ProgressManager *progressManager,
+                                            uint32_t step_number, uint32_t *bytesDone, uint32_t totalBytes)
+{
+    uint8_t readBuffer[2][PACKAGE_VERIFY_BUFFER_SIZE] __attribute__((aligned(32)));
+    uint32_t remaining = section->length;
+    STM32Crc_Context context;
+
+    if (f_lseek(file, section->offset) != FR_OK)
+    {
+        printf("Error: Failed to reposition to section %u\n", section->type);
+        return PACKAGE_ERROR;
+    }
+
+    STM32Crc_begin(&context);
+
+    // Each chunk is checksummed in the background while the next one is read
+    for (uint32_t chunk = 0; remaining > 0; chunk++)
+    {
+        UINT bytesRead = 0;
+        uint8_t *buffer = readBuffer[chunk & 1];
+        uint32_t chunkSize = (remaining > PACKAGE_VERIFY_BUFFER_SIZE) ? PACKAGE_VERIFY_BUFFER_SIZE : remaining;
+
+        if ((f_read(file, buffer, chunkSize, &bytesRead) != FR_OK) || (bytesRead != chunkSize))
+        {
+            printf("Error: Failed to read section %u\n", section->type);
+            STM32Crc_value(&context);
+            return PACKAGE_ERROR;
+        }
+
+        STM32Crc_start(&context, buffer, bytesRead);
+        remaining -= bytesRead;
+        *bytesDone += bytesRead;
+
+        progress_update(progressManager, step_number, *bytesDone, totalBytes);
+    }
+
+    uint32_t crc = STM32Crc_value(&context);
+
+    if (crc != section->crc)
+    {
+        printf("Section %u CRC mismatch: calculated 0x%08lX, expected 0x%08lX\n", section->type, crc, section->crc);
+        return PACKAGE_ERROR;
+    }
+
+    return PACKAGE_OK;
+}
+
+/**
+ * @brief  Maps the fixed v1 header onto a manifest.
+ *         Sections follow the header in CM7, CM4, external order and the
+ *         package ends with the CRC of everything before it.
+ */
+static package_StatusTypeDef package_readManifestV1(FIL *file, const uint8_t *header, Package_Manifest *manifest)
+{
+    static const uint8_t types[] = { PACKAGE_SECTION_CM7, PACKAGE_SECTION_CM4, PACKAGE_SECTION_EXTERNAL };
+    uint8_t footer[4];
+    uint32_t offset = PACKAGE_V1_HEADER_SIZE;
+
+    manifest->format = 1;
+    memcpy(manifest->version, header + 16, 8);
+
+    for (uint32_t i = 0; i < sizeof(types); i++)
+    {
+        uint32_t sizeField = package_readUint32LE(header + 4 + (i * 4));
+        Package_Section section =
+        {
+            .type = types[i],
+            .encoding = ((sizeField & PACKAGE_V1_COMPRESSED) ? PACKAGE_ENCODING_LZ4 : 0) |
+                        ((sizeField & PACKAGE_V1_DELTA) ? PACKAGE_ENCODING_DELTA : 0),
+            .target = 0,
+            .offset = offset,
+            .length = sizeField & PACKAGE_V1_SIZE_MASK,
+            .crc = 0
+        };
+
+        if (package_addSection(file, manifest, &section) != PACKAGE_OK)
+        {
+            return PACKAGE_ERROR;
+        }
+        offset += section.length;
+    }
+
+    if (package_read(file, f_size(file) - 4, footer, sizeof(footer)) != PACKAGE_OK)
+    {
+        printf("Failed to read package CRC\n");
+        return PACKAGE_ERROR;
+    }
+    manifest->identity = package_readUint32LE(footer);
+
+    return PACKAGE_OK;
+}
+
+/**
+ * @brief  Parses a v2 manifest.
+ * @param  manifestBuffer Buffer of PACKAGE_MAX_MANIFEST_SIZE bytes holding the
+ *                        fixed header, completed with the TLV records.
+ */
+static package_StatusTypeDef package_readManifestV2(FIL *file, uint8_t *manifestBuffer, Package_Manifest *manifest)
+{
+    uint16_t format = package_readUint16LE(manifestBuffer + 4);
+    uint16_t manifestSize = package_readUint16LE(manifestBuffer + 6);
+    uint32_t manifestCRC = package_readUint32LE(manifestBuffer + 8);
+
+    if (format != 2)
+    {
+        printf("Error: Unsupported package format %u\n", format);
+        return PACKAGE_ERROR;
+    }
+
+    if ((manifestSize < PACKAGE_V2_HEADER_SIZE) || (manifestSize > PACKAGE_MAX_MANIFEST_SIZE))
+    {
+        printf("Error: Invalid package manifest size %u\n", manifestSize);
+        return PACKAGE_ERROR;
+    }
+
+    if (package_read(file, PACKAGE_V2_HEADER_SIZE, manifestBuffer + PACKAGE_V2_HEADER_SIZE,
+                     manifestSize - PACKAGE_V2_HEADER_SIZE) != PACKAGE_OK)
+    {
+        printf("Error: Failed to read the package manifest\n");
+        return PACKAGE_ERROR;
+    }
+
+    if (package_crc(manifestBuffer + PACKAGE_V2_HEADER_SIZE, manifestSize - PACKAGE_V2_HEADER_SIZE) != manifestCRC)
+    {
+        printf("Error: Package manifest CRC mismatch\n");
+        return PACKAGE_ERROR;
+    }
+
+    manifest->format = 2;
+    manifest->identity = manifestCRC;
+
+    uint32_t position = PACKAGE_V2_HEADER_SIZE;
+    while (position + 2 <= manifestSize)
+    {
+        uint8_t tag = manifestBuffer[position];
+        uint8_t length = manifestBuffer[position + 1];
+        const uint8_t *value = manifestBuffer + position + 2;
+
+        if (tag == PACKAGE_TAG_END)
+        {
+            break;
+        }
+
+        if (position + 2 + length > manifestSize)
+        {
+            printf("Error: Truncated package manifest record\n");
+            return PACKAGE_ERROR;
+        }
+
+        if (tag == PACKAGE_TAG_VERSION)
+        {
+            uint32_t versionLength = (length < PACKAGE_VERSION_STR_SIZE - 1) ? length : PACKAGE_VERSION_STR_SIZE - 1;
+            memcpy(manifest->version, value, versionLength);
+            manifest->version[versionLength] = '\0';
+        }
+        else if (tag == PACKAGE_TAG_SECTION)
+        {
+            if (length < PACKAGE_SECTION_RECORD_SIZE)
+            {
+                printf("Error: Invalid package section record\n");
+                return PACKAGE_ERROR;
+            }
+
+            uint8_t alignLog2 = value[2];
+            Package_Section section =
+            {
+                .type = value[0],
+                .encoding = value[1],
+                .target = package_readUint32LE(value + 4),
+                .offset = package_readUint32LE(value + 8),
+                .length = package_readUint32LE(value + 12),
+                .crc = package_readUint32LE(value + 16)
+            };
+
+            if ((alignLog2 < PACKAGE_MIN_ALIGN_LOG2) || (alignLog2 > PACKAGE_MAX_ALIGN_LOG2) ||
+                ((section.offset & ((1UL << alignLog2) - 1)) != 0) || (section.offset < manifestSize))
+            {
+                printf("Error: Misplaced package section %u at offset %lu\n", section.type, section.offset);
+                return PACKAGE_ERROR;
+            }
+
+            if (package_addSection(file, manifest, &section) != PACKAGE_OK)
+            {
+                return PACKAGE_ERROR;
+            }
+        }
+        else if (tag == PACKAGE_TAG_BLOCKS)
+        {
+            if ((length < PACKAGE_BLOCKS_RECORD_SIZE) || (package_addBlocks(file, manifest, value) != PACKAGE_OK))
+            {
+                printf("Error: Invalid package block digests record\n");
+                return PACKAGE_ERROR;
+            }
+        }
+
+        position += 2 + length;
+    }
+
+    return PACKAGE_OK;
+}
+
+/**
+ * @brief  Appends a section to the manifest after checking it fits in the file.
+ */
+static package_StatusTypeDef package_addSection(FIL *file, Package_Manifest *manifest, const Package_Section *section)
+{
+    if ((section->offset > f_size(file)) || (section->length > (f_size(file) - section->offset)))
+    {
+        printf("Error: Package section %u exceeds the file\n", section->type);
+        return PACKAGE_ERROR;
+    }
+
+    if ((manifest->numSections >= PACKAGE_MAX_SECTIONS) || (package_findTarget(manifest, section->type, section->target) != NULL))
+    {
+        printf("Error: Too many or duplicate package sections\n");
+        return PACKAGE_ERROR;
+    }
+
+    manifest->sections[manifest->numSections++] = *section;
+
+    return PACKAGE_OK;
+}
+
+/**
+ * @brief  Attaches a block digest table to the last section of its type.
+ */
+static package_StatusTypeDef package_addBlocks(FIL *file, Package_Manifest *manifest, const uint8_t *value)
+{
+    Package_Section *section = NULL;
+    uint32_t tableOffset = package_readUint32LE(value + 4);
+
+    for (uint32_t i = 0; i < manifest->numSections; i++)
+    {
+        if (manifest->sections[i].type == value[0])
+        {
+            section = &manifest->sections[i];
+        }
+    }
+
+    if ((section == NULL) || (value[1] != PACKAGE_BLOCK_SIZE_LOG2) || (tableOffset == 0))
+    {
+        return PACKAGE_ERROR;
+    }
+
+    uint32_t tableSize = ((section->length + PACKAGE_BLOCK_SIZE - 1) / PACKAGE_BLOCK_SIZE) * sizeof(uint32_t);
+    if ((tableSize > sizeof(blockDigests)) || (tableOffset > f_size(file)) || (tableSize > (f_size(file) - tableOffset)))
+    {
+        return PACKAGE_ERROR;
+    }
+
+    section->blockTable = tableOffset;
+    section->blockTableCRC = package_readUint32LE(value + 8);
+
+    return PACKAGE_OK;
+}
+
+/**
+ * @brief  Opens the stored bytes of a section for reading.
+ *         The block digests, if any, are loaded and checked against their
+ *         root CRC, then every block read is checked before it is handed out.
+ * @param  reader  Reader to initialize.
+ * @param  file    Open package file.
+ * @param  section Section to read.
+ * @return PACKAGE_OK if the section can be read.
+ */
+package_StatusTypeDef package_openReader(Package_Reader *reader, FIL *file, const Package_Section *section)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->file = file;
+    reader->remaining = section->length;
+    reader->verified = (section->blockTable != 0);
+
+    if (reader->verified)
+    {
+        uint32_t tableSize = ((section->length + PACKAGE_BLOCK_SIZE - 1) / PACKAGE_BLOCK_SIZE) * sizeof(uint32_t);
+
+        if (package_read(file, section->blockTable, (uint8_t *)blockDigests, tableSize) != PACKAGE_OK)
+        {
+            printf("Error: Failed to read the digests of section %u\n", section->type);
+            return PACKAGE_ERROR;
+        }
+
+        if (package_crc((const uint8_t *)blockDigests, tableSize) != section->blockTableCRC)
+        {
+            printf("Error: Block digests of section %u do not match their root CRC\n", section->type);
+            return PACKAGE_ERROR;
+        }
+    }
+
+    if (f_lseek(file, section->offset) != FR_OK)
+    {
+        printf("Error: Failed to reposition to section %u\n", section->type);
+        return PACKAGE_ERROR;
+    }
+
+    return PACKAGE_OK;
+}
+
+/**
+ * @brief  Builds a stream writer source reading a section.
+ * @param  source Source to initialize.
+ * @param  reader Open reader, must outlive the writer.
+ */
+void package_readerSource(StreamWriter_Source *source, Package_Reader *reader)
+{
+    source->read = package_readerRead;
+    source->context = reader;
+}
+
+/**
+ * @brief  Stream writer source callback.
+ *         Whole blocks requested by the caller are read and checked in place,
+ *         so the 4 KB reads of the stream writer are never copied; smaller
+ *         reads are served from a checked copy of the block.
+ */
+static streamWriter_StatusTypeDef package_readerRead(void *context, uint8_t *buffer, uint32_t length, uint32_t *bytesRead)
+{
+    Package_Reader *reader = (Package_Reader *)context;
+
+    *bytesRead = 0;
+
+    while (length > 0)
+    {
+        uint32_t buffered = reader->blockLength - reader->blockOffset;
+
+        if (buffered > 0)
+        {
+            uint32_t chunk = (buffered < length) ? buffered : length;
+
+            memcpy(buffer, blockBuffer + reader->blockOffset, chunk);
+            reader->blockOffset += chunk;
+            buffer += chunk;
+            length -= chunk;
+            *bytesRead += chunk;
+            continue;
+        }
+
+        if (reader->remaining == 0)
+        {
+            break;
+        }
+
+        uint32_t blockLength = (reader->remaining < PACKAGE_BLOCK_SIZE) ? reader->remaining : PACKAGE_BLOCK_SIZE;
+
+        if (!reader->verified)
+        {
+            blockLength = (blockLength < length) ? blockLength : length;
+        }
+
+        if (blockLength <= length)
+        {
+            if (package_readBlock(reader, buffer, blockLength) != PACKAGE_OK)
+            {
+                return STREAMWRITER_ERROR;
+            }
+            buffer += blockLength;
+            length -= blockLength;
+            *bytesRead += blockLength;
+        }
+        else
+        {
+            if (package_readBlock(reader, blockBuffer, blockLength) != PACKAGE_OK)
+            {
+                return STREAMWRITER_ERROR;
+            }
+            reader->blockLength = blockLength;
+            reader->blockOffset = 0;
+        }
+    }
+
+    return STREAMWRITER_OK;
+}
+
+/**
+ * @brief  Reads the next block, or part of it for an unverified section,
+ *         and checks it against its digest.
+ */
+static package_StatusTypeDef package_readBlock(Package_Reader *reader, uint8_t *buffer, uint32_t length)
+{
+    UINT br = 0;
+
+    FRESULT res = f_read(reader->file, buffer, length, &br);
+    if ((res != FR_OK) || (br != length))
+    {
+        printf("Error: Failed to read package data (f_read returned %d)\n", res);
+        return PACKAGE_ERROR;
+    }
+
+    reader->remaining -= length;
+
+    if (!reader->verified)
+    {
+        return PACKAGE_OK;
+    }
+
+    uint32_t expected = package_readUint32LE((const uint8_t *)&blockDigests[reader->block]);
+    if (package_crc(buffer, length) != expected)
+    {
+        printf("Error: Package block %lu is corrupted\n", reader->block);
+        return PACKAGE_ERROR;
+    }
+
+    reader->block++;
+
+    return PACKAGE_OK;
+}
+
+/**
+ * @brief  Reads exactly `length` bytes at `offset`.
+ */
+static package_StatusTypeDef package_read(FIL *file, uint32_t offset, uint8_t *buffer, uint32_t length)
+{
+    UINT bytesRead = 0;
+
+    if ((f_lseek(file, offset) != FR_OK) || (f_read(file, buffer, length, &bytesRead) != FR_OK) || (bytesRead != length))
+    {
+        return PACKAGE_ERROR;
+    }
+
+    return PACKAGE_OK;
+}
+
+/**
+ * @brief  Computes the CRC-32 of a buffer.
+ */
+static uint32_t package_crc(const uint8_t *buffer, uint32_t length)
+{
+    return STM32Crc_compute(buffer, length);
+}
+
+/**
+ * @brief Reads a 32-bit unsigned integer from a buffer in little-endian format.
+ */
+static uint32_t package_readUint32LE(const uint8_t *buffer)
+{
+    return ((uint32_t)buffer[0]) |
+           ((uint32_t)buffer[1] << 8) |
+           ((uint32_t)buffer[2] << 16) |
+           ((uint32_t)buffer[3] << 24);
+}
+
+/**
+ * @brief Reads a 16-bit unsigned integer from a buffer in little-endian format.
+ */
+static uint16_t package_readUint16LE(const uint8_t *buffer)
+{
+    return (uint16_t)(buffer[0] | (buffer[1] << 8));
+}
@@ -0,0 +1,267 @@
+/**
+ ******************************************************************************
+ * @file           : profiler.c
+ * @brief          : Boot and update phase timing, see profiler.h.
+ *                   The 32-bit cycle counter wraps every 9 s at 480 MHz, so
+ *                   each event is turned into microseconds since
+ *                   profiler_init() when it is recorded: from the cycles
+ *                   elapsed since the previous event at the clock then in
+ *                   use, or from the HAL tick when more than a wrap may have
+ *                   gone by. profiler_clockChanged() closes the cycles run
+ *                   at the old clock when the core clock is switched.
+ *                   Totals are summed in microseconds the same way.
+ *                   Each event costs a few dozen cycles.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "main.h"
+#include "ff.h"
+
+#include "profiler.h"
+
+#ifdef BOOT_PROFILING
+
+/* Private define ------------------------------------------------------------*/
+#define PROFILER_WRAP_SAFE_MS   4000U       // Less than a counter wrap up to 1 GHz
+#define PROFILER_LINE_SIZE      96
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+    const char *name;
+    uint32_t time;                  // Microseconds since profiler_init()
+    Profiler_EventKind kind;
+} Profiler_Event;
+
+typedef struct
+{
+    const char *name;
+    uint32_t count;
+    uint32_t start;                 // Cycle counter at the pending begin
+    uint64_t elapsed;               // Microseconds, scaled by 2^16
+} Profiler_Total;
+
+/* Private variables ---------------------------------------------------------*/
+static Profiler_Event events[PROFILER_MAX_EVENTS];
+static uint32_t numEvents;          // Recorded since profiler_init(), the ring keeps the last ones
+static Profiler_Total totals[PROFILER_MAX_TOTALS];
+
+static uint32_t lastCycles;
+static uint32_t lastTick;
+static uint32_t cyclesPerUs;        // Core clock since the last event, in MHz
+static uint64_t elapsed;            // Microseconds at the last event, scaled by 2^16 to keep the fractions
+
+/* Private function prototypes -----------------------------------------------*/
+static uint32_t profiler_now(void);
+static Profiler_Total *profiler_findTotal(const char *name);
+static void profiler_writeLine(FIL *file, bool fileOpen, const char *line);
+
+/**
+ * @brief  Clears the events.
+ *         The cycle counter must have been started by bootInfo_init().
+ *         Usable right after reset, before HAL_Init().
+ */
+void profiler_init(void)
+{
+    numEvents = 0;
+    for (uint32_t i = 0; i < PROFILER_MAX_TOTALS; i++)
+    {
+        totals[i].name = NULL;
+    }
+
+    lastCycles = DWT->CYCCNT;
+    lastTick = HAL_GetTick();
+    cyclesPerUs = SystemCoreClock / 1000000U;
+    elapsed = 0;
+}
+
+/**
+ * @brief  Takes a new core clock into account, to call right after
+ *         SystemClock_Config(). The cycles since the last event are
+ *         converted at the previous clock, which ran the configuration
+ *         until its final switch.
+ */
+void profiler_clockChanged(void)
+{
+    profiler_now();
+    cyclesPerUs = SystemCoreClock / 1000000U;
+}
+
+/**
+ * @brief  Records an event in the ring buffer.
+ */
+void profiler_event(const char *name, Profiler_EventKind kind)
+{
+    Profiler_Event *event = &events[numEvents % PROFILER_MAX_EVENTS];
+
+    event->name = name;
+    event->time = profiler_now();
+    event->kind = kind;
+
+    numEvents++;
+}
+
+/**
+ * @brief  Starts one occurrence of a summed phase.
+ *         Occurrences of the same name must not overlap.
+ */
+void profiler_totalBegin(const char *name)
+{
+    Profiler_Total *total = profiler_findTotal(name);
+
+    if (total != NULL)
+    {
+        total->start = DWT->CYCCNT;
+    }
+}
+
+/**
+ * @brief  Ends one occurrence of a summed phase.
+ *         Occurrences are expected to be short, well under a counter wrap,
+ *         and not to span a clock change.
+ */
+void profiler_totalEnd(const char *name)
+{
+    Profiler_Total *total = profiler_findTotal(name);
+
+    if (total != NULL)
+    {
+        total->elapsed += ((uint64_t)(DWT->CYCCNT - total->start) << 16) / cyclesPerUs;
+        total->count++;
+    }
+}
+
+/**
+ * @brief  Prints the recorded events and totals, and writes them to a file.
+ *         A phase end also gives the duration since its begin, when that
+ *         begin is still in the ring buffer.
+ * @param  path  Text file replaced by the dump, NULL for the UART only.
+ */
+void profiler_dump(const char *path)
+{
+    FIL file;
+    bool fileOpen = (path != NULL) && (f_open(&file, path, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK);
+    char line[PROFILER_LINE_SIZE];
+    uint32_t first = (numEvents > PROFILER_MAX_EVENTS) ? (numEvents - PROFILER_MAX_EVENTS) : 0;
+
+    snprintf(line, sizeof(line), "Profile: %lu events (%lu dropped), core at %lu MHz\n",
+             (unsigned long)numEvents, (unsigned long)first, (unsigned long)(SystemCoreClock / 1000000U));
+    profiler_writeLine(&file, fileOpen, line);
+    profiler_writeLine(&file, fileOpen, "    time ms  duration ms  event\n");
+
+    for (uint32_t i = first; i < numEvents; i++)
+    {
+        const Profiler_Event *event = &events[i % PROFILER_MAX_EVENTS];
+        const char *prefix = (event->kind == PROFILER_EVENT_BEGIN) ? "> " : ((event->kind == PROFILER_EVENT_END) ? "< " : "");
+        char duration[16] = "";
+
+        // Duration of a phase, from the latest begin of the same name
+        for (uint32_t j = i; (event->kind == PROFILER_EVENT_END) && (j > first); j--)
+        {
+            const Profiler_Event *begin = &events[(j - 1) % PROFILER_MAX_EVENTS];
+
+            if ((begin->kind == PROFILER_EVENT_BEGIN) && (begin->name == event->name))
+            {
+                uint32_t us = event->time - begin->time;
+                snprintf(duration, sizeof(duration), "%lu.%03lu", (unsigned long)(us / 1000U), (unsigned long)(us % 1000U));
+                break;
+            }
+        }
+
+        snprintf(line, sizeof(line), "%7lu.%03lu  %11s  %s%s\n", (unsigned long)(event->time / 1000U),
+                 (unsigned long)(event->time % 1000U), duration, prefix, event->name);
+        profiler_writeLine(&file, fileOpen, line);
+    }
+
+    for (uint32_t i = 0; (i < PROFILER_MAX_TOTALS) && (totals[i].name != NULL); i++)
+    {
+        uint32_t us = (uint32_t)(totals[i].elapsed >> 16);
+
+        snprintf(line, sizeof(line), "Total %s: %lu.%03lu ms in %lu calls\n", totals[i].name,
+                 (unsigned long)(us / 1000U), (unsigned long)(us % 1000U), (unsigned long)totals[i].count);
+        profiler_writeLine(&file, fileOpen, line);
+    }
+
+    if (fileOpen)
+    {
+        f_close(&file);
+    }
+}
+
+/**
+ * @brief  Returns the microseconds since profiler_init().
+ */
+static uint32_t profiler_now(void)
+{
+    uint32_t cycles = DWT->CYCCNT;
+    uint32_t tick = HAL_GetTick();
+
+    if ((tick - lastTick) > PROFILER_WRAP_SAFE_MS)
+    {
+        elapsed += ((uint64_t)(tick - lastTick) * 1000U) << 16;
+    }
+    else
+    {
+        elapsed += ((uint64_t)(cycles - lastCycles) << 16) / cyclesPerUs;
+    }
+
+    lastCycles = cycles;
+    lastTick = tick;
+
+    return (uint32_t)(elapsed >> 16);
+}
+
+/**
+ * @brief  Returns the total of a name, allocated on first use.
+ * @return NULL if all the totals are in use.
+ */
+static Profiler_Total *profiler_findTotal(const char *name)
+{
+    for (uint32_t i = 0; i < PROFILER_MAX_TOTALS; i++)
+    {
+        if (totals[i].name == NULL)
+        {
+            totals[i].name = name;
+            totals[i].count = 0;
+            totals[i].elapsed = 0;
+        }
+
+        if (totals[i].name == name)
+        {
+            return &totals[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief  Prints one line of the dump and appends it to the file.
+ */
+static void profiler_writeLine(FIL *file, bool fileOpen, const char *line)
+{
+    UINT bytesWritten;
+
+    printf("%s", line);
+
+    if (fileOpen)
+    {
+        f_write(file, line, (UINT)strlen(line), &bytesWritten);
+    }
+}
+
+#endif /* BOOT_PROFILING */
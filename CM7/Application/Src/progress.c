@@ -14,14 +14,25 @@
  */
 
 
+#include <string.h>
+
 #include "progress.h"
 #include "update_gui.h" // For gui_displayUpdateProcess
+#include "profiler.h"
+
+static void progress_refresh(ProgressManager* pm);
 
 void progress_init(ProgressManager* pm, uint32_t num_steps)
 {
+    if (num_steps > PROGRESS_MAX_STEPS)
+    {
+        num_steps = PROGRESS_MAX_STEPS;
+    }
+
     pm->num_steps = num_steps;
     pm->current_step = 1;
     pm->last_progress = -1; // Initialize to -1 to force an update on first call
+    memset(pm->step_percent, 0, sizeof(pm->step_percent));
 }
 
 void progress_update(ProgressManager* pm, uint32_t step_number, uint32_t current_value, uint32_t total_value)
@@ -38,12 +49,45 @@ void progress_update(ProgressManager* pm, uint32_t step_number, uint32_t current
     }
 
     // Calculate progress percentage for the current step
-    float step_progress = (current_value * 100.0f) / total_value;
+    uint32_t step_progress = (uint32_t)(((uint64_t)current_value * 100U) / total_value);
+    if (step_progress > 100U)
+    {
+        step_progress = 100U;
+    }
 
-    // Calculate overall progress
-    float overall_progress = ((step_number - 1) + (step_progress / 100.0f)) * (100.0f / pm->num_steps);
+    pm->current_step = step_number;
+    pm->step_percent[step_number - 1] = (uint8_t)step_progress;
+
+    progress_refresh(pm);
+}
+
+void progress_complete(ProgressManager* pm, uint32_t step_number)
+{
+    if (step_number < 1 || step_number > pm->num_steps)
+    {
+        return;
+    }
+
+    pm->step_percent[step_number - 1] = 100U;
+
+    progress_refresh(pm);
+}
+
+/**
+ * @brief Redraws the progress bar from the completion of every step.
+ *        The overall progress is the mean of the steps, so it never moves
+ *        backwards when several steps advance at the same time.
+ */
+static void progress_refresh(ProgressManager* pm)
+{
+    uint32_t sum = 0;
+
+    for (int i = 0; i < pm->num_steps; i++)
+    {
+        sum += pm->step_percent[i];
+    }
 
-    int32_t int_progress = (int32_t)overall_progress;
+    int32_t int_progress = (int32_t)(sum / pm->num_steps);
 
     // Only update if the progress value has changed
     if (int_progress != pm->last_progress)
@@ -51,6 +95,8 @@ void progress_update(ProgressManager* pm, uint32_t step_number, uint32_t current
         pm->last_progress = int_progress;
         // Update the progress bar
 
+        PROFILE_TOTAL_BEGIN("GUI refresh");
         gui_displayUpdateProcess(int_progress);
+        PROFILE_TOTAL_END("GUI refresh");
     }
 }
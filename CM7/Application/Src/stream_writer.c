@@ -0,0 +1,287 @@
+/**
+ ******************************************************************************
+ * @file           : stream_writer.c
+ * @brief          : Double-buffered read/program pipeline.
+ *                   One buffer is filled from the source while the previous
+ *                   one is drained into the sink, so that package reads on
+ *                   the QSPI volume overlap with internal flash programming.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+#include "basetypes.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "stm32_flash_async.h"
+
+#include "stream_writer.h"
+
+/* Private define ------------------------------------------------------------*/
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Buffer currently handed to the asynchronous flash driver */
+typedef struct
+{
+    uint32_t startAddress;
+    uint32_t length;
+    const uint8_t *startData;
+    uint32_t bank;
+    uint32_t skipSectors;   // Sectors already holding the data (bit = sector number)
+    bool skipped;           // Current buffer was not programmed
+} StreamWriter_FlashSinkState;
+
+/* Private variables ---------------------------------------------------------*/
+static uint8_t streamBuffers[STREAMWRITER_NUM_BUFFERS][STREAMWRITER_BUFFER_SIZE] __attribute__((aligned(32)));
+static uint32_t streamLengths[STREAMWRITER_NUM_BUFFERS];
+
+static StreamWriter_FlashSinkState flashSink;
+
+/* Private function prototypes -----------------------------------------------*/
+static streamWriter_StatusTypeDef streamWriter_fileRead(void *context, uint8_t *buffer, uint32_t length, uint32_t *bytesRead);
+static streamWriter_StatusTypeDef streamWriter_flashStart(void *context, uint32_t address, const uint8_t *data, uint32_t length);
+static streamWriter_StatusTypeDef streamWriter_flashWait(void *context);
+
+/**
+ * @brief  Initializes a stream writer.
+ * @param  writer          Pointer to the writer to initialize.
+ * @param  source          Producer of the payload.
+ * @param  sink            Consumer of the payload.
+ * @param  address         Destination start address (32-byte aligned).
+ * @param  size            Number of payload bytes to transfer.
+ * @param  progressManager Pointer to the progress manager, or NULL.
+ * @param  step_number     Step number for the progress manager.
+ */
+void streamWriter_init(StreamWriter *writer, const StreamWriter_Source *source, const StreamWriter_Sink *sink,
+                       uint32_t address, uint32_t size, ProgressManager* progressManager, uint32_t step_number)
+{
+    writer->source = *source;
+    writer->sink = *sink;
+    writer->address = address;
+    writer->size = size;
+    writer->progressManager = progressManager;
+    writer->step_number = step_number;
+}
+
+/**
+ * @brief  Runs the pipeline until the whole payload has been drained.
+ *         The sink is started on the oldest filled buffer first, then the
+ *         next free buffer is filled while the sink works in the background.
+ *         The writer only blocks on the sink when every buffer is in use or
+ *         the source is exhausted.
+ *
+ * @param  writer Pointer to an initialized writer.
+ * @return STREAMWRITER_OK if the whole payload was written, STREAMWRITER_ERROR otherwise.
+ */
+streamWriter_StatusTypeDef streamWriter_run(StreamWriter *writer)
+{
+    uint32_t filledCount = 0;   // Buffers filled since the start
+    uint32_t startedCount = 0;  // Buffers handed to the sink
+    uint32_t doneCount = 0;     // Buffers fully drained
+    uint32_t bytesFilled = 0;
+    uint32_t bytesDone = 0;
+    uint32_t address = writer->address;
+
+    if ((address % STREAMWRITER_FLASH_WORD_SIZE) != 0)
+    {
+        printf("Error: Stream destination misaligned at 0x%08lx\n", (unsigned long)address);
+        return STREAMWRITER_ERROR;
+    }
+
+    while (bytesDone < writer->size)
+    {
+        // 1) Hand the oldest filled buffer to the sink if it is idle
+        if ((startedCount == doneCount) && (startedCount < filledCount))
+        {
+            uint32_t index = startedCount % STREAMWRITER_NUM_BUFFERS;
+            uint32_t paddedLength = (streamLengths[index] + STREAMWRITER_FLASH_WORD_SIZE - 1) & ~(STREAMWRITER_FLASH_WORD_SIZE - 1);
+
+            // Pad the last flash word with the erased value
+            memset(&streamBuffers[index][streamLengths[index]], 0xFF, paddedLength - streamLengths[index]);
+
+            if (writer->sink.start(writer->sink.context, address, streamBuffers[index], paddedLength) != STREAMWRITER_OK)
+            {
+                printf("Error: Stream sink failed to start at 0x%08lx\n", (unsigned long)address);
+                return STREAMWRITER_ERROR;
+            }
+
+            address += paddedLength;
+            startedCount++;
+        }
+
+        // 2) Fill a free buffer while the sink is busy
+        if ((bytesFilled < writer->size) && ((filledCount - doneCount) < STREAMWRITER_NUM_BUFFERS))
+        {
+            uint32_t index = filledCount % STREAMWRITER_NUM_BUFFERS;
+            uint32_t chunkSize = MIN(writer->size - bytesFilled, STREAMWRITER_BUFFER_SIZE);
+            uint32_t bytesRead = 0;
+
+            if ((writer->source.read(writer->source.context, streamBuffers[index], chunkSize, &bytesRead) != STREAMWRITER_OK) ||
+                (bytesRead != chunkSize))
+            {
+                printf("Error: Stream source failed after %lu bytes\n", (unsigned long)bytesFilled);
+                if (startedCount != doneCount)
+                {
+                    writer->sink.wait(writer->sink.context);
+                }
+                return STREAMWRITER_ERROR;
+            }
+
+            streamLengths[index] = chunkSize;
+            bytesFilled += chunkSize;
+            filledCount++;
+            continue;
+        }
+
+        // 3) Nothing left to overlap with, wait for the sink
+        if (startedCount != doneCount)
+        {
+            if (writer->sink.wait(writer->sink.context) != STREAMWRITER_OK)
+            {
+                printf("Error: Stream sink failed before 0x%08lx\n", (unsigned long)address);
+                return STREAMWRITER_ERROR;
+            }
+
+            bytesDone += streamLengths[doneCount % STREAMWRITER_NUM_BUFFERS];
+            doneCount++;
+
+            if (writer->progressManager != NULL)
+            {
+                progress_update(writer->progressManager, writer->step_number, bytesDone, writer->size);
+            }
+        }
+    }
+
+    return STREAMWRITER_OK;
+}
+
+/**
+ * @brief  Builds a source reading `size` bytes from the current position of an open file.
+ * @param  source  Source to initialize.
+ * @param  context Storage for the source state, must outlive the writer.
+ * @param  file    Pointer to the open file.
+ * @param  size    Number of bytes to read.
+ */
+void streamWriter_fileSource(StreamWriter_Source *source, StreamWriter_FileSource *context, FIL *file, uint32_t size)
+{
+    context->file = file;
+    context->remaining = size;
+
+    source->read = streamWriter_fileRead;
+    source->context = context;
+}
+
+/**
+ * @brief  Builds a sink programming the internal flash under interrupt.
+ *         Flash words are programmed by the asynchronous flash driver, so the
+ *         CPU is free to read the next chunk while the current one is programmed.
+ *         Buffers falling in a skipped sector are dropped: the sector already
+ *         holds them and has not been erased.
+ * @param  sink        Sink to initialize.
+ * @param  skipSectors Sectors not to program (bit = sector number), 0 to program everything.
+ */
+void streamWriter_flashSink(StreamWriter_Sink *sink, uint32_t skipSectors)
+{
+    flashSink.skipSectors = skipSectors;
+    flashSink.skipped = false;
+
+    sink->start = streamWriter_flashStart;
+    sink->wait = streamWriter_flashWait;
+    sink->context = &flashSink;
+}
+
+/**
+ * @brief  Reads the next chunk of the file.
+ */
+static streamWriter_StatusTypeDef streamWriter_fileRead(void *context, uint8_t *buffer, uint32_t length, uint32_t *bytesRead)
+{
+    StreamWriter_FileSource *fileSource = (StreamWriter_FileSource *)context;
+    UINT br = 0;
+
+    if (length > fileSource->remaining)
+    {
+        length = fileSource->remaining;
+    }
+
+    FRESULT res = f_read(fileSource->file, buffer, length, &br);
+    *bytesRead = br;
+    if (res != FR_OK)
+    {
+        printf("Error: Failed to read firmware data (f_read returned %d)\n", res);
+        return STREAMWRITER_ERROR;
+    }
+
+    fileSource->remaining -= br;
+    return STREAMWRITER_OK;
+}
+
+/**
+ * @brief  Queues a buffer for programming into internal flash.
+ */
+static streamWriter_StatusTypeDef streamWriter_flashStart(void *context, uint32_t address, const uint8_t *data, uint32_t length)
+{
+    StreamWriter_FlashSinkState *state = (StreamWriter_FlashSinkState *)context;
+
+    state->startAddress = address;
+    state->startData = data;
+    state->length = length;
+    state->bank = STM32FlashAsync_getBank(address);
+
+    // Buffers never straddle a sector, the buffer size divides the sector size
+    state->skipped = (state->skipSectors & (1UL << stm32Flash_getSector(address))) != 0;
+    if (state->skipped)
+    {
+        return STREAMWRITER_OK;
+    }
+
+    if (STM32FlashAsync_program(address, data, length, NULL, NULL) != STM32FLASH_OK)
+    {
+        printf("Error: Failed to queue flash program at 0x%08lx\n", address);
+        return STREAMWRITER_ERROR;
+    }
+
+    return STREAMWRITER_OK;
+}
+
+/**
+ * @brief  Waits for the current buffer to be programmed and verifies it
+ *         against the buffer in one pass, re-programming any word that was
+ *         left erased.
+ */
+static streamWriter_StatusTypeDef streamWriter_flashWait(void *context)
+{
+    StreamWriter_FlashSinkState *state = (StreamWriter_FlashSinkState *)context;
+
+    if (state->skipped)
+    {
+        return STREAMWRITER_OK;
+    }
+
+    // Words left erased by a failed operation are recovered by the verification
+    if (STM32FlashAsync_wait(state->bank) != STM32FLASH_OK)
+    {
+        printf("FLASH programming error in range 0x%08lx - 0x%08lx\n",
+               state->startAddress, state->startAddress + state->length);
+    }
+
+    if (STM32Flash_verify(state->startAddress, state->startData, state->length, true) != STM32FLASH_OK)
+    {
+        printf("Verify mismatch in flash range 0x%08lx - 0x%08lx\n", state->startAddress, state->startAddress + state->length);
+        return STREAMWRITER_ERROR;
+    }
+
+    return STREAMWRITER_OK;
+}
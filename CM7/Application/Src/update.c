@@ -24,32 +24,174 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdbool.h>
 
 #include "fatfs.h"
 #include "stm32_flash.h"
+#include "stm32_flash_async.h"
 #include "file_manager.h"
 
-#include "crc.h"
+#include "stm32_crc.h"
 
 #include "update_gui.h"
+#include "stream_writer.h"
+#include "decompressor.h"
+#include "delta.h"
+#include "update_scheduler.h"
+#include "update_journal.h"
+#include "package.h"
+#include "backup.h"
+#include "boot_slot.h"
+#include "profiler.h"
 #include "update.h"
 
 /* Private define ------------------------------------------------------------*/
 #define BUFFER_SIZE      2048
-#define HEADER_SIZE      24
-#define VERSION_STR_SIZE 9
+
+/* Entries of the fast-seek link map of a backup, (fragments * 2) + 1 */
+#define RESTORE_LINKMAP_SIZE    64
+
+#define EXTERNAL_DATA_PATH      "0:/External_MAX8.tar.gz"
+#define EXTERNAL_DATA_TMP_PATH  "0:/External_MAX8.tar.gz.tmp"
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Location and encoding of one section of the package */
+typedef struct
+{
+	Package_Section stored;             // Manifest entry of the stored bytes
+	uint32_t size;                      // Bytes once decoded
+	bool compressed;
+	bool delta;
+	Delta_Header deltaHeader;           // Base image expected by a delta section
+} update_Section;
+
+/* Source state of a section being read, raw, compressed and/or delta */
+typedef struct
+{
+	Package_Reader packageReader;
+	StreamWriter_Source stored;         // Section bytes as stored, block-verified
+	Decompressor decompressor;
+	StreamWriter_Source input;          // Section bytes once decompressed
+	Delta delta;
+	FIL baseFile;                       // Base image of a delta section
+	bool baseOpen;
+} update_SectionReader;
+
+/* State of one firmware image through the backup, erase and flash tasks */
+typedef struct
+{
+	const char *name;
+	FIL *package;                       // Open package file
+	update_Section section;             // New image in the package
+	uint32_t flashStartAddr;
+	uint32_t maxSize;                   // Size of the region to back up
+	char backupPath[64];
+	uint32_t image;                     // UPDATE_JOURNAL_IMAGE_xxx
+
+	// Sectors whose content differs from the new image (bit = sector number)
+	bool compared;
+	uint32_t changedSectors;
+	uint32_t programmedSectors;         // Changed sectors already holding the new image
+	bool resumeErase;                   // Erase completed before a reset, only redo the sector being programmed
+
+	// Background erase, advanced from the FLASH interrupt
+	uint32_t flashBank;
+	uint32_t firstSector;
+	uint32_t eraseMask;                 // Sectors to erase
+	uint32_t numSectors;                // Number of sectors in eraseMask
+	volatile uint32_t lastQueued;       // Last sector handed to the flash driver
+	volatile uint32_t sectorsErased;
+	volatile bool eraseFailed;
+	ProgressManager *progressManager;
+	uint32_t step_number;
+} update_ImageJob;
+
+/* Flash sink journaling each sector once it is programmed and verified */
+typedef struct
+{
+	StreamWriter_Sink flash;
+	update_ImageJob *job;
+	uint32_t skipSectors;
+	uint32_t address;                   // Buffer in flight
+	uint32_t length;
+} update_JournalSink;
+
+/* Package being installed, verified by the CRC task */
+typedef struct
+{
+	FIL *file;
+	const Package_Manifest *manifest;
+} update_PackageJob;
+
+/* Package sections written to the file system */
+typedef struct
+{
+	FIL *package;
+	update_Section section;
+} update_ExternalJob;
+
+/* State of one firmware image restored from its backup, sector by sector */
+typedef struct
+{
+	const char *name;
+	uint32_t flashStartAddr;
+	uint32_t maxSize;                   // Size of the image region
+	char backupPath[64];
+
+	// Backup, open for the whole restore
+	FIL file;
+	DWORD linkMap[RESTORE_LINKMAP_SIZE];
+	Backup_Header header;
+	Backup_Reader reader;
+	StreamWriter_Source source;
+	Backup_Mark mark;                   // Start of the current sector in the backup
+
+	uint32_t flashBank;
+	uint32_t firstSector;
+	uint32_t flashLength;               // Programmed length of the region before the restore
+	uint32_t numSectors;                // Sectors covering the backup and the flashed image
+	uint32_t sector;                    // Index of the current sector
+	uint32_t sectorsChanged;
+	bool done;
+
+	// Background erase of the current sector, completed from the FLASH interrupt
+	bool erasing;
+	volatile bool eraseDone;
+	volatile bool eraseFailed;
+} update_RestoreJob;
 
 /* Private variables ---------------------------------------------------------*/
-uint8_t tempBuffer[32] __attribute__((aligned(32)));
+static UpdateJournal updateJournal;
 
 /* Function prototypes -------------------------------------------------------*/
 static uint32_t update_readUint32LE(const uint8_t *buffer);
 static fwupdate_StatusTypeDef update_calculateCRC(FIL* file, ProgressManager* progressManager, uint32_t step_number);
-static fwupdate_StatusTypeDef update_backupFirmware(uint32_t flashStartAddr, uint32_t size, const char* backupFilePath, ProgressManager* progressManager, uint32_t step_number);
-static fwupdate_StatusTypeDef update_eraseFirmware(uint32_t flashStartAddr, uint32_t size, ProgressManager* progressManager, uint32_t step_number);
-static fwupdate_StatusTypeDef update_writeFirmware(uint32_t flashStartAddr, FIL* file, uint32_t size, ProgressManager* progressManager, uint32_t step_number);
-static fwupdate_StatusTypeDef update_writeExternalData(FIL* file, uint32_t external_size, ProgressManager* progressManager, uint32_t step_number);
+static fwupdate_StatusTypeDef update_writeFirmware(uint32_t flashStartAddr, const StreamWriter_Source* source, uint32_t size, uint32_t skipSectors, update_ImageJob* job, ProgressManager* progressManager, uint32_t step_number);
+static streamWriter_StatusTypeDef update_journalSinkStart(void *context, uint32_t address, const uint8_t *data, uint32_t length);
+static streamWriter_StatusTypeDef update_journalSinkWait(void *context);
+static void update_taskDone(const UpdateTask *task, void *context);
+static fwupdate_StatusTypeDef update_writeExternalData(const StreamWriter_Source* source, uint32_t external_size, ProgressManager* progressManager, uint32_t step_number);
+static const Package_Section* update_findImage(const Package_Manifest* manifest, uint8_t type, uint32_t target, uint32_t defaultTarget);
+static fwupdate_StatusTypeDef update_parseSection(FIL* file, const Package_Section* entry, uint32_t defaultTarget, update_Section* section);
+static fwupdate_StatusTypeDef update_openSectionInput(FIL* file, const update_Section* section, update_SectionReader* reader);
+static fwupdate_StatusTypeDef update_openSection(FIL* file, const update_Section* section, const char* basePath, StreamWriter_Source* source, update_SectionReader* reader);
+static void update_closeSection(update_SectionReader* reader);
+static fwupdate_StatusTypeDef update_checkDeltaBase(const char* basePath, const Delta_Header* header);
+static void update_eraseSectorDone(STM32Flash_StatusTypeDef status, uint32_t address, void *context);
+static fwupdate_StatusTypeDef update_taskCalculateCRC(void *context, ProgressManager *progressManager, uint32_t step_number);
+static fwupdate_StatusTypeDef update_taskBackup(void *context, ProgressManager *progressManager, uint32_t step_number);
+static uint32_t update_nextSector(uint32_t sectorMask, uint32_t fromSector);
+static fwupdate_StatusTypeDef update_taskCompare(void *context, ProgressManager *progressManager, uint32_t step_number);
+static fwupdate_StatusTypeDef update_taskStartErase(void *context, ProgressManager *progressManager, uint32_t step_number);
+static bool update_taskPollErase(void *context, fwupdate_StatusTypeDef *status);
+static fwupdate_StatusTypeDef update_taskFlash(void *context, ProgressManager *progressManager, uint32_t step_number);
+static fwupdate_StatusTypeDef update_taskExternalData(void *context, ProgressManager *progressManager, uint32_t step_number);
+static fwupdate_StatusTypeDef update_restoreOpen(update_RestoreJob *job);
+static fwupdate_StatusTypeDef update_restoreStep(update_RestoreJob *job, ProgressManager *progressManager, uint32_t step_number);
+static void update_restoreEraseDone(STM32Flash_StatusTypeDef status, uint32_t address, void *context);
+static void update_reportImage(BootInfo_Update *report, uint32_t flashStartAddr, uint32_t maxSize);
 
 /**
  * @brief Reads a 32-bit unsigned integer from a buffer in little-endian format.
@@ -80,8 +222,9 @@ static fwupdate_StatusTypeDef update_calculateCRC(FIL* file, ProgressManager* pr
 	uint32_t crc_calculated = 0;
 	uint32_t totalDataRead = 0;
 	uint32_t crc_length = file_size - 4; // Exclude the footer CRC
-	uint8_t readBuffer[BUFFER_SIZE] __attribute__((aligned(4))); // Buffer aligned to 4 bytes
+	uint8_t readBuffer[2][BUFFER_SIZE] __attribute__((aligned(32))); // One read while the other is checksummed
 	uint8_t crc_buffer[4];
+	STM32Crc_Context crc;
 
 	// Read the CRC from the footer
 	res = f_lseek(file, crc_position);
@@ -114,21 +257,23 @@ static fwupdate_StatusTypeDef update_calculateCRC(FIL* file, ProgressManager* pr
 	}
 
 	// Initialize the CRC calculation
-	__HAL_CRC_DR_RESET(&hcrc);
+	STM32Crc_begin(&crc);
 
-	while (totalDataRead < crc_length)
+	for (uint32_t chunk = 0; totalDataRead < crc_length; chunk++)
 	{
+		uint8_t *buffer = readBuffer[chunk & 1];
 		uint32_t bytesToRead = (crc_length - totalDataRead > BUFFER_SIZE) ? BUFFER_SIZE : (crc_length - totalDataRead);
-		res = f_read(file, readBuffer, bytesToRead, &bytesRead);
+		res = f_read(file, buffer, bytesToRead, &bytesRead);
 		if (res != FR_OK || bytesRead == 0)
 		{
 			printf("Error reading the file for CRC calculation\n");
+			STM32Crc_value(&crc);
 			gui_displayUpdateFailed();
 			return FWUPDATE_ERROR;
 		}
 
-		// Calculate the CRC for the read bytes
-		crc_calculated = HAL_CRC_Accumulate(&hcrc, (uint32_t *)readBuffer, bytesRead);
+		// Checksum the read bytes in the background while the next chunk is read
+		STM32Crc_start(&crc, buffer, bytesRead);
 
 		totalDataRead += bytesRead;
 
@@ -136,8 +281,7 @@ static fwupdate_StatusTypeDef update_calculateCRC(FIL* file, ProgressManager* pr
 		progress_update(progressManager, step_number, totalDataRead, crc_length);
 	}
 
-	// Perform the final XOR with 0xFFFFFFFF
-	crc_calculated ^= 0xFFFFFFFF;
+	crc_calculated = STM32Crc_value(&crc);
 
 	// Compare the calculated CRC with the CRC from the file
 	if (crc_calculated != crc_read)
@@ -155,636 +299,1386 @@ static fwupdate_StatusTypeDef update_calculateCRC(FIL* file, ProgressManager* pr
 }
 
 /**
- * @brief Backs up firmware from flash memory to a specified file.
- * This function reads firmware data from flash memory and writes it
- * to a backup file. Progress updates are reported during the operation.
- * @param flashStartAddr Starting address in flash memory.
- * @param size Size of the firmware to backup in bytes.
- * @param backupFilePath Path to the backup file to create.
- * @param progressManager Pointer to the progress manager for updates.
- * @param step_number Step number for the progress manager.
+ * @brief  Writes firmware to flash memory from a specified source.
+ *         This function streams firmware data from a file, or from the
+ *         decoder of a compressed section, to flash memory through the
+ *         double-buffered stream writer: the next chunk is produced while the
+ *         previous one is programmed. Padding of the last flash word and
+ *         progress updates are handled by the writer.
+ *
+ * @param  flashStartAddr  Starting address in flash memory.
+ * @param  source          Producer of the firmware data.
+ * @param  size            Size of the firmware to write in bytes.
+ * @param  skipSectors     Sectors already holding the firmware, not programmed
+ *                         (bit = sector number).
+ * @param  job             Image being updated, or NULL to program unjournaled.
+ *                         Programmed sectors are journaled.
+ * @param  progressManager Pointer to the progress manager for updates.
+ * @param  step_number     Step number for the progress manager.
+ *
  * @return FWUPDATE_OK if the update process is successful, FWUPDATE_ERROR otherwise.
  */
-static fwupdate_StatusTypeDef update_backupFirmware(uint32_t flashStartAddr, uint32_t size, const char* backupFilePath, ProgressManager* progressManager, uint32_t step_number)
+static fwupdate_StatusTypeDef update_writeFirmware(uint32_t flashStartAddr, const StreamWriter_Source* source, uint32_t size, uint32_t skipSectors, update_ImageJob* job, ProgressManager* progressManager, uint32_t step_number)
 {
-	// If the final backup file already exists, skip the backup
-	FILINFO fileInfo;
-	if (f_stat(backupFilePath, &fileInfo) == FR_OK)
+	StreamWriter writer;
+	StreamWriter_Sink sink;
+	update_JournalSink journalSink;
+
+	printf("Flashing firmware to address 0x%08lx...\n", (unsigned long)flashStartAddr);
+
+	// Verify alignment
+	if ((flashStartAddr % 32) != 0)
 	{
-		printf("File %s already exists. Skipping backup.\n", backupFilePath);
-		return FWUPDATE_OK;
+		printf("Error: Flash address misaligned at 0x%08lx\n", (unsigned long)flashStartAddr);
+		gui_displayUpdateFailed();
+		return FWUPDATE_ERROR;
 	}
 
-	// Build a temporary file name by appending ".tmp"
-	char tmpFilePath[256];
-	snprintf(tmpFilePath, sizeof(tmpFilePath), "%s.tmp", backupFilePath);
+	streamWriter_flashSink(&sink, skipSectors);
 
-	// Remove any existing temporary file
-	f_unlink(tmpFilePath);
-
-	// Check flash memory boundaries
-	if ((flashStartAddr + size) > FLASH_END_ADDR)
+	if (job != NULL)
 	{
-		printf("Error: Flash address out of range\n");
-		return FWUPDATE_ERROR;
+		journalSink.flash = sink;
+		journalSink.job = job;
+		journalSink.skipSectors = skipSectors;
+		sink.start = update_journalSinkStart;
+		sink.wait = update_journalSinkWait;
+		sink.context = &journalSink;
 	}
+	streamWriter_init(&writer, source, &sink, flashStartAddr, size, progressManager, step_number);
 
-	// Open the temporary backup file
-	FIL backupFile;
-	FRESULT res = f_open(&backupFile, tmpFilePath, FA_WRITE | FA_READ | FA_CREATE_ALWAYS);
-	if (res != FR_OK)
+	if (streamWriter_run(&writer) != STREAMWRITER_OK)
 	{
-		printf("Error: Cannot open temporary backup file %s\n", tmpFilePath);
+		printf("Error: Streamed flash write failed\n");
+		gui_displayUpdateFailed();
 		return FWUPDATE_ERROR;
 	}
 
-	uint8_t readBuffer[32768] __attribute__((aligned(32)));
-	uint32_t bytesRemaining = size;
-	uint32_t flashAddress = flashStartAddr;
-	uint32_t totalBytesRead = 0;
+	return FWUPDATE_OK;
+}
 
-	while (bytesRemaining > 0)
-	{
-		uint32_t chunkSize = (bytesRemaining > sizeof(readBuffer)) ? sizeof(readBuffer) : bytesRemaining;
+/**
+ * @brief  Journal sink start callback, see update_writeFirmware().
+ */
+static streamWriter_StatusTypeDef update_journalSinkStart(void *context, uint32_t address, const uint8_t *data, uint32_t length)
+{
+	update_JournalSink *sink = (update_JournalSink *)context;
 
-		// Read from flash memory
-		memcpy(readBuffer, (uint8_t*)flashAddress, chunkSize);
+	sink->address = address;
+	sink->length = length;
 
-		// Write to the temporary file
-		if (file_reliableWrite(&backupFile, readBuffer, chunkSize, 5) != FILEMANAGER_OK)
-		{
-		    printf("Error: Reliable write failed in temporary file %s\n", tmpFilePath);
-		    f_close(&backupFile);
-		    return FWUPDATE_ERROR;
-		}
+	return sink->flash.start(sink->flash.context, address, data, length);
+}
 
-		flashAddress += chunkSize;
-		bytesRemaining -= chunkSize;
-		totalBytesRead += chunkSize;
+/**
+ * @brief  Journal sink wait callback.
+ *         Once the last buffer of a sector is verified, the sector is
+ *         journaled so that a resumed update does not program it again.
+ */
+static streamWriter_StatusTypeDef update_journalSinkWait(void *context)
+{
+	update_JournalSink *sink = (update_JournalSink *)context;
+	update_ImageJob *job = sink->job;
 
-		// Update progress
-		progress_update(progressManager, step_number, totalBytesRead, size);
+	if (sink->flash.wait(sink->flash.context) != STREAMWRITER_OK)
+	{
+		return STREAMWRITER_ERROR;
 	}
 
-	// Close the temporary file
-	f_close(&backupFile);
+	uint32_t end = sink->address + sink->length;
+	uint32_t sector = stm32Flash_getSector(sink->address);
 
-	// Rename the temporary file to the final backup file
-	res = f_rename(tmpFilePath, backupFilePath);
-	if (res != FR_OK)
+	if (!(sink->skipSectors & (1UL << sector)) &&
+		(((end % FLASH_SECTOR_SIZE) == 0) || (end >= job->flashStartAddr + job->section.size)))
 	{
-		printf("Error: Failed to rename %s to %s\n", tmpFilePath, backupFilePath);
-		return FWUPDATE_ERROR;
+		job->programmedSectors |= 1UL << sector;
+		updateJournal_sectorDone(&updateJournal, job->image, sector);
 	}
 
-	return FWUPDATE_OK;
+	return STREAMWRITER_OK;
 }
 
 /**
- * @brief  Writes firmware to flash memory from a specified file.
- *         This function reads firmware data from a file and writes it to flash memory
- *         in aligned 32-byte blocks. It ensures proper alignment, handles padding,
- *         and updates the progress manager accordingly.
+ * @brief  Writes external data to the file system.
+ *         This function reads data from a package section source and writes it
+ *         to the file system in manageable chunks to prevent memory overload.
+ *         A reliable write operation with CRC verification is performed.
  *
- * @param  flashStartAddr  Starting address in flash memory.
- * @param  file            Pointer to the file containing the firmware.
- * @param  size            Size of the firmware to write in bytes.
- * @param  progressManager Pointer to the progress manager for updates.
- * @param  step_number     Step number for the progress manager.
+ * @param  source          Producer of the external data.
+ * @param  external_size   Size of the external data in bytes.
+ * @param  progressManager Pointer to the progress manager for tracking progress.
+ * @param  step_number     Step number for progress tracking.
  *
  * @return FWUPDATE_OK if the update process is successful, FWUPDATE_ERROR otherwise.
  */
-static fwupdate_StatusTypeDef update_writeFirmware(uint32_t flashStartAddr, FIL* file, uint32_t size, ProgressManager* progressManager, uint32_t step_number)
-{
-    uint8_t readBuffer[BUFFER_SIZE] __attribute__((aligned(32)));
-    uint8_t block32[32]     __attribute__((aligned(32)));
-
-    uint32_t flashAddress = flashStartAddr;
-    uint32_t totalWritten = 0;
-    FRESULT res;
-    UINT bytesRead;
-
-    printf("Flashing firmware to address 0x%08lx...\n", (unsigned long)flashAddress);
-
-    // Verify alignment
-    if ((flashAddress % 32) != 0)
-    {
-        printf("Error: Flash address misaligned at 0x%08lx\n", (unsigned long)flashAddress);
-        gui_displayUpdateFailed();
-        return FWUPDATE_ERROR;
-    }
-
-    uint32_t remaining = size;
-    while (remaining > 0)
-    {
-        // 1) Read a chunk from the file
-        uint32_t chunkSize = (remaining > sizeof(readBuffer)) ? sizeof(readBuffer) : remaining;
-
-        res = f_read(file, readBuffer, chunkSize, &bytesRead);
-        if (res != FR_OK || bytesRead != chunkSize)
-        {
-            printf("Error: Failed to read firmware data (f_read returned %d)\n", res);
-            gui_displayUpdateFailed();
-            return FWUPDATE_ERROR;
-        }
-
-        remaining -= chunkSize;
-
-        // 2) Write this chunk in 32-byte blocks to flash memory
-        uint32_t offset = 0;
-        while (offset < chunkSize)
-        {
-            // Determine the size of the next 32-byte block
-            uint32_t blockSize = (chunkSize - offset >= 32) ? 32 : (chunkSize - offset);
-
-            // Copy data into block32
-            memcpy(block32, &readBuffer[offset], blockSize);
-
-            // If block is < 32 bytes, pad with 0xFF
-            if (blockSize < 32)
-            {
-                memset(&block32[blockSize], 0xFF, 32 - blockSize);
-                blockSize = 32;  // Ensure correct size for write operation
-            }
-
-            // 3) Perform a reliable 32-byte flash write
-            if (STM32Flash_reliableWrite(flashAddress, block32, blockSize, 5) != STM32FLASH_OK)
-            {
-                printf("Error: Reliable flash write failed at 0x%08lx\n", (unsigned long)flashAddress);
-                gui_displayUpdateFailed();
-                return FWUPDATE_ERROR;
-            }
-
-            // 4) Advance flash pointer by 32, offset by actual data size
-            flashAddress += 32;
-            offset       += (blockSize == 32) ? (uint32_t)(blockSize < (chunkSize - offset) ? 32 : (chunkSize - offset))
-                                              : blockSize;
-
-            // 5) Update the total written bytes (excluding padding)
-            totalWritten += (blockSize == 32) ? ((offset <= chunkSize) ? 32 : (chunkSize - (offset - 32)))
-                                              : blockSize;
-
-            // 6) Update the progress bar
-            uint32_t displayedBytes = (totalWritten > size) ? size : totalWritten;
-            progress_update(progressManager, step_number, displayedBytes, size);
-        }
-    }
-
-    return FWUPDATE_OK;
-}
-
-/**
- * @brief Erases necessary flash sectors for firmware.
- * @param flashStartAddr Starting address of the firmware in flash.
- * @param size Size of the firmware.
- * @param progressManager Pointer to the progress manager.
- * @param step_number The step number for progress tracking.
- * @return FWUPDATE_OK if the update process is successful, FWUPDATE_ERROR otherwise.
- */
-static fwupdate_StatusTypeDef update_eraseFirmware(uint32_t flashStartAddr, uint32_t size, ProgressManager* progressManager, uint32_t step_number)
+static fwupdate_StatusTypeDef update_writeExternalData(const StreamWriter_Source* source, uint32_t external_size, ProgressManager* progressManager, uint32_t step_number)
 {
-	// Determine flash bank and sector
-	uint32_t flashBank = (flashStartAddr >= ADDR_FLASH_SECTOR_0_BANK2) ? FLASH_BANK_2 : FLASH_BANK_1;
-	uint32_t flashSector = stm32Flash_getSector(flashStartAddr);
-	uint32_t NbSectors = (size + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
-	uint32_t sectorsErased = 0;
+	uint32_t bytesRead;
+	FRESULT res;
+	uint8_t readBuffer[BUFFER_SIZE] __attribute__((aligned(4)));
+
+	uint32_t totalBytesToWrite = external_size;
+	uint32_t totalBytesWritten = 0;
+
+	printf("Writing external data to the file system...\n");
+
+	// Write to a temporary file, the current data is only replaced once the
+	// new data has been read and checked completely
+	FIL externalFile;
+	res = f_open(&externalFile, EXTERNAL_DATA_TMP_PATH, FA_WRITE | FA_READ | FA_CREATE_ALWAYS);
+	if (res != FR_OK)
+	{
+		printf("Failed to open the file on the file system\n");
+		gui_displayUpdateFailed();
+		return FWUPDATE_ERROR;
+	}
 
-	printf("Erasing flash sectors starting from sector %lu...\n", flashSector);
-	for (uint32_t sector = flashSector; sector < flashSector + NbSectors; sector++)
+	// Process data in chunks to avoid memory overload
+	uint32_t bytesToWrite = external_size;
+	while (bytesToWrite > 0)
 	{
-		if (STM32Flash_erase_sector(flashBank, sector) != STM32FLASH_OK)
+		// Read a chunk of data from the source file
+		uint32_t chunkSize = (bytesToWrite > BUFFER_SIZE) ? BUFFER_SIZE : bytesToWrite;
+		if (source->read(source->context, readBuffer, chunkSize, &bytesRead) != STREAMWRITER_OK || bytesRead != chunkSize)
+		{
+			printf("Failed to read external data\n");
+			f_close(&externalFile);
+			gui_displayUpdateFailed();
+			return FWUPDATE_ERROR;
+		}
+
+		// Perform a reliable write with CRC verification
+		if (file_reliableWrite(&externalFile, readBuffer, bytesRead, 5) != FILEMANAGER_OK)
 		{
-			printf("Failed to erase sector %lu\n", sector);
+			printf("Error: Reliable write failed in file system\n");
+			f_close(&externalFile);
 			gui_displayUpdateFailed();
 			return FWUPDATE_ERROR;
 		}
 
-		sectorsErased++;
+		bytesToWrite -= bytesRead;
+		totalBytesWritten += bytesRead;
 
-		// Update step progress
-		progress_update(progressManager, step_number, sectorsErased, NbSectors);
+		// Update progress bar
+		progress_update(progressManager, step_number, totalBytesWritten, totalBytesToWrite);
+	}
+
+	// Close the file
+	f_close(&externalFile);
+
+	res = f_unlink(EXTERNAL_DATA_PATH);
+	if ((res != FR_OK) && (res != FR_NO_FILE))
+	{
+		printf("Failed to remove the previous external data\n");
+		gui_displayUpdateFailed();
+		return FWUPDATE_ERROR;
+	}
+
+	if (f_rename(EXTERNAL_DATA_TMP_PATH, EXTERNAL_DATA_PATH) != FR_OK)
+	{
+		printf("Failed to rename the external data file\n");
+		gui_displayUpdateFailed();
+		return FWUPDATE_ERROR;
 	}
 
 	return FWUPDATE_OK;
 }
 
 /**
- * @brief  Writes external data to the file system.
- *         This function reads data from an open package file and writes it
- *         to the file system in manageable chunks to prevent memory overload.
- *         A reliable write operation with CRC verification is performed.
- *
- * @param  file            Pointer to the open package file.
- * @param  external_size   Size of the external data in bytes.
- * @param  progressManager Pointer to the progress manager for tracking progress.
- * @param  step_number     Step number for progress tracking.
- *
- * @return FWUPDATE_OK if the update process is successful, FWUPDATE_ERROR otherwise.
+ * @brief  Describes a section of the package from its manifest entry.
+ *         For a compressed or delta section, the size of the rebuilt image
+ *         is read from the section headers so that the erase can be sized
+ *         before anything is decoded.
+ * @param  file          Pointer to the open package file.
+ * @param  entry         Manifest entry of the section.
+ * @param  defaultTarget Only target accepted besides 0 (default), 0 if the section has none.
+ * @param  section       Section description to fill.
+ * @return FWUPDATE_OK if the section is valid, FWUPDATE_ERROR otherwise.
  */
-static fwupdate_StatusTypeDef update_writeExternalData(FIL* file, uint32_t external_size, ProgressManager* progressManager, uint32_t step_number)
-{
-    UINT bytesRead;
-    FRESULT res;
-    uint8_t readBuffer[BUFFER_SIZE] __attribute__((aligned(4)));
-
-    uint32_t totalBytesToWrite = external_size;
-    uint32_t totalBytesWritten = 0;
-
-    printf("Writing external data to the file system...\n");
-
-    // Open the destination file
-    FIL externalFile;
-    res = f_open(&externalFile, "0:/External_MAX8.tar.gz", FA_WRITE | FA_READ | FA_CREATE_ALWAYS);
-    if (res != FR_OK)
-    {
-        printf("Failed to open the file on the file system\n");
-        gui_displayUpdateFailed();
-        return FWUPDATE_ERROR;
-    }
-
-    // Process data in chunks to avoid memory overload
-    uint32_t bytesToWrite = external_size;
-    while (bytesToWrite > 0)
-    {
-        // Read a chunk of data from the source file
-        uint32_t chunkSize = (bytesToWrite > BUFFER_SIZE) ? BUFFER_SIZE : bytesToWrite;
-        res = f_read(file, readBuffer, chunkSize, &bytesRead);
-        if (res != FR_OK || bytesRead != chunkSize)
-        {
-            printf("Failed to read external data (error %d)\n", res);
-            f_close(&externalFile);
-            gui_displayUpdateFailed();
-            return FWUPDATE_ERROR;
-        }
-
-        // Perform a reliable write with CRC verification
-        if (file_reliableWrite(&externalFile, readBuffer, bytesRead, 5) != FILEMANAGER_OK)
-        {
-            printf("Error: Reliable write failed in file system\n");
-            f_close(&externalFile);
-            gui_displayUpdateFailed();
-            return FWUPDATE_ERROR;
-        }
-
-        bytesToWrite -= bytesRead;
-        totalBytesWritten += bytesRead;
-
-        // Update progress bar
-        progress_update(progressManager, step_number, totalBytesWritten, totalBytesToWrite);
-    }
-
-    // Close the file
-    f_close(&externalFile);
-
-    return FWUPDATE_OK;
+static fwupdate_StatusTypeDef update_parseSection(FIL* file, const Package_Section* entry, uint32_t defaultTarget, update_Section* section)
+{
+	if ((entry->target != 0) && (entry->target != defaultTarget))
+	{
+		printf("Error: Unsupported target 0x%08lx for section %u\n", entry->target, entry->type);
+		return FWUPDATE_ERROR;
+	}
+
+	section->stored = *entry;
+	section->compressed = (entry->encoding & PACKAGE_ENCODING_LZ4) != 0;
+	section->delta = (entry->encoding & PACKAGE_ENCODING_DELTA) != 0;
+	section->size = entry->length;
+
+	if (!section->compressed && !section->delta)
+	{
+		return FWUPDATE_OK;
+	}
+
+	// Holds a FIL and a decoder state, kept off the stack
+	static update_SectionReader reader;
+
+	if (update_openSectionInput(file, section, &reader) != FWUPDATE_OK)
+	{
+		printf("Error: Invalid compressed section at offset %lu\n", entry->offset);
+		return FWUPDATE_ERROR;
+	}
+
+	if (!section->delta)
+	{
+		section->size = reader.decompressor.contentSize;
+		return FWUPDATE_OK;
+	}
+
+	if (delta_readHeader(&reader.input, &section->deltaHeader) != DELTA_OK)
+	{
+		printf("Error: Invalid delta section at offset %lu\n", entry->offset);
+		return FWUPDATE_ERROR;
+	}
+	section->size = section->deltaHeader.targetSize;
+
+	return FWUPDATE_OK;
 }
 
 /**
- * @brief  Search for a firmware package file in the filesystem.
- * @param  packageFilePath Buffer to store the found package file path.
- * @param  maxLen Maximum length of the buffer.
- * @return FWUPDATE_OK if the update process is successful, FWUPDATE_ERROR otherwise.
+ * @brief  Finds the firmware image of a type built for a flash address.
+ *         A section without a target is installed at the default address
+ *         of its type. Failing that, any section of the type is returned,
+ *         so that its target is rejected rather than taken as left out.
+ * @return The section, or NULL if the package does not carry one.
  */
-fwupdate_StatusTypeDef update_findPackageFile(char *packageFilePath, size_t maxLen)
+static const Package_Section* update_findImage(const Package_Manifest* manifest, uint8_t type, uint32_t target, uint32_t defaultTarget)
 {
-    FRESULT res;
-    FILINFO fno;
-    DIR dir;
-    char *fn;
-
-    res = f_opendir(&dir, FW_PATH); // Open the directory
-    if (res == FR_OK)
-    {
-        for (;;)
-        {
-            res = f_readdir(&dir, &fno); // Read a directory item
-            if ((res != FR_OK) || (fno.fname[0] == 0))
-            {
-                break; // End of directory or error
-            }
-
-            // Ensure it is a file and not a directory
-            if (fno.fattrib & AM_DIR)
-            {
-                continue;
-            }
-
-            fn = fno.fname;
-
-            // Check if the filename starts with "cis_package_" and contains ".bin"
-            if ((strstr(fn, "cis_package_") == fn) && strstr(fn, ".bin"))
-            {
-                size_t fwPathLen = strlen(FW_PATH);
-                size_t fnLen = strlen(fn);
-                size_t totalLen = fwPathLen + 1 + fnLen + 1; // '/' + null terminator
-
-                // Ensure packageFilePath buffer is large enough
-                if (totalLen > maxLen)
-                {
-                    f_closedir(&dir);
-                    return FWUPDATE_ERROR; // Avoid truncation
-                }
-
-                // Use strncpy and strncat instead of snprintf to avoid -Wformat-truncation warning
-                strncpy(packageFilePath, FW_PATH, maxLen - 1);
-                packageFilePath[maxLen - 1] = '\0'; // Ensure null termination
-
-                strncat(packageFilePath, "/", maxLen - strlen(packageFilePath) - 1);
-                strncat(packageFilePath, fn, maxLen - strlen(packageFilePath) - 1);
-
-                f_closedir(&dir);
-                return FWUPDATE_OK;
-            }
-        }
-        f_closedir(&dir);
-    }
-    return FWUPDATE_ERROR;
+	const Package_Section *entry = package_findTarget(manifest, type, target);
+
+	if ((entry == NULL) && (target == defaultTarget))
+	{
+		entry = package_findTarget(manifest, type, 0);
+	}
+
+	if (entry == NULL)
+	{
+		entry = package_findSection(manifest, type);
+	}
+
+	return entry;
 }
 
 /**
- * @brief  Restores previously backed-up firmware versions.
- *         This function erases the designated flash memory regions and writes
- *         back the backed-up firmware stored in files. It ensures each step
- *         is properly tracked with a progress manager.
- *
- * @return FWUPDATE_OK if the update process is successful, FWUPDATE_ERROR otherwise.
+ * @brief  Positions the package on a section and builds the source of its
+ *         stored bytes, checked block by block when the package carries
+ *         block digests, and decompressed if needed.
  */
-fwupdate_StatusTypeDef update_restoreBackupFirmwares(void)
-{
-    const int NUM_STEPS = 4;
-    const int STEP_ERASE_CM7 = 1;
-    const int STEP_ERASE_CM4 = 2;
-    const int STEP_FLASH_CM7 = 3;
-    const int STEP_FLASH_CM4 = 4;
-
-    char backupPath[64];
-    ProgressManager progressManager;
-    progress_init(&progressManager, NUM_STEPS);
-    gui_displayRestorePreviousVersion();
-
-    FIL backupFile;
-    FRESULT fres;
-    FSIZE_t backupSize;
-
-    // Step 1: Erase CM7 flash region
-    printf("Step 1: Erasing CM7 region\n");
-    snprintf(backupPath, sizeof(backupPath), "%s/%s", FW_PATH, "backup_cm7.bin");
-    fres = f_open(&backupFile, backupPath, FA_READ);
-    if (fres != FR_OK)
-    {
-        printf("No backup found for %s (fres=%d). Skipping erase.\n", backupPath, fres);
-        return FWUPDATE_ERROR;
-    }
-    backupSize = f_size(&backupFile);
-    if (update_eraseFirmware(FW_CM7_START_ADDR, (uint32_t)backupSize, &progressManager, STEP_ERASE_CM7) != FWUPDATE_OK)
-    {
-        printf("Failed to erase flash region at 0x%08lX.\n", (long unsigned int)FW_CM7_START_ADDR);
-        f_close(&backupFile);
-        return FWUPDATE_ERROR;
-    }
-    f_close(&backupFile);
-
-    // Step 2: Erase CM4 flash region
-    printf("Step 2: Erasing CM4 region\n");
-    snprintf(backupPath, sizeof(backupPath), "%s/%s", FW_PATH, "backup_cm4.bin");
-    fres = f_open(&backupFile, backupPath, FA_READ);
-    if (fres != FR_OK)
-    {
-        printf("No backup found for %s (fres=%d). Skipping erase.\n", backupPath, fres);
-        return FWUPDATE_ERROR;
-    }
-    backupSize = f_size(&backupFile);
-    if (update_eraseFirmware(FW_CM4_START_ADDR, (uint32_t)backupSize, &progressManager, STEP_ERASE_CM4) != FWUPDATE_OK)
-    {
-        printf("Failed to erase flash region at 0x%08lX.\n", (long unsigned int)FW_CM4_START_ADDR);
-        f_close(&backupFile);
-        return FWUPDATE_ERROR;
-    }
-    f_close(&backupFile);
-
-    // Step 3: Restore CM7 firmware using `update_writeFirmware`
-    printf("Step 3: Restoring CM7 backup\n");
-    snprintf(backupPath, sizeof(backupPath), "%s/%s", FW_PATH, "backup_cm7.bin");
-    fres = f_open(&backupFile, backupPath, FA_READ);
-    if (fres != FR_OK)
-    {
-        printf("No backup found for %s (fres=%d). Skipping restore.\n", backupPath, fres);
-        return FWUPDATE_ERROR;
-    }
-    backupSize = f_size(&backupFile);
-
-    if (update_writeFirmware(FW_CM7_START_ADDR, &backupFile, (uint32_t)backupSize, &progressManager, STEP_FLASH_CM7) != FWUPDATE_OK)
-    {
-        printf("Error: Failed to restore CM7 firmware at 0x%08lX.\n", (long unsigned int)FW_CM7_START_ADDR);
-        f_close(&backupFile);
-        return FWUPDATE_ERROR;
-    }
-
-    f_close(&backupFile);
-    printf("Successfully restored %s to 0x%08lX.\n", backupPath, (long unsigned int)FW_CM7_START_ADDR);
-
-    // Step 4: Restore CM4 firmware using `update_writeFirmware`
-    printf("Step 4: Restoring CM4 backup\n");
-    snprintf(backupPath, sizeof(backupPath), "%s/%s", FW_PATH, "backup_cm4.bin");
-    fres = f_open(&backupFile, backupPath, FA_READ);
-    if (fres != FR_OK)
-    {
-        printf("No backup found for %s (fres=%d). Skipping restore.\n", backupPath, fres);
-        return FWUPDATE_ERROR;
-    }
-    backupSize = f_size(&backupFile);
-
-    if (update_writeFirmware(FW_CM4_START_ADDR, &backupFile, (uint32_t)backupSize, &progressManager, STEP_FLASH_CM4) != FWUPDATE_OK)
-    {
-        printf("Error: Failed to restore CM4 firmware at 0x%08lX.\n", (long unsigned int)FW_CM4_START_ADDR);
-        f_close(&backupFile);
-        return FWUPDATE_ERROR;
-    }
-
-    f_close(&backupFile);
-    printf("Successfully restored %s to 0x%08lX.\n", backupPath, (long unsigned int)FW_CM4_START_ADDR);
-
-    return FWUPDATE_OK;
+static fwupdate_StatusTypeDef update_openSectionInput(FIL* file, const update_Section* section, update_SectionReader* reader)
+{
+	reader->baseOpen = false;
+
+	if (package_openReader(&reader->packageReader, file, &section->stored) != PACKAGE_OK)
+	{
+		return FWUPDATE_ERROR;
+	}
+	package_readerSource(&reader->stored, &reader->packageReader);
+
+	if (!section->compressed)
+	{
+		reader->input = reader->stored;
+		return FWUPDATE_OK;
+	}
+
+	if (decompressor_open(&reader->decompressor, &reader->stored, section->stored.length) != DECOMPRESSOR_OK)
+	{
+		return FWUPDATE_ERROR;
+	}
+
+	decompressor_source(&reader->input, &reader->decompressor);
+	return FWUPDATE_OK;
 }
 
 /**
- * @brief Processes a firmware update package file.
- * This function handles the full update process including CRC verification,
- * backup, erasing, flashing, and external data handling.
- * @param packageFilePath Path to the firmware package file.
- * @return FWUPDATE_OK if the update process is successful, FWUPDATE_ERROR otherwise.
+ * @brief  Builds a source producing the image of a section.
+ *         A delta section is applied against the backup of the installed
+ *         image, which update_checkDeltaBase() has validated beforehand.
+ * @param  file     Pointer to the open package file.
+ * @param  section  Section to read.
+ * @param  basePath Base image of a delta section, may be NULL otherwise.
+ * @param  source   Source to initialize.
+ * @param  reader   Storage for the source state, released by update_closeSection().
+ * @return FWUPDATE_OK if the section is ready to be read, FWUPDATE_ERROR otherwise.
  */
-fwupdate_StatusTypeDef update_processPackageFile(const TCHAR* packageFilePath)
-{
-    const int NUM_STEPS = 8;
-    const int STEP_CRC_CALCULATION = 1;
-    const int STEP_BACKUP_CM7 = 2;
-    const int STEP_BACKUP_CM4 = 3;
-    const int STEP_ERASE_CM7 = 4;
-    const int STEP_ERASE_CM4 = 5;
-    const int STEP_FLASH_CM7 = 6;
-    const int STEP_FLASH_CM4 = 7;
-    const int STEP_SAVE_EXTERNAL = 8;
+static fwupdate_StatusTypeDef update_openSection(FIL* file, const update_Section* section, const char* basePath, StreamWriter_Source* source, update_SectionReader* reader)
+{
+	if (update_openSectionInput(file, section, reader) != FWUPDATE_OK)
+	{
+		return FWUPDATE_ERROR;
+	}
 
-	FIL file;
-	UINT bytesRead;
-	FRESULT res;
-	uint8_t header[HEADER_SIZE];
-	uint32_t cm7_size, cm4_size, external_size;
-	char version[VERSION_STR_SIZE] = {0};
-	uint8_t magic[4];
-	char backupPath[64];
-	ProgressManager progressManager;
+	if (!section->delta)
+	{
+		*source = reader->input;
+		return FWUPDATE_OK;
+	}
 
-	// Initialize progress manager
-	progress_init(&progressManager, NUM_STEPS);
+	Backup_Header backupHeader;
 
-	// Open the update package file
-	res = f_open(&file, packageFilePath, FA_READ);
-	if (res != FR_OK)
+	if ((basePath == NULL) || (backup_open(&reader->baseFile, basePath, &backupHeader) != BACKUP_OK))
 	{
-		printf("Error: Failed to open the package file: %s\n", packageFilePath);
-		gui_displayUpdateFailed();
+		printf("Error: No base image for the delta section\n");
 		return FWUPDATE_ERROR;
 	}
+	reader->baseOpen = true;
 
-	// Read the header
-	res = f_read(&file, header, sizeof(header), &bytesRead);
-	if (res != FR_OK || bytesRead != sizeof(header))
+	if (backupHeader.compression != BACKUP_COMPRESSION_NONE)
 	{
-		printf("Error: Failed to read the package header\n");
-		f_close(&file);
-		gui_displayUpdateFailed();
+		printf("Error: The base image of the delta section is compressed\n");
+		update_closeSection(reader);
 		return FWUPDATE_ERROR;
 	}
 
-	// Parse the header
-	memcpy(magic, header, 4);
-	if (memcmp(magic, "BOOT", 4) != 0)
+	if ((delta_open(&reader->delta, &reader->input, &reader->baseFile, backupHeader.imageOffset) != DELTA_OK) ||
+		(reader->delta.header.targetSize != section->size))
 	{
-		printf("Error: Invalid package magic number\n");
-		f_close(&file);
-		gui_displayUpdateFailed();
+		update_closeSection(reader);
 		return FWUPDATE_ERROR;
 	}
 
-	cm7_size = update_readUint32LE(header + 4);
-	cm4_size = update_readUint32LE(header + 8);
-	external_size = update_readUint32LE(header + 12);
-	memcpy(version, header + 16, 8);
+	delta_source(source, &reader->delta);
+	return FWUPDATE_OK;
+}
 
-	printf("Package version: %s\n", version);
-	printf("CM7 firmware size: %lu bytes\n", cm7_size);
-	printf("CM4 firmware size: %lu bytes\n", cm4_size);
-	printf("External data size: %lu bytes\n", external_size);
+/**
+ * @brief  Releases the files opened by update_openSection().
+ */
+static void update_closeSection(update_SectionReader* reader)
+{
+	if (reader->baseOpen)
+	{
+		f_close(&reader->baseFile);
+		reader->baseOpen = false;
+	}
+}
 
-	// Display version
-	gui_displayVersion(version);
+/**
+ * @brief  Checks that a backup matches the base image expected by a delta.
+ *         This runs before the flash is erased, so a package built against
+ *         another release fails without touching the installed firmware.
+ * @param  basePath Path of the backup of the installed image.
+ * @param  header   Header of the delta section.
+ * @return FWUPDATE_OK if the CRC of the base matches, FWUPDATE_ERROR otherwise.
+ */
+static fwupdate_StatusTypeDef update_checkDeltaBase(const char* basePath, const Delta_Header* header)
+{
+	FIL baseFile;
+	Backup_Header backupHeader;
 
-	// Step 1: Calculate and verify CRC
-	printf("Step 1: Calculate and verify CRC\n");
-	if (update_calculateCRC(&file, &progressManager, STEP_CRC_CALCULATION) != FWUPDATE_OK)
+	if (backup_open(&baseFile, basePath, &backupHeader) != BACKUP_OK)
 	{
-		printf("Error: Failed to calculate or verify CRC\n");
-		f_close(&file);
+		printf("Error: Cannot open delta base %s\n", basePath);
 		return FWUPDATE_ERROR;
 	}
 
-	// Step 2: Backup current CM7 firmware
-	printf("Step 2: Backup current CM7 firmware\n");
-	snprintf(backupPath, sizeof(backupPath), "%s/%s", FW_PATH, "backup_cm7.bin");
-	if (update_backupFirmware(FW_CM7_START_ADDR, FW_CM7_MAX_SIZE, backupPath, &progressManager, STEP_BACKUP_CM7) != FWUPDATE_OK)
+	if ((backupHeader.compression != BACKUP_COMPRESSION_NONE) || (backupHeader.imageLength < header->baseSize))
 	{
-	    printf("Error: Failed to backup current CM7 firmware\n");
-	    f_close(&file);
-	    return FWUPDATE_ERROR;
+		printf("Error: Delta base %s is compressed or too small\n", basePath);
+		f_close(&baseFile);
+		return FWUPDATE_ERROR;
 	}
 
-	// Step 3: Backup current CM4 firmware
-	printf("Step 3: Backup current CM4 firmware\n");
-	snprintf(backupPath, sizeof(backupPath), "%s/%s", FW_PATH, "backup_cm4.bin");
-	if (update_backupFirmware(FW_CM4_START_ADDR, FW_CM4_MAX_SIZE, backupPath, &progressManager, STEP_BACKUP_CM4) != FWUPDATE_OK)
+	delta_StatusTypeDef status = delta_checkBase(&baseFile, header);
+	f_close(&baseFile);
+
+	return (status == DELTA_OK) ? FWUPDATE_OK : FWUPDATE_ERROR;
+}
+
+/**
+ * @brief  Returns the first sector of a mask at or after a given sector.
+ * @return The sector number, or FLASH_SECTOR_TOTAL if there is none.
+ */
+static uint32_t update_nextSector(uint32_t sectorMask, uint32_t fromSector)
+{
+	for (uint32_t sector = fromSector; sector < FLASH_SECTOR_TOTAL; sector++)
 	{
-	    printf("Error: Failed to backup current CM4 firmware\n");
-	    f_close(&file);
-	    return FWUPDATE_ERROR;
+		if (sectorMask & (1UL << sector))
+		{
+			return sector;
+		}
 	}
 
-	// Step 4: Erase CM7 firmware
-	printf("Step 4: Erase CM7 firmware\n");
-	if (update_eraseFirmware(FW_CM7_START_ADDR, cm7_size, &progressManager, STEP_ERASE_CM7) != FWUPDATE_OK)
+	return FLASH_SECTOR_TOTAL;
+}
+
+/**
+ * @brief  Queues the next sector of a background erase.
+ *         Called from the FLASH interrupt each time a sector is erased, so the
+ *         bank keeps erasing while the CPU runs other update steps. This
+ *         only pays off on bank 2: code fetched from bank 1 stalls while a
+ *         bank 1 sector erases.
+ */
+static void update_eraseSectorDone(STM32Flash_StatusTypeDef status, uint32_t address, void *context)
+{
+	update_ImageJob *job = (update_ImageJob *)context;
+
+	if (status != STM32FLASH_OK)
 	{
-		printf("Error: Failed to erase CM7 firmware\n");
-		f_close(&file);
-		return FWUPDATE_ERROR;
+		job->eraseFailed = true;
+		return;
 	}
 
-	// Step 5: Erase CM4 firmware
-	printf("Step 5: Erase CM4 firmware\n");
-	if (update_eraseFirmware(FW_CM4_START_ADDR, cm4_size, &progressManager, STEP_ERASE_CM4) != FWUPDATE_OK)
+	job->sectorsErased++;
+
+	uint32_t sector = update_nextSector(job->eraseMask, job->lastQueued + 1);
+	if (sector < FLASH_SECTOR_TOTAL)
 	{
-		printf("Error: Failed to erase CM4 firmware\n");
-		f_close(&file);
-		return FWUPDATE_ERROR;
+		if (STM32FlashAsync_eraseSector(job->flashBank, sector, update_eraseSectorDone, job) != STM32FLASH_OK)
+		{
+			job->eraseFailed = true;
+			return;
+		}
+		job->lastQueued = sector;
 	}
+}
 
-	// Step 6: Flash new CM7 firmware
-	printf("Step 6: Flash new CM7 firmware\n");
-	res = f_lseek(&file, HEADER_SIZE);
-	if (res != FR_OK)
+/**
+ * @brief  Update task: verifies the package CRC.
+ *         A v2 package has no whole-file CRC, each section is checked
+ *         against the CRC of its manifest entry instead. Sections carrying
+ *         block digests are skipped: they are checked as they are read,
+ *         and a firmware image is read whole by its compare step, before
+ *         its sectors are erased.
+ */
+static fwupdate_StatusTypeDef update_taskCalculateCRC(void *context, ProgressManager *progressManager, uint32_t step_number)
+{
+	update_PackageJob *job = (update_PackageJob *)context;
+	const Package_Manifest *manifest = job->manifest;
+	uint32_t totalBytes = 0;
+	uint32_t bytesDone = 0;
+
+	if (manifest->format == 1)
 	{
-		printf("Error: Failed to reposition after the header\n");
-		gui_displayUpdateFailed();
-		f_close(&file);
-		return FWUPDATE_ERROR;
+		return update_calculateCRC(job->file, progressManager, step_number);
 	}
 
-	if (update_writeFirmware(FW_CM7_START_ADDR, &file, cm7_size, &progressManager, STEP_FLASH_CM7) != FWUPDATE_OK)
+	for (uint32_t i = 0; i < manifest->numSections; i++)
 	{
-		printf("Error: Failed to flash new CM7 firmware\n");
-		f_close(&file);
-		return FWUPDATE_ERROR;
+		if (manifest->sections[i].blockTable == 0)
+		{
+			totalBytes += manifest->sections[i].length;
+		}
 	}
 
-	// Step 7: Flash new CM4 firmware
-	printf("Step 7: Flash new CM4 firmware\n");
-	res = f_lseek(&file, HEADER_SIZE + cm7_size);
-	if (res != FR_OK)
+	for (uint32_t i = 0; i < manifest->numSections; i++)
 	{
-		printf("Error: Failed to reposition to CM4 firmware data\n");
-		gui_displayUpdateFailed();
-		f_close(&file);
-		return FWUPDATE_ERROR;
+		if (manifest->sections[i].blockTable != 0)
+		{
+			continue;
+		}
+
+		if (package_verifySection(job->file, &manifest->sections[i], progressManager, step_number, &bytesDone, totalBytes) != PACKAGE_OK)
+		{
+			gui_displayUpdateFailed();
+			return FWUPDATE_ERROR;
+		}
 	}
 
-	if (update_writeFirmware(FW_CM4_START_ADDR, &file, cm4_size, &progressManager, STEP_FLASH_CM4) != FWUPDATE_OK)
+	printf("CRC verified successfully\n");
+
+	return FWUPDATE_OK;
+}
+
+/**
+ * @brief  Update task: backs up the firmware currently in flash.
+ */
+static fwupdate_StatusTypeDef update_taskBackup(void *context, ProgressManager *progressManager, uint32_t step_number)
+{
+	update_ImageJob *job = (update_ImageJob *)context;
+
+	// The base of a delta is read at random offsets, it cannot be compressed
+	if (backup_create(job->flashStartAddr, job->maxSize, job->backupPath, !job->section.delta, progressManager, step_number) != BACKUP_OK)
 	{
-		printf("Error: Failed to flash new CM4 firmware\n");
-		f_close(&file);
+		printf("Error: Failed to backup current %s firmware\n", job->name);
 		return FWUPDATE_ERROR;
 	}
 
-	// Step 8: Save external data
-	printf("Step 8: Save external data\n");
-	res = f_lseek(&file, HEADER_SIZE + cm7_size + cm4_size);
-	if (res != FR_OK)
+	// The backup is the base of a delta, check it while the flash is intact
+	if (job->section.delta && (update_checkDeltaBase(job->backupPath, &job->section.deltaHeader) != FWUPDATE_OK))
 	{
-		printf("Error: Failed to reposition to external data\n");
+		printf("Error: Installed %s firmware does not match the delta base\n", job->name);
 		gui_displayUpdateFailed();
-		f_close(&file);
 		return FWUPDATE_ERROR;
 	}
 
-	if (update_writeExternalData(&file, external_size, &progressManager, STEP_SAVE_EXTERNAL) != FWUPDATE_OK)
-	{
-		printf("Error: Failed to save external data\n");
-		f_close(&file);
-		return FWUPDATE_ERROR;
-	}
+	return FWUPDATE_OK;
+}
+
+/**
+ * @brief  Update task: finds the sectors that the new image changes.
+ *         The image is decoded from the package and compared with the
+ *         memory-mapped flash. A sector is unchanged when all its bytes match
+ *         and, for the last one, the bytes past the end of the image are
+ *         erased, as they would be after an erase and program.
+ */
+static fwupdate_StatusTypeDef update_taskCompare(void *context, ProgressManager *progressManager, uint32_t step_number)
+{
+	update_ImageJob *job = (update_ImageJob *)context;
+	uint8_t readBuffer[STREAMWRITER_BUFFER_SIZE] __attribute__((aligned(32)));
+	update_SectionReader reader;
+	StreamWriter_Source source;
+	uint32_t firstSector = stm32Flash_getSector(job->flashStartAddr);
+	uint32_t imageSectors = (job->section.size + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
+	uint32_t offset = 0;
+
+	job->compared = false;
+	job->changedSectors = 0;
+
+	if (update_openSection(job->package, &job->section, job->backupPath, &source, &reader) != FWUPDATE_OK)
+	{
+		printf("Error: Failed to reposition to %s firmware data\n", job->name);
+		gui_displayUpdateFailed();
+		return FWUPDATE_ERROR;
+	}
+
+	while (offset < job->section.size)
+	{
+		uint32_t chunkSize = MIN(job->section.size - offset, sizeof(readBuffer));
+		uint32_t bytesRead = 0;
+		uint32_t bit = 1UL << (firstSector + (offset / FLASH_SECTOR_SIZE));
+
+		if ((source.read(source.context, readBuffer, chunkSize, &bytesRead) != STREAMWRITER_OK) || (bytesRead != chunkSize))
+		{
+			printf("Error: Failed to read %s firmware data\n", job->name);
+			update_closeSection(&reader);
+			gui_displayUpdateFailed();
+			return FWUPDATE_ERROR;
+		}
+
+		if (!(job->changedSectors & bit) && (memcmp((const void *)(job->flashStartAddr + offset), readBuffer, chunkSize) != 0))
+		{
+			job->changedSectors |= bit;
+		}
+
+		offset += chunkSize;
+		progress_update(progressManager, step_number, offset, job->section.size);
+	}
+
+	update_closeSection(&reader);
+
+	// The tail of the last sector must be blank
+	if ((job->section.size % FLASH_SECTOR_SIZE) != 0)
+	{
+		const uint8_t *tail = (const uint8_t *)(job->flashStartAddr + job->section.size);
+		const uint8_t *sectorEnd = (const uint8_t *)(job->flashStartAddr + imageSectors * FLASH_SECTOR_SIZE);
+
+		while (tail < sectorEnd && *tail == 0xFF)
+		{
+			tail++;
+		}
+		if (tail != sectorEnd)
+		{
+			job->changedSectors |= 1UL << (firstSector + imageSectors - 1);
+		}
+	}
+
+	job->compared = true;
+	updateJournal_compareDone(&updateJournal, job->image, job->changedSectors);
+
+	uint32_t numChanged = 0;
+	for (uint32_t i = 0; i < imageSectors; i++)
+	{
+		if (job->changedSectors & (1UL << (firstSector + i)))
+		{
+			numChanged++;
+		}
+	}
+	printf("%s firmware: %lu of %lu sector(s) changed\n", job->name, numChanged, imageSectors);
+
+	return FWUPDATE_OK;
+}
+
+/**
+ * @brief  Update task: starts erasing the sectors of an image under interrupt.
+ */
+static fwupdate_StatusTypeDef update_taskStartErase(void *context, ProgressManager *progressManager, uint32_t step_number)
+{
+	update_ImageJob *job = (update_ImageJob *)context;
+
+	uint32_t imageSectors = (job->section.size + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
+
+	job->flashBank = STM32FlashAsync_getBank(job->flashStartAddr);
+	job->firstSector = stm32Flash_getSector(job->flashStartAddr);
+	job->eraseMask = 0;
+	job->numSectors = 0;
+	job->sectorsErased = 0;
+	job->eraseFailed = false;
+	job->progressManager = progressManager;
+	job->step_number = step_number;
+
+	// Only the sectors that differ from the new image, when they are known
+	for (uint32_t i = 0; i < imageSectors && (job->firstSector + i) < FLASH_SECTOR_TOTAL; i++)
+	{
+		uint32_t bit = 1UL << (job->firstSector + i);
+		if (!job->compared || ((job->changedSectors & ~job->programmedSectors) & bit))
+		{
+			job->eraseMask |= bit;
+		}
+	}
+
+	// After a reset during programming, the sectors past the one being
+	// programmed are still blank: sectors are programmed in order
+	if (job->resumeErase)
+	{
+		job->eraseMask &= -job->eraseMask;
+	}
+
+	for (uint32_t mask = job->eraseMask; mask != 0; mask &= mask - 1)
+	{
+		job->numSectors++;
+	}
+
+	printf("Erasing %lu flash sector(s) starting from sector %lu...\n", job->numSectors, job->firstSector);
+
+	if (job->numSectors == 0)
+	{
+		return FWUPDATE_OK;
+	}
+
+	// The next sectors are queued from the completion callback
+	job->lastQueued = update_nextSector(job->eraseMask, job->firstSector);
+	if (STM32FlashAsync_eraseSector(job->flashBank, job->lastQueued, update_eraseSectorDone, job) != STM32FLASH_OK)
+	{
+		printf("Failed to erase sector %lu\n", job->lastQueued);
+		gui_displayUpdateFailed();
+		return FWUPDATE_ERROR;
+	}
+
+	return FWUPDATE_OK;
+}
+
+/**
+ * @brief  Update task: reports the progress of a background erase.
+ * @return true once every queued sector has been erased or an error occurred.
+ */
+static bool update_taskPollErase(void *context, fwupdate_StatusTypeDef *status)
+{
+	update_ImageJob *job = (update_ImageJob *)context;
+
+	if (job->numSectors != 0)
+	{
+		progress_update(job->progressManager, job->step_number, job->sectorsErased, job->numSectors);
+	}
+
+	if (STM32FlashAsync_isBusy(job->flashBank) ||
+		(!job->eraseFailed && (job->sectorsErased < job->numSectors)))
+	{
+		return false;
+	}
+
+	if ((STM32FlashAsync_wait(job->flashBank) != STM32FLASH_OK) || job->eraseFailed)
+	{
+		printf("Failed to erase sector %lu\n", job->lastQueued);
+		gui_displayUpdateFailed();
+		*status = FWUPDATE_ERROR;
+	}
+	else
+	{
+		*status = FWUPDATE_OK;
+	}
+
+	return true;
+}
+
+/**
+ * @brief  Update task: flashes an image from the package.
+ */
+static fwupdate_StatusTypeDef update_taskFlash(void *context, ProgressManager *progressManager, uint32_t step_number)
+{
+	update_ImageJob *job = (update_ImageJob *)context;
+	update_SectionReader reader;
+	StreamWriter_Source source;
+
+	if (job->compared && ((job->changedSectors & ~job->programmedSectors) == 0))
+	{
+		printf("%s firmware unchanged, nothing to flash\n", job->name);
+		return FWUPDATE_OK;
+	}
+
+	if (update_openSection(job->package, &job->section, job->backupPath, &source, &reader) != FWUPDATE_OK)
+	{
+		printf("Error: Failed to reposition to %s firmware data\n", job->name);
+		gui_displayUpdateFailed();
+		return FWUPDATE_ERROR;
+	}
+
+	// Sectors left unchanged by the package or programmed before a reset
+	uint32_t skipSectors = job->compared ? (~job->changedSectors | job->programmedSectors) : 0;
+
+	fwupdate_StatusTypeDef status = update_writeFirmware(job->flashStartAddr, &source, job->section.size, skipSectors, job, progressManager, step_number);
+	update_closeSection(&reader);
+
+	if (status != FWUPDATE_OK)
+	{
+		printf("Error: Failed to flash new %s firmware\n", job->name);
+		return FWUPDATE_ERROR;
+	}
+
+	return FWUPDATE_OK;
+}
+
+/**
+ * @brief  Update task: saves the external data section of the package.
+ */
+static fwupdate_StatusTypeDef update_taskExternalData(void *context, ProgressManager *progressManager, uint32_t step_number)
+{
+	update_ExternalJob *job = (update_ExternalJob *)context;
+	update_SectionReader reader;
+	StreamWriter_Source source;
+
+	if (update_openSection(job->package, &job->section, NULL, &source, &reader) != FWUPDATE_OK)
+	{
+		printf("Error: Failed to reposition to external data\n");
+		gui_displayUpdateFailed();
+		return FWUPDATE_ERROR;
+	}
+
+	if (update_writeExternalData(&source, job->section.size, progressManager, step_number) != FWUPDATE_OK)
+	{
+		printf("Error: Failed to save external data\n");
+		return FWUPDATE_ERROR;
+	}
+
+	return FWUPDATE_OK;
+}
+
+/**
+ * @brief  Search for a firmware package file in the filesystem.
+ * @param  packageFilePath Buffer to store the found package file path.
+ * @param  maxLen Maximum length of the buffer.
+ * @return FWUPDATE_OK if the update process is successful, FWUPDATE_ERROR otherwise.
+ */
+fwupdate_StatusTypeDef update_findPackageFile(char *packageFilePath, size_t maxLen)
+{
+	FRESULT res;
+	FILINFO fno;
+	DIR dir;
+	char *fn;
+
+	res = f_opendir(&dir, FW_PATH); // Open the directory
+	if (res == FR_OK)
+	{
+		for (;;)
+		{
+			res = f_readdir(&dir, &fno); // Read a directory item
+			if ((res != FR_OK) || (fno.fname[0] == 0))
+			{
+				break; // End of directory or error
+			}
+
+			// Ensure it is a file and not a directory
+			if (fno.fattrib & AM_DIR)
+			{
+				continue;
+			}
+
+			fn = fno.fname;
+
+			// Check if the filename starts with "cis_package_" and contains ".bin"
+			if ((strstr(fn, "cis_package_") == fn) && strstr(fn, ".bin"))
+			{
+				size_t fwPathLen = strlen(FW_PATH);
+				size_t fnLen = strlen(fn);
+				size_t totalLen = fwPathLen + 1 + fnLen + 1; // '/' + null terminator
+
+				// Ensure packageFilePath buffer is large enough
+				if (totalLen > maxLen)
+				{
+					f_closedir(&dir);
+					return FWUPDATE_ERROR; // Avoid truncation
+				}
+
+				// Use strncpy and strncat instead of snprintf to avoid -Wformat-truncation warning
+				strncpy(packageFilePath, FW_PATH, maxLen - 1);
+				packageFilePath[maxLen - 1] = '\0'; // Ensure null termination
+
+				strncat(packageFilePath, "/", maxLen - strlen(packageFilePath) - 1);
+				strncat(packageFilePath, fn, maxLen - strlen(packageFilePath) - 1);
+
+				f_closedir(&dir);
+				return FWUPDATE_OK;
+			}
+		}
+		f_closedir(&dir);
+	}
+	return FWUPDATE_ERROR;
+}
+
+/**
+ * @brief  Opens the backup of an image for a restore.
+ *         The file stays open for the whole restore; a fast-seek link map
+ *         makes going back to the start of a sector cheap.
+ */
+static fwupdate_StatusTypeDef update_restoreOpen(update_RestoreJob *job)
+{
+	if (backup_open(&job->file, job->backupPath, &job->header) != BACKUP_OK)
+	{
+		return FWUPDATE_ERROR;
+	}
+
+	// Plain seeks are still correct if the file is too fragmented for the map
+	job->linkMap[0] = RESTORE_LINKMAP_SIZE;
+	job->file.cltbl = job->linkMap;
+	if (f_lseek(&job->file, CREATE_LINKMAP) != FR_OK)
+	{
+		job->file.cltbl = NULL;
+	}
+
+	if (backup_source(&job->source, &job->reader, &job->file, &job->header) != BACKUP_OK)
+	{
+		f_close(&job->file);
+		return FWUPDATE_ERROR;
+	}
+
+	job->flashBank = STM32FlashAsync_getBank(job->flashStartAddr);
+	job->firstSector = stm32Flash_getSector(job->flashStartAddr);
+	job->flashLength = backup_imageLength(job->flashStartAddr, job->maxSize);
+	job->numSectors = (MAX(job->header.imageLength, job->flashLength) + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
+	job->sector = 0;
+	job->sectorsChanged = 0;
+	job->done = (job->numSectors == 0);
+	job->erasing = false;
+
+	return FWUPDATE_OK;
+}
+
+/**
+ * @brief  Restore erase callback, called from the FLASH interrupt.
+ */
+static void update_restoreEraseDone(STM32Flash_StatusTypeDef status, uint32_t address, void *context)
+{
+	update_RestoreJob *job = (update_RestoreJob *)context;
+
+	job->eraseFailed = (status != STM32FLASH_OK);
+	job->eraseDone = true;
+}
+
+/**
+ * @brief  Advances the restore of an image by one sector.
+ *         The sector is compared with the backup; if it differs, its erase
+ *         is started in the background and the call returns, so the other
+ *         bank can be compared or programmed meanwhile. Once erased, the
+ *         sector is programmed from the backup, read again from the start
+ *         of the sector. A sector past the backed-up image only needs to
+ *         be blank.
+ * @return FWUPDATE_OK, also while the erase is in progress, FWUPDATE_ERROR on failure.
+ */
+static fwupdate_StatusTypeDef update_restoreStep(update_RestoreJob *job, ProgressManager *progressManager, uint32_t step_number)
+{
+	uint8_t readBuffer[STREAMWRITER_BUFFER_SIZE] __attribute__((aligned(32)));
+	uint32_t sectorStart = job->sector * FLASH_SECTOR_SIZE;
+	uint32_t sectorEnd = sectorStart + FLASH_SECTOR_SIZE;
+	uint32_t imageEnd = MIN(sectorEnd, job->header.imageLength);
+	uint32_t offset = sectorStart;
+
+	if (job->erasing)
+	{
+		if (!job->eraseDone)
+		{
+			return FWUPDATE_OK;
+		}
+
+		job->erasing = false;
+		if (job->eraseFailed || (STM32FlashAsync_wait(job->flashBank) != STM32FLASH_OK))
+		{
+			printf("Failed to erase sector %lu\n", job->firstSector + job->sector);
+			return FWUPDATE_ERROR;
+		}
+
+		if ((offset < imageEnd) &&
+			((backup_rewind(&job->reader, &job->file, &job->mark) != BACKUP_OK) ||
+			 (update_writeFirmware(job->flashStartAddr + offset, &job->source, imageEnd - offset, 0, NULL, NULL, 0) != FWUPDATE_OK)))
+		{
+			return FWUPDATE_ERROR;
+		}
+	}
+	else
+	{
+		bool changed = false;
+
+		// Compressed backups are marked between two blocks, the sector size
+		// is a multiple of the block size
+		backup_mark(&job->reader, &job->file, &job->mark);
+
+		while (offset < imageEnd)
+		{
+			uint32_t chunkSize = MIN(imageEnd - offset, sizeof(readBuffer));
+			uint32_t bytesRead = 0;
+
+			if ((job->source.read(job->source.context, readBuffer, chunkSize, &bytesRead) != STREAMWRITER_OK) || (bytesRead != chunkSize))
+			{
+				printf("Error: Failed to read %s\n", job->backupPath);
+				return FWUPDATE_ERROR;
+			}
+
+			changed = changed || (memcmp((const void *)(job->flashStartAddr + offset), readBuffer, chunkSize) != 0);
+			offset += chunkSize;
+		}
+
+		// Past the backed-up image, the flash must be blank
+		const uint8_t *tail = (const uint8_t *)(job->flashStartAddr + offset);
+		const uint8_t *end = (const uint8_t *)(job->flashStartAddr + MAX(offset, MIN(sectorEnd, job->flashLength)));
+		while (!changed && (tail < end))
+		{
+			changed = (*tail++ != 0xFF);
+		}
+
+		if (changed)
+		{
+			job->eraseDone = false;
+			job->eraseFailed = false;
+			if (STM32FlashAsync_eraseSector(job->flashBank, job->firstSector + job->sector, update_restoreEraseDone, job) != STM32FLASH_OK)
+			{
+				printf("Failed to erase sector %lu\n", job->firstSector + job->sector);
+				return FWUPDATE_ERROR;
+			}
+			job->erasing = true;
+			job->sectorsChanged++;
+			return FWUPDATE_OK;
+		}
+	}
+
+	job->sector++;
+	job->done = (job->sector == job->numSectors);
+	progress_update(progressManager, step_number, job->sector, job->numSectors);
+
+	if (job->done)
+	{
+		printf("%s firmware: %lu of %lu sector(s) restored\n", job->name, job->sectorsChanged, job->numSectors);
+	}
+
+	return FWUPDATE_OK;
+}
+
+/**
+ * @brief  Restores previously backed-up firmware versions.
+ *         Each backup is read in a single pass, one sector at a time: a
+ *         sector that differs from the backup is erased, then programmed
+ *         again, the others are left alone. The two images live in
+ *         different flash banks and are restored in turn, so a CM4 sector
+ *         erases in the background while the CM7 image is compared or
+ *         programmed; a CM7 sector erase stalls the bootloader, which runs
+ *         from bank 1.
+ *
+ * @param  report  Filled with the outcome, for the boot information.
+ * @return FWUPDATE_OK if the update process is successful, FWUPDATE_ERROR otherwise.
+ */
+fwupdate_StatusTypeDef update_restoreBackupFirmwares(BootInfo_Update *report)
+{
+	const int NUM_STEPS = 2;
+	const int STEP_RESTORE_CM7 = 1;
+	const int STEP_RESTORE_CM4 = 2;
+
+	static update_RestoreJob cm7Job, cm4Job;
+	fwupdate_StatusTypeDef status = FWUPDATE_OK;
+
+	uint32_t startTick = HAL_GetTick();
+	memset(report, 0, sizeof(BootInfo_Update));
+	report->result = BOOT_INFO_UPDATE_FAILED;
+
+	ProgressManager progressManager;
+	progress_init(&progressManager, NUM_STEPS);
+	gui_displayRestorePreviousVersion();
+
+	cm7Job.name = "CM7";
+	cm7Job.flashStartAddr = FW_CM7_START_ADDR;
+	cm7Job.maxSize = FW_CM7_MAX_SIZE;
+	snprintf(cm7Job.backupPath, sizeof(cm7Job.backupPath), "%s/%s", FW_PATH, "backup_cm7.bin");
+
+	cm4Job.name = "CM4";
+	cm4Job.flashStartAddr = FW_CM4_START_ADDR;
+	cm4Job.maxSize = FW_CM4_MAX_SIZE;
+	snprintf(cm4Job.backupPath, sizeof(cm4Job.backupPath), "%s/%s", FW_PATH, "backup_cm4.bin");
+
+	// Both backups must be readable before anything is erased
+	if (update_restoreOpen(&cm7Job) != FWUPDATE_OK)
+	{
+		printf("Skipping restore.\n");
+		return FWUPDATE_ERROR;
+	}
+	if (update_restoreOpen(&cm4Job) != FWUPDATE_OK)
+	{
+		printf("Skipping restore.\n");
+		f_close(&cm7Job.file);
+		return FWUPDATE_ERROR;
+	}
+
+	printf("Restoring %s and %s\n", cm7Job.backupPath, cm4Job.backupPath);
+	PROFILE_BEGIN("Restore backups");
+
+	while ((status == FWUPDATE_OK) && !(cm7Job.done && cm4Job.done))
+	{
+		if (!cm7Job.done)
+		{
+			status = update_restoreStep(&cm7Job, &progressManager, STEP_RESTORE_CM7);
+		}
+		if ((status == FWUPDATE_OK) && !cm4Job.done)
+		{
+			status = update_restoreStep(&cm4Job, &progressManager, STEP_RESTORE_CM4);
+		}
+	}
+
+	// Let a failed restore leave no erase in flight
+	STM32FlashAsync_wait(cm7Job.flashBank);
+	STM32FlashAsync_wait(cm4Job.flashBank);
+	PROFILE_END("Restore backups");
+
+	f_close(&cm7Job.file);
+	f_close(&cm4Job.file);
+
+	if (status != FWUPDATE_OK)
+	{
+		printf("Error: Failed to restore the firmware backups.\n");
+		gui_displayUpdateFailed();
+		return FWUPDATE_ERROR;
+	}
+
+	printf("Successfully restored the firmware backups.\n");
+
+	report->result = BOOT_INFO_UPDATE_RESTORED;
+	report->updateTime = HAL_GetTick() - startTick;
+	update_reportImage(report, FW_CM7_START_ADDR, FW_CM7_MAX_SIZE);
+
+	return FWUPDATE_OK;
+}
+
+/**
+ * @brief  Records the length and CRC-32 of the installed CM7 image in an
+ *         update report, so that the firmware does not compute them again.
+ */
+static void update_reportImage(BootInfo_Update *report, uint32_t flashStartAddr, uint32_t maxSize)
+{
+	report->imageAddress = flashStartAddr;
+	report->imageLength = backup_imageLength(flashStartAddr, maxSize);
+	report->imageCRC = STM32Crc_compute((const uint8_t *)flashStartAddr, report->imageLength);
+}
+
+/**
+ * @brief  Scheduler callback: journals a completed update step.
+ */
+static void update_taskDone(const UpdateTask *task, void *context)
+{
+	updateJournal_stepDone((UpdateJournal *)context, task->step_number);
+}
+
+/**
+ * @brief Processes a firmware update package file.
+ * This function handles the full update process including CRC verification,
+ * backup, erasing, flashing, and external data handling. The steps are run
+ * by the update scheduler: the two firmware images live in different flash
+ * banks, so bank 2 is erased in the background while the CPU backs up,
+ * compares or flashes the CM7 image. Bank 1 also holds the bootloader, whose
+ * instruction fetches stall while a bank 1 sector erases: the CM7 erase is
+ * run by the same interrupt-driven code, but leaves the CPU little to do
+ * meanwhile. The external data is written once both images are installed.
+ * @param packageFilePath Path to the firmware package file.
+ * @param report Filled with the outcome, for the boot information.
+ * @return FWUPDATE_OK if the update process is successful, FWUPDATE_ERROR otherwise.
+ */
+fwupdate_StatusTypeDef update_processPackageFile(const TCHAR* packageFilePath, BootInfo_Update *report)
+{
+	const int NUM_STEPS = 10;
+	const int STEP_CRC_CALCULATION = 1;
+	const int STEP_BACKUP_CM7 = 2;
+	const int STEP_BACKUP_CM4 = 3;
+	const int STEP_COMPARE_CM7 = 4;
+	const int STEP_COMPARE_CM4 = 5;
+	const int STEP_ERASE_CM7 = 6;
+	const int STEP_ERASE_CM4 = 7;
+	const int STEP_FLASH_CM7 = 8;
+	const int STEP_FLASH_CM4 = 9;
+	const int STEP_SAVE_EXTERNAL = 10;
+
+	// Indexes in the task table, used for the dependencies
+	enum {
+		TASK_CRC = 0,
+		TASK_BACKUP_CM7,
+		TASK_COMPARE_CM7,
+		TASK_BACKUP_CM4,
+		TASK_COMPARE_CM4,
+		TASK_ERASE_CM7,
+		TASK_ERASE_CM4,
+		TASK_FLASH_CM7,
+		TASK_FLASH_CM4,
+		TASK_SAVE_EXTERNAL,
+		NUM_TASKS
+	};
+
+	FIL file;
+	FRESULT res;
+	Package_Manifest manifest;
+	ProgressManager progressManager;
+	update_PackageJob packageJob;
+	update_ImageJob cm7Job, cm4Job;
+	update_ExternalJob externalJob;
+
+	uint32_t startTick = HAL_GetTick();
+	memset(report, 0, sizeof(BootInfo_Update));
+	report->result = BOOT_INFO_UPDATE_FAILED;
+
+	// Initialize progress manager
+	progress_init(&progressManager, NUM_STEPS);
+
+	// Open the update package file
+	res = f_open(&file, packageFilePath, FA_READ);
+	if (res != FR_OK)
+	{
+		printf("Error: Failed to open the package file: %s\n", packageFilePath);
+		gui_displayUpdateFailed();
+		return FWUPDATE_ERROR;
+	}
+
+	// Read the manifest, v2 or the fixed v1 header
+	if (package_readManifest(&file, &manifest) != PACKAGE_OK)
+	{
+		f_close(&file);
+		gui_displayUpdateFailed();
+		return FWUPDATE_ERROR;
+	}
+
+	// The images are installed into the inactive slot in A/B mode, the
+	// active one is left untouched and is the rollback image
+#ifdef BOOT_AB_SLOTS
+	uint32_t slot = bootSlot_other(bootSlot_active());
+	uint32_t cm7Target = bootSlot_cm7Address(slot);
+	uint32_t cm4Target = bootSlot_cm4Address(slot);
+	uint32_t cm7MaxSize = BOOT_SLOT_CM7_SIZE;
+	uint32_t cm4MaxSize = BOOT_SLOT_CM4_SIZE;
+#else
+	uint32_t cm7Target = FW_CM7_START_ADDR;
+	uint32_t cm4Target = FW_CM4_START_ADDR;
+	uint32_t cm7MaxSize = FW_CM7_MAX_SIZE;
+	uint32_t cm4MaxSize = FW_CM4_MAX_SIZE;
+#endif
+
+	const Package_Section *cm7Entry = update_findImage(&manifest, PACKAGE_SECTION_CM7, cm7Target, FW_CM7_START_ADDR);
+	const Package_Section *cm4Entry = update_findImage(&manifest, PACKAGE_SECTION_CM4, cm4Target, FW_CM4_START_ADDR);
+	const Package_Section *externalEntry = package_findSection(&manifest, PACKAGE_SECTION_EXTERNAL);
+
+	// Locate the sections, each one may be stored compressed or left out
+	memset(&cm7Job, 0, sizeof(cm7Job));
+	memset(&cm4Job, 0, sizeof(cm4Job));
+	memset(&externalJob, 0, sizeof(externalJob));
+	if (((cm7Entry != NULL) && (update_parseSection(&file, cm7Entry, cm7Target, &cm7Job.section) != FWUPDATE_OK)) ||
+		((cm4Entry != NULL) && (update_parseSection(&file, cm4Entry, cm4Target, &cm4Job.section) != FWUPDATE_OK)) ||
+		((externalEntry != NULL) && (update_parseSection(&file, externalEntry, 0, &externalJob.section) != FWUPDATE_OK)) ||
+		externalJob.section.delta)
+	{
+		printf("Error: Invalid package sections\n");
+		f_close(&file);
+		gui_displayUpdateFailed();
+		return FWUPDATE_ERROR;
+	}
+
+#ifdef BOOT_AB_SLOTS
+	// A slot is tried as a whole, so it needs both images, and there is no
+	// backup to serve as the base of a delta
+	if ((cm7Entry == NULL) || (cm4Entry == NULL) || cm7Job.section.delta || cm4Job.section.delta ||
+		(cm7Job.section.size > cm7MaxSize) || (cm4Job.section.size > cm4MaxSize))
+	{
+		printf("Error: Package has no full CM7 and CM4 images for slot %c\n", (slot == BOOT_SLOT_A) ? 'A' : 'B');
+		f_close(&file);
+		gui_displayUpdateFailed();
+		return FWUPDATE_ERROR;
+	}
+	printf("Installing into slot %c\n", (slot == BOOT_SLOT_A) ? 'A' : 'B');
+#endif
+
+	printf("Package version: %s (format %lu)\n", manifest.version, manifest.format);
+	if (cm7Entry != NULL)
+	{
+		printf("CM7 firmware size: %lu bytes%s%s\n", cm7Job.section.size, cm7Job.section.compressed ? " (compressed)" : "",
+			   cm7Job.section.delta ? " (delta)" : "");
+	}
+	if (cm4Entry != NULL)
+	{
+		printf("CM4 firmware size: %lu bytes%s%s\n", cm4Job.section.size, cm4Job.section.compressed ? " (compressed)" : "",
+			   cm4Job.section.delta ? " (delta)" : "");
+	}
+	if (externalEntry != NULL)
+	{
+		printf("External data size: %lu bytes%s\n", externalJob.section.size, externalJob.section.compressed ? " (compressed)" : "");
+	}
+
+	// Display version
+	gui_displayVersion(manifest.version);
+
+	// Describe each image once, it is shared by its backup, erase and flash tasks
+	cm7Job.name = "CM7";
+	cm7Job.package = &file;
+	cm7Job.flashStartAddr = cm7Target;
+	cm7Job.maxSize = cm7MaxSize;
+	snprintf(cm7Job.backupPath, sizeof(cm7Job.backupPath), "%s/%s", FW_PATH, "backup_cm7.bin");
+
+	cm4Job.name = "CM4";
+	cm4Job.package = &file;
+	cm4Job.flashStartAddr = cm4Target;
+	cm4Job.maxSize = cm4MaxSize;
+	snprintf(cm4Job.backupPath, sizeof(cm4Job.backupPath), "%s/%s", FW_PATH, "backup_cm4.bin");
+
+	externalJob.package = &file;
+
+	packageJob.file = &file;
+	packageJob.manifest = &manifest;
+
+	// Pick up an update interrupted by a power loss
+	updateJournal_open(&updateJournal, (uint32_t)f_size(&file), manifest.identity);
+
+	cm7Job.image = UPDATE_JOURNAL_IMAGE_CM7;
+	cm7Job.compared = updateJournal.compared[UPDATE_JOURNAL_IMAGE_CM7];
+	cm7Job.changedSectors = updateJournal.changedSectors[UPDATE_JOURNAL_IMAGE_CM7];
+	cm7Job.programmedSectors = updateJournal.programmedSectors[UPDATE_JOURNAL_IMAGE_CM7];
+
+	cm4Job.image = UPDATE_JOURNAL_IMAGE_CM4;
+	cm4Job.compared = updateJournal.compared[UPDATE_JOURNAL_IMAGE_CM4];
+	cm4Job.changedSectors = updateJournal.changedSectors[UPDATE_JOURNAL_IMAGE_CM4];
+	cm4Job.programmedSectors = updateJournal.programmedSectors[UPDATE_JOURNAL_IMAGE_CM4];
+
+	// Every package read goes through the QSPI volume, so foreground steps are
+	// serialized on it; the erases only hold their flash bank. Only the CM4
+	// erase really overlaps foreground work, the bootloader runs from bank 1.
+	// The external data is written last, once both images are in flash: a
+	// failed flash step rolls the firmware back, which must find the
+	// external data of that firmware.
+	// An erase only waits for the compare of its own image, which it needs to
+	// know the changed sectors. The compare checks the block digests of that
+	// image on the way, there is no separate verification pass: a corrupt
+	// block of the other image aborts the update later, and the rollback
+	// restores the sectors already changed.
+	UpdateTask tasks[NUM_TASKS] =
+	{
+		[TASK_CRC] = {
+			.name = "Calculate and verify CRC", .step_number = STEP_CRC_CALCULATION,
+			.resources = UPDATE_RES_QSPI | UPDATE_RES_CRC,
+			.dependencies = 0,
+			.run = update_taskCalculateCRC, .context = &packageJob },
+		[TASK_BACKUP_CM7] = {
+			.name = "Backup current CM7 firmware", .step_number = STEP_BACKUP_CM7,
+			.resources = UPDATE_RES_QSPI | UPDATE_RES_CRC | UPDATE_RES_BANK1,
+			.dependencies = UPDATE_DEP(TASK_CRC),
+			.run = update_taskBackup, .context = &cm7Job },
+		[TASK_COMPARE_CM7] = {
+			.name = "Compare CM7 firmware", .step_number = STEP_COMPARE_CM7,
+			.resources = UPDATE_RES_QSPI | UPDATE_RES_BANK1,
+			.dependencies = UPDATE_DEP(TASK_BACKUP_CM7),
+			.run = update_taskCompare, .context = &cm7Job },
+		[TASK_BACKUP_CM4] = {
+			.name = "Backup current CM4 firmware", .step_number = STEP_BACKUP_CM4,
+			.resources = UPDATE_RES_QSPI | UPDATE_RES_CRC | UPDATE_RES_BANK2,
+			.dependencies = UPDATE_DEP(TASK_CRC),
+			.run = update_taskBackup, .context = &cm4Job },
+		[TASK_COMPARE_CM4] = {
+			.name = "Compare CM4 firmware", .step_number = STEP_COMPARE_CM4,
+			.resources = UPDATE_RES_QSPI | UPDATE_RES_BANK2,
+			.dependencies = UPDATE_DEP(TASK_BACKUP_CM4),
+			.run = update_taskCompare, .context = &cm4Job },
+		[TASK_ERASE_CM7] = {
+			.name = "Erase CM7 firmware", .step_number = STEP_ERASE_CM7,
+			.resources = UPDATE_RES_BANK1,
+			.dependencies = UPDATE_DEP(TASK_COMPARE_CM7),
+			.start = update_taskStartErase, .poll = update_taskPollErase, .context = &cm7Job },
+		[TASK_ERASE_CM4] = {
+			.name = "Erase CM4 firmware", .step_number = STEP_ERASE_CM4,
+			.resources = UPDATE_RES_BANK2,
+			.dependencies = UPDATE_DEP(TASK_COMPARE_CM4),
+			.start = update_taskStartErase, .poll = update_taskPollErase, .context = &cm4Job },
+		[TASK_FLASH_CM7] = {
+			.name = "Flash new CM7 firmware", .step_number = STEP_FLASH_CM7,
+			.resources = UPDATE_RES_QSPI | UPDATE_RES_BANK1,
+			.dependencies = UPDATE_DEP(TASK_ERASE_CM7),
+			.run = update_taskFlash, .context = &cm7Job },
+		[TASK_FLASH_CM4] = {
+			.name = "Flash new CM4 firmware", .step_number = STEP_FLASH_CM4,
+			.resources = UPDATE_RES_QSPI | UPDATE_RES_BANK2,
+			.dependencies = UPDATE_DEP(TASK_ERASE_CM4),
+			.run = update_taskFlash, .context = &cm4Job },
+		[TASK_SAVE_EXTERNAL] = {
+			.name = "Save external data", .step_number = STEP_SAVE_EXTERNAL,
+			.resources = UPDATE_RES_QSPI | UPDATE_RES_CRC,
+			.dependencies = UPDATE_DEP(TASK_FLASH_CM7) | UPDATE_DEP(TASK_FLASH_CM4),
+			.run = update_taskExternalData, .context = &externalJob },
+	};
+
+	for (uint32_t i = 0; i < NUM_TASKS; i++)
+	{
+		if (updateJournal_isStepDone(&updateJournal, tasks[i].step_number))
+		{
+			tasks[i].state = UPDATE_TASK_DONE;
+		}
+	}
+
+	// A sector may have been half programmed when the power dropped
+	if ((tasks[TASK_ERASE_CM7].state == UPDATE_TASK_DONE) && (tasks[TASK_FLASH_CM7].state != UPDATE_TASK_DONE))
+	{
+		tasks[TASK_ERASE_CM7].state = UPDATE_TASK_PENDING;
+		cm7Job.resumeErase = true;
+	}
+	if ((tasks[TASK_ERASE_CM4].state == UPDATE_TASK_DONE) && (tasks[TASK_FLASH_CM4].state != UPDATE_TASK_DONE))
+	{
+		tasks[TASK_ERASE_CM4].state = UPDATE_TASK_PENDING;
+		cm4Job.resumeErase = true;
+	}
+
+	// Sections left out of the package are not installed
+	if (cm7Entry == NULL)
+	{
+		tasks[TASK_BACKUP_CM7].state = UPDATE_TASK_DONE;
+		tasks[TASK_COMPARE_CM7].state = UPDATE_TASK_DONE;
+		tasks[TASK_ERASE_CM7].state = UPDATE_TASK_DONE;
+		tasks[TASK_FLASH_CM7].state = UPDATE_TASK_DONE;
+	}
+	if (cm4Entry == NULL)
+	{
+		tasks[TASK_BACKUP_CM4].state = UPDATE_TASK_DONE;
+		tasks[TASK_COMPARE_CM4].state = UPDATE_TASK_DONE;
+		tasks[TASK_ERASE_CM4].state = UPDATE_TASK_DONE;
+		tasks[TASK_FLASH_CM4].state = UPDATE_TASK_DONE;
+	}
+	if (externalEntry == NULL)
+	{
+		tasks[TASK_SAVE_EXTERNAL].state = UPDATE_TASK_DONE;
+	}
+
+#ifdef BOOT_AB_SLOTS
+	// The active slot is not touched, nothing to back up
+	tasks[TASK_BACKUP_CM7].state = UPDATE_TASK_DONE;
+	tasks[TASK_BACKUP_CM4].state = UPDATE_TASK_DONE;
+#endif
+
+	fwupdate_StatusTypeDef status = updateScheduler_run(tasks, NUM_TASKS, &progressManager, update_taskDone, &updateJournal);
+
+	// The persistent update state is rewritten next, in the journal sector.
+	// A record that could not be programmed fails the update, the records
+	// after it were dropped.
+	if (!updateJournal_close(&updateJournal))
+	{
+		status = FWUPDATE_ERROR;
+	}
+
+	for (uint32_t i = 0; i < NUM_TASKS; i++)
+	{
+		if ((tasks[i].step_number >= 1) && (tasks[i].step_number <= BOOT_INFO_MAX_STEPS))
+		{
+			report->stepTime[tasks[i].step_number - 1] = tasks[i].elapsed;
+		}
+	}
+	report->updateTime = HAL_GetTick() - startTick;
+	update_reportImage(report, cm7Target, cm7MaxSize);
+
+	if (status != FWUPDATE_OK)
+	{
+		f_close(&file);
+		return FWUPDATE_ERROR;
+	}
 
 	// Close the package file
 	f_close(&file);
 
+	report->result = BOOT_INFO_UPDATE_INSTALLED;
+
 	// Display success message
 	gui_displayUpdateSuccess();
 
@@ -0,0 +1,388 @@
+/**
+ ******************************************************************************
+ * @file           : update_journal.c
+ * @brief          : Power-loss journal of an update in progress.
+ *                   Each completed step, compare result and programmed flash
+ *                   sector is appended as one flash word record, so that an
+ *                   update interrupted by a brownout resumes where it stopped
+ *                   instead of restarting from the package CRC.
+ *                   Records are programmed through the asynchronous flash
+ *                   driver: they queue behind a bank 1 erase in progress
+ *                   instead of waiting for it. They are handed to the
+ *                   driver one at a time, each once the previous one is
+ *                   programmed, so that a failed record is retried before
+ *                   any later one lands: the log never has an erased hole.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+#include "boot_config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "stm32_flash.h"
+#include "stm32_flash_async.h"
+
+#include "update_journal.h"
+
+/* Private define ------------------------------------------------------------*/
+
+/* Records of the persistent data log, the first flash word is left to the
+ * state word the firmware may write there */
+#define JOURNAL_START_ADDR      (FLASH_PERSISTENT_DATA_ADDRESS + STM32FLASH_WORD_SIZE)
+#define JOURNAL_END_ADDR        (FLASH_PERSISTENT_DATA_ADDRESS + FLASH_SECTOR_SIZE)
+
+#define JOURNAL_MAGIC           0x4C4E4A55U     // "UJNL"
+
+#define JOURNAL_RECORD_STEP     1   // value = step number
+#define JOURNAL_RECORD_COMPARE  2   // value = changed sectors
+#define JOURNAL_RECORD_SECTOR   3   // value = programmed sector
+
+/* Records appended and not programmed yet */
+#define JOURNAL_PENDING_RECORDS 4
+
+/* Attempts at programming one record before the journal gives up */
+#define JOURNAL_WRITE_ATTEMPTS  3
+
+/* Private types -------------------------------------------------------------*/
+typedef struct
+{
+    uint32_t magic;
+    uint32_t packageSize;
+    uint32_t packageCRC;
+    uint8_t type;
+    uint8_t image;
+    uint16_t reserved;
+    uint32_t value;
+    uint32_t session;               // Persistent data session the update runs in
+    uint32_t padding;
+    uint32_t check;                 // Complement of the sum of the other words
+} UpdateJournal_Record;
+
+/* Private variables ---------------------------------------------------------*/
+static UpdateJournal_Record pendingRecords[JOURNAL_PENDING_RECORDS] __attribute__((aligned(32)));
+static volatile uint32_t recordsQueued;
+static volatile uint32_t recordsWritten;
+static volatile uint32_t writeAddress;      // Flash word of the next record to program
+static volatile uint32_t writeAttempts;     // Failed attempts at the record being programmed
+static volatile bool writing;               // A record is handed to the flash driver
+static volatile bool writeFailed;           // A record could not be programmed
+
+/* Private function prototypes -----------------------------------------------*/
+static uint32_t updateJournal_check(const UpdateJournal_Record *record);
+static bool updateJournal_isErased(const UpdateJournal_Record *record);
+static void updateJournal_apply(UpdateJournal *journal, const UpdateJournal_Record *record);
+static void updateJournal_append(UpdateJournal *journal, uint8_t type, uint8_t image, uint32_t value);
+static void updateJournal_writeNext(void);
+static void updateJournal_recordWritten(STM32Flash_StatusTypeDef status, uint32_t address, void *context);
+
+/**
+ * @brief  Loads the journal of a package.
+ *         Records left by an interrupted update of the same package are
+ *         replayed into `journal`; records of any other package, or of an
+ *         update that ended with a state change, are ignored.
+ * @param  journal     Journal to initialize.
+ * @param  packageSize Size of the package file.
+ * @param  packageCRC  CRC stored in the package footer.
+ */
+void updateJournal_open(UpdateJournal *journal, uint32_t packageSize, uint32_t packageCRC)
+{
+    STM32Flash_PersistentState state;
+
+    memset(journal, 0, sizeof(*journal));
+    journal->packageSize = packageSize;
+    journal->packageCRC = packageCRC;
+
+    STM32Flash_readPersistentState(&state);
+    journal->session = state.session;
+
+    recordsQueued = 0;
+    recordsWritten = 0;
+    writeAttempts = 0;
+    writing = false;
+    writeFailed = false;
+
+    // The sector may have been rewritten since the cache was filled
+    SCB_InvalidateDCache_by_Addr((void *)JOURNAL_START_ADDR, JOURNAL_END_ADDR - JOURNAL_START_ADDR);
+
+    uint32_t address = JOURNAL_START_ADDR;
+    while (address < JOURNAL_END_ADDR)
+    {
+        const UpdateJournal_Record *record = (const UpdateJournal_Record *)(uintptr_t)address;
+
+        if (updateJournal_isErased(record))
+        {
+            break;
+        }
+
+        // A record torn by a power loss fails its check and is skipped
+        if ((record->magic == JOURNAL_MAGIC) && (record->check == updateJournal_check(record)) &&
+            (record->packageSize == packageSize) && (record->packageCRC == packageCRC) &&
+            (record->session == journal->session))
+        {
+            updateJournal_apply(journal, record);
+            journal->resumed = true;
+        }
+
+        address += sizeof(UpdateJournal_Record);
+    }
+
+    journal->nextRecord = address;
+    writeAddress = address;
+
+    if (journal->resumed)
+    {
+        printf("Resuming interrupted update (steps 0x%08lx done)\n", (unsigned long)journal->doneSteps);
+    }
+}
+
+/**
+ * @brief  Waits until every record is programmed.
+ *         Must be called before the persistent update state is rewritten.
+ * @return false if a record could not be programmed: the records appended
+ *         after it were dropped, the update must not be reported as done.
+ */
+bool updateJournal_close(UpdateJournal *journal)
+{
+    while (!writeFailed && (recordsWritten != recordsQueued))
+    {
+        uint32_t primask = __get_PRIMASK();
+
+        // Restart the chain if the flash driver had no room for a record
+        __disable_irq();
+        updateJournal_writeNext();
+        __set_PRIMASK(primask);
+
+        STM32FlashAsync_wait(FLASH_BANK_1);
+    }
+
+    if (writeFailed)
+    {
+        printf("Error: Update journal record could not be written at 0x%08lx\n", (unsigned long)writeAddress);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief  Tells whether an update step was completed before the last reset.
+ */
+bool updateJournal_isStepDone(const UpdateJournal *journal, uint32_t step)
+{
+    return (journal->doneSteps & (1UL << step)) != 0;
+}
+
+/**
+ * @brief  Records the completion of an update step.
+ */
+void updateJournal_stepDone(UpdateJournal *journal, uint32_t step)
+{
+    updateJournal_append(journal, JOURNAL_RECORD_STEP, 0, step);
+}
+
+/**
+ * @brief  Records the sectors of an image changed by the package.
+ */
+void updateJournal_compareDone(UpdateJournal *journal, uint32_t image, uint32_t changedSectors)
+{
+    updateJournal_append(journal, JOURNAL_RECORD_COMPARE, (uint8_t)image, changedSectors);
+}
+
+/**
+ * @brief  Records a sector of an image as fully programmed and verified.
+ */
+void updateJournal_sectorDone(UpdateJournal *journal, uint32_t image, uint32_t sector)
+{
+    updateJournal_append(journal, JOURNAL_RECORD_SECTOR, (uint8_t)image, sector);
+}
+
+/**
+ * @brief  Updates the in-memory state with one record.
+ */
+static void updateJournal_apply(UpdateJournal *journal, const UpdateJournal_Record *record)
+{
+    if ((record->type != JOURNAL_RECORD_STEP) && (record->image >= UPDATE_JOURNAL_NUM_IMAGES))
+    {
+        return;
+    }
+
+    switch (record->type)
+    {
+    case JOURNAL_RECORD_STEP:
+        if (record->value < 32)
+        {
+            journal->doneSteps |= 1UL << record->value;
+        }
+        break;
+
+    case JOURNAL_RECORD_COMPARE:
+        journal->compared[record->image] = true;
+        journal->changedSectors[record->image] = record->value;
+        break;
+
+    case JOURNAL_RECORD_SECTOR:
+        if (record->value < 32)
+        {
+            journal->programmedSectors[record->image] |= 1UL << record->value;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief  Queues a record for programming and applies it.
+ *         When the journal sector is full the update goes on unjournaled.
+ *         Once a record has failed, the later ones are dropped so that
+ *         none lands after the failed word.
+ */
+static void updateJournal_append(UpdateJournal *journal, uint8_t type, uint8_t image, uint32_t value)
+{
+    if (journal->nextRecord >= JOURNAL_END_ADDR)
+    {
+        return;
+    }
+
+    // Wait for a free slot, records complete from the FLASH interrupt.
+    // Polling the bank also starts a step deferred by a blocking operation.
+    while (!writeFailed && ((recordsQueued - recordsWritten) >= JOURNAL_PENDING_RECORDS))
+    {
+        STM32FlashAsync_isBusy(FLASH_BANK_1);
+    }
+
+    if (writeFailed)
+    {
+        return;
+    }
+
+    UpdateJournal_Record *record = &pendingRecords[recordsQueued % JOURNAL_PENDING_RECORDS];
+
+    memset(record, 0, sizeof(*record));
+    record->magic = JOURNAL_MAGIC;
+    record->packageSize = journal->packageSize;
+    record->packageCRC = journal->packageCRC;
+    record->session = journal->session;
+    record->type = type;
+    record->image = image;
+    record->value = value;
+    record->check = updateJournal_check(record);
+
+    journal->nextRecord += sizeof(UpdateJournal_Record);
+    updateJournal_apply(journal, record);
+
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    recordsQueued++;
+    updateJournal_writeNext();
+    __set_PRIMASK(primask);
+}
+
+/**
+ * @brief  Hands the oldest pending record to the flash driver, unless one
+ *         is already being programmed.
+ *         Called with the FLASH interrupt masked or from it.
+ */
+static void updateJournal_writeNext(void)
+{
+    if (writing || writeFailed || (recordsWritten == recordsQueued))
+    {
+        return;
+    }
+
+    if (writeAddress >= JOURNAL_END_ADDR)
+    {
+        // Failed words used up the sector, the update goes on unjournaled
+        recordsWritten = recordsQueued;
+        return;
+    }
+
+    writing = true;
+    if (STM32FlashAsync_program(writeAddress, (const uint8_t *)&pendingRecords[recordsWritten % JOURNAL_PENDING_RECORDS],
+                                sizeof(UpdateJournal_Record), updateJournal_recordWritten, NULL) != STM32FLASH_OK)
+    {
+        // Queue full, retried by the next append or by updateJournal_close()
+        writing = false;
+    }
+}
+
+/**
+ * @brief  Completion callback of a record, called from the FLASH interrupt.
+ *         A failed record is programmed again: in place if its word is still
+ *         erased, otherwise in the next word, the torn one failing its check.
+ */
+static void updateJournal_recordWritten(STM32Flash_StatusTypeDef status, uint32_t address, void *context)
+{
+    writing = false;
+
+    if (status == STM32FLASH_OK)
+    {
+        writeAttempts = 0;
+        writeAddress += sizeof(UpdateJournal_Record);
+        recordsWritten++;
+    }
+    else if (++writeAttempts >= JOURNAL_WRITE_ATTEMPTS)
+    {
+        writeFailed = true;
+        return;
+    }
+    else
+    {
+        SCB_InvalidateDCache_by_Addr((void *)(uintptr_t)writeAddress, sizeof(UpdateJournal_Record));
+        if (!updateJournal_isErased((const UpdateJournal_Record *)(uintptr_t)writeAddress))
+        {
+            writeAddress += sizeof(UpdateJournal_Record);
+        }
+    }
+
+    updateJournal_writeNext();
+}
+
+/**
+ * @brief  Computes the check word of a record.
+ */
+static uint32_t updateJournal_check(const UpdateJournal_Record *record)
+{
+    const uint32_t *words = (const uint32_t *)record;
+    uint32_t sum = 0;
+
+    for (uint32_t i = 0; i < (sizeof(*record) / sizeof(uint32_t)) - 1; i++)
+    {
+        sum += words[i];
+    }
+
+    return ~sum;
+}
+
+/**
+ * @brief  Tells whether a record slot has never been programmed.
+ */
+static bool updateJournal_isErased(const UpdateJournal_Record *record)
+{
+    const uint32_t *words = (const uint32_t *)record;
+
+    for (uint32_t i = 0; i < sizeof(*record) / sizeof(uint32_t); i++)
+    {
+        if (words[i] != 0xFFFFFFFFU)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,232 @@
+/**
+ ******************************************************************************
+ * @file           : update_scheduler.c
+ * @brief          : Dependency-graph scheduler for the update steps.
+ *                   A task becomes ready once all its dependencies are done
+ *                   and none of its resources is held by a running task.
+ *                   Background tasks (flash erases driven by interrupt) are
+ *                   started as soon as they are ready, and the CPU then runs
+ *                   one ready foreground task at a time, so that e.g. bank 2
+ *                   is erased while bank 1 is programmed from the package.
+ *                   The reverse gains little: the bootloader runs from
+ *                   bank 1, whose erases stall its instruction fetches.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "main.h"
+
+#include "update_scheduler.h"
+#include "profiler.h"
+
+/* Private function prototypes -----------------------------------------------*/
+static bool updateScheduler_isReady(const UpdateTask *task, uint32_t doneMask, uint32_t busyResources);
+static void updateScheduler_finish(UpdateTask *task, fwupdate_StatusTypeDef status, ProgressManager *progressManager,
+                                   UpdateScheduler_Callback onTaskDone, void *context);
+
+/**
+ * @brief  Runs every task of a graph, overlapping independent tasks.
+ *         On the first failure no new task is started; background tasks
+ *         already running are drained before returning.
+ *         Tasks already marked UPDATE_TASK_DONE (completed before a reset)
+ *         satisfy their dependents without being run.
+ *
+ * @param  tasks           Task table, dependencies refer to indexes in this table.
+ * @param  numTasks        Number of tasks (at most UPDATE_SCHEDULER_MAX_TASKS).
+ * @param  progressManager Pointer to the progress manager.
+ * @param  onTaskDone      Called after each successful task, may be NULL.
+ * @param  context         User pointer passed to `onTaskDone`.
+ *
+ * @return FWUPDATE_OK if every task succeeded, FWUPDATE_ERROR otherwise.
+ */
+fwupdate_StatusTypeDef updateScheduler_run(UpdateTask *tasks, uint32_t numTasks, ProgressManager *progressManager,
+                                           UpdateScheduler_Callback onTaskDone, void *context)
+{
+    uint32_t doneMask = 0;
+    uint32_t busyResources = 0;
+    uint32_t numDone = 0;
+    uint32_t numRunning = 0;
+    bool failed = false;
+
+    if (numTasks > UPDATE_SCHEDULER_MAX_TASKS)
+    {
+        printf("Error: Too many update tasks (%lu)\n", (unsigned long)numTasks);
+        return FWUPDATE_ERROR;
+    }
+
+    for (uint32_t i = 0; i < numTasks; i++)
+    {
+        if ((tasks[i].run == NULL) && ((tasks[i].start == NULL) || (tasks[i].poll == NULL)))
+        {
+            printf("Error: Update task %s has no handler\n", tasks[i].name);
+            return FWUPDATE_ERROR;
+        }
+
+        if (tasks[i].state == UPDATE_TASK_DONE)
+        {
+            printf("Step %lu: %s (skipped)\n", (unsigned long)tasks[i].step_number, tasks[i].name);
+            progress_complete(progressManager, tasks[i].step_number);
+            doneMask |= UPDATE_DEP(i);
+            numDone++;
+        }
+        else
+        {
+            tasks[i].state = UPDATE_TASK_PENDING;
+        }
+    }
+
+    while (numDone < numTasks)
+    {
+        bool progressed = false;
+
+        // 1) Retire finished background tasks and release their resources
+        for (uint32_t i = 0; i < numTasks; i++)
+        {
+            fwupdate_StatusTypeDef status = FWUPDATE_OK;
+
+            if ((tasks[i].state != UPDATE_TASK_RUNNING) || !tasks[i].poll(tasks[i].context, &status))
+            {
+                continue;
+            }
+
+            updateScheduler_finish(&tasks[i], status, progressManager, onTaskDone, context);
+            busyResources &= ~tasks[i].resources;
+            numRunning--;
+            progressed = true;
+
+            if (status == FWUPDATE_OK)
+            {
+                doneMask |= UPDATE_DEP(i);
+                numDone++;
+            }
+            else
+            {
+                failed = true;
+            }
+        }
+
+        if (failed)
+        {
+            if (numRunning == 0)
+            {
+                break;
+            }
+            continue;
+        }
+
+        // 2) Hand every ready background task to the hardware
+        for (uint32_t i = 0; i < numTasks && !failed; i++)
+        {
+            if ((tasks[i].run != NULL) || !updateScheduler_isReady(&tasks[i], doneMask, busyResources))
+            {
+                continue;
+            }
+
+            printf("Step %lu: %s\n", (unsigned long)tasks[i].step_number, tasks[i].name);
+            PROFILE_BEGIN(tasks[i].name);
+            tasks[i].startTick = HAL_GetTick();
+            if (tasks[i].start(tasks[i].context, progressManager, tasks[i].step_number) != FWUPDATE_OK)
+            {
+                updateScheduler_finish(&tasks[i], FWUPDATE_ERROR, progressManager, onTaskDone, context);
+                failed = true;
+                break;
+            }
+
+            tasks[i].state = UPDATE_TASK_RUNNING;
+            busyResources |= tasks[i].resources;
+            numRunning++;
+            progressed = true;
+        }
+
+        if (failed)
+        {
+            continue;
+        }
+
+        // 3) Run one ready foreground task while the background work goes on
+        for (uint32_t i = 0; i < numTasks; i++)
+        {
+            if ((tasks[i].run == NULL) || !updateScheduler_isReady(&tasks[i], doneMask, busyResources))
+            {
+                continue;
+            }
+
+            printf("Step %lu: %s\n", (unsigned long)tasks[i].step_number, tasks[i].name);
+            PROFILE_BEGIN(tasks[i].name);
+            tasks[i].startTick = HAL_GetTick();
+            tasks[i].state = UPDATE_TASK_RUNNING;
+
+            fwupdate_StatusTypeDef status = tasks[i].run(tasks[i].context, progressManager, tasks[i].step_number);
+            updateScheduler_finish(&tasks[i], status, progressManager, onTaskDone, context);
+            progressed = true;
+
+            if (status == FWUPDATE_OK)
+            {
+                doneMask |= UPDATE_DEP(i);
+                numDone++;
+            }
+            else
+            {
+                failed = true;
+            }
+            break;
+        }
+
+        // 4) Nothing can ever start again: a dependency cannot be satisfied
+        if (!progressed && (numRunning == 0) && !failed)
+        {
+            printf("Error: Update graph is stalled (%lu/%lu tasks done)\n", (unsigned long)numDone, (unsigned long)numTasks);
+            failed = true;
+        }
+    }
+
+    return failed ? FWUPDATE_ERROR : FWUPDATE_OK;
+}
+
+/**
+ * @brief  Tells whether a pending task may start.
+ */
+static bool updateScheduler_isReady(const UpdateTask *task, uint32_t doneMask, uint32_t busyResources)
+{
+    return (task->state == UPDATE_TASK_PENDING) &&
+           ((task->dependencies & ~doneMask) == 0) &&
+           ((task->resources & busyResources) == 0);
+}
+
+/**
+ * @brief  Records the outcome of a task.
+ */
+static void updateScheduler_finish(UpdateTask *task, fwupdate_StatusTypeDef status, ProgressManager *progressManager,
+                                   UpdateScheduler_Callback onTaskDone, void *context)
+{
+    PROFILE_END(task->name);
+    task->elapsed = HAL_GetTick() - task->startTick;
+
+    if (status == FWUPDATE_OK)
+    {
+        task->state = UPDATE_TASK_DONE;
+        progress_complete(progressManager, task->step_number);
+
+        if (onTaskDone != NULL)
+        {
+            onTaskDone(task, context);
+        }
+    }
+    else
+    {
+        task->state = UPDATE_TASK_FAILED;
+        printf("Error: Step %lu (%s) failed\n", (unsigned long)task->step_number, task->name);
+    }
+}
@@ -60,6 +60,7 @@ void TIM2_IRQHandler(void);
 void EXTI15_10_IRQHandler(void);
 void QUADSPI_IRQHandler(void);
 /* USER CODE BEGIN EFP */
+void FLASH_IRQHandler(void);
 
 /* USER CODE END EFP */
 
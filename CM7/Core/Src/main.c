@@ -29,11 +29,18 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "boot_config.h"
+#include "config.h"
 #include "stm32_flash.h"
+#include "stm32_flash_async.h"
+#include "stm32_crc.h"
 #include "file_manager.h"
 
 #include "update.h"
 #include "update_gui.h"
+#include "boot_slot.h"
+#include "boot_state.h"
+#include "boot_info.h"
+#include "profiler.h"
 
 #include "basetypes.h"
 #include "stdio.h"
@@ -71,6 +78,11 @@ static void MPU_Config(void);
 
 /* Function prototypes */
 static void configureBootConfiguration(void);
+static bool bootConfigurationIsCurrent(void);
+static bool firmwareIsValid(uint32_t fwFlashStartAdd, uint32_t fwMaxSize);
+static void startFirmware(uint32_t fwFlashStartAdd);
+static void writeBootInfo(const STM32Flash_PersistentState *flashState, const BootState *bootState,
+                          FW_UpdateState updateState, uint32_t activeSlot, uint32_t fwFlashStartAdd);
 static void reboot(void);
 static void gotoFirmware(uint32_t fwFlashStartAdd);
 
@@ -85,6 +97,7 @@ static void gotoFirmware(uint32_t fwFlashStartAdd);
  * @brief  Configure boot settings for CM4.
  *         This function checks and updates the option bytes to ensure the correct
  *         boot address and permissions for the Cortex-M4 core.
+ *         With A/B slots, the boot address of either slot is kept.
  */
 void configureBootConfiguration(void)
 {
@@ -102,7 +115,11 @@ void configureBootConfiguration(void)
     // 3) Check if the current boot addresses match the desired ones
     uint32_t currentCm4Boot = currentOB.CM4BootAddr0;
 
+#ifdef BOOT_AB_SLOTS
+    if ((currentCm4Boot != bootSlot_cm4Address(BOOT_SLOT_A)) && (currentCm4Boot != bootSlot_cm4Address(BOOT_SLOT_B)))
+#else
     if (currentCm4Boot != FW_CM4_START_ADDR)
+#endif
     {
         newOB.OptionType |= OPTIONBYTE_CM4_BOOTADD;
         newOB.CM4BootConfig = OB_BOOT_ADD0;
@@ -145,11 +162,74 @@ void configureBootConfiguration(void)
     HAL_FLASH_Lock();
 }
 
+/**
+ * @brief  Tells whether the option bytes already hold the boot settings
+ *         written by configureBootConfiguration(). Reads the option byte
+ *         registers directly: usable before HAL_Init(), without unlocking.
+ */
+static bool bootConfigurationIsCurrent(void)
+{
+    uint32_t currentCm4Boot = (FLASH->BOOT4_CUR & FLASH_BOOT4_BCM4_ADD0) << 16;
+
+#ifdef BOOT_AB_SLOTS
+    if ((currentCm4Boot != bootSlot_cm4Address(BOOT_SLOT_A)) && (currentCm4Boot != bootSlot_cm4Address(BOOT_SLOT_B)))
+#else
+    if (currentCm4Boot != FW_CM4_START_ADDR)
+#endif
+    {
+        return false;
+    }
+
+    return (FLASH->OPTSR_CUR & FLASH_OPTSR_BCM4) == 0U;
+}
+
+/**
+ * @brief  Checks the vector table of a firmware: the initial stack pointer
+ *         must be in a RAM and the reset handler a Thumb address in the image.
+ * @param  fwFlashStartAdd  Address where the firmware starts in flash memory.
+ * @param  fwMaxSize        Size of the image region.
+ */
+static bool firmwareIsValid(uint32_t fwFlashStartAdd, uint32_t fwMaxSize)
+{
+	uint32_t appStack = *((volatile uint32_t*) fwFlashStartAdd);
+	uint32_t appEntry = *((volatile uint32_t*) (fwFlashStartAdd + 4));
+
+	bool stackValid = ((appStack > D1_DTCMRAM_BASE) && (appStack <= (D1_DTCMRAM_BASE + 0x20000U))) ||
+	                  ((appStack > D1_AXISRAM_BASE) && (appStack <= (D1_AXISRAM_BASE + 0x80000U))) ||
+	                  ((appStack > D2_AHBSRAM_BASE) && (appStack <= (D2_AHBSRAM_BASE + 0x48000U)));
+
+	bool entryValid = ((appEntry & 1U) != 0U) &&
+	                  (appEntry > fwFlashStartAdd) && (appEntry < (fwFlashStartAdd + fwMaxSize));
+
+	return stackValid && entryValid;
+}
+
+/**
+ * @brief  Hands the boot information over to the firmware about to start,
+ *         with the report of the update that led to the current state.
+ * @param  flashState       Flash state read at reset.
+ * @param  bootState        Boot state read at reset.
+ * @param  updateState      State the firmware runs in.
+ * @param  activeSlot       Slot the firmware runs from, STM32FLASH_NO_SLOT without A/B slots.
+ * @param  fwFlashStartAdd  Address where the firmware starts in flash memory.
+ */
+static void writeBootInfo(const STM32Flash_PersistentState *flashState, const BootState *bootState,
+                          FW_UpdateState updateState, uint32_t activeSlot, uint32_t fwFlashStartAdd)
+{
+	BootInfo_Update report;
+	bool hasReport = (bootState_readReport(flashState, &report) == BOOTSTATE_OK);
+
+	bootInfo_write(updateState, activeSlot, fwFlashStartAdd, bootState->bootCount, bootState->stateBoots,
+	               hasReport ? &report : NULL);
+}
+
 /**
  * @brief  Reboot the system after a delay.
  */
 static void reboot(void)
 {
+	PROFILE_DUMP(FW_PATH "/profile.txt");
+
 	printf("Rebooting in 2\n");
 	/* Wait 2 seconds. */
 	HAL_Delay(2000);
@@ -179,20 +259,32 @@ static void gotoFirmware(uint32_t fwFlashStartAdd)
 		NVIC->ICPR[i] = 0xFFFFFFFF;
 	}
 
-	// Validate firmware address
-	uint32_t appStack = *((volatile uint32_t*) fwFlashStartAdd);
-	uint32_t appEntry = *((volatile uint32_t*) (fwFlashStartAdd + 4));
-
 	SCB_DisableICache();
 	SCB_DisableDCache();
 
 	__enable_irq();
 
+	HAL_DeInit();
+
+	startFirmware(fwFlashStartAdd);
+}
+
+/**
+ * @brief  Hands the core over to a firmware: vector table, stack, reset
+ *         handler. The caller leaves the core as after a reset, MPU,
+ *         caches, SysTick and interrupts off.
+ * @param  fwFlashStartAdd  Address where the firmware starts in flash memory.
+ */
+static void startFirmware(uint32_t fwFlashStartAdd)
+{
+	uint32_t appStack = *((volatile uint32_t*) fwFlashStartAdd);
+	uint32_t appEntry = *((volatile uint32_t*) (fwFlashStartAdd + 4));
+
 	__DMB();
 	SCB->VTOR = fwFlashStartAdd;
 	__DSB();
+	__ISB();
 
-	HAL_DeInit();
 	__set_MSP(appStack);
 
 	pFunction jumpToApplication = (pFunction)appEntry;
@@ -209,6 +301,42 @@ int main(void)
 
 	/* USER CODE BEGIN 1 */
 
+	bootInfo_init();
+	PROFILE_INIT();
+
+	/* Read the update state straight from reset: it only needs the
+	 * memory-mapped flash and the backup SRAM. The flash log is read once
+	 * and handed to everything that needs it until the jump. */
+	PROFILE_BEGIN("Read boot state");
+	STM32Flash_PersistentState flashState;
+	BootState bootState;
+	STM32Flash_readPersistentState(&flashState);
+	bootState_init();
+	bootState_recordBoot(&flashState);
+	bootState_read(&flashState, &bootState);
+	PROFILE_END("Read boot state");
+
+#ifdef BOOT_AB_SLOTS
+	/* Both cores run the active slot, the CM4 boots from its option byte */
+	uint32_t activeSlot = bootSlot_active();
+	uint32_t cm7Address = bootSlot_cm7Address(activeSlot);
+	uint32_t cm7MaxSize = BOOT_SLOT_CM7_SIZE;
+#else
+	uint32_t activeSlot = STM32FLASH_NO_SLOT;
+	uint32_t cm7Address = FW_CM7_START_ADDR;
+	uint32_t cm7MaxSize = FW_CM7_MAX_SIZE;
+#endif
+
+	/* Normal boot: nothing to install and the option bytes are set, jump
+	 * before the MPU, the caches, the HAL and the clocks are set up */
+	bool bootConfigurationCurrent = bootConfigurationIsCurrent();
+	if ((bootState.updateState == FW_UPDATE_NONE) && bootConfigurationCurrent &&
+	    firmwareIsValid(cm7Address, cm7MaxSize))
+	{
+		writeBootInfo(&flashState, &bootState, FW_UPDATE_NONE, activeSlot, cm7Address);
+		startFirmware(cm7Address);
+	}
+
 	/* USER CODE END 1 */
 	/* USER CODE BEGIN Boot_Mode_Sequence_0 */
 
@@ -226,7 +354,7 @@ int main(void)
 	SCB_EnableDCache();
 
 	/* USER CODE BEGIN Boot_Mode_Sequence_1 */
-
+	PROFILE_BEGIN("HAL init");
 	/* USER CODE END Boot_Mode_Sequence_1 */
 	/* MCU Configuration--------------------------------------------------------*/
 
@@ -234,12 +362,19 @@ int main(void)
 	HAL_Init();
 
 	/* USER CODE BEGIN Init */
-	configureBootConfiguration();
+	PROFILE_END("HAL init");
+	if (!bootConfigurationCurrent)
+	{
+		configureBootConfiguration();
+	}
+	PROFILE_BEGIN("Clock config");
 	/* USER CODE END Init */
 
 	/* Configure the system clock */
 	SystemClock_Config();
 	/* USER CODE BEGIN Boot_Mode_Sequence_2 */
+	PROFILE_CLOCK_CHANGED();
+	PROFILE_END("Clock config");
 	//STM32Flash_writePersistentData(FW_UPDATE_RECEIVED);	//uncomment for testing
 	//STM32Flash_writePersistentData(FW_UPDATE_NONE);
 
@@ -248,19 +383,66 @@ int main(void)
 	/* USER CODE BEGIN SysInit */
 
 	/* Initialize the Flash Update State */
-	FW_UpdateState dataRead;
-	STM32Flash_readPersistentData(&dataRead);
+	FW_UpdateState dataRead = bootState.updateState;
+
+#ifdef BOOT_AB_SLOTS
+	uint32_t trialSlot = bootState.trialSlot;
+#endif
 
 	if (dataRead == FW_UPDATE_NONE)
 	{
-		gotoFirmware(FW_CM7_START_ADDR);
+		writeBootInfo(&flashState, &bootState, FW_UPDATE_NONE, activeSlot, cm7Address);
+		gotoFirmware(cm7Address);
 	}
 
 	if (dataRead == FW_UPDATE_TO_TEST)
 	{
-		STM32Flash_writePersistentData(FW_UPDATE_TESTING);
-		gotoFirmware(FW_CM7_START_ADDR);
+#ifdef BOOT_AB_SLOTS
+		/* Activate the slot under test, it runs after a reset */
+		if (bootSlot_isValid(trialSlot) && (trialSlot != activeSlot))
+		{
+			if (bootSlot_select(trialSlot) != BOOTSLOT_OK)
+			{
+				Error_Handler();
+			}
+			NVIC_SystemReset();
+		}
+		writeBootInfo(&flashState, &bootState, FW_UPDATE_TESTING, activeSlot, cm7Address);
+
+		/* Only the next boot needs to see the trial, a lost handoff retries it */
+		if (bootState_handoff(&flashState, FW_UPDATE_TESTING, trialSlot) != BOOTSTATE_OK)
+		{
+			STM32Flash_writePersistentTrial(FW_UPDATE_TESTING, trialSlot);
+		}
+#else
+		writeBootInfo(&flashState, &bootState, FW_UPDATE_TESTING, activeSlot, cm7Address);
+
+		if (bootState_handoff(&flashState, FW_UPDATE_TESTING, STM32FLASH_NO_SLOT) != BOOTSTATE_OK)
+		{
+			STM32Flash_writePersistentData(FW_UPDATE_TESTING);
+		}
+#endif
+		gotoFirmware(cm7Address);
+	}
+
+#ifdef BOOT_AB_SLOTS
+	if (dataRead == FW_UPDATE_TESTING)
+	{
+		/* The slot under test did not confirm: switch back to the previous
+		 * one, nothing is reflashed. Already done if a reset interrupted
+		 * the rollback. */
+		if (bootSlot_isValid(trialSlot) && (trialSlot == activeSlot))
+		{
+			if (bootSlot_select(bootSlot_other(trialSlot)) != BOOTSLOT_OK)
+			{
+				Error_Handler();
+			}
+		}
+		STM32Flash_writePersistentData(FW_UPDATE_NONE);
+		NVIC_SystemReset();
 	}
+#endif
+	PROFILE_BEGIN("Peripherals init");
 	/* USER CODE END SysInit */
 
 	/* Initialize all configured peripherals */
@@ -272,6 +454,9 @@ int main(void)
 	MX_QUADSPI_Init();
 	MX_FATFS_Init();
 	/* USER CODE BEGIN 2 */
+	STM32FlashAsync_init();
+	STM32Crc_init();
+	PROFILE_END("Peripherals init");
 
 	printf("\n------- START BOOTLOADER -------\n");
 
@@ -281,9 +466,12 @@ int main(void)
 	printf("----- FILE INITIALIZATION ------\n");
 
 	FRESULT fres; // Variable to store the result of FATFS operations
+	BootInfo_Update updateReport; // Outcome of the update, for the boot information
 
 	// Attempt to mount the file system on SD card or USB (where the package is stored)
+	PROFILE_BEGIN("Mount");
 	fres = f_mount(&fs, "0:", 1);
+	PROFILE_END("Mount");
 	if (fres != FR_OK)
 	{
 		printf("FS mount ERROR\n");
@@ -291,10 +479,17 @@ int main(void)
 	}
 	printf("FS mount SUCCESS\n");
 
+	// Parse the configuration now if it changed, the firmware then starts from the snapshot
+	struct shared_config config;
+	if ((fres == FR_OK) && (file_loadConfig(CONFIG_FILE_PATH, &config) != FILEMANAGER_OK))
+	{
+		printf("No configuration file\n");
+	}
+
 	if (dataRead == FW_UPDATE_TESTING)
 	{
 		printf("--- RESTORE PREVIOUS FIRMWARE --\n");
-		if (update_restoreBackupFirmwares() != FWUPDATE_OK)
+		if (update_restoreBackupFirmwares(&updateReport) != FWUPDATE_OK)
 		{
 			gui_displayUpdateFailed();
 
@@ -308,6 +503,8 @@ int main(void)
 		}
 		else
 		{
+			STM32Flash_readPersistentState(&flashState);
+			bootState_writeReport(&flashState, &updateReport);
 			printf("Firmware update done, reset firmware update flag\n");
 		}
 
@@ -360,13 +557,20 @@ int main(void)
 
 			printf("--------- START UPDATE ---------\n");
 
-			fwupdate_StatusTypeDef status = update_processPackageFile(packageFilePath);
+			fwupdate_StatusTypeDef status = update_processPackageFile(packageFilePath, &updateReport);
 			if (status != FWUPDATE_OK)
 			{
 				if (status != FWUPDATE_CRCMISMATCH)
 				{
 					printf("Firmware update failed\n");
 					gui_displayUpdateFailed();
+#ifdef BOOT_AB_SLOTS
+					/* The active slot is intact, keep running it */
+					if (STM32Flash_writePersistentData(FW_UPDATE_NONE) == STM32FLASH_OK)
+					{
+						reboot();
+					}
+#endif
 				}
 				else
 				{
@@ -393,12 +597,18 @@ int main(void)
 		printf("Preparing to reset all cores \n");
 
 		/* Reboot after we close the connection. */
+#ifdef BOOT_AB_SLOTS
+		if (STM32Flash_writePersistentTrial(FW_UPDATE_TO_TEST, bootSlot_other(activeSlot)) != STM32FLASH_OK)
+#else
 		if (STM32Flash_writePersistentData(FW_UPDATE_TO_TEST) != STM32FLASH_OK)
+#endif
 		{
 			printf("Failed to write firmware update status in STM32 flash\n");
 		}
 		else
 		{
+			STM32Flash_readPersistentState(&flashState);
+			bootState_writeReport(&flashState, &updateReport);
 			printf("Firmware update must be tested now \n");
 			reboot();
 		}
@@ -23,7 +23,7 @@
 #include "stm32h7xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
-
+#include "stm32_flash_async.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -248,4 +248,13 @@ void QUADSPI_IRQHandler(void)
 
 /* USER CODE BEGIN 1 */
 
+/**
+  * @brief This function handles FLASH global interrupt.
+  */
+void FLASH_IRQHandler(void)
+{
+  /* Both bank controllers are driven by the asynchronous flash layer */
+  STM32FlashAsync_IRQHandler();
+}
+
 /* USER CODE END 1 */
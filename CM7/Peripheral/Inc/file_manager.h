@@ -28,17 +28,42 @@
 
 /* Private define ------------------------------------------------------------*/
 
+/* Parsed configuration kept in RAM_SHARED, after the boot information
+ * (boot_info.h), so that the configuration file is parsed again only when
+ * it changes. It survives resets, not power cycles.
+ * The bootloader builds it only when it mounts the volume, that is on the
+ * update and restore paths: the fast path never does. Unless the firmware
+ * stores it with file_storeConfigSnapshot(), the snapshot only helps the
+ * boot that follows an update. */
+#define CONFIG_SNAPSHOT_ADDRESS     0x24000080U
+#define CONFIG_SNAPSHOT_MAGIC       0x47464E43U     // "CNFG"
+
+/* Largest configuration file read whole by file_loadConfig() */
+#define CONFIG_FILE_MAX_SIZE        1024U
+
 /* Custom return type for STM32 file operations -----------------------------*/
 typedef enum {
     FILEMANAGER_OK = 0,
 	FILEMANAGER_ERROR = 1
 } fileManager_StatusTypeDef;
 
+typedef struct
+{
+    uint32_t magic;
+    uint32_t size;                      // sizeof(file_ConfigSnapshot)
+    uint32_t fileSize;                  // Configuration file the snapshot was parsed from
+    uint32_t fileCRC;                   // CRC-32 of its bytes
+    struct shared_config config;
+    uint32_t crc;                       // CRC-32 of the previous bytes
+} file_ConfigSnapshot;
+
 extern FATFS fs;
 
 fileManager_StatusTypeDef file_factoryReset(void);
 fileManager_StatusTypeDef file_initConfig(volatile struct shared_config* config);
 fileManager_StatusTypeDef file_readConfig(const char* filePath, volatile struct shared_config* config);
+fileManager_StatusTypeDef file_loadConfig(const char* filePath, volatile struct shared_config* config);
+void file_storeConfigSnapshot(const volatile struct shared_config* config, uint32_t fileSize, uint32_t fileCRC);
 fileManager_StatusTypeDef file_writeConfig(const char* filePath, const volatile struct shared_config* config);
 fileManager_StatusTypeDef file_writeCisCals(const char* filePath, const struct cisCals* data);
 fileManager_StatusTypeDef file_readCisCals(const char* filePath, struct cisCals* data);
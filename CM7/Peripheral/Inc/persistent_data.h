@@ -0,0 +1,173 @@
+/**
+ ******************************************************************************
+ * @file           : persistent_data.h
+ * @brief          : Layout and reader of the persistent data sector, shared
+ *                   by the bootloader and the firmware.
+ *
+ *                   The sector at FLASH_PERSISTENT_DATA_ADDRESS holds:
+ *                   - word 0: a bare FW_UpdateState, written by the firmware
+ *                     after erasing the sector;
+ *                   - words 1 and up: a log of one-flash-word records,
+ *                     appended without holes and ended by the first erased
+ *                     word. Persistent data records (PERSISTENT_DATA_MAGIC)
+ *                     are mixed with the update journal records.
+ *
+ *                   The current state is the newest valid persistent data
+ *                   record, or word 0 when the log holds none.
+ *
+ *                   Deployed firmware reads the state from word 0, so the
+ *                   bootloader keeps word 0 equal to the current state: a
+ *                   record changing the state is followed by the state in
+ *                   word 0, on a freshly erased sector unless word 0 was
+ *                   still blank. Journal records and repeated states are
+ *                   appended without an erase. Once every firmware in the
+ *                   field reads the state with persistentData_readState(),
+ *                   defining BOOT_PERSISTENT_LOG_ONLY in boot_config.h or on
+ *                   the compiler command line drops the mirror, and word 0
+ *                   alone is then NOT the current state.
+ *
+ *                   Neither tells the firmware that it runs on trial in that
+ *                   case: the bootloader hands TESTING over in the backup
+ *                   SRAM (boot_state.h) and the flash still reads TO_TEST.
+ *                   The trial state is then only in BootInfo.updateState
+ *                   (boot_info.h), which the firmware must read to know
+ *                   whether it has a trial to confirm.
+ *
+ *                   To change the state, the firmware erases the sector and
+ *                   programs the new state as word 0, as before; this also
+ *                   ends any update journal.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __PERSISTENT_DATA_H__
+#define __PERSISTENT_DATA_H__
+
+/* Includes ------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+#include "stddef.h"
+
+#include "stm32_crc.h"
+#include "stm32_flash.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define PERSISTENT_DATA_MAGIC       0x4C545350U     // "PSTL"
+
+/* Exported types ------------------------------------------------------------*/
+
+/* Record of the persistent data log (one flash word) */
+typedef struct
+{
+    FW_UpdateState updateState;
+    uint32_t trialSlot;             // A/B slot under test, STM32FLASH_NO_SLOT if none
+    uint32_t magic;
+    uint32_t sequence;              // Incremented by every record
+    uint32_t session;               // Incremented by every state change
+    uint32_t reserved[2];
+    uint32_t crc;                   // CRC-32 of the previous 28 bytes
+} PersistentData_Record;
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * @brief  Tells whether a flash word still holds the erased value.
+ */
+static inline bool persistentData_isErased(uint32_t address)
+{
+    const uint32_t *word = (const uint32_t *)(uintptr_t)address;
+
+    for (uint32_t i = 0; i < (STM32FLASH_WORD_SIZE / 4U); i++)
+    {
+        if (word[i] != 0xFFFFFFFFU)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief  Tells whether a flash word holds an intact persistent data record.
+ *         A record torn by a power loss fails its CRC.
+ */
+static inline bool persistentData_isRecord(uint32_t address)
+{
+    const PersistentData_Record *record = (const PersistentData_Record *)(uintptr_t)address;
+
+    return (record->magic == PERSISTENT_DATA_MAGIC) &&
+           (record->crc == STM32Crc_computeSoftware(record, offsetof(PersistentData_Record, crc)));
+}
+
+/**
+ * @brief  Finds the newest persistent data record.
+ *         The end of the log is found by a binary search for the first
+ *         erased word, then records are checked backward from there, so a
+ *         well-filled sector costs a dozen word reads and usually one CRC.
+ *         The D-cache must not hold stale lines of the sector.
+ * @param  sectorAddress FLASH_PERSISTENT_DATA_ADDRESS.
+ * @param  sectorSize    Size of the sector.
+ * @param  endAddress    Filled with the first erased word of the log,
+ *                       sectorAddress + sectorSize if full. May be NULL.
+ * @return The newest record, NULL if the log holds none.
+ */
+static inline const PersistentData_Record *persistentData_find(uint32_t sectorAddress, uint32_t sectorSize, uint32_t *endAddress)
+{
+    uint32_t low = 1;                                   // First word of the log
+    uint32_t high = sectorSize / STM32FLASH_WORD_SIZE;  // Words past the end are erased
+
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2U;
+
+        if (persistentData_isErased(sectorAddress + middle * STM32FLASH_WORD_SIZE))
+        {
+            high = middle;
+        }
+        else
+        {
+            low = middle + 1U;
+        }
+    }
+
+    if (endAddress != NULL)
+    {
+        *endAddress = sectorAddress + low * STM32FLASH_WORD_SIZE;
+    }
+
+    while (low-- > 1U)
+    {
+        if (persistentData_isRecord(sectorAddress + low * STM32FLASH_WORD_SIZE))
+        {
+            return (const PersistentData_Record *)(uintptr_t)(sectorAddress + low * STM32FLASH_WORD_SIZE);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief  Reads the current firmware update state.
+ *         A trial handed over in the backup SRAM still reads TO_TEST, see
+ *         above.
+ * @param  sectorAddress FLASH_PERSISTENT_DATA_ADDRESS.
+ * @param  sectorSize    Size of the sector.
+ */
+static inline FW_UpdateState persistentData_readState(uint32_t sectorAddress, uint32_t sectorSize)
+{
+    const PersistentData_Record *record = persistentData_find(sectorAddress, sectorSize, NULL);
+
+    return (record != NULL) ? record->updateState : *(const FW_UpdateState *)(uintptr_t)sectorAddress;
+}
+
+#endif /* __PERSISTENT_DATA_H__ */
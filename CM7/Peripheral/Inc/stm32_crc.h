@@ -0,0 +1,51 @@
+/**
+ ******************************************************************************
+ * @file           : stm32_crc.h
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __STM32_CRC_H__
+#define __STM32_CRC_H__
+
+/* Includes ------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+
+/* Private define ------------------------------------------------------------*/
+
+/* Host builds have no CRC unit and use the software CRC */
+#if !defined(CORE_CM7) && !defined(STM32CRC_SOFTWARE)
+#define STM32CRC_SOFTWARE
+#endif
+
+/* Shorter inputs are fed by the CPU, the MDMA setup costs more than it saves */
+#define STM32CRC_DMA_THRESHOLD  256
+
+/* Running CRC-32 (zlib convention) of one stream.
+ * A context only holds its value, so any number of streams may be
+ * interleaved: the CRC unit is loaded from and saved to the context of
+ * whichever stream uses it. */
+typedef struct
+{
+    uint32_t crc;
+} STM32Crc_Context;
+
+void STM32Crc_init(void);
+void STM32Crc_begin(STM32Crc_Context *context);
+void STM32Crc_start(STM32Crc_Context *context, const void *data, uint32_t length);
+void STM32Crc_update(STM32Crc_Context *context, const void *data, uint32_t length);
+uint32_t STM32Crc_value(STM32Crc_Context *context);
+uint32_t STM32Crc_compute(const void *data, uint32_t length);
+uint32_t STM32Crc_computeSoftware(const void *data, uint32_t length);
+
+#endif /* __STM32_CRC_H__ */
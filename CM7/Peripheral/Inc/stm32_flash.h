@@ -18,8 +18,17 @@
 #define __STM32_FLASH_H__
 
 /* Includes ------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+
 /* Private define ------------------------------------------------------------*/
 
+/* Internal flash programming granularity (one 256-bit flash word) */
+#define STM32FLASH_WORD_SIZE    32U
+
+/* No A/B slot under test in the persistent data */
+#define STM32FLASH_NO_SLOT      0xFFFFFFFFU
+
 /* Custom return type for STM32 Flash operations -----------------------------*/
 typedef enum {
     STM32FLASH_OK = 0,
@@ -35,12 +44,46 @@ typedef enum {
     FW_UPDATE_DONE      = 0xFFFFFFFF
 } FW_UpdateState;
 
+/* Persistent data, see STM32Flash_readPersistentState() */
+typedef struct
+{
+    FW_UpdateState updateState;
+    uint32_t trialSlot;             // A/B slot under test, STM32FLASH_NO_SLOT if none
+    uint32_t sequence;              // Of the current record, 0 for a bare state word
+    uint32_t session;               // Incremented by every state change
+} STM32Flash_PersistentState;
+
+/* Streaming programmer session over one flash region.
+ * The bank is unlocked once when the session is opened and relocked when it
+ * is closed. Input of any length and alignment is staged into flash words;
+ * the first error is latched and reported by every later call. */
+typedef struct
+{
+    uint32_t startAddress;
+    uint32_t address;               // Next flash word to program
+    uint32_t endAddress;            // End of the region (exclusive)
+    uint32_t bank;
+    uint8_t staging[STM32FLASH_WORD_SIZE] __attribute__((aligned(32)));
+    uint32_t staged;                // Bytes waiting in `staging`
+    STM32Flash_StatusTypeDef status;
+    uint32_t errorAddress;          // First failing flash word
+    uint32_t errorFlags;            // FLASH_SRx error bits of that failure
+    bool open;
+} STM32Flash_Session;
+
 uint32_t stm32Flash_getSector(uint32_t Address);
 STM32Flash_StatusTypeDef STM32Flash_readPersistentData(FW_UpdateState* state);
 STM32Flash_StatusTypeDef STM32Flash_writePersistentData(FW_UpdateState updateState);
+STM32Flash_StatusTypeDef STM32Flash_readPersistentTrial(uint32_t* trialSlot);
+STM32Flash_StatusTypeDef STM32Flash_writePersistentTrial(FW_UpdateState updateState, uint32_t trialSlot);
+STM32Flash_StatusTypeDef STM32Flash_readPersistentState(STM32Flash_PersistentState* state);
 STM32Flash_StatusTypeDef STM32Flash_erase_app_memory(uint32_t flashBank, uint32_t flashSector, uint32_t NbSectors);
 STM32Flash_StatusTypeDef STM32Flash_write32B(const uint8_t *data, uint32_t address);
 STM32Flash_StatusTypeDef STM32Flash_erase_sector(uint32_t flashBank, uint32_t sector);
-STM32Flash_StatusTypeDef STM32Flash_reliableWrite(uint32_t flashAddress, const uint8_t *buffer, uint32_t length, int maxRetries);
+STM32Flash_StatusTypeDef STM32Flash_sessionOpen(STM32Flash_Session *session, uint32_t address, uint32_t size);
+STM32Flash_StatusTypeDef STM32Flash_sessionWrite(STM32Flash_Session *session, const uint8_t *data, uint32_t length);
+STM32Flash_StatusTypeDef STM32Flash_sessionClose(STM32Flash_Session *session);
+STM32Flash_StatusTypeDef STM32Flash_verify(uint32_t flashAddress, const uint8_t *data, uint32_t length, bool repair);
+STM32Flash_StatusTypeDef STM32Flash_reliableWrite(uint32_t flashAddress, const uint8_t *buffer, uint32_t length);
 
 #endif /* __STM32_FLASH_H__ */
@@ -0,0 +1,47 @@
+/**
+ ******************************************************************************
+ * @file           : stm32_flash_async.h
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __STM32_FLASH_ASYNC_H__
+#define __STM32_FLASH_ASYNC_H__
+
+/* Includes ------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+
+#include "stm32_flash.h"
+
+/* Private define ------------------------------------------------------------*/
+
+/* Maximum number of pending operations per flash bank */
+#define STM32FLASH_ASYNC_QUEUE_DEPTH    8
+
+/* Priority of the FLASH interrupt driving the queues */
+#define STM32FLASH_ASYNC_IRQ_PRIORITY   5
+
+/* Completion callback, called from the FLASH interrupt.
+ * `address` is the sector start address for an erase, or the first faulty
+ * (or last programmed) flash word address for a program operation. */
+typedef void (*STM32FlashAsync_Callback)(STM32Flash_StatusTypeDef status, uint32_t address, void *context);
+
+void STM32FlashAsync_init(void);
+STM32Flash_StatusTypeDef STM32FlashAsync_eraseSector(uint32_t flashBank, uint32_t sector, STM32FlashAsync_Callback callback, void *context);
+STM32Flash_StatusTypeDef STM32FlashAsync_program(uint32_t address, const uint8_t *data, uint32_t length, STM32FlashAsync_Callback callback, void *context);
+bool STM32FlashAsync_isBusy(uint32_t flashBank);
+STM32Flash_StatusTypeDef STM32FlashAsync_wait(uint32_t flashBank);
+uint32_t STM32FlashAsync_getBank(uint32_t address);
+void STM32FlashAsync_IRQHandler(void);
+
+#endif /* __STM32_FLASH_ASYNC_H__ */
@@ -19,16 +19,36 @@
 #include "basetypes.h"
 #include "globals.h"
 #include "stdio.h"
+#include "stddef.h"
 
 #include "ff.h" // FATFS include
 #include "diskio.h" // DiskIO include
-#include "crc.h"
+#include "stm32_crc.h"
 
 #include "file_manager.h"
 
 /* Private define ------------------------------------------------------------*/
 #define WORKING_BUFFER_SIZE (2 * _MAX_SS)
 #define CHUNK_SIZE 4096
+#define CONFIG_BLOCK_SIZE 512
+#define CONFIG_LINE_SIZE 128
+
+/* Private typedef -----------------------------------------------------------*/
+typedef enum {
+    CONFIG_TYPE_U8 = 0,
+    CONFIG_TYPE_U16,
+    CONFIG_TYPE_U32
+} file_ConfigType;
+
+/* One key of the configuration file and the field it sets */
+typedef struct
+{
+    const char* name;
+    file_ConfigType type;
+    uint16_t offset;                    // Of the field, array element included
+} file_ConfigKey;
+
+#define CONFIG_KEY(name, type, field)  { name, type, offsetof(struct shared_config, field) }
 
 /* Private variables ---------------------------------------------------------*/
 const struct shared_config DefaultConfig =
@@ -49,15 +69,48 @@ const struct shared_config DefaultConfig =
 
 FATFS fs;
 
+/* Keys of the configuration file, written in this order */
+static const file_ConfigKey configKeys[] =
+{
+    CONFIG_KEY("UI_BUTTON_DELAY",         CONFIG_TYPE_U32, ui_button_delay),
+    CONFIG_KEY("NETWORK_IP_ADDR0",        CONFIG_TYPE_U8,  network_ip[0]),
+    CONFIG_KEY("NETWORK_IP_ADDR1",        CONFIG_TYPE_U8,  network_ip[1]),
+    CONFIG_KEY("NETWORK_IP_ADDR2",        CONFIG_TYPE_U8,  network_ip[2]),
+    CONFIG_KEY("NETWORK_IP_ADDR3",        CONFIG_TYPE_U8,  network_ip[3]),
+    CONFIG_KEY("NETWORK_NETMASK_ADDR0",   CONFIG_TYPE_U8,  network_netmask[0]),
+    CONFIG_KEY("NETWORK_NETMASK_ADDR1",   CONFIG_TYPE_U8,  network_netmask[1]),
+    CONFIG_KEY("NETWORK_NETMASK_ADDR2",   CONFIG_TYPE_U8,  network_netmask[2]),
+    CONFIG_KEY("NETWORK_NETMASK_ADDR3",   CONFIG_TYPE_U8,  network_netmask[3]),
+    CONFIG_KEY("NETWORK_GW_ADDR0",        CONFIG_TYPE_U8,  network_gw[0]),
+    CONFIG_KEY("NETWORK_GW_ADDR1",        CONFIG_TYPE_U8,  network_gw[1]),
+    CONFIG_KEY("NETWORK_GW_ADDR2",        CONFIG_TYPE_U8,  network_gw[2]),
+    CONFIG_KEY("NETWORK_GW_ADDR3",        CONFIG_TYPE_U8,  network_gw[3]),
+    CONFIG_KEY("NETWORK_DEST_IP_ADDR0",   CONFIG_TYPE_U8,  network_dest_ip[0]),
+    CONFIG_KEY("NETWORK_DEST_IP_ADDR1",   CONFIG_TYPE_U8,  network_dest_ip[1]),
+    CONFIG_KEY("NETWORK_DEST_IP_ADDR2",   CONFIG_TYPE_U8,  network_dest_ip[2]),
+    CONFIG_KEY("NETWORK_DEST_IP_ADDR3",   CONFIG_TYPE_U8,  network_dest_ip[3]),
+    CONFIG_KEY("NETWORK_UDP_PORT",        CONFIG_TYPE_U16, network_udp_port),
+    CONFIG_KEY("NETWORK_TCP_PORT",        CONFIG_TYPE_U16, network_tcp_port),
+    CONFIG_KEY("CIS_PRINT_CALIBRATION",   CONFIG_TYPE_U8,  cis_print_calibration),
+    CONFIG_KEY("CIS_DPI",                 CONFIG_TYPE_U16, cis_dpi),
+    CONFIG_KEY("CIS_CLK_FREQ",            CONFIG_TYPE_U32, cis_clk_freq),
+    CONFIG_KEY("CIS_OVERSAMPLING",        CONFIG_TYPE_U8,  cis_oversampling),
+    CONFIG_KEY("CIS_HANDEDNESS",          CONFIG_TYPE_U8,  cis_handedness),
+};
+
 /* Private function prototypes -----------------------------------------------*/
 static fileManager_StatusTypeDef file_parseLine(char* line, volatile struct shared_config* config);
 static fileManager_StatusTypeDef print_shared_config(struct shared_config config);
-static uint32_t file_computeCRC_buffer(CRC_HandleTypeDef *hcrc, const uint8_t *pData, uint32_t length);
+static fileManager_StatusTypeDef file_readText(const char* filePath, char* text, uint32_t* length);
+static void file_parseText(char* text, volatile struct shared_config* config);
+static const file_ConfigKey* file_findConfigKey(const char* name);
+static uint32_t file_formatConfig(const volatile struct shared_config* config, char* text);
+static void file_recoverConfig(const char* filePath);
 
 /**
  * @brief  Reads the shared configuration from a file.
- *         This function opens the specified file and reads its content line by line,
- *         parsing each key-value pair to populate the `shared_config` structure.
+ *         This function opens the specified file and reads its content in blocks,
+ *         parsing each key-value line to populate the `shared_config` structure.
  *
  * @param  filePath  Path to the configuration file.
  * @param  config    Pointer to the shared configuration structure to populate.
@@ -68,7 +121,12 @@ fileManager_StatusTypeDef file_readConfig(const char* filePath, volatile struct
 {
     FIL file;
     FRESULT fr;
-    char line[128];
+    char block[CONFIG_BLOCK_SIZE];
+    char line[CONFIG_LINE_SIZE];
+    uint32_t lineLength = 0;
+    UINT br;
+
+    file_recoverConfig(filePath);
 
     // Open the file in read mode
     fr = f_open(&file, filePath, FA_READ);
@@ -77,9 +135,35 @@ fileManager_StatusTypeDef file_readConfig(const char* filePath, volatile struct
         return FILEMANAGER_ERROR;
     }
 
-    // Read the file line by line and parse each entry
-    while (f_gets(line, sizeof(line), &file))
+    // Read the file in blocks and parse each complete line
+    do
     {
+        fr = f_read(&file, block, sizeof(block), &br);
+        if (fr != FR_OK)
+        {
+            f_close(&file);
+            return FILEMANAGER_ERROR;
+        }
+
+        for (UINT i = 0; i < br; i++)
+        {
+            if (block[i] == '\n')
+            {
+                line[lineLength] = '\0';
+                file_parseLine(line, config);
+                lineLength = 0;
+            }
+            else if (lineLength < (sizeof(line) - 1))
+            {
+                line[lineLength++] = block[i];
+            }
+        }
+    } while (br == sizeof(block));
+
+    // Last line without a line feed
+    if (lineLength != 0)
+    {
+        line[lineLength] = '\0';
         file_parseLine(line, config);
     }
 
@@ -88,100 +172,257 @@ fileManager_StatusTypeDef file_readConfig(const char* filePath, volatile struct
     return FILEMANAGER_OK;
 }
 
+/**
+ * @brief  Loads the shared configuration, from the snapshot in RAM_SHARED
+ *         when the file has not changed since it was taken, otherwise by
+ *         parsing the file, which then replaces the snapshot.
+ *         The file is read whole in one call and identified by its size and
+ *         CRC: without an RTC every file carries the same timestamp.
+ *         Keys missing from the file keep their default value.
+ *
+ * @param  filePath  Path to the configuration file.
+ * @param  config    Pointer to the shared configuration structure to populate.
+ *
+ * @return FILEMANAGER_OK if the configuration was loaded, FILEMANAGER_ERROR otherwise.
+ */
+fileManager_StatusTypeDef file_loadConfig(const char* filePath, volatile struct shared_config* config)
+{
+    const file_ConfigSnapshot *snapshot = (const file_ConfigSnapshot *)CONFIG_SNAPSHOT_ADDRESS;
+    char text[CONFIG_FILE_MAX_SIZE + 1];
+    uint32_t length;
+
+    file_recoverConfig(filePath);
+
+    if (file_readText(filePath, text, &length) != FILEMANAGER_OK)
+    {
+        // Not a file of ours, or too large for the snapshot: parse it line by line
+        *config = DefaultConfig;
+        return file_readConfig(filePath, config);
+    }
+
+    uint32_t fileCRC = STM32Crc_compute(text, length);
+
+    SCB_InvalidateDCache_by_Addr((void *)CONFIG_SNAPSHOT_ADDRESS, sizeof(file_ConfigSnapshot));
+    if ((snapshot->magic == CONFIG_SNAPSHOT_MAGIC) && (snapshot->size == sizeof(file_ConfigSnapshot)) &&
+        (snapshot->fileSize == length) && (snapshot->fileCRC == fileCRC) &&
+        (snapshot->crc == STM32Crc_compute(snapshot, offsetof(file_ConfigSnapshot, crc))))
+    {
+        *config = snapshot->config;
+        return FILEMANAGER_OK;
+    }
+
+    *config = DefaultConfig;
+    file_parseText(text, config);
+    file_storeConfigSnapshot(config, length, fileCRC);
+
+    return FILEMANAGER_OK;
+}
+
+/**
+ * @brief  Reads a whole configuration file, NUL-terminated.
+ * @param  text    Buffer of CONFIG_FILE_MAX_SIZE + 1 bytes.
+ * @return FILEMANAGER_ERROR if the file cannot be read or is larger than the buffer.
+ */
+static fileManager_StatusTypeDef file_readText(const char* filePath, char* text, uint32_t* length)
+{
+    FIL file;
+    UINT br;
+
+    if (f_open(&file, filePath, FA_READ) != FR_OK)
+    {
+        return FILEMANAGER_ERROR;
+    }
+
+    if ((f_size(&file) > CONFIG_FILE_MAX_SIZE) || (f_read(&file, text, (UINT)f_size(&file), &br) != FR_OK) ||
+        (br != f_size(&file)))
+    {
+        f_close(&file);
+        return FILEMANAGER_ERROR;
+    }
+
+    f_close(&file);
+
+    text[br] = '\0';
+    *length = br;
+
+    return FILEMANAGER_OK;
+}
+
+/**
+ * @brief  Parses a configuration held in memory, line by line.
+ */
+static void file_parseText(char* text, volatile struct shared_config* config)
+{
+    char* line = text;
+
+    while (*line != '\0')
+    {
+        char* end = strchr(line, '\n');
+
+        if (end != NULL)
+        {
+            *end = '\0';
+        }
+
+        file_parseLine(line, config);
+
+        if (end == NULL)
+        {
+            break;
+        }
+        line = end + 1;
+    }
+}
+
+/**
+ * @brief  Replaces the configuration snapshot in RAM_SHARED.
+ *         The bootloader only calls it on boots that mount the volume
+ *         (update and restore), and file_writeConfig(). The firmware must
+ *         call it too, after reading or writing the configuration file,
+ *         for the snapshot to serve the boots that follow a plain reset.
+ *
+ * @param  config   Configuration parsed from the file.
+ * @param  fileSize Size of the configuration file in bytes.
+ * @param  fileCRC  STM32Crc_compute() of the whole file.
+ */
+void file_storeConfigSnapshot(const volatile struct shared_config* config, uint32_t fileSize, uint32_t fileCRC)
+{
+    file_ConfigSnapshot *snapshot = (file_ConfigSnapshot *)CONFIG_SNAPSHOT_ADDRESS;
+
+    snapshot->magic = CONFIG_SNAPSHOT_MAGIC;
+    snapshot->size = sizeof(file_ConfigSnapshot);
+    snapshot->fileSize = fileSize;
+    snapshot->fileCRC = fileCRC;
+    snapshot->config = *config;
+    snapshot->crc = STM32Crc_compute(snapshot, offsetof(file_ConfigSnapshot, crc));
+
+    SCB_CleanDCache_by_Addr((void *)CONFIG_SNAPSHOT_ADDRESS, sizeof(file_ConfigSnapshot));
+}
+
 /**
  * @brief  Parses a configuration line and updates the shared configuration structure.
- *         This function takes a key-value formatted string (e.g., "KEY=VALUE"),
- *         extracts the parameter name and its corresponding value, and updates
- *         the provided `shared_config` structure accordingly.
+ *         The line holds one "KEY=VALUE" pair, the key is looked up in
+ *         `configKeys`. Unknown keys and lines without '=' are ignored.
  *
- * @param  line   Pointer to the line string to parse.
+ * @param  line   Pointer to the line string to parse, modified in place.
  * @param  config Pointer to the shared configuration structure to update.
  *
  * @return FILEMANAGER_OK after successful parsing.
  */
 fileManager_StatusTypeDef file_parseLine(char* line, volatile struct shared_config* config)
 {
-    char* token = strtok(line, "=");
-    while (token != NULL)
+    char* value = strchr(line, '=');
+    if (value == NULL)
+    {
+        return FILEMANAGER_OK;
+    }
+    *value++ = '\0';
+
+    const file_ConfigKey* key = file_findConfigKey(line);
+    if (key == NULL)
+    {
+        return FILEMANAGER_OK;
+    }
+
+    uint32_t number = strtoul(value, NULL, 10);
+    volatile uint8_t* field = (volatile uint8_t*)config + key->offset;
+
+    switch (key->type)
     {
-        char* value = strtok(NULL, "\r\n");
-        if (value != NULL)
+        case CONFIG_TYPE_U8:
+            *field = (uint8_t)number;
+            break;
+        case CONFIG_TYPE_U16:
+            *(volatile uint16_t*)field = (uint16_t)number;
+            break;
+        default:
+            *(volatile uint32_t*)field = number;
+            break;
+    }
+
+    return FILEMANAGER_OK;
+}
+
+/**
+ * @brief  Looks a key up in `configKeys`.
+ * @return The key entry, NULL if the key is unknown.
+ */
+static const file_ConfigKey* file_findConfigKey(const char* name)
+{
+    for (uint32_t i = 0; i < (sizeof(configKeys) / sizeof(configKeys[0])); i++)
+    {
+        if (strcmp(configKeys[i].name, name) == 0)
         {
-            if (strcmp(token, "UI_BUTTON_DELAY") == 0)
-            {
-                config->ui_button_delay = strtoul(value, NULL, 10);
-            }
-            else if (strncmp(token, "NETWORK_IP_ADDR", 15) == 0)
-            {
-                int index = token[15] - '0';
-                if (index >= 0 && index < 4)
-                {
-                    config->network_ip[index] = (uint8_t)strtoul(value, NULL, 10);
-                }
-            }
-            else if (strncmp(token, "NETWORK_NETMASK_ADDR", 20) == 0)
-            {
-                int index = token[20] - '0';
-                if (index >= 0 && index < 4)
-                {
-                    config->network_netmask[index] = (uint8_t)strtoul(value, NULL, 10);
-                }
-            }
-            else if (strncmp(token, "NETWORK_GW_ADDR", 15) == 0)
-            {
-                int index = token[15] - '0';
-                if (index >= 0 && index < 4)
-                {
-                    config->network_gw[index] = (uint8_t)strtoul(value, NULL, 10);
-                }
-            }
-            else if (strncmp(token, "NETWORK_DEST_IP_ADDR", 20) == 0)
-            {
-                int index = token[20] - '0';
-                if (index >= 0 && index < 4)
-                {
-                    config->network_dest_ip[index] = (uint8_t)strtoul(value, NULL, 10);
-                }
-            }
-            else if (strcmp(token, "NETWORK_UDP_PORT") == 0)
-            {
-                config->network_udp_port = (uint16_t)strtoul(value, NULL, 10);
-            }
-            else if (strcmp(token, "NETWORK_TCP_PORT") == 0)
-            {
-                config->network_tcp_port = (uint16_t)strtoul(value, NULL, 10);
-            }
-            else if (strcmp(token, "CIS_PRINT_CALIBRATION") == 0)
-            {
-                config->cis_print_calibration = (uint8_t)strtoul(value, NULL, 10);
-            }
-            else if (strcmp(token, "CIS_DPI") == 0)
-            {
-                config->cis_dpi = (uint16_t)strtoul(value, NULL, 10);
-            }
-            else if (strcmp(token, "CIS_CLK_FREQ") == 0)
-            {
-                config->cis_clk_freq = strtoul(value, NULL, 10);
-            }
-            else if (strcmp(token, "CIS_OVERSAMPLING") == 0)
-            {
-                config->cis_oversampling = (uint8_t)strtoul(value, NULL, 10);
-            }
-            else if (strcmp(token, "CIS_HANDEDNESS") == 0)
-            {
-                config->cis_handedness = (uint8_t)strtoul(value, NULL, 10);
-            }
+            return &configKeys[i];
         }
-        token = strtok(NULL, "=");
     }
 
-    return FILEMANAGER_OK;
+    return NULL;
+}
+
+/**
+ * @brief  Formats the shared configuration as the text of a configuration
+ *         file, one "KEY=VALUE" line per entry of `configKeys`.
+ * @param  text  Buffer of CONFIG_FILE_MAX_SIZE + 1 bytes.
+ * @return Length of the text, 0 if it does not fit.
+ */
+static uint32_t file_formatConfig(const volatile struct shared_config* config, char* text)
+{
+    uint32_t length = 0;
+
+    for (uint32_t i = 0; i < (sizeof(configKeys) / sizeof(configKeys[0])); i++)
+    {
+        const volatile uint8_t* field = (const volatile uint8_t*)config + configKeys[i].offset;
+        uint32_t number;
+
+        switch (configKeys[i].type)
+        {
+            case CONFIG_TYPE_U8:
+                number = *field;
+                break;
+            case CONFIG_TYPE_U16:
+                number = *(const volatile uint16_t*)field;
+                break;
+            default:
+                number = *(const volatile uint32_t*)field;
+                break;
+        }
+
+        int written = snprintf(text + length, CONFIG_FILE_MAX_SIZE + 1 - length, "%s=%lu\n",
+                               configKeys[i].name, (unsigned long)number);
+        if ((written < 0) || ((uint32_t)written > (CONFIG_FILE_MAX_SIZE - length)))
+        {
+            return 0;
+        }
+        length += (uint32_t)written;
+    }
+
+    return length;
+}
+
+/**
+ * @brief  Completes a configuration write interrupted between the removal
+ *         of the old file and the rename of the new one: the temporary file
+ *         is only renamed once it is complete.
+ */
+static void file_recoverConfig(const char* filePath)
+{
+    char tmpFilePath[64];
+    FILINFO info;
+
+    snprintf(tmpFilePath, sizeof(tmpFilePath), "%s.tmp", filePath);
+
+    if ((f_stat(filePath, &info) == FR_NO_FILE) && (f_stat(tmpFilePath, &info) == FR_OK))
+    {
+        f_rename(tmpFilePath, filePath);
+    }
 }
 
 /**
  * @brief  Writes the shared configuration data to a file.
- *         This function creates or overwrites the specified file and writes
- *         the configuration parameters in a key-value format.
+ *         The whole file is built in memory, one key-value line per entry
+ *         of `configKeys`, written to a temporary file, then renamed over
+ *         the previous one.
  *
  * @param  filePath  Path to the configuration file.
  * @param  config    Pointer to the shared configuration structure.
@@ -192,42 +433,42 @@ fileManager_StatusTypeDef file_writeConfig(const char* filePath, const volatile
 {
     FIL file;
     FRESULT fr;
+    UINT bw;
+    char text[CONFIG_FILE_MAX_SIZE + 1];
+    char tmpFilePath[64];
 
-    // Open the file in write mode (overwrite if exists)
-    fr = f_open(&file, filePath, FA_WRITE | FA_CREATE_ALWAYS);
+    // Build the whole file first
+    uint32_t length = file_formatConfig(config, text);
+    if (length == 0)
+    {
+        return FILEMANAGER_ERROR;
+    }
+
+    // Write it to a temporary file, the current one stays valid meanwhile
+    snprintf(tmpFilePath, sizeof(tmpFilePath), "%s.tmp", filePath);
+    fr = f_open(&file, tmpFilePath, FA_WRITE | FA_CREATE_ALWAYS);
     if (fr != FR_OK)
     {
         return FILEMANAGER_ERROR;
     }
 
-    // Write configuration parameters to the file
-    f_printf(&file, "UI_BUTTON_DELAY=%lu\n", config->ui_button_delay);
-    f_printf(&file, "NETWORK_IP_ADDR0=%u\n", config->network_ip[0]);
-    f_printf(&file, "NETWORK_IP_ADDR1=%u\n", config->network_ip[1]);
-    f_printf(&file, "NETWORK_IP_ADDR2=%u\n", config->network_ip[2]);
-    f_printf(&file, "NETWORK_IP_ADDR3=%u\n", config->network_ip[3]);
-    f_printf(&file, "NETWORK_NETMASK_ADDR0=%u\n", config->network_netmask[0]);
-    f_printf(&file, "NETWORK_NETMASK_ADDR1=%u\n", config->network_netmask[1]);
-    f_printf(&file, "NETWORK_NETMASK_ADDR2=%u\n", config->network_netmask[2]);
-    f_printf(&file, "NETWORK_NETMASK_ADDR3=%u\n", config->network_netmask[3]);
-    f_printf(&file, "NETWORK_GW_ADDR0=%u\n", config->network_gw[0]);
-    f_printf(&file, "NETWORK_GW_ADDR1=%u\n", config->network_gw[1]);
-    f_printf(&file, "NETWORK_GW_ADDR2=%u\n", config->network_gw[2]);
-    f_printf(&file, "NETWORK_GW_ADDR3=%u\n", config->network_gw[3]);
-    f_printf(&file, "NETWORK_DEST_IP_ADDR0=%u\n", config->network_dest_ip[0]);
-    f_printf(&file, "NETWORK_DEST_IP_ADDR1=%u\n", config->network_dest_ip[1]);
-    f_printf(&file, "NETWORK_DEST_IP_ADDR2=%u\n", config->network_dest_ip[2]);
-    f_printf(&file, "NETWORK_DEST_IP_ADDR3=%u\n", config->network_dest_ip[3]);
-    f_printf(&file, "NETWORK_UDP_PORT=%u\n", config->network_udp_port);
-    f_printf(&file, "NETWORK_TCP_PORT=%u\n", config->network_tcp_port);
-    f_printf(&file, "CIS_PRINT_CALIBRATION=%u\n", config->cis_print_calibration);
-    f_printf(&file, "CIS_DPI=%u\n", config->cis_dpi);
-    f_printf(&file, "CIS_CLK_FREQ=%lu\n", config->cis_clk_freq);
-    f_printf(&file, "CIS_OVERSAMPLING=%u\n", config->cis_oversampling);
-    f_printf(&file, "CIS_HANDEDNESS=%u\n", config->cis_handedness);
+    fr = f_write(&file, text, length, &bw);
+    if ((f_close(&file) != FR_OK) || (fr != FR_OK) || (bw != length))
+    {
+        f_unlink(tmpFilePath);
+        return FILEMANAGER_ERROR;
+    }
+
+    // Replace the file, file_recoverConfig() completes this after a power loss
+    f_unlink(filePath);
+    if (f_rename(tmpFilePath, filePath) != FR_OK)
+    {
+        return FILEMANAGER_ERROR;
+    }
+
+    // The snapshot now describes the new file
+    file_storeConfigSnapshot(config, length, STM32Crc_compute(text, length));
 
-    // Close the file
-    f_close(&file);
     return FILEMANAGER_OK;
 }
 
@@ -348,8 +589,8 @@ fileManager_StatusTypeDef file_initConfig(volatile struct shared_config* config)
         printf("FS mount SUCCESS\n");
     }
 
-    // Attempt to read the configuration file
-    if (file_readConfig(CONFIG_FILE_PATH, config) != 0)
+    // Attempt to load the configuration, parsing the file only if it changed
+    if (file_loadConfig(CONFIG_FILE_PATH, config) != 0)
     {
         printf("Failed to read configuration file\n");
 
@@ -451,57 +692,6 @@ fileManager_StatusTypeDef file_readCisCals(const char* filePath, struct cisCals*
     return FILEMANAGER_OK;
 }
 
-/**
- * @brief Computes CRC over a memory buffer in streaming mode using STM32H7 hardware CRC.
- *
- * This function:
- *  - Resets the CRC Data Register for a new calculation
- *  - Processes data in small chunks (CHUNK_SIZE)
- *  - Feeds each chunk to HAL_CRC_Accumulate()
- *  - Returns the final CRC value
- *
- * @param hcrc      Pointer to the CRC_HandleTypeDef
- * @param pData     Pointer to the data in memory
- * @param length    Number of bytes to compute CRC over
- * @return 32-bit CRC result as configured by hcrc.Init parameters, or 0 if error
- */
-static uint32_t file_computeCRC_buffer(CRC_HandleTypeDef *hcrc, const uint8_t *pData, uint32_t length)
-{
-    // Reset the CRC Data Register for a new calculation
-    __HAL_CRC_DR_RESET(hcrc);
-
-    uint32_t totalProcessed = 0;
-    uint32_t crcVal = 0;
-
-    while (totalProcessed < length)
-    {
-        // Determine how many bytes in this chunk
-        uint32_t chunkLen = (length - totalProcessed < CHUNK_SIZE)
-                            ? (length - totalProcessed)
-                            : CHUNK_SIZE;
-
-        // Round up chunkLen to a multiple of 4
-        uint32_t remainder = chunkLen % 4U;
-        uint32_t wordAlignedSize = chunkLen + (remainder ? (4U - remainder) : 0U);
-
-        // Create a small temp buffer
-        uint8_t tempBuf[CHUNK_SIZE + 3]; // +3 to handle up to 3 bytes of padding
-        memcpy(tempBuf, pData + totalProcessed, chunkLen);
-
-        // Pad leftover bytes with 0x00
-        memset(tempBuf + chunkLen, 0, wordAlignedSize - chunkLen);
-
-        // Accumulate
-        // The return value after each call is the running CRC so far
-        crcVal = HAL_CRC_Accumulate(hcrc, (uint32_t *)tempBuf, wordAlignedSize / 4U);
-
-        totalProcessed += chunkLen;
-    }
-
-    // crcVal is the final CRC
-    return crcVal;
-}
-
 /**
  * @brief  Reliably writes data to a file with CRC verification and retries.
  *         This function writes a data block to the file, flushes it, and then
@@ -522,8 +712,8 @@ fileManager_StatusTypeDef file_reliableWrite(FIL *file, const uint8_t *buffer, u
     UINT bytesRead;
     DWORD currentPos;
 
-    // 1) Compute CRC of the source buffer in streaming mode
-    uint32_t originalCRC = file_computeCRC_buffer(&hcrc, buffer, length);
+    // 1) Compute CRC of the source buffer, fed to the CRC unit in place
+    uint32_t originalCRC = STM32Crc_compute(buffer, length);
 
     // 2) Remember current position
     currentPos = f_tell(file);
@@ -558,14 +748,13 @@ fileManager_StatusTypeDef file_reliableWrite(FIL *file, const uint8_t *buffer, u
                     // 6) Read back in chunks, accumulate CRC
                     //    We will perform a streaming CRC on the read data
                     uint32_t totalRead = 0;
-                    uint32_t readCRC = 0;
+                    STM32Crc_Context readCRC;
 
-                    // Reset CRC hardware for new accumulation
-                    __HAL_CRC_DR_RESET(&hcrc);
+                    STM32Crc_begin(&readCRC);
 
                     while (totalRead < length)
                     {
-                        uint8_t verifyBuf[CHUNK_SIZE + 3];
+                        uint8_t verifyBuf[CHUNK_SIZE] __attribute__((aligned(32)));
                         UINT chunkSize = (length - totalRead < CHUNK_SIZE)
                                             ? (length - totalRead)
                                             : CHUNK_SIZE;
@@ -578,15 +767,8 @@ fileManager_StatusTypeDef file_reliableWrite(FIL *file, const uint8_t *buffer, u
                             break;
                         }
 
-                        // Round up to a multiple of 4
-                        uint32_t remainder = chunkSize % 4U;
-                        uint32_t wordAlignedSize = chunkSize + (remainder ? (4U - remainder) : 0U);
-
-                        // Pad leftover bytes
-                        memset(verifyBuf + chunkSize, 0, wordAlignedSize - chunkSize);
-
                         // Accumulate the chunk's CRC
-                        readCRC = HAL_CRC_Accumulate(&hcrc, (uint32_t *)verifyBuf, wordAlignedSize / 4U);
+                        STM32Crc_update(&readCRC, verifyBuf, chunkSize);
 
                         totalRead += chunkSize;
                     }
@@ -594,7 +776,7 @@ fileManager_StatusTypeDef file_reliableWrite(FIL *file, const uint8_t *buffer, u
                     if ((fres == FR_OK) && (totalRead == length))
                     {
                         // Compare CRC
-                        if (readCRC == originalCRC)
+                        if (STM32Crc_value(&readCRC) == originalCRC)
                         {
                             // 7) All good; move pointer after the written block
                             f_lseek(file, currentPos + length);
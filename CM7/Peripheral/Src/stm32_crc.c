@@ -0,0 +1,399 @@
+/**
+ ******************************************************************************
+ * @file           : stm32_crc.c
+ * @brief          : CRC-32 (zlib convention) shared by the update, the
+ *                   package reader and the file manager.
+ *                   Word-aligned input is fed to the CRC unit by the MDMA
+ *                   straight from the caller's buffer; the unaligned head
+ *                   and tail bytes are written in byte mode, so nothing is
+ *                   copied or padded. STM32Crc_start() returns while the
+ *                   MDMA runs, so the caller can read the next chunk in the
+ *                   meantime.
+ *                   A bit-exact slice-by-8 software CRC serves host builds,
+ *                   and the target before the CRC unit is set up
+ *                   (STM32Crc_computeSoftware()).
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdio.h"
+#include "stdbool.h"
+
+#include "stm32_crc.h"
+
+#ifndef STM32CRC_SOFTWARE
+#include "main.h"
+#include "crc.h"
+#endif
+
+/* Private define ------------------------------------------------------------*/
+#define CRC_POLYNOMIAL      0xEDB88320U     // Reflected CRC-32 polynomial
+
+#ifndef STM32CRC_SOFTWARE
+#define CRC_DMA_CHANNEL     MDMA_Channel0
+#define CRC_DMA_CHUNK       32768U          // Bytes per MDMA transfer, at most 65536
+#define CRC_DMA_TIMEOUT     100U            // Milliseconds per transfer
+#define CRC_INIT_DEFAULT    0xFFFFFFFFU
+#define CRC_REV_IN_BYTE     CRC_CR_REV_IN_0 // Configuration of crc.c, for byte writes
+#define CRC_REV_IN_WORD     CRC_CR_REV_IN   // Little-endian words in memory order
+#endif
+
+/* Private variables ---------------------------------------------------------*/
+static uint32_t crcTable[8][256];
+static bool crcTableReady;
+
+#ifndef STM32CRC_SOFTWARE
+static MDMA_HandleTypeDef hmdma;
+static bool dmaReady;
+
+/* Stream whose state is in the CRC unit while the MDMA feeds it, else NULL */
+static STM32Crc_Context *owner;
+static const uint8_t *dmaNext;          // Start of the transfer in progress
+static uint32_t dmaChunk;               // Bytes of the transfer in progress
+static uint32_t dmaRemaining;           // Word bytes left, transfer in progress included
+static uint32_t dmaChunkState;          // CRC unit output before the transfer in progress
+static const uint8_t *tailData;         // Bytes to write once the MDMA is done
+static uint32_t tailLength;
+#endif
+
+/* Private function prototypes -----------------------------------------------*/
+static void STM32Crc_buildTable(void);
+static uint32_t STM32Crc_software(uint32_t crc, const uint8_t *data, uint32_t length);
+
+#ifndef STM32CRC_SOFTWARE
+static void STM32Crc_load(uint32_t state);
+static void STM32Crc_feedBytes(const uint8_t *data, uint32_t length);
+static void STM32Crc_feedWords(const uint8_t *data, uint32_t length);
+static void STM32Crc_startChunk(void);
+static void STM32Crc_finish(void);
+#endif
+
+/**
+ * @brief  Prepares the MDMA channel feeding the CRC unit.
+ *         Must be called after MX_CRC_Init(). Without it every input is fed
+ *         by the CPU.
+ */
+void STM32Crc_init(void)
+{
+#ifdef STM32CRC_SOFTWARE
+    STM32Crc_buildTable();
+#else
+    __HAL_RCC_MDMA_CLK_ENABLE();
+
+    hmdma.Instance = CRC_DMA_CHANNEL;
+    hmdma.Init.Request = MDMA_REQUEST_SW;
+    hmdma.Init.TransferTriggerMode = MDMA_FULL_TRANSFER;
+    hmdma.Init.Priority = MDMA_PRIORITY_HIGH;
+    hmdma.Init.Endianness = MDMA_LITTLE_ENDIANNESS_PRESERVE;
+    hmdma.Init.SourceInc = MDMA_SRC_INC_WORD;
+    hmdma.Init.DestinationInc = MDMA_DEST_INC_DISABLE;
+    hmdma.Init.SourceDataSize = MDMA_SRC_DATASIZE_WORD;
+    hmdma.Init.DestDataSize = MDMA_DEST_DATASIZE_WORD;
+    hmdma.Init.DataAlignment = MDMA_DATAALIGN_PACKENABLE;
+    hmdma.Init.BufferTransferLength = 128;
+    hmdma.Init.SourceBurst = MDMA_SOURCE_BURST_SINGLE;
+    hmdma.Init.DestBurst = MDMA_DEST_BURST_SINGLE;
+    hmdma.Init.SourceBlockAddressOffset = 0;
+    hmdma.Init.DestBlockAddressOffset = 0;
+
+    if (HAL_MDMA_Init(&hmdma) != HAL_OK)
+    {
+        printf("Warning: CRC MDMA init failed, CRC fed by the CPU\n");
+        return;
+    }
+
+    dmaReady = true;
+#endif
+}
+
+/**
+ * @brief  Starts a new CRC-32 stream.
+ */
+void STM32Crc_begin(STM32Crc_Context *context)
+{
+    context->crc = 0;
+}
+
+/**
+ * @brief  Starts feeding a buffer to a stream and returns without waiting
+ *         for the MDMA. Any transfer of another stream is completed first.
+ * @param  context Stream, must stay valid until STM32Crc_value().
+ * @param  data    Input, must stay valid and unchanged until the next call
+ *                 of this driver.
+ * @param  length  Number of bytes.
+ */
+void STM32Crc_start(STM32Crc_Context *context, const void *data, uint32_t length)
+{
+#ifdef STM32CRC_SOFTWARE
+    context->crc = STM32Crc_software(context->crc, (const uint8_t *)data, length);
+#else
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint32_t head = (4U - ((uint32_t)bytes & 3U)) & 3U;
+
+    STM32Crc_finish();
+
+    if (head > length)
+    {
+        head = length;
+    }
+
+    uint32_t words = (length - head) & ~3U;
+
+    STM32Crc_load(~context->crc);
+    STM32Crc_feedBytes(bytes, head);
+
+    if (!dmaReady || (words < STM32CRC_DMA_THRESHOLD))
+    {
+        STM32Crc_feedWords(bytes + head, words);
+        STM32Crc_feedBytes(bytes + head + words, length - head - words);
+        context->crc = CRC->DR ^ 0xFFFFFFFFU;
+        return;
+    }
+
+    // The MDMA reads memory, not the data cache
+    uint32_t start = ((uint32_t)bytes + head) & ~31U;
+    uint32_t end = (uint32_t)bytes + head + words;
+    SCB_CleanDCache_by_Addr((uint32_t *)start, (int32_t)(end - start));
+
+    owner = context;
+    dmaNext = bytes + head;
+    dmaRemaining = words;
+    tailData = bytes + head + words;
+    tailLength = length - head - words;
+
+    STM32Crc_startChunk();
+#endif
+}
+
+/**
+ * @brief  Feeds a buffer to a stream and waits for the result.
+ */
+void STM32Crc_update(STM32Crc_Context *context, const void *data, uint32_t length)
+{
+    STM32Crc_start(context, data, length);
+#ifndef STM32CRC_SOFTWARE
+    STM32Crc_finish();
+#endif
+}
+
+/**
+ * @brief  Returns the CRC-32 of everything fed to a stream so far.
+ *         The stream may be fed further afterwards.
+ */
+uint32_t STM32Crc_value(STM32Crc_Context *context)
+{
+#ifndef STM32CRC_SOFTWARE
+    if (owner == context)
+    {
+        STM32Crc_finish();
+    }
+#endif
+
+    return context->crc;
+}
+
+/**
+ * @brief  Computes the CRC-32 of a buffer.
+ */
+uint32_t STM32Crc_compute(const void *data, uint32_t length)
+{
+    STM32Crc_Context context;
+
+    STM32Crc_begin(&context);
+    STM32Crc_update(&context, data, length);
+
+    return context.crc;
+}
+
+/**
+ * @brief  Computes the CRC-32 of a buffer with the CPU only.
+ *         Usable right after reset, before the CRC unit is initialized, for
+ *         the small records read on the way to the firmware.
+ */
+uint32_t STM32Crc_computeSoftware(const void *data, uint32_t length)
+{
+    return STM32Crc_software(0, (const uint8_t *)data, length);
+}
+
+/**
+ * @brief  Fills the slice-by-8 tables: crcTable[k][n] is the CRC of byte n
+ *         followed by k zero bytes.
+ */
+static void STM32Crc_buildTable(void)
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = n;
+
+        for (uint32_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1U) ? (CRC_POLYNOMIAL ^ (crc >> 1)) : (crc >> 1);
+        }
+        crcTable[0][n] = crc;
+    }
+
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = crcTable[0][n];
+
+        for (uint32_t k = 1; k < 8; k++)
+        {
+            crc = crcTable[0][crc & 0xFFU] ^ (crc >> 8);
+            crcTable[k][n] = crc;
+        }
+    }
+
+    crcTableReady = true;
+}
+
+/**
+ * @brief  Continues a CRC-32 over a buffer, eight bytes per step.
+ */
+static uint32_t STM32Crc_software(uint32_t crc, const uint8_t *data, uint32_t length)
+{
+    if (!crcTableReady)
+    {
+        STM32Crc_buildTable();
+    }
+
+    crc = ~crc;
+
+    while (length >= 8)
+    {
+        uint32_t low = crc ^ ((uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+                              ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24));
+        uint32_t high = (uint32_t)data[4] | ((uint32_t)data[5] << 8) |
+                        ((uint32_t)data[6] << 16) | ((uint32_t)data[7] << 24);
+
+        crc = crcTable[7][low & 0xFFU] ^ crcTable[6][(low >> 8) & 0xFFU] ^
+              crcTable[5][(low >> 16) & 0xFFU] ^ crcTable[4][low >> 24] ^
+              crcTable[3][high & 0xFFU] ^ crcTable[2][(high >> 8) & 0xFFU] ^
+              crcTable[1][(high >> 16) & 0xFFU] ^ crcTable[0][high >> 24];
+
+        data += 8;
+        length -= 8;
+    }
+
+    while (length-- > 0)
+    {
+        crc = crcTable[0][(crc ^ *data++) & 0xFFU] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+#ifndef STM32CRC_SOFTWARE
+
+/**
+ * @brief  Loads the CRC unit with a saved state, as read from its output.
+ *         The output is bit-reversed, the INIT register is not.
+ */
+static void STM32Crc_load(uint32_t state)
+{
+    CRC->INIT = __RBIT(state);
+    SET_BIT(CRC->CR, CRC_CR_RESET);
+    CRC->INIT = CRC_INIT_DEFAULT;
+}
+
+/**
+ * @brief  Feeds bytes one by one.
+ */
+static void STM32Crc_feedBytes(const uint8_t *data, uint32_t length)
+{
+    MODIFY_REG(CRC->CR, CRC_CR_REV_IN, CRC_REV_IN_BYTE);
+
+    while (length-- > 0)
+    {
+        *(__IO uint8_t *)&CRC->DR = *data++;
+    }
+}
+
+/**
+ * @brief  Feeds word-aligned words with the CPU.
+ */
+static void STM32Crc_feedWords(const uint8_t *data, uint32_t length)
+{
+    const uint32_t *words = (const uint32_t *)data;
+
+    MODIFY_REG(CRC->CR, CRC_CR_REV_IN, CRC_REV_IN_WORD);
+
+    for (uint32_t i = 0; i < length / 4U; i++)
+    {
+        CRC->DR = words[i];
+    }
+
+    MODIFY_REG(CRC->CR, CRC_CR_REV_IN, CRC_REV_IN_BYTE);
+}
+
+/**
+ * @brief  Hands the next chunk of the current stream to the MDMA.
+ *         If the MDMA refuses it, the chunk is fed by the CPU.
+ */
+static void STM32Crc_startChunk(void)
+{
+    while (dmaRemaining > 0)
+    {
+        dmaChunk = (dmaRemaining > CRC_DMA_CHUNK) ? CRC_DMA_CHUNK : dmaRemaining;
+        dmaChunkState = CRC->DR;
+
+        MODIFY_REG(CRC->CR, CRC_CR_REV_IN, CRC_REV_IN_WORD);
+
+        if (HAL_MDMA_Start(&hmdma, (uint32_t)dmaNext, (uint32_t)&CRC->DR, dmaChunk, 1) == HAL_OK)
+        {
+            return;
+        }
+
+        STM32Crc_feedWords(dmaNext, dmaChunk);
+        dmaNext += dmaChunk;
+        dmaRemaining -= dmaChunk;
+        dmaChunk = 0;
+    }
+}
+
+/**
+ * @brief  Waits for the MDMA transfers of the current stream, writes its
+ *         tail bytes and saves its state.
+ *         A failed transfer is fed again by the CPU from the state saved
+ *         before it started.
+ */
+static void STM32Crc_finish(void)
+{
+    if (owner == NULL)
+    {
+        return;
+    }
+
+    while (dmaChunk > 0)
+    {
+        if (HAL_MDMA_PollForTransfer(&hmdma, HAL_MDMA_FULL_TRANSFER, CRC_DMA_TIMEOUT) != HAL_OK)
+        {
+            printf("Warning: CRC MDMA transfer failed, fed by the CPU\n");
+            HAL_MDMA_Abort(&hmdma);
+            STM32Crc_load(dmaChunkState);
+            STM32Crc_feedWords(dmaNext, dmaChunk);
+        }
+
+        dmaNext += dmaChunk;
+        dmaRemaining -= dmaChunk;
+        dmaChunk = 0;
+
+        STM32Crc_startChunk();
+    }
+
+    STM32Crc_feedBytes(tailData, tailLength);
+
+    owner->crc = CRC->DR ^ 0xFFFFFFFFU;
+    owner = NULL;
+}
+
+#endif
@@ -21,26 +21,33 @@
 #include "stdlib.h"
 #include "stdio.h"
 #include "stdbool.h"
+#include "stddef.h"
+#include "string.h"
 
 #include "arm_math.h"
 
 #include "crc.h"
 
+#include "stm32_crc.h"
 #include "stm32_flash.h"
+#include "persistent_data.h"
 
 /* Private define ------------------------------------------------------------*/
+#define FLASH_PROGRAM_TIMEOUT   100U    // ms, a flash word takes a few tens of microseconds
+
+/* Persistent data log, see persistent_data.h */
+#define PERSISTENT_LOG_ADDR     (FLASH_PERSISTENT_DATA_ADDRESS + STM32FLASH_WORD_SIZE)
+#define PERSISTENT_END_ADDR     (FLASH_PERSISTENT_DATA_ADDRESS + FLASH_SECTOR_SIZE)
 
 /* Private variables ---------------------------------------------------------*/
 bool update_requested = false;
 
-typedef struct
-{
-    FW_UpdateState updateState;     //(4 bytes)
-    uint8_t padding[24];            // for 32 bytes alignment
-} PersistentData;
-
 /* Private function prototypes -----------------------------------------------*/
-static uint32_t STM32Flash_computeCRC(const uint8_t *data, uint32_t length);
+static STM32Flash_StatusTypeDef STM32Flash_sessionProgramWord(STM32Flash_Session *session, const uint8_t *word);
+static void STM32Flash_invalidateCache(uint32_t flashAddress, uint32_t length);
+static bool STM32Flash_isErased(uint32_t flashAddress);
+static void STM32Flash_scanPersistentData(PersistentData_Record *current, uint32_t *nextAddress);
+static STM32Flash_StatusTypeDef STM32Flash_appendPersistentData(PersistentData_Record *record, uint32_t address);
 
 /**
  * @brief  Gets the sector of a given address.
@@ -91,15 +98,59 @@ uint32_t stm32Flash_getSector(uint32_t Address)
  */
 STM32Flash_StatusTypeDef STM32Flash_readPersistentData(FW_UpdateState* state)
 {
+    PersistentData_Record current;
+
     if (state == NULL)
     {
         return STM32FLASH_ERROR; // Return error if the input pointer is invalid
     }
 
-    const uint32_t flashAddress = FLASH_PERSISTENT_DATA_ADDRESS;
-    const FW_UpdateState* flashState = (const FW_UpdateState*)flashAddress;
+    STM32Flash_scanPersistentData(&current, NULL);
+
+    *state = current.updateState;
+    return STM32FLASH_OK;
+}
+
+/**
+ * @brief  Reads the A/B slot under test from the flash memory.
+ * @param  trialSlot Pointer to fill, STM32FLASH_NO_SLOT if none was written.
+ * @retval STM32Flash_StatusTypeDef Status of the flash operation.
+ */
+STM32Flash_StatusTypeDef STM32Flash_readPersistentTrial(uint32_t* trialSlot)
+{
+    PersistentData_Record current;
+
+    if (trialSlot == NULL)
+    {
+        return STM32FLASH_ERROR;
+    }
+
+    STM32Flash_scanPersistentData(&current, NULL);
 
-    *state = *flashState;
+    *trialSlot = current.trialSlot;
+    return STM32FLASH_OK;
+}
+
+/**
+ * @brief  Reads the whole persistent data: state, sequence and session.
+ * @param  state Pointer to the structure to fill.
+ * @retval STM32Flash_StatusTypeDef Status of the flash operation.
+ */
+STM32Flash_StatusTypeDef STM32Flash_readPersistentState(STM32Flash_PersistentState* state)
+{
+    PersistentData_Record current;
+
+    if (state == NULL)
+    {
+        return STM32FLASH_ERROR;
+    }
+
+    STM32Flash_scanPersistentData(&current, NULL);
+
+    state->updateState = current.updateState;
+    state->trialSlot = current.trialSlot;
+    state->sequence = current.sequence;
+    state->session = current.session;
     return STM32FLASH_OK;
 }
 
@@ -109,18 +160,96 @@ STM32Flash_StatusTypeDef STM32Flash_readPersistentData(FW_UpdateState* state)
  * @retval STM32Flash_StatusTypeDef.
  */
 STM32Flash_StatusTypeDef STM32Flash_writePersistentData(FW_UpdateState updateState)
+{
+    return STM32Flash_writePersistentTrial(updateState, STM32FLASH_NO_SLOT);
+}
+
+/**
+ * @brief  Updates the firmware state in flash memory, with the A/B slot
+ *         the state applies to.
+ *         A record is appended to the log; the sector is only erased when
+ *         it is full, so a state change takes one flash word program.
+ *         Each state change opens a new session, which closes the update
+ *         journal of the previous one.
+ * @param  updateState The new firmware update state to be written.
+ * @param  trialSlot   Slot under test, STM32FLASH_NO_SLOT if none.
+ * @retval STM32Flash_StatusTypeDef.
+ */
+STM32Flash_StatusTypeDef STM32Flash_writePersistentTrial(FW_UpdateState updateState, uint32_t trialSlot)
+{
+    PersistentData_Record record;
+    uint32_t address;
+
+    STM32Flash_scanPersistentData(&record, &address);
+
+    record.updateState = updateState;
+    record.trialSlot = trialSlot;
+    record.session++;
+
+    return STM32Flash_appendPersistentData(&record, address);
+}
+
+/**
+ * @brief  Finds the current persistent data, see persistentData_find().
+ *         Without any record, the first word of the sector is the state,
+ *         as last written by the firmware.
+ * @param  current     Current data, filled.
+ * @param  nextAddress First free record, FLASH_PERSISTENT_DATA_ADDRESS + sector size if full. May be NULL.
+ */
+static void STM32Flash_scanPersistentData(PersistentData_Record *current, uint32_t *nextAddress)
+{
+    const PersistentData_Record *record;
+
+    // Records may have been programmed since the cache was filled
+    STM32Flash_invalidateCache(FLASH_PERSISTENT_DATA_ADDRESS, FLASH_SECTOR_SIZE);
+
+    record = persistentData_find(FLASH_PERSISTENT_DATA_ADDRESS, FLASH_SECTOR_SIZE, nextAddress);
+    if (record != NULL)
+    {
+        *current = *record;
+        return;
+    }
+
+    memset(current, 0, sizeof(*current));
+    current->updateState = *(const FW_UpdateState *)FLASH_PERSISTENT_DATA_ADDRESS;
+    current->trialSlot = STM32FLASH_NO_SLOT;
+}
+
+/**
+ * @brief  Appends a record to the persistent data log.
+ *         A full sector is erased first; the record carries the whole
+ *         current data, so nothing else needs to be copied.
+ *         Unless BOOT_PERSISTENT_LOG_ONLY is defined, word 0 is then made
+ *         to hold the new state too, see persistent_data.h.
+ * @param  record  Record to write, its magic, sequence and CRC are set here.
+ * @param  address First free record of the log.
+ */
+static STM32Flash_StatusTypeDef STM32Flash_appendPersistentData(PersistentData_Record *record, uint32_t address)
 {
     HAL_StatusTypeDef halStatus;
     FLASH_EraseInitTypeDef eraseInitStruct;
     uint32_t sectorError = 0;
-
-    const uint32_t flashAddress = FLASH_PERSISTENT_DATA_ADDRESS;
-
-    PersistentData dataToWrite =
+    PersistentData_Record dataToWrite __attribute__((aligned(32)));
+    bool mirror = false;
+
+    record->magic = PERSISTENT_DATA_MAGIC;
+    record->sequence++;
+    record->crc = STM32Crc_computeSoftware(record, offsetof(PersistentData_Record, crc));
+    dataToWrite = *record;
+
+#ifndef BOOT_PERSISTENT_LOG_ONLY
+    // Deployed firmware reads the state from word 0, which can only be
+    // programmed once: a state it does not hold restarts the log on an
+    // erased sector, unless word 0 is still blank
+    if (*(const FW_UpdateState *)FLASH_PERSISTENT_DATA_ADDRESS != record->updateState)
     {
-        .updateState = updateState,
-        .padding = {0}
-    };
+        mirror = true;
+        if (!STM32Flash_isErased(FLASH_PERSISTENT_DATA_ADDRESS))
+        {
+            address = PERSISTENT_END_ADDR;
+        }
+    }
+#endif
 
     // Unlock the Flash memory
     halStatus = HAL_FLASH_Unlock();
@@ -129,34 +258,47 @@ STM32Flash_StatusTypeDef STM32Flash_writePersistentData(FW_UpdateState updateSta
         return STM32FLASH_ERROR;
     }
 
-    // Configure sector erase
-    eraseInitStruct.TypeErase     = FLASH_TYPEERASE_SECTORS;
-    eraseInitStruct.Sector        = stm32Flash_getSector(flashAddress);
-    eraseInitStruct.NbSectors     = 1;
-    eraseInitStruct.Banks         = FLASH_BANK_1;
-    eraseInitStruct.VoltageRange  = FLASH_VOLTAGE_RANGE_3;
-
-    // Erase the sector
-    halStatus = HAL_FLASHEx_Erase(&eraseInitStruct, &sectorError);
-    if (halStatus != HAL_OK)
+    if (address >= PERSISTENT_END_ADDR)
     {
-        HAL_FLASH_Lock();
-        return STM32FLASH_ERROR;
+        // Configure sector erase
+        eraseInitStruct.TypeErase     = FLASH_TYPEERASE_SECTORS;
+        eraseInitStruct.Sector        = stm32Flash_getSector(FLASH_PERSISTENT_DATA_ADDRESS);
+        eraseInitStruct.NbSectors     = 1;
+        eraseInitStruct.Banks         = FLASH_BANK_1;
+        eraseInitStruct.VoltageRange  = FLASH_VOLTAGE_RANGE_3;
+
+        // Erase the sector
+        halStatus = HAL_FLASHEx_Erase(&eraseInitStruct, &sectorError);
+        if (halStatus != HAL_OK)
+        {
+            HAL_FLASH_Lock();
+            return STM32FLASH_ERROR;
+        }
+
+        // Word 0 reads erased, FW_UPDATE_DONE, until it is mirrored below
+        address = PERSISTENT_LOG_ADDR;
     }
 
     // Write the data
-    uint32_t* pData = (uint32_t*)&dataToWrite;
-    halStatus = HAL_FLASH_Program(FLASH_TYPEPROGRAM_FLASHWORD, flashAddress, (uint32_t)pData);
-    if (halStatus != HAL_OK)
+    halStatus = HAL_FLASH_Program(FLASH_TYPEPROGRAM_FLASHWORD, address, (uint32_t)&dataToWrite);
+    STM32Flash_invalidateCache(address, sizeof(PersistentData_Record));
+
+    // The record goes first: a power loss in between leaves the bootloader
+    // with the new state and the firmware with a blank word 0.
+    // FW_UPDATE_DONE is the erased value, word 0 is left blank for it.
+    if ((halStatus == HAL_OK) && mirror && (record->updateState != FW_UPDATE_DONE))
     {
-        HAL_FLASH_Lock();
-        return STM32FLASH_ERROR;
+        memset(&dataToWrite, 0xFF, sizeof(dataToWrite));
+        memcpy(&dataToWrite, &record->updateState, sizeof(record->updateState));
+
+        halStatus = HAL_FLASH_Program(FLASH_TYPEPROGRAM_FLASHWORD, FLASH_PERSISTENT_DATA_ADDRESS, (uint32_t)&dataToWrite);
+        STM32Flash_invalidateCache(FLASH_PERSISTENT_DATA_ADDRESS, STM32FLASH_WORD_SIZE);
     }
 
     // Lock the Flash memory
     HAL_FLASH_Lock();
 
-    return STM32FLASH_OK;
+    return (halStatus == HAL_OK) ? STM32FLASH_OK : STM32FLASH_ERROR;
 }
 
 /**
@@ -167,39 +309,200 @@ STM32Flash_StatusTypeDef STM32Flash_writePersistentData(FW_UpdateState updateSta
  */
 STM32Flash_StatusTypeDef STM32Flash_write32B(const uint8_t* data, uint32_t address)
 {
+    STM32Flash_Session session;
+
     // Check alignments
     if ((address % 32) != 0 || (((uint32_t)data) % 32) != 0) {
         printf("Alignment error: address=0x%08lx, data=0x%08lx\n", address, (uint32_t)data);
         return STM32FLASH_ERROR;
     }
 
-    // Unlock flash memory
-    HAL_StatusTypeDef halStatus = HAL_FLASH_Unlock();
-    if (halStatus != HAL_OK) {
-        printf("Failed to unlock FLASH\n");
+    if (STM32Flash_sessionOpen(&session, address, STM32FLASH_WORD_SIZE) != STM32FLASH_OK) {
         return STM32FLASH_ERROR;
     }
 
-    // Clear flash error flags
-    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS_BANK1);
-    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS_BANK2);
+    STM32Flash_sessionWrite(&session, data, STM32FLASH_WORD_SIZE);
 
-    // Write to flash memory
-    halStatus = HAL_FLASH_Program(FLASH_TYPEPROGRAM_FLASHWORD, address, (uint32_t)data);
-    if (halStatus != HAL_OK) {
-        uint32_t error = HAL_FLASH_GetError();
-        printf("FLASH programming error: 0x%08lx at address 0x%08lx\n", error, address);
-        HAL_FLASH_Lock();
+    return STM32Flash_sessionClose(&session);
+}
+
+/**
+ * @brief  Opens a programming session over an erased flash region.
+ *         Only the bank holding the region is unlocked, and it stays unlocked
+ *         with PG set until STM32Flash_sessionClose() is called.
+ * @param  session Session to initialize.
+ * @param  address Start of the region (must be aligned to 32 bytes).
+ * @param  size    Size of the region in bytes, within a single bank.
+ * @retval STM32FLASH_OK if the bank is ready for programming.
+ */
+STM32Flash_StatusTypeDef STM32Flash_sessionOpen(STM32Flash_Session *session, uint32_t address, uint32_t size)
+{
+    session->open = false;
+    session->status = STM32FLASH_ERROR;
+    session->staged = 0;
+    session->errorAddress = 0;
+    session->errorFlags = 0;
+
+    if ((address % STM32FLASH_WORD_SIZE) != 0) {
+        printf("Alignment error: address=0x%08lx\n", address);
         return STM32FLASH_ERROR;
     }
 
-    // Lock flash memory
-    halStatus = HAL_FLASH_Lock();
-    if (halStatus != HAL_OK) {
-        printf("Failed to lock FLASH\n");
+    session->bank = (address >= ADDR_FLASH_SECTOR_0_BANK2) ? FLASH_BANK_2 : FLASH_BANK_1;
+    uint32_t bankEnd = (session->bank == FLASH_BANK_2) ? FLASH_END_ADDR : ADDR_FLASH_SECTOR_0_BANK2;
+
+    if ((address < ADDR_FLASH_SECTOR_0_BANK1) || (size > (bankEnd - address))) {
+        printf("Error: Flash region 0x%08lx (+%lu bytes) out of range\n", address, size);
         return STM32FLASH_ERROR;
     }
 
+    session->startAddress = address;
+    session->address = address;
+    session->endAddress = address + size;
+
+    __IO uint32_t *cr = (session->bank == FLASH_BANK_2) ? &FLASH->CR2 : &FLASH->CR1;
+    __IO uint32_t *keyr = (session->bank == FLASH_BANK_2) ? &FLASH->KEYR2 : &FLASH->KEYR1;
+
+    // Unlock this bank only, once for the whole session
+    if (READ_BIT(*cr, FLASH_CR_LOCK) != 0U) {
+        WRITE_REG(*keyr, FLASH_KEY1);
+        WRITE_REG(*keyr, FLASH_KEY2);
+        if (READ_BIT(*cr, FLASH_CR_LOCK) != 0U) {
+            printf("Failed to unlock FLASH\n");
+            return STM32FLASH_ERROR;
+        }
+    }
+
+    if (FLASH_WaitForLastOperation(FLASH_PROGRAM_TIMEOUT, session->bank) != HAL_OK) {
+        printf("FLASH bank %lu busy or in error\n", session->bank);
+    }
+
+    // Clear flash error flags of this bank
+    if (session->bank == FLASH_BANK_2) {
+        __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS_BANK2);
+    } else {
+        __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS_BANK1);
+    }
+
+    SET_BIT(*cr, FLASH_CR_PG);
+
+    session->status = STM32FLASH_OK;
+    session->open = true;
+
+    return STM32FLASH_OK;
+}
+
+/**
+ * @brief  Appends data to a programming session.
+ *         Complete flash words are programmed as soon as they are available,
+ *         straight from `data` when it is word aligned; the remainder is
+ *         staged until the next call or STM32Flash_sessionClose().
+ * @param  session Open session.
+ * @param  data    Data to program, any alignment.
+ * @param  length  Number of bytes, any length.
+ * @retval The session status: STM32FLASH_ERROR once any word has failed.
+ */
+STM32Flash_StatusTypeDef STM32Flash_sessionWrite(STM32Flash_Session *session, const uint8_t *data, uint32_t length)
+{
+    if (!session->open) {
+        return STM32FLASH_ERROR;
+    }
+
+    while ((length > 0) && (session->status == STM32FLASH_OK)) {
+        // Fast path, nothing staged and a whole word readable as 32-bit words
+        if ((session->staged == 0) && (length >= STM32FLASH_WORD_SIZE) && ((((uint32_t)data) % 4U) == 0)) {
+            STM32Flash_sessionProgramWord(session, data);
+            data += STM32FLASH_WORD_SIZE;
+            length -= STM32FLASH_WORD_SIZE;
+            continue;
+        }
+
+        uint32_t chunk = STM32FLASH_WORD_SIZE - session->staged;
+        if (chunk > length) {
+            chunk = length;
+        }
+
+        memcpy(&session->staging[session->staged], data, chunk);
+        session->staged += chunk;
+        data += chunk;
+        length -= chunk;
+
+        if (session->staged == STM32FLASH_WORD_SIZE) {
+            STM32Flash_sessionProgramWord(session, session->staging);
+            session->staged = 0;
+        }
+    }
+
+    return session->status;
+}
+
+/**
+ * @brief  Closes a programming session.
+ *         A partially staged flash word is padded with the erased value
+ *         (0xFF) and programmed, then the bank is locked again.
+ * @param  session Session to close.
+ * @retval STM32FLASH_OK if every word of the session was programmed.
+ */
+STM32Flash_StatusTypeDef STM32Flash_sessionClose(STM32Flash_Session *session)
+{
+    if (!session->open) {
+        return STM32FLASH_ERROR;
+    }
+
+    if ((session->staged > 0) && (session->status == STM32FLASH_OK)) {
+        memset(&session->staging[session->staged], 0xFF, STM32FLASH_WORD_SIZE - session->staged);
+        STM32Flash_sessionProgramWord(session, session->staging);
+        session->staged = 0;
+    }
+
+    __IO uint32_t *cr = (session->bank == FLASH_BANK_2) ? &FLASH->CR2 : &FLASH->CR1;
+
+    CLEAR_BIT(*cr, FLASH_CR_PG);
+    SET_BIT(*cr, FLASH_CR_LOCK);
+    session->open = false;
+
+    if (session->status != STM32FLASH_OK) {
+        printf("FLASH programming error: 0x%08lx at address 0x%08lx (session 0x%08lx - 0x%08lx)\n",
+               session->errorFlags, session->errorAddress, session->startAddress, session->endAddress);
+    }
+
+    return session->status;
+}
+
+/**
+ * @brief  Programs one flash word at the session position and waits for it.
+ *         The first failure is latched in the session.
+ */
+static STM32Flash_StatusTypeDef STM32Flash_sessionProgramWord(STM32Flash_Session *session, const uint8_t *word)
+{
+    if ((session->endAddress - session->address) < STM32FLASH_WORD_SIZE) {
+        printf("Error: Write past the end of the flash session at 0x%08lx\n", session->address);
+        session->status = STM32FLASH_ERROR;
+        session->errorAddress = session->address;
+        return STM32FLASH_ERROR;
+    }
+
+    __IO uint32_t *dest = (__IO uint32_t *)session->address;
+    const uint32_t *src = (const uint32_t *)word;
+
+    __ISB();
+    __DSB();
+
+    for (uint32_t i = 0; i < (STM32FLASH_WORD_SIZE / 4U); i++) {
+        dest[i] = src[i];
+    }
+
+    __ISB();
+    __DSB();
+
+    if (FLASH_WaitForLastOperation(FLASH_PROGRAM_TIMEOUT, session->bank) != HAL_OK) {
+        session->status = STM32FLASH_ERROR;
+        session->errorAddress = session->address;
+        session->errorFlags = HAL_FLASH_GetError();
+        return STM32FLASH_ERROR;
+    }
+
+    session->address += STM32FLASH_WORD_SIZE;
     return STM32FLASH_OK;
 }
 
@@ -238,113 +541,140 @@ STM32Flash_StatusTypeDef STM32Flash_erase_sector(uint32_t flashBank, uint32_t se
 }
 
 /**
- * @brief  Computes the CRC32 checksum of a given data buffer.
- *         This function processes data in 256-byte chunks (aligned to 4-byte words)
- *         to compute the CRC using the STM32 hardware CRC unit.
+ * @brief  Verifies a programmed flash range against its source in one pass.
+ *         The D-cache lines covering the range are invalidated first, so the
+ *         comparison reads the flash array and not lines cached before the
+ *         range was erased or programmed.
+ *         With `repair` set, each mismatching flash word that is still erased
+ *         is programmed again; a word already holding other data cannot be
+ *         rewritten without erasing its sector and fails the verification.
  *
- * @param  data   Pointer to the data buffer.
- * @param  length Length of the data buffer in bytes.
+ * @param  flashAddress Start of the range (must be aligned to 32 bytes).
+ * @param  data         Expected content.
+ * @param  length       Number of bytes to compare.
+ * @param  repair       Re-program erased words that do not match.
  *
- * @return Computed CRC32 value.
+ * @return STM32FLASH_OK if the flash matches the source, STM32FLASH_ERROR otherwise.
  */
-static uint32_t STM32Flash_computeCRC(const uint8_t *data, uint32_t length)
+STM32Flash_StatusTypeDef STM32Flash_verify(uint32_t flashAddress, const uint8_t *data, uint32_t length, bool repair)
 {
-    // Reset CRC for fresh calculation
-    __HAL_CRC_DR_RESET(&hcrc);
+    uint32_t repaired = 0;
+
+    if ((flashAddress % STM32FLASH_WORD_SIZE) != 0)
+    {
+        printf("Alignment error: address=0x%08lx\n", flashAddress);
+        return STM32FLASH_ERROR;
+    }
+
+    STM32Flash_invalidateCache(flashAddress, length);
 
-    uint32_t totalProcessed = 0;
-    uint32_t crcVal = 0;
+    // Common case, the whole range matches
+    if (memcmp((const void *)flashAddress, data, length) == 0)
+    {
+        return STM32FLASH_OK;
+    }
 
-    while (totalProcessed < length)
+    for (uint32_t offset = 0; offset < length; offset += STM32FLASH_WORD_SIZE)
     {
-        // Define chunk size (must be aligned to 4 bytes)
-        uint32_t chunkSize = 256U;
-        if ((length - totalProcessed) < chunkSize)
+        uint32_t address = flashAddress + offset;
+        uint32_t wordLength = ((length - offset) >= STM32FLASH_WORD_SIZE) ? STM32FLASH_WORD_SIZE : (length - offset);
+
+        if (memcmp((const void *)address, data + offset, wordLength) == 0)
         {
-            chunkSize = (length - totalProcessed);
+            continue;
+        }
+
+        if (!repair || !STM32Flash_isErased(address))
+        {
+            printf("Verify mismatch at flash address 0x%08lx\n", address);
+            return STM32FLASH_ERROR;
+        }
+
+        STM32Flash_Session session;
+        if (STM32Flash_sessionOpen(&session, address, STM32FLASH_WORD_SIZE) != STM32FLASH_OK)
+        {
+            return STM32FLASH_ERROR;
         }
+        STM32Flash_sessionWrite(&session, data + offset, wordLength);
+        if (STM32Flash_sessionClose(&session) != STM32FLASH_OK)
+        {
+            return STM32FLASH_ERROR;
+        }
+
+        STM32Flash_invalidateCache(address, STM32FLASH_WORD_SIZE);
+        if (memcmp((const void *)address, data + offset, wordLength) != 0)
+        {
+            printf("Verify mismatch at flash address 0x%08lx after re-programming\n", address);
+            return STM32FLASH_ERROR;
+        }
+
+        repaired++;
+    }
+
+    if (repaired > 0)
+    {
+        printf("Re-programmed %lu flash word(s) in range 0x%08lx - 0x%08lx\n", repaired, flashAddress, flashAddress + length);
+    }
 
-        // Round chunk size up to a multiple of 4 bytes
-        uint32_t remainder = chunkSize % 4U;
-        uint32_t wordAlignedSize = chunkSize + (remainder ? (4U - remainder) : 0U);
+    return STM32FLASH_OK;
+}
 
-        // Copy chunk to a temporary buffer and pad if needed
-        uint8_t tempBuf[256 + 3]; // Buffer large enough to accommodate padding
-        memcpy(tempBuf, data + totalProcessed, chunkSize);
-        memset(tempBuf + chunkSize, 0, wordAlignedSize - chunkSize);
+/**
+ * @brief  Invalidates the D-cache lines covering a flash range.
+ */
+static void STM32Flash_invalidateCache(uint32_t flashAddress, uint32_t length)
+{
+    uint32_t start = flashAddress & ~(__SCB_DCACHE_LINE_SIZE - 1U);
+    uint32_t end = (flashAddress + length + __SCB_DCACHE_LINE_SIZE - 1U) & ~(__SCB_DCACHE_LINE_SIZE - 1U);
 
-        // Accumulate CRC
-        crcVal = HAL_CRC_Accumulate(&hcrc, (uint32_t *)tempBuf, wordAlignedSize / 4U);
+    SCB_InvalidateDCache_by_Addr((void *)start, (int32_t)(end - start));
+}
 
-        totalProcessed += chunkSize;
+/**
+ * @brief  Tells whether a flash word still holds the erased value.
+ */
+static bool STM32Flash_isErased(uint32_t flashAddress)
+{
+    const uint32_t *word = (const uint32_t *)flashAddress;
+
+    for (uint32_t i = 0; i < (STM32FLASH_WORD_SIZE / 4U); i++)
+    {
+        if (word[i] != 0xFFFFFFFFU)
+        {
+            return false;
+        }
     }
 
-    // Return final computed CRC
-    return crcVal;
+    return true;
 }
 
 /**
- * @brief  Reliably writes data to STM32 flash memory with CRC verification.
- *         This function writes data in 32-byte blocks, verifies each block
- *         by reading it back, and compares CRC values to ensure integrity.
- *         If verification fails, the function retries writing up to `maxRetries` times.
+ * @brief  Reliably writes data to STM32 flash memory with verification.
+ *         This function programs the data through a single session, then
+ *         compares the whole range against the buffer in one pass. Words left
+ *         erased by a failed program are programmed again.
  *
  * @param  flashAddress  Target flash memory address for writing.
  * @param  buffer        Pointer to the data buffer to write.
  * @param  length        Length of the data in bytes.
- * @param  maxRetries    Maximum number of retries in case of CRC mismatch.
  *
  * @return STM32FLASH_OK if the write operation is successful, STM32FLASH_ERROR otherwise.
  */
-STM32Flash_StatusTypeDef STM32Flash_reliableWrite(uint32_t flashAddress, const uint8_t *buffer, uint32_t length, int maxRetries)
+STM32Flash_StatusTypeDef STM32Flash_reliableWrite(uint32_t flashAddress, const uint8_t *buffer, uint32_t length)
 {
-    uint8_t verifyBlock[32] __attribute__((aligned(32)));
-    uint32_t totalBytesWritten = 0;
-    uint32_t remaining = length;
+    STM32Flash_Session session;
 
-    while (remaining > 0)
+    if (STM32Flash_sessionOpen(&session, flashAddress, length) != STM32FLASH_OK)
     {
-        uint32_t blockSize = (remaining >= 32) ? 32 : remaining;
-
-        // Compute the reference CRC directly on the buffer
-        uint32_t originalCRC = STM32Flash_computeCRC(buffer + totalBytesWritten, blockSize);
-
-        STM32Flash_StatusTypeDef writeSuccess = STM32FLASH_ERROR;
-        for (int attempt = 1; attempt <= maxRetries; attempt++)
-        {
-            // Write data directly to flash
-            STM32Flash_StatusTypeDef status = STM32Flash_write32B(buffer + totalBytesWritten, flashAddress);
-            if (status != STM32FLASH_OK)
-            {
-                printf("Error: flash write attempt %d failed at 0x%08lx\n", attempt, flashAddress);
-                continue;
-            }
-
-            // Read back directly from flash and compare CRC
-            memcpy(verifyBlock, (uint8_t *)flashAddress, 32);
-            uint32_t readCRC = STM32Flash_computeCRC(verifyBlock, 32);
-
-            if (readCRC == originalCRC)
-            {
-                writeSuccess = STM32FLASH_OK;
-                break;
-            }
-            else
-            {
-                printf("CRC mismatch in flash write attempt %d at address 0x%08lx\n", attempt, flashAddress);
-            }
-        }
-
-        if (writeSuccess != STM32FLASH_OK)
-        {
-            return STM32FLASH_ERROR;
-        }
+        return STM32FLASH_ERROR;
+    }
 
-        flashAddress     += 32;
-        totalBytesWritten += blockSize;
-        remaining        -= blockSize;
+    STM32Flash_sessionWrite(&session, buffer, length);
+    if (STM32Flash_sessionClose(&session) != STM32FLASH_OK)
+    {
+        printf("Error: flash write failed at 0x%08lx\n", session.errorAddress);
     }
 
-    return STM32FLASH_OK;
+    return STM32Flash_verify(flashAddress, buffer, length, true);
 }
 #endif
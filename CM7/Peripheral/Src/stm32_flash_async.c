@@ -0,0 +1,436 @@
+/**
+ ******************************************************************************
+ * @file           : stm32_flash_async.c
+ * @brief          : Non-blocking erase and program of the internal flash.
+ *                   Operations are queued per bank and driven from the FLASH
+ *                   interrupt, so the CPU can read the package or refresh the
+ *                   display while a sector erase runs. Each bank controller
+ *                   is driven on its own, so bank 2 can erase while bank 1
+ *                   programs. The blocking API of stm32_flash.c is left
+ *                   untouched: a step that finds the bank owned by a
+ *                   blocking operation waits for its end of operation.
+ ******************************************************************************
+ * @attention
+ *
+ * Copyright (C) 2018-present Reso-nance Numerique.
+ * All rights reserved.
+ *
+ * This software is licensed under terms that can be found in the LICENSE file
+ * in the root directory of this software component.
+ *
+ ******************************************************************************
+ */
+
+#ifdef CORE_CM7
+
+/* Includes ------------------------------------------------------------------*/
+#include "boot_config.h"
+
+#include "stdlib.h"
+#include "stdio.h"
+#include "stdbool.h"
+
+#include "stm32_flash_async.h"
+
+/* Private define ------------------------------------------------------------*/
+#define FLASH_WORD_SIZE     STM32FLASH_WORD_SIZE
+#define NB_BANKS            2U
+#define BANK_INDEX(bank)    (((bank) == FLASH_BANK_2) ? 1U : 0U)
+
+#define ASYNC_SR_ERRORS     (FLASH_SR_WRPERR | FLASH_SR_PGSERR | FLASH_SR_STRBERR | FLASH_SR_INCERR | FLASH_SR_OPERR)
+#define ASYNC_CR_IT         (FLASH_CR_EOPIE | FLASH_CR_WRPERRIE | FLASH_CR_PGSERRIE | FLASH_CR_STRBERRIE | \
+                             FLASH_CR_INCERRIE | FLASH_CR_OPERRIE)
+
+/* Private typedef -----------------------------------------------------------*/
+typedef enum {
+    ASYNC_OP_ERASE_SECTOR = 0,
+    ASYNC_OP_PROGRAM
+} STM32FlashAsync_OperationType;
+
+typedef struct
+{
+    STM32FlashAsync_OperationType type;
+    uint32_t bank;
+    uint32_t sector;
+    uint32_t address;
+    const uint8_t *data;
+    uint32_t remaining;
+    STM32FlashAsync_Callback callback;
+    void *context;
+} STM32FlashAsync_Operation;
+
+typedef struct
+{
+    __IO uint32_t *KEYR;
+    __IO uint32_t *CR;
+    __IO uint32_t *SR;
+    __IO uint32_t *CCR;
+
+    STM32FlashAsync_Operation ops[STM32FLASH_ASYNC_QUEUE_DEPTH];
+    volatile uint32_t head;     // Next operation to run
+    volatile uint32_t tail;     // Next free slot
+    volatile bool active;       // Head operation is in progress
+    volatile bool deferred;     // Head step waits for a blocking operation
+    volatile bool error;        // Sticky until STM32FlashAsync_wait()
+} STM32FlashAsync_Queue;
+
+/* Private variables ---------------------------------------------------------*/
+static STM32FlashAsync_Queue queues[NB_BANKS] =
+{
+    { .KEYR = &FLASH->KEYR1, .CR = &FLASH->CR1, .SR = &FLASH->SR1, .CCR = &FLASH->CCR1 },
+    { .KEYR = &FLASH->KEYR2, .CR = &FLASH->CR2, .SR = &FLASH->SR2, .CCR = &FLASH->CCR2 }
+};
+
+/* Private function prototypes -----------------------------------------------*/
+static STM32Flash_StatusTypeDef STM32FlashAsync_enqueue(const STM32FlashAsync_Operation *op);
+static void STM32FlashAsync_dispatch(STM32FlashAsync_Queue *queue);
+static bool STM32FlashAsync_startStep(STM32FlashAsync_Queue *queue, STM32FlashAsync_Operation *op);
+static void STM32FlashAsync_complete(STM32FlashAsync_Queue *queue, STM32Flash_StatusTypeDef status, uint32_t address);
+static void STM32FlashAsync_serviceBank(STM32FlashAsync_Queue *queue);
+static void STM32FlashAsync_retryDeferred(STM32FlashAsync_Queue *queue);
+
+/**
+ * @brief  Enables the FLASH interrupt used to drive the queues.
+ */
+void STM32FlashAsync_init(void)
+{
+    HAL_NVIC_SetPriority(FLASH_IRQn, STM32FLASH_ASYNC_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(FLASH_IRQn);
+}
+
+/**
+ * @brief  Returns the flash bank holding a given address.
+ * @param  address Address in the internal flash.
+ * @retval FLASH_BANK_1 or FLASH_BANK_2.
+ */
+uint32_t STM32FlashAsync_getBank(uint32_t address)
+{
+    return (address >= ADDR_FLASH_SECTOR_0_BANK2) ? FLASH_BANK_2 : FLASH_BANK_1;
+}
+
+/**
+ * @brief  Queues the erase of a single sector.
+ * @param  flashBank Flash bank (FLASH_BANK_1 or FLASH_BANK_2).
+ * @param  sector    Sector number to erase.
+ * @param  callback  Completion callback (may be NULL), called from interrupt context.
+ * @param  context   User pointer passed to the callback.
+ * @retval STM32FLASH_OK if the operation was queued, STM32FLASH_ERROR if the queue is full.
+ */
+STM32Flash_StatusTypeDef STM32FlashAsync_eraseSector(uint32_t flashBank, uint32_t sector, STM32FlashAsync_Callback callback, void *context)
+{
+    STM32FlashAsync_Operation op =
+    {
+        .type = ASYNC_OP_ERASE_SECTOR,
+        .bank = flashBank,
+        .sector = sector,
+        .address = ((flashBank == FLASH_BANK_2) ? FLASH_BANK2_BASE : FLASH_BANK1_BASE) + (sector * FLASH_SECTOR_SIZE),
+        .data = NULL,
+        .remaining = 0,
+        .callback = callback,
+        .context = context
+    };
+
+    return STM32FlashAsync_enqueue(&op);
+}
+
+/**
+ * @brief  Queues the programming of a buffer, one flash word at a time.
+ * @param  address  Flash address to write (must be aligned to 32 bytes).
+ * @param  data     Pointer to the data (aligned to 32 bytes), must stay valid until completion.
+ * @param  length   Number of bytes, a multiple of 32.
+ * @param  callback Completion callback (may be NULL), called from interrupt context.
+ * @param  context  User pointer passed to the callback.
+ * @retval STM32FLASH_OK if the operation was queued, STM32FLASH_ERROR otherwise.
+ */
+STM32Flash_StatusTypeDef STM32FlashAsync_program(uint32_t address, const uint8_t *data, uint32_t length, STM32FlashAsync_Callback callback, void *context)
+{
+    if ((address % FLASH_WORD_SIZE) != 0 || (((uint32_t)data) % FLASH_WORD_SIZE) != 0 ||
+        (length % FLASH_WORD_SIZE) != 0 || length == 0)
+    {
+        printf("Alignment error: address=0x%08lx, data=0x%08lx, length=%lu\n", address, (uint32_t)data, length);
+        return STM32FLASH_ERROR;
+    }
+
+    STM32FlashAsync_Operation op =
+    {
+        .type = ASYNC_OP_PROGRAM,
+        .bank = STM32FlashAsync_getBank(address),
+        .sector = stm32Flash_getSector(address),
+        .address = address,
+        .data = data,
+        .remaining = length,
+        .callback = callback,
+        .context = context
+    };
+
+    return STM32FlashAsync_enqueue(&op);
+}
+
+/**
+ * @brief  Tells whether operations are still pending on a bank.
+ *         Also starts a deferred step whose blocking operation ended
+ *         without raising an end of operation (on an error).
+ * @param  flashBank Flash bank (FLASH_BANK_1 or FLASH_BANK_2).
+ */
+bool STM32FlashAsync_isBusy(uint32_t flashBank)
+{
+    STM32FlashAsync_Queue *queue = &queues[BANK_INDEX(flashBank)];
+
+    if (queue->deferred)
+    {
+        uint32_t primask = __get_PRIMASK();
+
+        __disable_irq();
+        STM32FlashAsync_retryDeferred(queue);
+        __set_PRIMASK(primask);
+    }
+
+    return queue->head != queue->tail;
+}
+
+/**
+ * @brief  Waits until every queued operation of a bank has completed,
+ *         then relocks the bank.
+ * @param  flashBank Flash bank (FLASH_BANK_1 or FLASH_BANK_2).
+ * @retval STM32FLASH_ERROR if any operation of the bank failed since the last wait.
+ */
+STM32Flash_StatusTypeDef STM32FlashAsync_wait(uint32_t flashBank)
+{
+    STM32FlashAsync_Queue *queue = &queues[BANK_INDEX(flashBank)];
+
+    while (STM32FlashAsync_isBusy(flashBank))
+    {
+    }
+
+    SET_BIT(*queue->CR, FLASH_CR_LOCK);
+
+    bool failed = queue->error;
+    queue->error = false;
+
+    return failed ? STM32FLASH_ERROR : STM32FLASH_OK;
+}
+
+/**
+ * @brief  Advances both bank queues from the FLASH interrupt.
+ */
+void STM32FlashAsync_IRQHandler(void)
+{
+    for (uint32_t i = 0; i < NB_BANKS; i++)
+    {
+        STM32FlashAsync_serviceBank(&queues[i]);
+    }
+}
+
+/**
+ * @brief  Handles the end of operation and error flags of one bank.
+ */
+static void STM32FlashAsync_serviceBank(STM32FlashAsync_Queue *queue)
+{
+    if (!queue->active)
+    {
+        return;
+    }
+
+    STM32FlashAsync_Operation *op = &queue->ops[queue->head % STM32FLASH_ASYNC_QUEUE_DEPTH];
+    uint32_t status = *queue->SR;
+
+    if (queue->deferred)
+    {
+        // End of the blocking operation, its owner reads its own errors
+        if ((status & FLASH_SR_EOP) == 0)
+        {
+            return;
+        }
+        *queue->CCR = FLASH_SR_EOP;
+        STM32FlashAsync_retryDeferred(queue);
+        return;
+    }
+
+    if ((status & ASYNC_SR_ERRORS) != 0)
+    {
+        *queue->CCR = (status & ASYNC_SR_ERRORS) | FLASH_SR_EOP;
+        STM32FlashAsync_complete(queue, STM32FLASH_ERROR, op->address);
+    }
+    else if ((status & FLASH_SR_EOP) != 0)
+    {
+        *queue->CCR = FLASH_SR_EOP;
+
+        if (op->type == ASYNC_OP_PROGRAM && op->remaining > FLASH_WORD_SIZE)
+        {
+            op->address += FLASH_WORD_SIZE;
+            op->data += FLASH_WORD_SIZE;
+            op->remaining -= FLASH_WORD_SIZE;
+
+            if (STM32FlashAsync_startStep(queue, op))
+            {
+                return;
+            }
+            STM32FlashAsync_complete(queue, STM32FLASH_ERROR, op->address);
+        }
+        else
+        {
+            STM32FlashAsync_complete(queue, STM32FLASH_OK, op->address);
+        }
+    }
+    else
+    {
+        return;
+    }
+
+    STM32FlashAsync_dispatch(queue);
+}
+
+/**
+ * @brief  Appends an operation to its bank queue and starts it if the bank is idle.
+ */
+static STM32Flash_StatusTypeDef STM32FlashAsync_enqueue(const STM32FlashAsync_Operation *op)
+{
+    STM32FlashAsync_Queue *queue = &queues[BANK_INDEX(op->bank)];
+    STM32Flash_StatusTypeDef status = STM32FLASH_OK;
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+
+    if ((queue->tail - queue->head) >= STM32FLASH_ASYNC_QUEUE_DEPTH)
+    {
+        status = STM32FLASH_ERROR;
+    }
+    else
+    {
+        queue->ops[queue->tail % STM32FLASH_ASYNC_QUEUE_DEPTH] = *op;
+        queue->tail++;
+
+        STM32FlashAsync_dispatch(queue);
+    }
+
+    __set_PRIMASK(primask);
+
+    return status;
+}
+
+/**
+ * @brief  Starts the head operation of a bank if nothing is running on it.
+ */
+static void STM32FlashAsync_dispatch(STM32FlashAsync_Queue *queue)
+{
+    while (!queue->active && (queue->head != queue->tail))
+    {
+        STM32FlashAsync_Operation *op = &queue->ops[queue->head % STM32FLASH_ASYNC_QUEUE_DEPTH];
+
+        queue->active = true;
+        if (!STM32FlashAsync_startStep(queue, op))
+        {
+            STM32FlashAsync_complete(queue, STM32FLASH_ERROR, op->address);
+        }
+    }
+}
+
+/**
+ * @brief  Starts the step a blocking operation held back, once the bank is idle.
+ *         Called with the FLASH interrupt masked or from it.
+ */
+static void STM32FlashAsync_retryDeferred(STM32FlashAsync_Queue *queue)
+{
+    if (!queue->deferred || ((*queue->SR & (FLASH_SR_QW | FLASH_SR_BSY)) != 0))
+    {
+        return;
+    }
+
+    STM32FlashAsync_Operation *op = &queue->ops[queue->head % STM32FLASH_ASYNC_QUEUE_DEPTH];
+
+    queue->deferred = false;
+    if (!STM32FlashAsync_startStep(queue, op))
+    {
+        STM32FlashAsync_complete(queue, STM32FLASH_ERROR, op->address);
+        STM32FlashAsync_dispatch(queue);
+    }
+}
+
+/**
+ * @brief  Starts the erase, or the next flash word of a program operation.
+ *         The bank is unlocked here since a blocking caller working on the
+ *         other bank may have locked both controllers meanwhile.
+ *         While a blocking operation owns the bank the step is deferred to
+ *         its end of operation, which only EOPIE is enabled for: the error
+ *         flags are left to the blocking caller.
+ * @retval true if the operation was started or deferred.
+ */
+static bool STM32FlashAsync_startStep(STM32FlashAsync_Queue *queue, STM32FlashAsync_Operation *op)
+{
+    if (READ_BIT(*queue->CR, FLASH_CR_LOCK) != 0U)
+    {
+        WRITE_REG(*queue->KEYR, FLASH_KEY1);
+        WRITE_REG(*queue->KEYR, FLASH_KEY2);
+        if (READ_BIT(*queue->CR, FLASH_CR_LOCK) != 0U)
+        {
+            return false;
+        }
+    }
+
+    if ((*queue->SR & (FLASH_SR_QW | FLASH_SR_BSY)) != 0)
+    {
+        queue->deferred = true;
+        SET_BIT(*queue->CR, FLASH_CR_EOPIE);
+
+        // Check again: the operation may have ended before EOPIE was set
+        if ((*queue->SR & (FLASH_SR_QW | FLASH_SR_BSY)) != 0)
+        {
+            return true;
+        }
+        queue->deferred = false;
+    }
+
+    *queue->CCR = ASYNC_SR_ERRORS | FLASH_SR_EOP;
+    SET_BIT(*queue->CR, ASYNC_CR_IT);
+
+    if (op->type == ASYNC_OP_ERASE_SECTOR)
+    {
+        FLASH_Erase_Sector(op->sector, op->bank, FLASH_VOLTAGE_RANGE_3);
+        return true;
+    }
+
+    __IO uint32_t *dest = (__IO uint32_t *)op->address;
+    const uint32_t *src = (const uint32_t *)op->data;
+
+    SET_BIT(*queue->CR, FLASH_CR_PG);
+    __ISB();
+    __DSB();
+
+    for (uint32_t i = 0; i < (FLASH_WORD_SIZE / 4U); i++)
+    {
+        dest[i] = src[i];
+    }
+
+    __ISB();
+    __DSB();
+
+    return true;
+}
+
+/**
+ * @brief  Retires the head operation of a bank and notifies its owner.
+ */
+static void STM32FlashAsync_complete(STM32FlashAsync_Queue *queue, STM32Flash_StatusTypeDef status, uint32_t address)
+{
+    STM32FlashAsync_Operation *op = &queue->ops[queue->head % STM32FLASH_ASYNC_QUEUE_DEPTH];
+    STM32FlashAsync_Callback callback = op->callback;
+    void *context = op->context;
+
+    // Leave the controller in a clean state for the next operation
+    CLEAR_BIT(*queue->CR, FLASH_CR_PG | FLASH_CR_SER | ASYNC_CR_IT);
+
+    if (status != STM32FLASH_OK)
+    {
+        queue->error = true;
+    }
+
+    queue->active = false;
+    queue->deferred = false;
+    queue->head++;
+
+    if (callback != NULL)
+    {
+        callback(status, address, context);
+    }
+}
+#endif
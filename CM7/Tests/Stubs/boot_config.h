@@ -0,0 +1,17 @@
+/**
+ ******************************************************************************
+ * @file           : boot_config.h
+ * @brief          : Host stand-in for the bootloader memory map.
+ ******************************************************************************
+ */
+
+#ifndef __BOOT_CONFIG_H__
+#define __BOOT_CONFIG_H__
+
+#include "stm32h7xx_hal.h"
+
+#define FLASH_PERSISTENT_DATA_ADDRESS   0x08020000UL
+#define FW_CM4_START_ADDR               0x08100000UL
+#define FLASH_END_ADDR                  0x08200000UL
+
+#endif /* __BOOT_CONFIG_H__ */
@@ -0,0 +1,24 @@
+/**
+ ******************************************************************************
+ * @file           : globals.h
+ * @brief          : Host stand-in for the configuration shared with the
+ *                   firmware, pulled in by file_manager.h.
+ ******************************************************************************
+ */
+
+#ifndef __GLOBALS_H__
+#define __GLOBALS_H__
+
+#include <stdint.h>
+
+struct shared_config
+{
+    uint32_t ui_button_delay;
+};
+
+struct cisCals
+{
+    uint8_t data[16];
+};
+
+#endif /* __GLOBALS_H__ */
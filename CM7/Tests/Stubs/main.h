@@ -0,0 +1,16 @@
+/**
+ ******************************************************************************
+ * @file           : main.h
+ * @brief          : Host stand-in for the CubeMX main.h, used by the host tests.
+ ******************************************************************************
+ */
+
+#ifndef __MAIN_H
+#define __MAIN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stm32h7xx_hal.h"
+
+#endif /* __MAIN_H */
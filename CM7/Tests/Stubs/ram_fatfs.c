@@ -0,0 +1,266 @@
+/**
+ ******************************************************************************
+ * @file           : ram_fatfs.c
+ * @brief          : RAM-backed stand-in for the FatFs read path.
+ *                   A FIL is bound to a memory buffer with ramFatfs_open();
+ *                   f_read() and f_lseek() then behave like FatFs: a read
+ *                   returns fewer bytes than requested only at the end of
+ *                   the file.
+ *                   A few named files can also be created with f_open() and
+ *                   written, renamed and deleted, enough for the modules
+ *                   writing a file under a temporary name. One file is open
+ *                   at a time either way.
+ ******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "ram_flash.h"
+#include "ram_fatfs.h"
+
+#define RAMFATFS_MAX_FILES  4
+#define RAMFATFS_MAX_PATH   64
+
+/* Named file of the volume */
+typedef struct
+{
+    char path[RAMFATFS_MAX_PATH];
+    uint8_t *data;
+    uint32_t size;
+} RamFatfs_VolumeFile;
+
+static FIL *openFile;
+static RamFatfs_File *openRamFile;
+
+static RamFatfs_VolumeFile volume[RAMFATFS_MAX_FILES];
+static RamFatfs_VolumeFile *openVolumeFile;     // NULL for a file bound by ramFatfs_open()
+static RamFatfs_File volumeRamFile;
+
+static RamFatfs_VolumeFile *ramFatfs_find(const TCHAR *path)
+{
+    for (uint32_t i = 0; i < RAMFATFS_MAX_FILES; i++)
+    {
+        if ((volume[i].path[0] != '\0') && (strcmp(volume[i].path, path) == 0))
+        {
+            return &volume[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief  Binds `file` to `size` bytes of `data`, positioned at the start.
+ */
+void ramFatfs_open(FIL *file, RamFatfs_File *ramFile, const uint8_t *data, uint32_t size)
+{
+    memset(file, 0, sizeof(*file));
+    memset(ramFile, 0, sizeof(*ramFile));
+    ramFile->data = data;
+    ramFile->size = size;
+    file->obj.objsize = size;
+
+    openFile = file;
+    openRamFile = ramFile;
+    openVolumeFile = NULL;
+}
+
+/**
+ * @brief  Deletes every named file of the volume.
+ */
+void ramFatfs_format(void)
+{
+    for (uint32_t i = 0; i < RAMFATFS_MAX_FILES; i++)
+    {
+        free(volume[i].data);
+    }
+    memset(volume, 0, sizeof(volume));
+}
+
+/**
+ * @brief  Looks up a named file of the volume.
+ * @return Its bytes, or NULL if it does not exist.
+ */
+uint8_t *ramFatfs_file(const char *path, uint32_t *size)
+{
+    RamFatfs_VolumeFile *file = ramFatfs_find(path);
+
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    *size = file->size;
+    return file->data;
+}
+
+FRESULT f_open(FIL* fp, const TCHAR* path, BYTE mode)
+{
+    RamFatfs_VolumeFile *file = ramFatfs_find(path);
+
+    if (file == NULL)
+    {
+        if (!(mode & (FA_CREATE_ALWAYS | FA_OPEN_ALWAYS | FA_CREATE_NEW)))
+        {
+            return FR_NO_FILE;
+        }
+
+        for (uint32_t i = 0; (file == NULL) && (i < RAMFATFS_MAX_FILES); i++)
+        {
+            if (volume[i].path[0] == '\0')
+            {
+                file = &volume[i];
+            }
+        }
+        if ((file == NULL) || (strlen(path) >= RAMFATFS_MAX_PATH))
+        {
+            return FR_DENIED;
+        }
+        strcpy(file->path, path);
+    }
+
+    if (mode & FA_CREATE_ALWAYS)
+    {
+        file->size = 0;
+    }
+
+    ramFatfs_open(fp, &volumeRamFile, file->data, file->size);
+    openVolumeFile = file;
+    return FR_OK;
+}
+
+FRESULT f_close(FIL* fp)
+{
+    if (fp == openFile)
+    {
+        openFile = NULL;
+        openVolumeFile = NULL;
+    }
+    return FR_OK;
+}
+
+FRESULT f_write(FIL* fp, const void* buff, UINT btw, UINT* bw)
+{
+    RamFatfs_VolumeFile *file = openVolumeFile;
+    RamFatfs_File *ramFile = openRamFile;
+
+    assert((fp == openFile) && (file != NULL));
+    *bw = 0;
+
+    if (ramFile->failAt != 0 && ramFile->position + btw > ramFile->failAt)
+    {
+        return FR_DISK_ERR;
+    }
+
+    if (ramFile->position + btw > file->size)
+    {
+        file->data = realloc(file->data, ramFile->position + btw);
+        file->size = ramFile->position + btw;
+    }
+
+    memcpy(file->data + ramFile->position, buff, btw);
+    ramFile->data = file->data;
+    ramFile->size = file->size;
+    ramFile->position += btw;
+    fp->obj.objsize = file->size;
+    fp->fptr = ramFile->position;
+    *bw = btw;
+    return FR_OK;
+}
+
+FRESULT f_truncate(FIL* fp)
+{
+    assert((fp == openFile) && (openVolumeFile != NULL));
+
+    openVolumeFile->size = openRamFile->position;
+    openRamFile->size = openRamFile->position;
+    fp->obj.objsize = openRamFile->position;
+    return FR_OK;
+}
+
+FRESULT f_stat(const TCHAR* path, FILINFO* fno)
+{
+    RamFatfs_VolumeFile *file = ramFatfs_find(path);
+
+    if (file == NULL)
+    {
+        return FR_NO_FILE;
+    }
+
+    memset(fno, 0, sizeof(*fno));
+    fno->fsize = file->size;
+    return FR_OK;
+}
+
+FRESULT f_unlink(const TCHAR* path)
+{
+    RamFatfs_VolumeFile *file = ramFatfs_find(path);
+
+    if (file == NULL)
+    {
+        return FR_NO_FILE;
+    }
+
+    free(file->data);
+    memset(file, 0, sizeof(*file));
+    return FR_OK;
+}
+
+FRESULT f_rename(const TCHAR* path_old, const TCHAR* path_new)
+{
+    RamFatfs_VolumeFile *file = ramFatfs_find(path_old);
+
+    if (file == NULL)
+    {
+        return FR_NO_FILE;
+    }
+    if ((ramFatfs_find(path_new) != NULL) || (strlen(path_new) >= RAMFATFS_MAX_PATH))
+    {
+        return FR_EXIST;
+    }
+
+    strcpy(file->path, path_new);
+    return FR_OK;
+}
+
+FRESULT f_read(FIL* fp, void* buff, UINT btr, UINT* br)
+{
+    RamFatfs_File *ramFile = openRamFile;
+
+    assert(fp == openFile);
+    *br = 0;
+
+    ramFile->reads++;
+    if (ramFlash_stats.busy)
+    {
+        ramFile->overlapped++;
+    }
+
+    if (ramFile->failAt != 0 && ramFile->position + btr > ramFile->failAt)
+    {
+        return FR_DISK_ERR;
+    }
+
+    if (btr > ramFile->size - ramFile->position)
+    {
+        btr = ramFile->size - ramFile->position;
+    }
+
+    memcpy(buff, ramFile->data + ramFile->position, btr);
+    ramFile->position += btr;
+    fp->fptr = ramFile->position;
+    *br = btr;
+    return FR_OK;
+}
+
+FRESULT f_lseek(FIL* fp, FSIZE_t ofs)
+{
+    assert(fp == openFile);
+
+    // A read-only file cannot be extended, FatFs clips the position
+    openRamFile->position = (ofs > openRamFile->size) ? openRamFile->size : (uint32_t)ofs;
+    fp->fptr = openRamFile->position;
+    return FR_OK;
+}
@@ -0,0 +1,31 @@
+/**
+ ******************************************************************************
+ * @file           : ram_fatfs.h
+ * @brief          : RAM-backed stand-in for the FatFs read path, with fault
+ *                   injection for the host tests, and a small volume of
+ *                   named files.
+ ******************************************************************************
+ */
+
+#ifndef __RAM_FATFS_H__
+#define __RAM_FATFS_H__
+
+#include <stdint.h>
+
+#include "ff.h"
+
+typedef struct
+{
+    const uint8_t *data;
+    uint32_t size;
+    uint32_t position;
+    uint32_t failAt;        // f_read() returns FR_DISK_ERR once the position reaches it, 0 to disable
+    uint32_t reads;         // Calls to f_read()
+    uint32_t overlapped;    // Calls made while a flash buffer was being programmed
+} RamFatfs_File;
+
+void ramFatfs_open(FIL *file, RamFatfs_File *ramFile, const uint8_t *data, uint32_t size);
+void ramFatfs_format(void);
+uint8_t *ramFatfs_file(const char *path, uint32_t *size);
+
+#endif /* __RAM_FATFS_H__ */
@@ -0,0 +1,162 @@
+/**
+ ******************************************************************************
+ * @file           : ram_flash.c
+ * @brief          : RAM-backed stand-in for the internal flash drivers.
+ *                   Programming is deferred until STM32FlashAsync_wait(), like
+ *                   the interrupt-driven driver, so a buffer handed to the
+ *                   driver must stay untouched until it has been waited for.
+ ******************************************************************************
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "stm32_flash.h"
+#include "stm32_flash_async.h"
+
+#include "ram_flash.h"
+
+RamFlash_Faults ramFlash_faults;
+RamFlash_Stats ramFlash_stats;
+
+static uint8_t flashMemory[RAMFLASH_SIZE];
+
+/* Operation queued by STM32FlashAsync_program() */
+static uint32_t pendingAddress;
+static const uint8_t *pendingData;
+static uint32_t pendingLength;
+
+/**
+ * @brief  Erases the whole flash and clears the faults and statistics.
+ */
+void ramFlash_reset(void)
+{
+    memset(flashMemory, 0xFF, sizeof(flashMemory));
+    memset(&ramFlash_faults, 0, sizeof(ramFlash_faults));
+    memset(&ramFlash_stats, 0, sizeof(ramFlash_stats));
+    pendingData = NULL;
+}
+
+/**
+ * @brief  Returns the RAM backing a flash address.
+ */
+uint8_t *ramFlash_at(uint32_t address)
+{
+    assert(address >= RAMFLASH_BASE && address < RAMFLASH_BASE + RAMFLASH_SIZE);
+    return &flashMemory[address - RAMFLASH_BASE];
+}
+
+static bool ramFlash_isErased(uint32_t address)
+{
+    const uint8_t *word = ramFlash_at(address);
+
+    for (uint32_t i = 0; i < RAMFLASH_WORD_SIZE; i++)
+    {
+        if (word[i] != 0xFF)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t stm32Flash_getSector(uint32_t Address)
+{
+    return ((Address - RAMFLASH_BASE) % RAMFLASH_BANK_SIZE) / RAMFLASH_SECTOR_SIZE;
+}
+
+uint32_t STM32FlashAsync_getBank(uint32_t address)
+{
+    return ((address - RAMFLASH_BASE) < RAMFLASH_BANK_SIZE) ? 1 : 2;
+}
+
+STM32Flash_StatusTypeDef STM32FlashAsync_program(uint32_t address, const uint8_t *data, uint32_t length, STM32FlashAsync_Callback callback, void *context)
+{
+    // The pipeline never queues a second buffer before waiting for the first
+    assert(!ramFlash_stats.busy);
+    (void)callback;
+    (void)context;
+
+    if ((address % RAMFLASH_WORD_SIZE) != 0 || (length % RAMFLASH_WORD_SIZE) != 0 ||
+        address == ramFlash_faults.refuseProgramAt)
+    {
+        return STM32FLASH_ERROR;
+    }
+
+    ramFlash_at(address + length - 1);
+
+    pendingAddress = address;
+    pendingData = data;
+    pendingLength = length;
+    ramFlash_stats.programs++;
+    ramFlash_stats.busy = true;
+    return STM32FLASH_OK;
+}
+
+STM32Flash_StatusTypeDef STM32FlashAsync_wait(uint32_t flashBank)
+{
+    STM32Flash_StatusTypeDef status = STM32FLASH_OK;
+
+    (void)flashBank;
+    ramFlash_stats.waits++;
+    if (!ramFlash_stats.busy)
+    {
+        return STM32FLASH_OK;
+    }
+    ramFlash_stats.busy = false;
+
+    for (uint32_t offset = 0; offset < pendingLength; offset += RAMFLASH_WORD_SIZE)
+    {
+        uint32_t address = pendingAddress + offset;
+        uint8_t *word = ramFlash_at(address);
+
+        if (address == ramFlash_faults.dropWordAt)
+        {
+            status = STM32FLASH_ERROR;
+            continue;
+        }
+
+        for (uint32_t i = 0; i < RAMFLASH_WORD_SIZE; i++)
+        {
+            word[i] &= pendingData[offset + i];
+        }
+
+        if (address == ramFlash_faults.corruptWordAt)
+        {
+            word[0] ^= 0x01;
+        }
+    }
+
+    pendingData = NULL;
+    return status;
+}
+
+STM32Flash_StatusTypeDef STM32Flash_verify(uint32_t flashAddress, const uint8_t *data, uint32_t length, bool repair)
+{
+    if ((flashAddress % RAMFLASH_WORD_SIZE) != 0)
+    {
+        return STM32FLASH_ERROR;
+    }
+
+    for (uint32_t offset = 0; offset < length; offset += RAMFLASH_WORD_SIZE)
+    {
+        uint32_t address = flashAddress + offset;
+        uint32_t wordLength = ((length - offset) >= RAMFLASH_WORD_SIZE) ? RAMFLASH_WORD_SIZE : (length - offset);
+
+        if (memcmp(ramFlash_at(address), data + offset, wordLength) == 0)
+        {
+            continue;
+        }
+
+        if (!repair || !ramFlash_isErased(address))
+        {
+            return STM32FLASH_ERROR;
+        }
+
+        memcpy(ramFlash_at(address), data + offset, wordLength);
+        ramFlash_stats.repairs++;
+    }
+
+    return STM32FLASH_OK;
+}
@@ -0,0 +1,44 @@
+/**
+ ******************************************************************************
+ * @file           : ram_flash.h
+ * @brief          : RAM-backed stand-in for the internal flash drivers
+ *                   (stm32_flash.c and stm32_flash_async.c), with fault
+ *                   injection for the host tests.
+ ******************************************************************************
+ */
+
+#ifndef __RAM_FLASH_H__
+#define __RAM_FLASH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Same geometry as the STM32H745: two banks of eight 128 KB sectors */
+#define RAMFLASH_BASE           0x08000000UL
+#define RAMFLASH_BANK_SIZE      0x00100000UL
+#define RAMFLASH_SIZE           (2 * RAMFLASH_BANK_SIZE)
+#define RAMFLASH_SECTOR_SIZE    0x00020000UL
+#define RAMFLASH_WORD_SIZE      32
+
+typedef struct
+{
+    uint32_t refuseProgramAt;   // program() refuses to queue a buffer starting here
+    uint32_t dropWordAt;        // Flash word left erased, wait() reports the failure
+    uint32_t corruptWordAt;     // Flash word programmed with wrong data, no error reported
+} RamFlash_Faults;
+
+typedef struct
+{
+    uint32_t programs;          // Buffers queued with STM32FlashAsync_program()
+    uint32_t waits;             // Calls to STM32FlashAsync_wait()
+    uint32_t repairs;           // Words re-programmed by STM32Flash_verify()
+    bool busy;                  // A queued buffer has not been waited for
+} RamFlash_Stats;
+
+extern RamFlash_Faults ramFlash_faults;
+extern RamFlash_Stats ramFlash_stats;
+
+void ramFlash_reset(void);
+uint8_t *ramFlash_at(uint32_t address);
+
+#endif /* __RAM_FLASH_H__ */
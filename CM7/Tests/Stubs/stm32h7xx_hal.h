@@ -0,0 +1,71 @@
+/**
+ ******************************************************************************
+ * @file           : stm32h7xx_hal.h
+ * @brief          : Host stand-in for the HAL, pulled in by ffconf.h and
+ *                   main.h: the few flash and backup domain definitions and
+ *                   Cortex-M intrinsics the modules under test use.
+ ******************************************************************************
+ */
+
+#ifndef __STM32H7xx_HAL_H
+#define __STM32H7xx_HAL_H
+
+#include <stdint.h>
+
+#define FLASH_BANK_1        0x01U
+#define FLASH_BANK_2        0x02U
+#define FLASH_SECTOR_SIZE   0x00020000UL
+
+/* Backup domain, the tests map the backup SRAM at its address */
+#define D3_BKPSRAM_BASE     0x38800000UL
+#define PWR_CR2_BREN        0x00000001U
+#define PWR_CR2_BRRDY       0x00010000U
+
+#define SET_BIT(REG, BIT)   ((REG) |= (BIT))
+#define __HAL_RCC_BKPRAM_CLK_ENABLE()   do { } while (0)
+
+typedef struct
+{
+    volatile uint32_t CR2;
+} PWR_TypeDef;
+
+/* The backup regulator is always ready */
+static inline PWR_TypeDef *hostPwr(void)
+{
+    static PWR_TypeDef pwr = { PWR_CR2_BRRDY };
+    return &pwr;
+}
+#define PWR                 (hostPwr())
+
+static inline void HAL_PWR_EnableBkUpAccess(void)
+{
+}
+
+/* Single-threaded host: the FLASH interrupt is simulated by the tests */
+static inline uint32_t __get_PRIMASK(void)
+{
+    return 0;
+}
+
+static inline void __set_PRIMASK(uint32_t primask)
+{
+    (void)primask;
+}
+
+static inline void __disable_irq(void)
+{
+}
+
+static inline void SCB_InvalidateDCache_by_Addr(volatile void *addr, int32_t dsize)
+{
+    (void)addr;
+    (void)dsize;
+}
+
+static inline void SCB_CleanDCache_by_Addr(volatile void *addr, int32_t dsize)
+{
+    (void)addr;
+    (void)dsize;
+}
+
+#endif /* __STM32H7xx_HAL_H */
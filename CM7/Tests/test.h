@@ -0,0 +1,34 @@
+/**
+ ******************************************************************************
+ * @file           : test.h
+ * @brief          : Minimal check macros shared by the host tests.
+ ******************************************************************************
+ */
+
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stdio.h>
+
+extern int test_failures;
+
+/* Records a failure and carries on with the next check */
+#define TEST_CHECK(condition)                                                   \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #condition);       \
+            test_failures++;                                                    \
+        }                                                                       \
+    } while (0)
+
+#define TEST_RUN(test)                                                          \
+    do                                                                          \
+    {                                                                           \
+        int failuresBefore = test_failures;                                     \
+        test();                                                                 \
+        printf("%s %s\n", (test_failures == failuresBefore) ? "ok  " : "FAIL", #test); \
+    } while (0)
+
+#endif /* __TEST_H__ */
@@ -0,0 +1,160 @@
+/**
+ ******************************************************************************
+ * @file           : test_boot_state.c
+ * @brief          : Host test of the boot state kept in the backup SRAM,
+ *                   mapped at its address. The flash state is given as
+ *                   STM32Flash_readPersistentState() would read it.
+ *
+ *                   Built twice: with BOOT_PERSISTENT_LOG_ONLY, a trial is
+ *                   handed over to the next boot and confirmed by the
+ *                   firmware; without it, handoffs are refused so that
+ *                   TESTING goes to flash, where older firmware reads it.
+ ******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "main.h"
+
+#include "boot_state.h"
+
+#include "test.h"
+
+#define TEST_BKPSRAM_SIZE   0x1000U
+
+int test_failures;
+
+static uint8_t *bkpsram;
+
+/* Record of a trial written by the bootloader before the trial boot */
+static const STM32Flash_PersistentState toTest = { FW_UPDATE_TO_TEST, STM32FLASH_NO_SLOT, 7, 3 };
+
+/* Boot sequence: counts the boot, then reads the state */
+static void test_boot(const STM32Flash_PersistentState *flash, BootState *state)
+{
+    bootState_recordBoot(flash);
+    bootState_read(flash, state);
+}
+
+#ifdef BOOT_PERSISTENT_LOG_ONLY
+
+/**
+ * @brief  TO_TEST -> handoff of TESTING -> trial boot -> the firmware
+ *         confirms by erasing the sector and writing NONE as word 0.
+ */
+static void test_handoffConfirm(void)
+{
+    static const STM32Flash_PersistentState confirmed = { FW_UPDATE_NONE, STM32FLASH_NO_SLOT, 0, 0 };
+    static const STM32Flash_PersistentState done = { FW_UPDATE_NONE, STM32FLASH_NO_SLOT, 8, 4 };
+    BootState state;
+
+    memset(bkpsram, 0, TEST_BKPSRAM_SIZE);
+
+    test_boot(&toTest, &state);
+    TEST_CHECK(state.updateState == FW_UPDATE_TO_TEST);
+    TEST_CHECK(state.bootCount == 1);
+
+    TEST_CHECK(bootState_handoff(&toTest, FW_UPDATE_TESTING, STM32FLASH_NO_SLOT) == BOOTSTATE_OK);
+
+    // Trial boot: TESTING is what goes to BootInfo.updateState
+    test_boot(&toTest, &state);
+    TEST_CHECK(state.updateState == FW_UPDATE_TESTING);
+    TEST_CHECK(state.trialSlot == STM32FLASH_NO_SLOT);
+    TEST_CHECK(state.bootCount == 2);
+    TEST_CHECK(state.stateBoots == 1);
+
+    // Not confirmed: the trial is still seen on the next boot
+    test_boot(&toTest, &state);
+    TEST_CHECK(state.updateState == FW_UPDATE_TESTING);
+    TEST_CHECK(state.stateBoots == 2);
+
+    // Confirmed by the firmware: the handoff no longer applies
+    test_boot(&confirmed, &state);
+    TEST_CHECK(state.updateState == FW_UPDATE_NONE);
+    TEST_CHECK(state.bootCount == 4);
+
+    // Nor does it over a state written by the bootloader
+    TEST_CHECK(bootState_handoff(&toTest, FW_UPDATE_TESTING, STM32FLASH_NO_SLOT) == BOOTSTATE_OK);
+    test_boot(&done, &state);
+    TEST_CHECK(state.updateState == FW_UPDATE_NONE);
+    TEST_CHECK(state.stateBoots == 1);
+}
+
+/**
+ * @brief  A lost backup SRAM brings the flash state back: the trial is
+ *         retried rather than taken for confirmed.
+ */
+static void test_lostHandoff(void)
+{
+    BootState state;
+
+    memset(bkpsram, 0, TEST_BKPSRAM_SIZE);
+
+    TEST_CHECK(bootState_handoff(&toTest, FW_UPDATE_TESTING, STM32FLASH_NO_SLOT) == BOOTSTATE_OK);
+    bkpsram[12] ^= 0x01;
+
+    test_boot(&toTest, &state);
+    TEST_CHECK(state.updateState == FW_UPDATE_TO_TEST);
+    TEST_CHECK(state.bootCount == 1);
+}
+
+/**
+ * @brief  A bare state word written by the firmware has no record for the
+ *         handoff to apply to.
+ */
+static void test_handoffBareState(void)
+{
+    static const STM32Flash_PersistentState bare = { FW_UPDATE_TO_TEST, STM32FLASH_NO_SLOT, 0, 0 };
+    BootState state;
+
+    memset(bkpsram, 0, TEST_BKPSRAM_SIZE);
+
+    TEST_CHECK(bootState_handoff(&bare, FW_UPDATE_TESTING, STM32FLASH_NO_SLOT) == BOOTSTATE_ERROR);
+    test_boot(&bare, &state);
+    TEST_CHECK(state.updateState == FW_UPDATE_TO_TEST);
+}
+
+#else
+
+/**
+ * @brief  While word 0 is mirrored, TESTING must be written to flash.
+ */
+static void test_handoffRefused(void)
+{
+    BootState state;
+
+    memset(bkpsram, 0, TEST_BKPSRAM_SIZE);
+
+    TEST_CHECK(bootState_handoff(&toTest, FW_UPDATE_TESTING, STM32FLASH_NO_SLOT) == BOOTSTATE_ERROR);
+    test_boot(&toTest, &state);
+    TEST_CHECK(state.updateState == FW_UPDATE_TO_TEST);
+    TEST_CHECK(state.bootCount == 1);
+}
+
+#endif
+
+int main(void)
+{
+    bkpsram = mmap((void *)(uintptr_t)D3_BKPSRAM_BASE, TEST_BKPSRAM_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (bkpsram != (uint8_t *)(uintptr_t)D3_BKPSRAM_BASE)
+    {
+        printf("%s: cannot map the backup SRAM\n", __FILE__);
+        return EXIT_FAILURE;
+    }
+
+    bootState_init();
+
+#ifdef BOOT_PERSISTENT_LOG_ONLY
+    TEST_RUN(test_handoffConfirm);
+    TEST_RUN(test_lostHandoff);
+    TEST_RUN(test_handoffBareState);
+#else
+    TEST_RUN(test_handoffRefused);
+#endif
+
+    printf("%s: %d failure(s)\n", __FILE__, test_failures);
+    return (test_failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,397 @@
+/**
+ ******************************************************************************
+ * @file           : test_compressor.c
+ * @brief          : Host round-trip test of the LZ4 encoder of the backups.
+ *                   Samples are encoded into frames laid out as backup.c
+ *                   writes them, decoded with the decompressor, and by the
+ *                   lz4 command line tool, and compared. Incompressible
+ *                   blocks must be stored. Compressed backups are written
+ *                   from a memory-mapped stand-in for the flash into a RAM
+ *                   volume, and read back through their header.
+ ******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "boot_config.h"
+#include "backup.h"
+#include "compressor.h"
+#include "decompressor.h"
+#include "file_manager.h"
+#include "stm32_crc.h"
+#include "stm32_flash.h"
+
+#include "ram_fatfs.h"
+#include "test.h"
+#include "test_support.h"
+
+#ifndef TEST_LZ4
+#define TEST_LZ4            "lz4"
+#endif
+
+#ifndef TEST_BINARY_SAMPLE
+#define TEST_BINARY_SAMPLE  "/proc/self/exe"
+#endif
+
+#ifndef TEST_WORK_DIR
+#define TEST_WORK_DIR       "build"
+#endif
+
+#define TEST_MAX_SIZE       (512 * 1024)
+#define TEST_MAX_FRAME      (TEST_MAX_SIZE + (TEST_MAX_SIZE / COMPRESSOR_BLOCK_SIZE + 2) * 4 + COMPRESSOR_FRAME_HEADER_SIZE)
+#define TEST_REGION_ADDRESS FW_CM4_START_ADDR
+#define TEST_REGION_SIZE    (8 * FLASH_SECTOR_SIZE)
+#define TEST_BACKUP_PATH    "0:/firmware/backup_cm4.bin"
+
+int test_failures;
+
+static uint8_t binarySample[TEST_MAX_SIZE];
+static uint32_t binarySampleSize;
+static uint8_t frame[TEST_MAX_FRAME];
+static uint8_t decoded[TEST_MAX_SIZE];
+static uint8_t *region;
+
+void progress_update(ProgressManager* pm, uint32_t step_number, uint32_t current_value, uint32_t total_value)
+{
+}
+
+/* Backups are written through the file manager */
+fileManager_StatusTypeDef file_reliableWrite(FIL *file, const uint8_t *buffer, uint32_t length, int maxRetries)
+{
+    UINT bytesWritten = 0;
+
+    if ((f_write(file, buffer, length, &bytesWritten) != FR_OK) || (bytesWritten != length))
+    {
+        return FILEMANAGER_ERROR;
+    }
+
+    return FILEMANAGER_OK;
+}
+
+/**
+ * @brief  Encodes `size` bytes into `frame`, block by block, as a backup.
+ * @return Size of the frame.
+ */
+static uint32_t test_compress(const uint8_t *data, uint32_t size)
+{
+    uint32_t frameSize = compressor_frameHeader(frame, size);
+
+    for (uint32_t offset = 0; offset < size; offset += COMPRESSOR_BLOCK_SIZE)
+    {
+        uint32_t blockSize = (size - offset > COMPRESSOR_BLOCK_SIZE) ? COMPRESSOR_BLOCK_SIZE : (size - offset);
+
+        frameSize += compressor_compressBlock(data + offset, blockSize, frame + frameSize);
+    }
+
+    memset(frame + frameSize, 0, 4);
+    return frameSize + 4;
+}
+
+/**
+ * @brief  Decodes `frame` into `decoded`.
+ */
+static decompressor_StatusTypeDef test_decode(uint32_t frameSize, uint32_t *decodedSize)
+{
+    static Decompressor decompressor;
+    TestMemorySource memory;
+    StreamWriter_Source input;
+
+    *decodedSize = 0;
+    test_memorySource(&input, &memory, frame, frameSize);
+
+    if ((decompressor_open(&decompressor, &input, frameSize) != DECOMPRESSOR_OK) ||
+        (decompressor.contentSize > TEST_MAX_SIZE) ||
+        (decompressor_read(&decompressor, decoded, decompressor.contentSize, decodedSize) != DECOMPRESSOR_OK))
+    {
+        return DECOMPRESSOR_ERROR;
+    }
+
+    return (*decodedSize == decompressor.contentSize) ? DECOMPRESSOR_OK : DECOMPRESSOR_ERROR;
+}
+
+/**
+ * @brief  Encodes and decodes `size` bytes.
+ * @return true if they came back unchanged.
+ */
+static bool test_roundTrip(const uint8_t *data, uint32_t size, uint32_t *frameSize)
+{
+    uint32_t decodedSize;
+
+    *frameSize = test_compress(data, size);
+
+    return (test_decode(*frameSize, &decodedSize) == DECOMPRESSOR_OK) && (decodedSize == size) &&
+           (memcmp(decoded, data, size) == 0);
+}
+
+/**
+ * @brief  Machine code, runs of a byte and text round-trip, across block
+ *         boundaries and with a short last block; all of them shrink.
+ */
+static void test_samples(void)
+{
+    uint8_t *data = malloc(TEST_MAX_SIZE);
+    uint32_t frameSize;
+
+    TEST_CHECK(binarySampleSize > 2 * COMPRESSOR_BLOCK_SIZE);
+    TEST_CHECK(test_roundTrip(binarySample, binarySampleSize, &frameSize));
+    TEST_CHECK(frameSize < binarySampleSize);
+    printf("     machine code: %lu -> %lu bytes\n", (unsigned long)binarySampleSize, (unsigned long)frameSize);
+
+    memset(data, 0xFF, TEST_MAX_SIZE);
+    TEST_CHECK(test_roundTrip(data, 3 * COMPRESSOR_BLOCK_SIZE + 17, &frameSize));
+    TEST_CHECK(frameSize < 1024);
+
+    for (uint32_t i = 0; i < TEST_MAX_SIZE; i++)
+    {
+        data[i] = "firmware backup "[(i * 7 / 5) % 16];
+    }
+    TEST_CHECK(test_roundTrip(data, TEST_MAX_SIZE, &frameSize));
+    TEST_CHECK(frameSize < TEST_MAX_SIZE / 8);
+
+    TEST_CHECK(test_roundTrip(data, COMPRESSOR_BLOCK_SIZE, &frameSize));
+    TEST_CHECK(test_roundTrip(data, 0, &frameSize));
+    TEST_CHECK(frameSize == COMPRESSOR_FRAME_HEADER_SIZE + 4);
+
+    free(data);
+}
+
+/**
+ * @brief  Blocks that do not shrink are stored as is, flagged by bit 31 of
+ *         their length, and still decode.
+ */
+static void test_incompressible(void)
+{
+    uint32_t size = 2 * COMPRESSOR_BLOCK_SIZE + 1000;
+    uint8_t *data = malloc(size);
+    uint32_t frameSize;
+    uint32_t position = COMPRESSOR_FRAME_HEADER_SIZE;
+
+    for (uint32_t i = 0; i < size; i++)
+    {
+        data[i] = (uint8_t)rand();
+    }
+
+    TEST_CHECK(test_roundTrip(data, size, &frameSize));
+    TEST_CHECK(frameSize == COMPRESSOR_FRAME_HEADER_SIZE + size + 3 * 4 + 4);
+
+    for (uint32_t offset = 0; offset < size; offset += COMPRESSOR_BLOCK_SIZE)
+    {
+        uint32_t blockSize = (size - offset > COMPRESSOR_BLOCK_SIZE) ? COMPRESSOR_BLOCK_SIZE : (size - offset);
+        uint32_t length = frame[position] | (frame[position + 1] << 8) | (frame[position + 2] << 16) |
+                          ((uint32_t)frame[position + 3] << 24);
+
+        TEST_CHECK(length == (0x80000000U | blockSize));
+        TEST_CHECK(memcmp(frame + position + 4, data + offset, blockSize) == 0);
+        position += 4 + blockSize;
+    }
+
+    // Random data with a repeat: only the block holding it is compressed
+    memcpy(data + COMPRESSOR_BLOCK_SIZE + 30000, data + COMPRESSOR_BLOCK_SIZE + 100, 20000);
+    TEST_CHECK(test_roundTrip(data, size, &frameSize));
+    TEST_CHECK(frameSize < COMPRESSOR_FRAME_HEADER_SIZE + size + 3 * 4 + 4 - 10000);
+
+    free(data);
+}
+
+/**
+ * @brief  Short blocks, and matches ending right before the literals the
+ *         format keeps at the end of a block.
+ */
+static void test_blockEnds(void)
+{
+    uint8_t data[300];
+    uint32_t frameSize;
+
+    for (uint32_t size = 0; size <= 40; size++)
+    {
+        memset(data, 'a', size);
+        TEST_CHECK(test_roundTrip(data, size, &frameSize));
+
+        for (uint32_t i = 0; i < size; i++)
+        {
+            data[i] = (uint8_t)rand();
+        }
+        TEST_CHECK(test_roundTrip(data, size, &frameSize));
+    }
+
+    for (uint32_t tail = 0; tail < 20; tail++)
+    {
+        for (uint32_t i = 0; i < sizeof(data); i++)
+        {
+            data[i] = (i < 100) ? (uint8_t)rand() : data[i - 100];
+        }
+        for (uint32_t i = sizeof(data) - tail; i < sizeof(data); i++)
+        {
+            data[i] = (uint8_t)rand();
+        }
+        TEST_CHECK(test_roundTrip(data, sizeof(data), &frameSize));
+    }
+}
+
+/**
+ * @brief  The lz4 tool reads the frames too.
+ */
+static void test_lz4Tool(void)
+{
+    uint32_t frameSize = test_compress(binarySample, binarySampleSize);
+    char command[512];
+    FILE *file;
+
+    file = fopen(TEST_WORK_DIR "/backup.lz4", "wb");
+    TEST_CHECK((file != NULL) && (fwrite(frame, 1, frameSize, file) == frameSize));
+    if (file == NULL)
+    {
+        return;
+    }
+    fclose(file);
+
+    snprintf(command, sizeof(command), "%s -qq -d -f %s/backup.lz4 %s/backup.bin", TEST_LZ4, TEST_WORK_DIR, TEST_WORK_DIR);
+    TEST_CHECK(system(command) == 0);
+
+    file = fopen(TEST_WORK_DIR "/backup.bin", "rb");
+    TEST_CHECK(file != NULL);
+    if (file == NULL)
+    {
+        return;
+    }
+    TEST_CHECK(fread(decoded, 1, sizeof(decoded), file) == binarySampleSize);
+    TEST_CHECK(memcmp(decoded, binarySample, binarySampleSize) == 0);
+    fclose(file);
+}
+
+/**
+ * @brief  Reads the image of the backup through its header into `decoded`.
+ */
+static backup_StatusTypeDef test_readBackup(Backup_Header *header)
+{
+    static Backup_Reader reader;
+    StreamWriter_Source source;
+    FIL file;
+    uint32_t bytesRead = 0;
+
+    if (backup_open(&file, TEST_BACKUP_PATH, header) != BACKUP_OK)
+    {
+        return BACKUP_ERROR;
+    }
+
+    if ((backup_source(&source, &reader, &file, header) != BACKUP_OK) ||
+        (source.read(source.context, decoded, header->imageLength, &bytesRead) != STREAMWRITER_OK) ||
+        (bytesRead != header->imageLength))
+    {
+        f_close(&file);
+        return BACKUP_ERROR;
+    }
+
+    f_close(&file);
+    return BACKUP_OK;
+}
+
+/**
+ * @brief  A compressed backup holds the programmed part of the region, with
+ *         its length and CRC in a header covered by its own CRC.
+ */
+static void test_backupHeader(void)
+{
+    Backup_Header header;
+    uint32_t imageLength = (binarySampleSize - 1000) & ~(STM32FLASH_WORD_SIZE - 1);
+    uint32_t fileSize;
+    uint8_t *backup;
+
+    ramFatfs_format();
+    memset(region, 0xFF, TEST_REGION_SIZE);
+    memcpy(region, binarySample, imageLength);
+
+    TEST_CHECK(backup_create(TEST_REGION_ADDRESS, TEST_REGION_SIZE, TEST_BACKUP_PATH, true, NULL, 0) == BACKUP_OK);
+    TEST_CHECK(ramFatfs_file(TEST_BACKUP_PATH ".tmp", &fileSize) == NULL);
+
+    backup = ramFatfs_file(TEST_BACKUP_PATH, &fileSize);
+    TEST_CHECK((backup != NULL) && (fileSize < BACKUP_HEADER_SIZE + imageLength));
+    if (backup == NULL)
+    {
+        return;
+    }
+
+    memset(decoded, 0, sizeof(decoded));
+    TEST_CHECK(test_readBackup(&header) == BACKUP_OK);
+    TEST_CHECK((header.format == 2) && (header.compression == BACKUP_COMPRESSION_LZ4));
+    TEST_CHECK((header.flashAddress == TEST_REGION_ADDRESS) && (header.regionSize == TEST_REGION_SIZE));
+    TEST_CHECK(header.imageLength == imageLength);
+    TEST_CHECK(header.imageCRC == STM32Crc_compute(region, imageLength));
+    TEST_CHECK(memcmp(decoded, region, imageLength) == 0);
+
+    // The backup of an unchanged image is left alone
+    TEST_CHECK(backup_create(TEST_REGION_ADDRESS, TEST_REGION_SIZE, TEST_BACKUP_PATH, true, NULL, 0) == BACKUP_OK);
+    TEST_CHECK(ramFatfs_file(TEST_BACKUP_PATH, &fileSize) == backup);
+
+    // Every header field after the magic is covered by the header CRC
+    test_quiet(true);
+    for (uint32_t i = 4; i < BACKUP_HEADER_SIZE; i++)
+    {
+        backup[i] ^= 0x20;
+        TEST_CHECK(test_readBackup(&header) == BACKUP_ERROR);
+        backup[i] ^= 0x20;
+    }
+    test_quiet(false);
+
+    // A changed image is written again
+    region[imageLength / 2] ^= 0x01;
+    TEST_CHECK(backup_create(TEST_REGION_ADDRESS, TEST_REGION_SIZE, TEST_BACKUP_PATH, true, NULL, 0) == BACKUP_OK);
+    TEST_CHECK(test_readBackup(&header) == BACKUP_OK);
+    TEST_CHECK(header.imageCRC == STM32Crc_compute(region, imageLength));
+    TEST_CHECK(memcmp(decoded, region, imageLength) == 0);
+
+    // The base of a delta is stored as is
+    TEST_CHECK(backup_create(TEST_REGION_ADDRESS, TEST_REGION_SIZE, TEST_BACKUP_PATH, false, NULL, 0) == BACKUP_OK);
+    TEST_CHECK(test_readBackup(&header) == BACKUP_OK);
+    TEST_CHECK(header.compression == BACKUP_COMPRESSION_NONE);
+    TEST_CHECK((ramFatfs_file(TEST_BACKUP_PATH, &fileSize) != NULL) && (fileSize == BACKUP_HEADER_SIZE + imageLength));
+    TEST_CHECK(memcmp(decoded, region, imageLength) == 0);
+
+    ramFatfs_format();
+}
+
+/**
+ * @brief  Loads the first bytes of the machine code sample.
+ */
+static bool test_loadSample(void)
+{
+    FILE *file = fopen(TEST_BINARY_SAMPLE, "rb");
+
+    if (file == NULL)
+    {
+        printf("Cannot open %s\n", TEST_BINARY_SAMPLE);
+        return false;
+    }
+    binarySampleSize = (uint32_t)fread(binarySample, 1, sizeof(binarySample), file);
+    fclose(file);
+
+    return true;
+}
+
+int main(void)
+{
+    srand(1);
+
+    region = mmap((void *)(uintptr_t)TEST_REGION_ADDRESS, TEST_REGION_SIZE, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (region != (void *)(uintptr_t)TEST_REGION_ADDRESS)
+    {
+        printf("Cannot map the flash region at 0x%08lx\n", (unsigned long)TEST_REGION_ADDRESS);
+        return EXIT_FAILURE;
+    }
+    if (!test_loadSample())
+    {
+        return EXIT_FAILURE;
+    }
+
+    TEST_RUN(test_samples);
+    TEST_RUN(test_incompressible);
+    TEST_RUN(test_blockEnds);
+    TEST_RUN(test_lz4Tool);
+    TEST_RUN(test_backupHeader);
+
+    printf("%s: %d failure(s)\n", __FILE__, test_failures);
+    return (test_failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
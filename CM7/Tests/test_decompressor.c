@@ -0,0 +1,419 @@
+/**
+ ******************************************************************************
+ * @file           : test_decompressor.c
+ * @brief          : Host round-trip test of the LZ4 decompressor.
+ *                   Sample images are compressed with the lz4 command line
+ *                   tool, decoded through the stream writer into RAM-backed
+ *                   flash and compared. Corrupted and truncated frames must
+ *                   fail cleanly. With --throughput, the decode rate of each
+ *                   sample is measured as well.
+ ******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "decompressor.h"
+#include "stream_writer.h"
+
+#include "ram_flash.h"
+#include "test.h"
+#include "test_support.h"
+
+#ifndef TEST_LZ4
+#define TEST_LZ4        "lz4"
+#endif
+
+#ifndef TEST_BINARY_SAMPLE
+#define TEST_BINARY_SAMPLE  "/proc/self/exe"
+#endif
+
+#ifndef TEST_WORK_DIR
+#define TEST_WORK_DIR   "build"
+#endif
+
+#define TEST_ADDRESS            RAMFLASH_BASE
+#define TEST_MAX_SIZE           (1024 * 1024)
+#define TEST_FRAME_HEADER_SIZE  15              // Magic, FLG, BD, content size, header checksum
+#define TEST_CORRUPTIONS        3000
+#define TEST_THROUGHPUT_BYTES   (256UL * 1024 * 1024)
+
+typedef struct
+{
+    const char *name;
+    uint8_t *data;
+    uint32_t size;
+} TestSample;
+
+int test_failures;
+
+static TestSample samples[3];
+static uint8_t decoded[TEST_MAX_SIZE];
+
+void progress_update(ProgressManager* pm, uint32_t step_number, uint32_t current_value, uint32_t total_value)
+{
+    (void)pm;
+    (void)step_number;
+    (void)current_value;
+    (void)total_value;
+}
+
+/**
+ * @brief  Compresses `size` bytes with the lz4 tool.
+ * @return The frame, to be freed by the caller, or NULL if the tool failed.
+ */
+static uint8_t *test_compress(const uint8_t *data, uint32_t size, const char *options, uint32_t *frameSize)
+{
+    char command[512];
+    FILE *file;
+    uint8_t *frame;
+    long length;
+
+    file = fopen(TEST_WORK_DIR "/sample.bin", "wb");
+    if (file == NULL || fwrite(data, 1, size, file) != size)
+    {
+        return NULL;
+    }
+    fclose(file);
+
+    snprintf(command, sizeof(command), "%s -qq %s -B4 -BI --content-size -f %s/sample.bin %s/sample.lz4",
+             TEST_LZ4, options, TEST_WORK_DIR, TEST_WORK_DIR);
+    if (system(command) != 0)
+    {
+        printf("Error: '%s' failed\n", command);
+        return NULL;
+    }
+
+    file = fopen(TEST_WORK_DIR "/sample.lz4", "rb");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    frame = malloc(length);
+    if (fread(frame, 1, length, file) != (size_t)length)
+    {
+        free(frame);
+        frame = NULL;
+    }
+    fclose(file);
+
+    *frameSize = (uint32_t)length;
+    return frame;
+}
+
+/**
+ * @brief  Decodes a whole frame into `decoded`.
+ */
+static decompressor_StatusTypeDef test_decode(const uint8_t *frame, uint32_t frameSize, uint32_t *decodedSize)
+{
+    static Decompressor decompressor;
+    TestMemorySource memory;
+    StreamWriter_Source input;
+    uint32_t bytesRead = 0;
+
+    *decodedSize = 0;
+    test_memorySource(&input, &memory, frame, frameSize);
+
+    if (decompressor_open(&decompressor, &input, frameSize) != DECOMPRESSOR_OK)
+    {
+        return DECOMPRESSOR_ERROR;
+    }
+    if (decompressor.contentSize > TEST_MAX_SIZE)
+    {
+        return DECOMPRESSOR_ERROR;
+    }
+    if (decompressor_read(&decompressor, decoded, decompressor.contentSize, &bytesRead) != DECOMPRESSOR_OK)
+    {
+        return DECOMPRESSOR_ERROR;
+    }
+
+    *decodedSize = bytesRead;
+    return (bytesRead == decompressor.contentSize) ? DECOMPRESSOR_OK : DECOMPRESSOR_ERROR;
+}
+
+/**
+ * @brief  Decodes a frame through the stream writer into flash, as the
+ *         update does for a compressed section.
+ */
+static streamWriter_StatusTypeDef test_decodeToFlash(const uint8_t *frame, uint32_t frameSize, uint32_t *contentSize)
+{
+    static ProgressManager progressManager;
+    static Decompressor decompressor;
+    TestMemorySource memory;
+    StreamWriter_Source input;
+    StreamWriter_Source source;
+    StreamWriter_Sink sink;
+    StreamWriter writer;
+
+    test_memorySource(&input, &memory, frame, frameSize);
+    if (decompressor_open(&decompressor, &input, frameSize) != DECOMPRESSOR_OK)
+    {
+        return STREAMWRITER_ERROR;
+    }
+
+    *contentSize = decompressor.contentSize;
+    decompressor_source(&source, &decompressor);
+    streamWriter_flashSink(&sink, 0);
+    streamWriter_init(&writer, &source, &sink, TEST_ADDRESS, decompressor.contentSize, &progressManager, 0);
+
+    return streamWriter_run(&writer);
+}
+
+/**
+ * @brief  Fills the samples: a host binary for a firmware-like image,
+ *         random bytes, and text runs mixed with random bytes.
+ */
+static void test_loadSamples(void)
+{
+    FILE *file = fopen(TEST_BINARY_SAMPLE, "rb");
+
+    if (file == NULL)
+    {
+        file = fopen("/proc/self/exe", "rb");
+    }
+
+    samples[0].name = "binary";
+    samples[0].data = malloc(TEST_MAX_SIZE);
+    samples[0].size = (file != NULL) ? (uint32_t)fread(samples[0].data, 1, TEST_MAX_SIZE, file) : 0;
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+
+    samples[1].name = "random";
+    samples[1].size = 300 * 1024 + 17;
+    samples[1].data = malloc(samples[1].size);
+    for (uint32_t i = 0; i < samples[1].size; i++)
+    {
+        samples[1].data[i] = (uint8_t)rand();
+    }
+
+    samples[2].name = "mixed";
+    samples[2].size = 700 * 1024 + 3;
+    samples[2].data = malloc(samples[2].size);
+    for (uint32_t i = 0; i < samples[2].size;)
+    {
+        static const char text[] = "CISYNTH bootloader sample text, repeated with noise. ";
+        uint32_t run = 1 + (uint32_t)rand() % 200;
+
+        for (uint32_t j = 0; j < run && i < samples[2].size; j++, i++)
+        {
+            samples[2].data[i] = (rand() % 4 == 0) ? (uint8_t)rand() : (uint8_t)text[(i + j) % (sizeof(text) - 1)];
+        }
+    }
+}
+
+/**
+ * @brief  Every sample survives a round trip with each encoder setting,
+ *         with and without block and content checksums.
+ */
+static void test_roundTrip(void)
+{
+    static const char *options[] = { "-1", "-1 --no-frame-crc", "-1 -BX", "-9", "--fast=3" };
+
+    for (uint32_t s = 0; s < sizeof(samples) / sizeof(samples[0]); s++)
+    {
+        for (uint32_t o = 0; o < sizeof(options) / sizeof(options[0]); o++)
+        {
+            uint32_t frameSize = 0;
+            uint32_t decodedSize = 0;
+            uint8_t *frame = test_compress(samples[s].data, samples[s].size, options[o], &frameSize);
+
+            TEST_CHECK(frame != NULL);
+            if (frame == NULL)
+            {
+                continue;
+            }
+
+            TEST_CHECK(test_decode(frame, frameSize, &decodedSize) == DECOMPRESSOR_OK);
+            TEST_CHECK(decodedSize == samples[s].size);
+            TEST_CHECK(memcmp(decoded, samples[s].data, samples[s].size) == 0);
+            free(frame);
+        }
+    }
+}
+
+/**
+ * @brief  A compressed section decoded through the stream writer lands in
+ *         flash intact.
+ */
+static void test_roundTripToFlash(void)
+{
+    for (uint32_t s = 0; s < sizeof(samples) / sizeof(samples[0]); s++)
+    {
+        uint32_t frameSize = 0;
+        uint32_t contentSize = 0;
+        uint8_t *frame = test_compress(samples[s].data, samples[s].size, "-1", &frameSize);
+
+        TEST_CHECK(frame != NULL);
+        if (frame == NULL)
+        {
+            continue;
+        }
+
+        ramFlash_reset();
+        TEST_CHECK(test_decodeToFlash(frame, frameSize, &contentSize) == STREAMWRITER_OK);
+        TEST_CHECK(contentSize == samples[s].size);
+        TEST_CHECK(memcmp(ramFlash_at(TEST_ADDRESS), samples[s].data, samples[s].size) == 0);
+        free(frame);
+    }
+}
+
+/**
+ * @brief  Random byte flips in the blocks of a frame never make the decoder
+ *         read or write out of bounds (checked by the sanitizers); the frame
+ *         either fails or decodes to its announced size. A truncated frame
+ *         always fails.
+ */
+static void test_corruptedBlocks(void)
+{
+    uint32_t frameSize = 0;
+    uint32_t decodedSize = 0;
+    uint32_t rejected = 0;
+    uint8_t *frame = test_compress(samples[0].data, samples[0].size, "-1", &frameSize);
+    uint8_t *corrupted = malloc(frameSize);
+
+    TEST_CHECK(frame != NULL);
+    if (frame == NULL)
+    {
+        free(corrupted);
+        return;
+    }
+
+    test_quiet(true);
+    for (uint32_t i = 0; i < TEST_CORRUPTIONS; i++)
+    {
+        uint32_t flips = 1 + (uint32_t)rand() % 4;
+
+        memcpy(corrupted, frame, frameSize);
+        for (uint32_t f = 0; f < flips; f++)
+        {
+            uint32_t offset = TEST_FRAME_HEADER_SIZE + (uint32_t)rand() % (frameSize - TEST_FRAME_HEADER_SIZE);
+            corrupted[offset] ^= (uint8_t)(1 + rand() % 255);
+        }
+
+        if (test_decode(corrupted, frameSize, &decodedSize) != DECOMPRESSOR_OK)
+        {
+            rejected++;
+        }
+        else if (decodedSize != samples[0].size)
+        {
+            test_failures++;
+        }
+    }
+
+    // Flips in literals go unnoticed (the package CRC catches them), the
+    // ones hitting a token, a length or an offset are caught
+    TEST_CHECK(rejected > TEST_CORRUPTIONS / 4);
+
+    for (uint32_t i = 0; i < 200; i++)
+    {
+        uint32_t truncatedSize = (uint32_t)rand() % (frameSize - 4);
+        if (test_decode(frame, truncatedSize, &decodedSize) != DECOMPRESSOR_ERROR)
+        {
+            test_failures++;
+        }
+    }
+    test_quiet(false);
+
+    free(corrupted);
+    free(frame);
+}
+
+/**
+ * @brief  Hand-made blocks hitting each bounds check of the block decoder.
+ */
+static void test_malformedBlocks(void)
+{
+    static uint8_t out[64];
+
+    // 4 literals then a 4 byte match at offset 4, 8 bytes out
+    static const uint8_t valid[] = { 0x40, 'a', 'b', 'c', 'd', 0x04, 0x00, 0x00 };
+    TEST_CHECK(decompressor_decodeBlock(valid, sizeof(valid), out, sizeof(out)) == 8);
+    TEST_CHECK(memcmp(out, "abcdabcd", 8) == 0);
+
+    // Overlapping match repeating one byte
+    static const uint8_t run[] = { 0x1F, 'x', 0x01, 0x00, 0x05 };
+    TEST_CHECK(decompressor_decodeBlock(run, sizeof(run), out, sizeof(out)) == 1 + 15 + 5 + 4);
+    TEST_CHECK(out[0] == 'x' && out[24] == 'x');
+
+    static const uint8_t offsetZero[] = { 0x40, 'a', 'b', 'c', 'd', 0x00, 0x00, 0x00 };
+    TEST_CHECK(decompressor_decodeBlock(offsetZero, sizeof(offsetZero), out, sizeof(out)) < 0);
+
+    static const uint8_t offsetTooFar[] = { 0x40, 'a', 'b', 'c', 'd', 0x05, 0x00, 0x00 };
+    TEST_CHECK(decompressor_decodeBlock(offsetTooFar, sizeof(offsetTooFar), out, sizeof(out)) < 0);
+
+    static const uint8_t literalsPastInput[] = { 0x50, 'a', 'b', 'c', 'd' };
+    TEST_CHECK(decompressor_decodeBlock(literalsPastInput, sizeof(literalsPastInput), out, sizeof(out)) < 0);
+
+    static const uint8_t truncatedLength[] = { 0xF0, 0xFF, 0xFF };
+    TEST_CHECK(decompressor_decodeBlock(truncatedLength, sizeof(truncatedLength), out, sizeof(out)) < 0);
+
+    static const uint8_t truncatedOffset[] = { 0x40, 'a', 'b', 'c', 'd', 0x04 };
+    TEST_CHECK(decompressor_decodeBlock(truncatedOffset, sizeof(truncatedOffset), out, sizeof(out)) < 0);
+
+    static const uint8_t matchPastOutput[] = { 0x4F, 'a', 'b', 'c', 'd', 0x04, 0x00, 0xFF, 0x00 };
+    TEST_CHECK(decompressor_decodeBlock(matchPastOutput, sizeof(matchPastOutput), out, sizeof(out)) < 0);
+
+    TEST_CHECK(decompressor_decodeBlock(valid, sizeof(valid), out, 7) < 0);
+}
+
+/**
+ * @brief  Measures the decode rate of each sample at the lz4 -1 setting.
+ */
+static void test_throughput(void)
+{
+    for (uint32_t s = 0; s < sizeof(samples) / sizeof(samples[0]); s++)
+    {
+        struct timespec start, end;
+        uint32_t frameSize = 0;
+        uint32_t decodedSize = 0;
+        uint32_t rounds = (uint32_t)(TEST_THROUGHPUT_BYTES / samples[s].size) + 1;
+        uint8_t *frame = test_compress(samples[s].data, samples[s].size, "-1", &frameSize);
+
+        if (frame == NULL)
+        {
+            test_failures++;
+            continue;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint32_t r = 0; r < rounds; r++)
+        {
+            TEST_CHECK(test_decode(frame, frameSize, &decodedSize) == DECOMPRESSOR_OK);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) * 1e-9;
+        printf("  %-8s %8lu -> %8lu bytes (ratio %.2f), decode %.0f MB/s\n", samples[s].name,
+               (unsigned long)samples[s].size, (unsigned long)frameSize, (double)samples[s].size / frameSize,
+               (double)samples[s].size * rounds / seconds / 1e6);
+        free(frame);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    srand(1);
+    test_loadSamples();
+
+    if (argc > 1 && strcmp(argv[1], "--throughput") == 0)
+    {
+        TEST_RUN(test_throughput);
+    }
+    else
+    {
+        TEST_RUN(test_malformedBlocks);
+        TEST_RUN(test_roundTrip);
+        TEST_RUN(test_roundTripToFlash);
+        TEST_RUN(test_corruptedBlocks);
+    }
+
+    printf("%s: %d failure(s)\n", __FILE__, test_failures);
+    return (test_failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
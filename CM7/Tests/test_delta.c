@@ -0,0 +1,303 @@
+/**
+ ******************************************************************************
+ * @file           : test_delta.c
+ * @brief          : Host test of the delta patch applier.
+ *                   Deltas are built in memory against a pseudo-random base
+ *                   image held in a RAM-backed file. The rebuilt image must
+ *                   match byte for byte whatever the read sizes, and base
+ *                   mismatches, copies outside of the base and overflows of
+ *                   the target must be rejected.
+ ******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "delta.h"
+#include "stm32_crc.h"
+
+#include "ram_fatfs.h"
+#include "test.h"
+#include "test_support.h"
+
+#define TEST_BASE_SIZE      8192
+#define TEST_BASE_OFFSET    512                 // Backup header in front of the image
+#define TEST_BASE_SLACK     1024                // File bytes past the base, not covered by its CRC
+#define TEST_MAX_SIZE       16384
+
+/* Delta stream being built */
+typedef struct
+{
+    uint8_t data[TEST_MAX_SIZE];
+    uint32_t size;
+} TestDelta;
+
+int test_failures;
+
+static uint8_t baseFile[TEST_BASE_OFFSET + TEST_BASE_SIZE + TEST_BASE_SLACK];
+static const uint8_t *base = baseFile + TEST_BASE_OFFSET;
+static uint8_t expected[TEST_MAX_SIZE];
+static uint8_t rebuilt[TEST_MAX_SIZE];
+
+static void test_putUint32LE(TestDelta *delta, uint32_t value)
+{
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        delta->data[delta->size++] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static void test_header(TestDelta *delta, uint32_t baseSize, uint32_t targetSize)
+{
+    memcpy(delta->data, "DLTA", 4);
+    delta->size = 4;
+    test_putUint32LE(delta, baseSize);
+    test_putUint32LE(delta, STM32Crc_compute(base, baseSize));
+    test_putUint32LE(delta, targetSize);
+}
+
+static void test_copy(TestDelta *delta, uint32_t offset, uint32_t length)
+{
+    delta->data[delta->size++] = 0x01;
+    test_putUint32LE(delta, offset);
+    test_putUint32LE(delta, length);
+}
+
+static void test_literal(TestDelta *delta, const uint8_t *bytes, uint32_t length)
+{
+    delta->data[delta->size++] = 0x02;
+    test_putUint32LE(delta, length);
+    memcpy(delta->data + delta->size, bytes, length);
+    delta->size += length;
+}
+
+static void test_end(TestDelta *delta)
+{
+    delta->data[delta->size++] = 0x00;
+}
+
+/**
+ * @brief  Applies a delta against the base file, `chunk` bytes per read.
+ * @return DELTA_OK if the whole target was rebuilt into `rebuilt`.
+ */
+static delta_StatusTypeDef test_apply(const TestDelta *delta, uint32_t chunk, uint32_t *rebuiltSize)
+{
+    static Delta state;
+    static FIL file;
+    static RamFatfs_File ramFile;
+    TestMemorySource memory;
+    StreamWriter_Source input;
+    uint32_t bytesRead;
+
+    *rebuiltSize = 0;
+    ramFatfs_open(&file, &ramFile, baseFile, sizeof(baseFile));
+    test_memorySource(&input, &memory, delta->data, delta->size);
+
+    if (delta_open(&state, &input, &file, TEST_BASE_OFFSET) != DELTA_OK)
+    {
+        return DELTA_ERROR;
+    }
+
+    do
+    {
+        uint32_t length = (TEST_MAX_SIZE - *rebuiltSize < chunk) ? (TEST_MAX_SIZE - *rebuiltSize) : chunk;
+
+        if (delta_read(&state, rebuilt + *rebuiltSize, length, &bytesRead) != DELTA_OK)
+        {
+            return DELTA_ERROR;
+        }
+        *rebuiltSize += bytesRead;
+    } while (bytesRead != 0);
+
+    return (*rebuiltSize == state.header.targetSize) ? DELTA_OK : DELTA_ERROR;
+}
+
+/**
+ * @brief  Copies and literals interleaved, read with chunk sizes that
+ *         straddle the command boundaries.
+ */
+static void test_copyAndLiteral(void)
+{
+    static const uint32_t chunks[] = { 1, 7, 333, 4096, TEST_MAX_SIZE };
+    uint8_t literal[300];
+    TestDelta *delta = malloc(sizeof(TestDelta));
+    uint32_t target = 0;
+
+    for (uint32_t i = 0; i < sizeof(literal); i++)
+    {
+        literal[i] = (uint8_t)rand();
+    }
+
+    // base[100..1100) + literal + base[6000..8192) + base[0..50) + literal[0..1)
+    memcpy(expected, base + 100, 1000);
+    memcpy(expected + 1000, literal, sizeof(literal));
+    memcpy(expected + 1300, base + 6000, TEST_BASE_SIZE - 6000);
+    memcpy(expected + 1300 + TEST_BASE_SIZE - 6000, base, 50);
+    expected[1350 + TEST_BASE_SIZE - 6000] = literal[0];
+    target = 1351 + TEST_BASE_SIZE - 6000;
+
+    test_header(delta, TEST_BASE_SIZE, target);
+    test_copy(delta, 100, 1000);
+    test_literal(delta, literal, sizeof(literal));
+    test_copy(delta, 6000, TEST_BASE_SIZE - 6000);
+    test_copy(delta, 0, 50);
+    test_literal(delta, literal, 1);
+    test_end(delta);
+
+    for (uint32_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+    {
+        uint32_t rebuiltSize;
+
+        memset(rebuilt, 0, sizeof(rebuilt));
+        TEST_CHECK(test_apply(delta, chunks[i], &rebuiltSize) == DELTA_OK);
+        TEST_CHECK(rebuiltSize == target);
+        TEST_CHECK(memcmp(rebuilt, expected, target) == 0);
+    }
+
+    free(delta);
+}
+
+/**
+ * @brief  The base is checked against the CRC of the header before the
+ *         flash is touched: any changed byte of the covered part fails,
+ *         bytes past it do not matter.
+ */
+static void test_baseMismatch(void)
+{
+    static FIL file;
+    static RamFatfs_File ramFile;
+    Delta_Header header = { .baseSize = TEST_BASE_SIZE - 1000, .baseCRC = STM32Crc_compute(base, TEST_BASE_SIZE - 1000) };
+
+    ramFatfs_open(&file, &ramFile, base, TEST_BASE_SIZE);
+    TEST_CHECK(delta_checkBase(&file, &header) == DELTA_OK);
+
+    baseFile[TEST_BASE_OFFSET + TEST_BASE_SIZE - 1] ^= 0x01;
+    ramFatfs_open(&file, &ramFile, base, TEST_BASE_SIZE);
+    TEST_CHECK(delta_checkBase(&file, &header) == DELTA_OK);
+    baseFile[TEST_BASE_OFFSET + TEST_BASE_SIZE - 1] ^= 0x01;
+
+    test_quiet(true);
+
+    baseFile[TEST_BASE_OFFSET + 1234] ^= 0x80;
+    ramFatfs_open(&file, &ramFile, base, TEST_BASE_SIZE);
+    TEST_CHECK(delta_checkBase(&file, &header) == DELTA_ERROR);
+    baseFile[TEST_BASE_OFFSET + 1234] ^= 0x80;
+
+    // Installed image shorter than the base the delta expects
+    ramFatfs_open(&file, &ramFile, base, header.baseSize - 1);
+    TEST_CHECK(delta_checkBase(&file, &header) == DELTA_ERROR);
+
+    test_quiet(false);
+}
+
+/**
+ * @brief  Copies must stay within the part of the base covered by the CRC,
+ *         including when offset + length wraps around 32 bits.
+ */
+static void test_copyOutOfRange(void)
+{
+    static const uint32_t copies[][2] =
+    {
+        { TEST_BASE_SIZE + 1, 0 },
+        { TEST_BASE_SIZE, 1 },
+        { TEST_BASE_SIZE - 10, 11 },
+        { 0, TEST_BASE_SIZE + 1 },
+        { 0xFFFFFFF0U, 0x20 },
+        { 16, 0xFFFFFFF8U },
+    };
+    TestDelta *delta = malloc(sizeof(TestDelta));
+    uint32_t rebuiltSize;
+
+    // The covered part ends before the file does: copies past it are rejected too
+    test_header(delta, TEST_BASE_SIZE - 100, TEST_BASE_SIZE);
+    test_copy(delta, TEST_BASE_SIZE - 150, 100);
+    test_end(delta);
+    test_quiet(true);
+    TEST_CHECK(test_apply(delta, TEST_MAX_SIZE, &rebuiltSize) == DELTA_ERROR);
+    test_quiet(false);
+
+    for (uint32_t i = 0; i < sizeof(copies) / sizeof(copies[0]); i++)
+    {
+        // Sized so that the copy alone would rebuild the target if it were let through
+        test_header(delta, TEST_BASE_SIZE, (copies[i][1] < TEST_MAX_SIZE) ? copies[i][1] : TEST_MAX_SIZE);
+        test_copy(delta, copies[i][0], copies[i][1]);
+        test_end(delta);
+
+        test_quiet(true);
+        TEST_CHECK(test_apply(delta, TEST_MAX_SIZE, &rebuiltSize) == DELTA_ERROR);
+        test_quiet(false);
+    }
+
+    // The last byte of the base is still in range
+    test_header(delta, TEST_BASE_SIZE, 1);
+    test_copy(delta, TEST_BASE_SIZE - 1, 1);
+    test_end(delta);
+    TEST_CHECK(test_apply(delta, TEST_MAX_SIZE, &rebuiltSize) == DELTA_OK);
+    TEST_CHECK(rebuilt[0] == base[TEST_BASE_SIZE - 1]);
+
+    free(delta);
+}
+
+/**
+ * @brief  Streams that do not rebuild exactly the announced target fail.
+ */
+static void test_malformedStreams(void)
+{
+    TestDelta *delta = malloc(sizeof(TestDelta));
+    uint8_t literal[16] = { 0 };
+    uint32_t rebuiltSize;
+
+    test_quiet(true);
+
+    // Produces more than announced
+    test_header(delta, TEST_BASE_SIZE, 10);
+    test_literal(delta, literal, sizeof(literal));
+    test_end(delta);
+    TEST_CHECK(test_apply(delta, TEST_MAX_SIZE, &rebuiltSize) == DELTA_ERROR);
+
+    // Ends short of the target
+    test_header(delta, TEST_BASE_SIZE, 100);
+    test_copy(delta, 0, 99);
+    test_end(delta);
+    TEST_CHECK(test_apply(delta, TEST_MAX_SIZE, &rebuiltSize) == DELTA_ERROR);
+
+    // Unknown command, truncated literal, missing end, bad magic
+    test_header(delta, TEST_BASE_SIZE, 10);
+    delta->data[delta->size++] = 0x03;
+    TEST_CHECK(test_apply(delta, TEST_MAX_SIZE, &rebuiltSize) == DELTA_ERROR);
+
+    test_header(delta, TEST_BASE_SIZE, sizeof(literal));
+    test_literal(delta, literal, sizeof(literal));
+    delta->size -= 4;
+    TEST_CHECK(test_apply(delta, TEST_MAX_SIZE, &rebuiltSize) == DELTA_ERROR);
+
+    test_header(delta, TEST_BASE_SIZE, sizeof(literal));
+    test_literal(delta, literal, sizeof(literal));
+    TEST_CHECK(test_apply(delta, TEST_MAX_SIZE, &rebuiltSize) == DELTA_ERROR);
+
+    test_header(delta, TEST_BASE_SIZE, 0);
+    test_end(delta);
+    delta->data[0] = 'X';
+    TEST_CHECK(test_apply(delta, TEST_MAX_SIZE, &rebuiltSize) == DELTA_ERROR);
+
+    test_quiet(false);
+
+    free(delta);
+}
+
+int main(void)
+{
+    srand(1);
+    for (uint32_t i = 0; i < sizeof(baseFile); i++)
+    {
+        baseFile[i] = (uint8_t)rand();
+    }
+
+    TEST_RUN(test_copyAndLiteral);
+    TEST_RUN(test_baseMismatch);
+    TEST_RUN(test_copyOutOfRange);
+    TEST_RUN(test_malformedStreams);
+
+    printf("%s: %d failure(s)\n", __FILE__, test_failures);
+    return (test_failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
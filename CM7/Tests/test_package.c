@@ -0,0 +1,546 @@
+/**
+ ******************************************************************************
+ * @file           : test_package.c
+ * @brief          : Host test of the update package manifest parser.
+ *                   Packages are built in memory and read through a
+ *                   RAM-backed file. v1 headers must map onto the same
+ *                   manifest as v2, unknown records must be skipped, and
+ *                   truncated or corrupted manifests, sections running past
+ *                   the file and block digests without their section must
+ *                   be rejected. Sections with block digests must read back
+ *                   whatever the read sizes, and a corrupted block or digest
+ *                   table must stop the reader.
+ ******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "package.h"
+#include "stm32_crc.h"
+
+#include "ram_fatfs.h"
+#include "test.h"
+#include "test_support.h"
+
+#define TEST_PACKAGE_SIZE   65536
+#define TEST_SECTION_OFFSET 512                 // First section, past the manifest
+#define TEST_HEADER_SIZE    12                  // v2 fixed header
+#define TEST_TABLE_OFFSET   16384               // Block digests of the CM7 section
+#define TEST_VERIFIED_SIZE  (3 * PACKAGE_BLOCK_SIZE + 1000)
+#define TEST_PLAIN_OFFSET   32768               // CM4 section, without digests
+#define TEST_PLAIN_SIZE     5000
+
+/* Package being built: the v2 manifest is appended record by record */
+typedef struct
+{
+    uint8_t data[TEST_PACKAGE_SIZE];
+    uint32_t size;                              // File size
+    uint32_t manifestSize;
+} TestPackage;
+
+int test_failures;
+
+static TestPackage package;
+static FIL packageFile;
+static RamFatfs_File packageRamFile;
+static uint8_t output[TEST_PACKAGE_SIZE];
+
+/* package_verifySection() reports its progress */
+void progress_update(ProgressManager *pm, uint32_t step_number, uint32_t current_value, uint32_t total_value)
+{
+}
+
+static void test_putUint16LE(uint8_t *buffer, uint16_t value)
+{
+    buffer[0] = (uint8_t)value;
+    buffer[1] = (uint8_t)(value >> 8);
+}
+
+static void test_putUint32LE(uint8_t *buffer, uint32_t value)
+{
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        buffer[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+/**
+ * @brief  Starts a v2 package of `size` pseudo-random bytes with an empty manifest.
+ */
+static void test_beginV2(uint32_t size)
+{
+    for (uint32_t i = 0; i < size; i++)
+    {
+        package.data[i] = (uint8_t)rand();
+    }
+    package.size = size;
+
+    memcpy(package.data, "BOT2", 4);
+    test_putUint16LE(package.data + 4, 2);
+    package.manifestSize = TEST_HEADER_SIZE;
+}
+
+static void test_record(uint8_t tag, const uint8_t *value, uint8_t length)
+{
+    package.data[package.manifestSize] = tag;
+    package.data[package.manifestSize + 1] = length;
+    memcpy(package.data + package.manifestSize + 2, value, length);
+    package.manifestSize += 2 + length;
+}
+
+static void test_section(uint8_t type, uint8_t encoding, uint32_t target, uint32_t offset, uint32_t length)
+{
+    uint8_t value[20] = { type, encoding, 5, 0 };
+
+    test_putUint32LE(value + 4, target);
+    test_putUint32LE(value + 8, offset);
+    test_putUint32LE(value + 12, length);
+    test_putUint32LE(value + 16, STM32Crc_compute(package.data + offset, length));
+    test_record(0x02, value, sizeof(value));
+}
+
+static void test_blocks(uint8_t type, uint32_t tableOffset, uint32_t tableSize)
+{
+    uint8_t value[12] = { type, 12, 0, 0 };
+
+    test_putUint32LE(value + 4, tableOffset);
+    test_putUint32LE(value + 8, STM32Crc_compute(package.data + tableOffset, tableSize));
+    test_record(0x03, value, sizeof(value));
+}
+
+/**
+ * @brief  Closes the manifest: size and CRC of the records.
+ */
+static void test_endV2(void)
+{
+    test_putUint16LE(package.data + 6, (uint16_t)package.manifestSize);
+    test_putUint32LE(package.data + 8, STM32Crc_compute(package.data + TEST_HEADER_SIZE,
+                                                        package.manifestSize - TEST_HEADER_SIZE));
+}
+
+static package_StatusTypeDef test_read(Package_Manifest *manifest)
+{
+    ramFatfs_open(&packageFile, &packageRamFile, package.data, package.size);
+    return package_readManifest(&packageFile, manifest);
+}
+
+/**
+ * @brief  Builds a package holding a CM7 section with block digests, its last
+ *         block short, and a CM4 section without.
+ */
+static void test_buildVerified(void)
+{
+    uint32_t numBlocks = (TEST_VERIFIED_SIZE + PACKAGE_BLOCK_SIZE - 1) / PACKAGE_BLOCK_SIZE;
+
+    test_beginV2(TEST_PACKAGE_SIZE);
+    for (uint32_t i = 0; i < numBlocks; i++)
+    {
+        uint32_t length = (i == numBlocks - 1) ? (TEST_VERIFIED_SIZE - i * PACKAGE_BLOCK_SIZE) : PACKAGE_BLOCK_SIZE;
+        test_putUint32LE(package.data + TEST_TABLE_OFFSET + i * 4,
+                         STM32Crc_compute(package.data + TEST_SECTION_OFFSET + i * PACKAGE_BLOCK_SIZE, length));
+    }
+    test_section(PACKAGE_SECTION_CM7, 0, 0, TEST_SECTION_OFFSET, TEST_VERIFIED_SIZE);
+    test_blocks(PACKAGE_SECTION_CM7, TEST_TABLE_OFFSET, numBlocks * 4);
+    test_section(PACKAGE_SECTION_CM4, 0, 0, TEST_PLAIN_OFFSET, TEST_PLAIN_SIZE);
+    test_endV2();
+}
+
+/**
+ * @brief  Reads a whole section into `output`, cycling through the read sizes.
+ * @return PACKAGE_OK if the reader handed out the section without error,
+ *         `outputSize` is set to the bytes handed out either way.
+ */
+static package_StatusTypeDef test_readSection(uint8_t type, const uint32_t *chunks, uint32_t numChunks, uint32_t *outputSize)
+{
+    Package_Manifest manifest;
+    Package_Reader reader;
+    StreamWriter_Source source;
+    uint32_t bytesRead;
+
+    *outputSize = 0;
+    if ((test_read(&manifest) != PACKAGE_OK) ||
+        (package_openReader(&reader, &packageFile, package_findSection(&manifest, type)) != PACKAGE_OK))
+    {
+        return PACKAGE_ERROR;
+    }
+    package_readerSource(&source, &reader);
+
+    for (uint32_t i = 0; ; i++)
+    {
+        uint32_t chunk = chunks[i % numChunks];
+        uint32_t length = (sizeof(output) - *outputSize < chunk) ? (sizeof(output) - *outputSize) : chunk;
+
+        if (source.read(source.context, output + *outputSize, length, &bytesRead) != STREAMWRITER_OK)
+        {
+            return PACKAGE_ERROR;
+        }
+        *outputSize += bytesRead;
+
+        if (bytesRead == 0)
+        {
+            return PACKAGE_OK;
+        }
+    }
+}
+
+/**
+ * @brief  The fixed v1 header maps onto three sections stored back to back,
+ *         with their encoding flags, the version and the footer CRC.
+ */
+static void test_v1Mapping(void)
+{
+    static const uint32_t sizes[3] = { 1000, 2000, 300 };
+    Package_Manifest manifest;
+    uint32_t size = 24 + sizes[0] + sizes[1] + sizes[2] + 4;
+
+    memset(package.data, 0xA5, size);
+    package.size = size;
+    memcpy(package.data, "BOOT", 4);
+    test_putUint32LE(package.data + 4, sizes[0] | 0x80000000U);
+    test_putUint32LE(package.data + 8, sizes[1]);
+    test_putUint32LE(package.data + 12, sizes[2] | 0x40000000U);
+    memcpy(package.data + 16, "1.2.3-rc", 8);
+    test_putUint32LE(package.data + size - 4, 0x12345678);
+
+    TEST_CHECK(test_read(&manifest) == PACKAGE_OK);
+    TEST_CHECK(manifest.format == 1);
+    TEST_CHECK(strcmp(manifest.version, "1.2.3-rc") == 0);
+    TEST_CHECK(manifest.identity == 0x12345678);
+    TEST_CHECK(manifest.numSections == 3);
+
+    const Package_Section *cm7 = package_findSection(&manifest, PACKAGE_SECTION_CM7);
+    const Package_Section *cm4 = package_findSection(&manifest, PACKAGE_SECTION_CM4);
+    const Package_Section *external = package_findSection(&manifest, PACKAGE_SECTION_EXTERNAL);
+
+    TEST_CHECK((cm7 != NULL) && (cm7->offset == 24) && (cm7->length == sizes[0]) &&
+               (cm7->encoding == PACKAGE_ENCODING_LZ4) && (cm7->target == 0) && (cm7->blockTable == 0));
+    TEST_CHECK((cm4 != NULL) && (cm4->offset == 24 + sizes[0]) && (cm4->length == sizes[1]) && (cm4->encoding == 0));
+    TEST_CHECK((external != NULL) && (external->offset == 24 + sizes[0] + sizes[1]) &&
+               (external->length == sizes[2]) && (external->encoding == PACKAGE_ENCODING_DELTA));
+
+    // Sizes adding up past the file
+    test_putUint32LE(package.data + 8, sizes[1] + 1000);
+    test_quiet(true);
+    TEST_CHECK(test_read(&manifest) == PACKAGE_ERROR);
+    test_quiet(false);
+}
+
+/**
+ * @brief  A v2 manifest with records of unknown tags, longer records than
+ *         this parser knows and a block digest table.
+ */
+static void test_v2Manifest(void)
+{
+    static const uint8_t unknown[] = { 0xDE, 0xAD, 0xBE, 0xEF, 0x02, 0x14 };
+    Package_Manifest manifest;
+
+    test_beginV2(TEST_PACKAGE_SIZE);
+    test_record(0x01, (const uint8_t *)"2.0.1", 5);
+    test_record(0x7F, unknown, sizeof(unknown));
+    test_section(PACKAGE_SECTION_CM7, PACKAGE_ENCODING_LZ4, 0, TEST_SECTION_OFFSET, 10000);
+    test_record(0x80, (const uint8_t *)"", 0);
+    test_section(PACKAGE_SECTION_CM4, 0, 0x08180000, 10528, 3000);
+    test_blocks(PACKAGE_SECTION_CM7, 16384, 3 * 4);
+    test_endV2();
+
+    TEST_CHECK(test_read(&manifest) == PACKAGE_OK);
+    TEST_CHECK(manifest.format == 2);
+    TEST_CHECK(strcmp(manifest.version, "2.0.1") == 0);
+    TEST_CHECK(manifest.numSections == 2);
+
+    const Package_Section *cm7 = package_findSection(&manifest, PACKAGE_SECTION_CM7);
+    const Package_Section *cm4 = package_findTarget(&manifest, PACKAGE_SECTION_CM4, 0x08180000);
+
+    TEST_CHECK((cm7 != NULL) && (cm7->offset == TEST_SECTION_OFFSET) && (cm7->length == 10000) &&
+               (cm7->encoding == PACKAGE_ENCODING_LZ4) && (cm7->blockTable == 16384));
+    TEST_CHECK((cm4 != NULL) && (cm4->offset == 10528) && (cm4->length == 3000) && (cm4->blockTable == 0));
+    TEST_CHECK(package_findSection(&manifest, PACKAGE_SECTION_EXTERNAL) == NULL);
+
+    // A section record with trailing fields from a later format is still read
+    test_beginV2(TEST_PACKAGE_SIZE);
+    uint8_t longer[24] = { PACKAGE_SECTION_EXTERNAL, 0, 5, 0 };
+    test_putUint32LE(longer + 8, TEST_SECTION_OFFSET);
+    test_putUint32LE(longer + 12, 64);
+    test_record(0x02, longer, sizeof(longer));
+    test_endV2();
+
+    TEST_CHECK(test_read(&manifest) == PACKAGE_OK);
+    TEST_CHECK((manifest.numSections == 1) && (manifest.sections[0].length == 64));
+}
+
+/**
+ * @brief  A record running past the manifest size, or too short for its
+ *         tag, is rejected.
+ */
+static void test_truncatedRecord(void)
+{
+    Package_Manifest manifest;
+
+    test_quiet(true);
+
+    test_beginV2(TEST_PACKAGE_SIZE);
+    test_section(PACKAGE_SECTION_CM7, 0, 0, TEST_SECTION_OFFSET, 1000);
+    package.manifestSize -= 1;
+    test_endV2();
+    TEST_CHECK(test_read(&manifest) == PACKAGE_ERROR);
+
+    test_beginV2(TEST_PACKAGE_SIZE);
+    test_record(0x01, (const uint8_t *)"1.0", 3);
+    package.data[package.manifestSize++] = 0x7F;
+    package.data[package.manifestSize++] = 10;
+    package.manifestSize += 9;
+    test_endV2();
+    TEST_CHECK(test_read(&manifest) == PACKAGE_ERROR);
+
+    test_beginV2(TEST_PACKAGE_SIZE);
+    test_record(0x02, package.data + TEST_SECTION_OFFSET, 19);
+    test_endV2();
+    TEST_CHECK(test_read(&manifest) == PACKAGE_ERROR);
+
+    test_beginV2(TEST_PACKAGE_SIZE);
+    test_section(PACKAGE_SECTION_CM7, 0, 0, TEST_SECTION_OFFSET, 4096);
+    test_record(0x03, package.data + TEST_SECTION_OFFSET, 11);
+    test_endV2();
+    TEST_CHECK(test_read(&manifest) == PACKAGE_ERROR);
+
+    // Manifest size past the end of the file
+    test_beginV2(64);
+    test_record(0x01, (const uint8_t *)"1.0", 3);
+    test_endV2();
+    test_putUint16LE(package.data + 6, 128);
+    TEST_CHECK(test_read(&manifest) == PACKAGE_ERROR);
+
+    test_quiet(false);
+}
+
+/**
+ * @brief  Any changed byte of the records fails the manifest CRC.
+ */
+static void test_badManifestCRC(void)
+{
+    Package_Manifest manifest;
+
+    test_beginV2(TEST_PACKAGE_SIZE);
+    test_record(0x01, (const uint8_t *)"1.0", 3);
+    test_section(PACKAGE_SECTION_CM7, 0, 0, TEST_SECTION_OFFSET, 1000);
+    test_endV2();
+    TEST_CHECK(test_read(&manifest) == PACKAGE_OK);
+
+    test_quiet(true);
+
+    for (uint32_t position = TEST_HEADER_SIZE; position < package.manifestSize; position += 7)
+    {
+        package.data[position] ^= 0x10;
+        TEST_CHECK(test_read(&manifest) == PACKAGE_ERROR);
+        package.data[position] ^= 0x10;
+    }
+
+    package.data[8] ^= 0x01;
+    TEST_CHECK(test_read(&manifest) == PACKAGE_ERROR);
+    package.data[8] ^= 0x01;
+
+    test_quiet(false);
+
+    TEST_CHECK(test_read(&manifest) == PACKAGE_OK);
+}
+
+/**
+ * @brief  Sections and digest tables must lie within the file, including
+ *         when offset + length wraps around 32 bits.
+ */
+static void test_sectionPastFile(void)
+{
+    static const uint32_t sections[][2] =
+    {
+        { TEST_PACKAGE_SIZE - 1024, 1025 },
+        { TEST_PACKAGE_SIZE + 32, 0 },
+        { TEST_SECTION_OFFSET, TEST_PACKAGE_SIZE },
+        { TEST_SECTION_OFFSET, 0xFFFFFFE0U },
+        { 0xFFFFFFE0U, 0x40 },
+    };
+    Package_Manifest manifest;
+
+    test_quiet(true);
+
+    for (uint32_t i = 0; i < sizeof(sections) / sizeof(sections[0]); i++)
+    {
+        test_beginV2(TEST_PACKAGE_SIZE);
+        test_section(PACKAGE_SECTION_CM7, 0, 0, TEST_SECTION_OFFSET, 0);
+        test_putUint32LE(package.data + package.manifestSize - 12, sections[i][0]);
+        test_putUint32LE(package.data + package.manifestSize - 8, sections[i][1]);
+        test_endV2();
+        TEST_CHECK(test_read(&manifest) == PACKAGE_ERROR);
+    }
+
+    // Digest table running past the file
+    test_beginV2(TEST_PACKAGE_SIZE);
+    test_section(PACKAGE_SECTION_CM7, 0, 0, TEST_SECTION_OFFSET, 8192);
+    test_blocks(PACKAGE_SECTION_CM7, TEST_PACKAGE_SIZE - 4, 4);
+    test_endV2();
+    TEST_CHECK(test_read(&manifest) == PACKAGE_ERROR);
+
+    test_quiet(false);
+
+    // Last byte of the file
+    test_beginV2(TEST_PACKAGE_SIZE);
+    test_section(PACKAGE_SECTION_CM7, 0, 0, TEST_PACKAGE_SIZE - 1024, 1024);
+    test_blocks(PACKAGE_SECTION_CM7, TEST_PACKAGE_SIZE - 4, 4);
+    test_endV2();
+    TEST_CHECK(test_read(&manifest) == PACKAGE_OK);
+}
+
+/**
+ * @brief  Block digests attach to a section read before them: a BLOCKS
+ *         record ahead of its SECTION, or of another type, is rejected.
+ */
+static void test_blocksBeforeSection(void)
+{
+    Package_Manifest manifest;
+
+    test_quiet(true);
+
+    test_beginV2(TEST_PACKAGE_SIZE);
+    test_blocks(PACKAGE_SECTION_CM7, 16384, 4);
+    test_section(PACKAGE_SECTION_CM7, 0, 0, TEST_SECTION_OFFSET, 4096);
+    test_endV2();
+    TEST_CHECK(test_read(&manifest) == PACKAGE_ERROR);
+
+    test_beginV2(TEST_PACKAGE_SIZE);
+    test_section(PACKAGE_SECTION_CM7, 0, 0, TEST_SECTION_OFFSET, 4096);
+    test_blocks(PACKAGE_SECTION_CM4, 16384, 4);
+    test_endV2();
+    TEST_CHECK(test_read(&manifest) == PACKAGE_ERROR);
+
+    test_quiet(false);
+
+    test_beginV2(TEST_PACKAGE_SIZE);
+    test_section(PACKAGE_SECTION_CM7, 0, 0, TEST_SECTION_OFFSET, 4096);
+    test_blocks(PACKAGE_SECTION_CM7, 16384, 4);
+    test_endV2();
+    TEST_CHECK(test_read(&manifest) == PACKAGE_OK);
+    TEST_CHECK(manifest.sections[0].blockTable == 16384);
+}
+
+/**
+ * @brief  Verified and plain sections read back whatever the read sizes,
+ *         whole blocks and partial reads mixed, short tail block included.
+ */
+static void test_blockReader(void)
+{
+    static const uint32_t chunks[][4] =
+    {
+        { 1 }, { 7 }, { 1000 }, { PACKAGE_BLOCK_SIZE }, { 5000 }, { 2 * PACKAGE_BLOCK_SIZE },
+        { 100, PACKAGE_BLOCK_SIZE, PACKAGE_BLOCK_SIZE - 100, 1 },
+        { PACKAGE_BLOCK_SIZE, 3, PACKAGE_BLOCK_SIZE + 5, 17 },
+    };
+    uint32_t outputSize;
+
+    test_buildVerified();
+
+    for (uint32_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+    {
+        uint32_t numChunks = 0;
+
+        while ((numChunks < 4) && (chunks[i][numChunks] != 0))
+        {
+            numChunks++;
+        }
+
+        memset(output, 0, sizeof(output));
+        TEST_CHECK(test_readSection(PACKAGE_SECTION_CM7, chunks[i], numChunks, &outputSize) == PACKAGE_OK);
+        TEST_CHECK(outputSize == TEST_VERIFIED_SIZE);
+        TEST_CHECK(memcmp(output, package.data + TEST_SECTION_OFFSET, TEST_VERIFIED_SIZE) == 0);
+
+        memset(output, 0, sizeof(output));
+        TEST_CHECK(test_readSection(PACKAGE_SECTION_CM4, chunks[i], numChunks, &outputSize) == PACKAGE_OK);
+        TEST_CHECK(outputSize == TEST_PLAIN_SIZE);
+        TEST_CHECK(memcmp(output, package.data + TEST_PLAIN_OFFSET, TEST_PLAIN_SIZE) == 0);
+    }
+}
+
+/**
+ * @brief  A corrupted block stops the reader before any of its bytes are
+ *         handed out; a corrupted digest table is rejected when the reader
+ *         is opened.
+ */
+static void test_corruptedBlock(void)
+{
+    static const uint32_t blockReads[] = { PACKAGE_BLOCK_SIZE };
+    static const uint32_t smallReads[] = { 100 };
+    static const uint32_t corrupted[] = { 0, PACKAGE_BLOCK_SIZE + 17, 3 * PACKAGE_BLOCK_SIZE, TEST_VERIFIED_SIZE - 1 };
+    uint32_t outputSize;
+
+    test_buildVerified();
+    test_quiet(true);
+
+    for (uint32_t i = 0; i < sizeof(corrupted) / sizeof(corrupted[0]); i++)
+    {
+        uint32_t blockStart = (corrupted[i] / PACKAGE_BLOCK_SIZE) * PACKAGE_BLOCK_SIZE;
+
+        package.data[TEST_SECTION_OFFSET + corrupted[i]] ^= 0x04;
+
+        TEST_CHECK(test_readSection(PACKAGE_SECTION_CM7, blockReads, 1, &outputSize) == PACKAGE_ERROR);
+        TEST_CHECK(outputSize == blockStart);
+        TEST_CHECK(test_readSection(PACKAGE_SECTION_CM7, smallReads, 1, &outputSize) == PACKAGE_ERROR);
+        TEST_CHECK(outputSize <= blockStart);
+
+        package.data[TEST_SECTION_OFFSET + corrupted[i]] ^= 0x04;
+    }
+
+    // Digest table not matching table_crc
+    package.data[TEST_TABLE_OFFSET + 5] ^= 0x01;
+    TEST_CHECK(test_readSection(PACKAGE_SECTION_CM7, blockReads, 1, &outputSize) == PACKAGE_ERROR);
+    TEST_CHECK(outputSize == 0);
+    package.data[TEST_TABLE_OFFSET + 5] ^= 0x01;
+
+    test_quiet(false);
+
+    TEST_CHECK(test_readSection(PACKAGE_SECTION_CM7, blockReads, 1, &outputSize) == PACKAGE_OK);
+}
+
+/**
+ * @brief  The digest table of a section is bounded by PACKAGE_MAX_BLOCKS.
+ */
+static void test_maxBlocks(void)
+{
+    uint32_t maxLength = PACKAGE_MAX_BLOCKS * PACKAGE_BLOCK_SIZE;
+    uint32_t size = TEST_SECTION_OFFSET + maxLength + PACKAGE_BLOCK_SIZE;
+    uint8_t *data = calloc(size, 1);
+    Package_Manifest manifest;
+
+    for (uint32_t length = maxLength; length <= maxLength + 1; length++)
+    {
+        test_beginV2(TEST_HEADER_SIZE);
+        test_section(PACKAGE_SECTION_CM7, 0, 0, TEST_SECTION_OFFSET, 0);
+        test_putUint32LE(package.data + package.manifestSize - 8, length);
+        test_blocks(PACKAGE_SECTION_CM7, TEST_SECTION_OFFSET, 0);
+        test_endV2();
+        memcpy(data, package.data, package.manifestSize);
+
+        ramFatfs_open(&packageFile, &packageRamFile, data, size);
+        test_quiet(true);
+        TEST_CHECK(package_readManifest(&packageFile, &manifest) == ((length == maxLength) ? PACKAGE_OK : PACKAGE_ERROR));
+        test_quiet(false);
+    }
+
+    free(data);
+}
+
+int main(void)
+{
+    srand(1);
+
+    TEST_RUN(test_v1Mapping);
+    TEST_RUN(test_v2Manifest);
+    TEST_RUN(test_truncatedRecord);
+    TEST_RUN(test_badManifestCRC);
+    TEST_RUN(test_sectionPastFile);
+    TEST_RUN(test_blocksBeforeSection);
+    TEST_RUN(test_blockReader);
+    TEST_RUN(test_corruptedBlock);
+    TEST_RUN(test_maxBlocks);
+
+    printf("%s: %d failure(s)\n", __FILE__, test_failures);
+    return (test_failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,168 @@
+/**
+ ******************************************************************************
+ * @file           : test_persistent_data.c
+ * @brief          : Host test of the persistent data reader shared with the
+ *                   firmware, on a sector mapped below 4 GB so that its
+ *                   addresses fit the 32-bit address arguments.
+ ******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "persistent_data.h"
+
+#include "test.h"
+
+#define TEST_SECTOR_SIZE    0x20000U
+#define TEST_WORDS          (TEST_SECTOR_SIZE / STM32FLASH_WORD_SIZE)
+
+int test_failures;
+
+static uint8_t *sector;
+static uint32_t sectorAddress;
+static uint32_t sequence;
+
+static void test_erase(void)
+{
+    memset(sector, 0xFF, TEST_SECTOR_SIZE);
+    sequence = 0;
+}
+
+static uint32_t test_wordAddress(uint32_t word)
+{
+    return sectorAddress + word * STM32FLASH_WORD_SIZE;
+}
+
+static void test_writeRecord(uint32_t word, FW_UpdateState updateState, bool torn)
+{
+    PersistentData_Record record;
+
+    memset(&record, 0, sizeof(record));
+    record.updateState = updateState;
+    record.trialSlot = STM32FLASH_NO_SLOT;
+    record.magic = PERSISTENT_DATA_MAGIC;
+    record.sequence = ++sequence;
+    record.crc = STM32Crc_computeSoftware(&record, offsetof(PersistentData_Record, crc));
+    if (torn)
+    {
+        record.session ^= 1;
+    }
+
+    memcpy(sector + word * STM32FLASH_WORD_SIZE, &record, sizeof(record));
+}
+
+/* Stands for an update journal record, never taken for persistent data */
+static void test_writeOther(uint32_t word)
+{
+    memset(sector + word * STM32FLASH_WORD_SIZE, 0x5A, STM32FLASH_WORD_SIZE);
+}
+
+static void test_emptySector(void)
+{
+    uint32_t end = 0;
+
+    test_erase();
+    TEST_CHECK(persistentData_find(sectorAddress, TEST_SECTOR_SIZE, &end) == NULL);
+    TEST_CHECK(end == test_wordAddress(1));
+    TEST_CHECK(persistentData_readState(sectorAddress, TEST_SECTOR_SIZE) == FW_UPDATE_DONE);
+}
+
+/* Word 0 alone, as written by the firmware after erasing the sector */
+static void test_bareState(void)
+{
+    uint32_t state = FW_UPDATE_RECEIVED;
+    uint32_t end = 0;
+
+    test_erase();
+    memcpy(sector, &state, sizeof(state));
+    TEST_CHECK(persistentData_find(sectorAddress, TEST_SECTOR_SIZE, &end) == NULL);
+    TEST_CHECK(end == test_wordAddress(1));
+    TEST_CHECK(persistentData_readState(sectorAddress, TEST_SECTOR_SIZE) == FW_UPDATE_RECEIVED);
+
+    // The bootloader logs TO_TEST then TESTING after it, word 0 no longer tells the state
+    test_writeRecord(1, FW_UPDATE_TO_TEST, false);
+    test_writeOther(2);
+    test_writeRecord(3, FW_UPDATE_TESTING, false);
+    TEST_CHECK(persistentData_readState(sectorAddress, TEST_SECTOR_SIZE) == FW_UPDATE_TESTING);
+    TEST_CHECK(persistentData_find(sectorAddress, TEST_SECTOR_SIZE, &end) == (const PersistentData_Record *)(uintptr_t)test_wordAddress(3));
+    TEST_CHECK(end == test_wordAddress(4));
+}
+
+/* Every log length, records mixed with journal words */
+static void test_logLengths(void)
+{
+    for (uint32_t length = 1; length < TEST_WORDS; length += (length < 64) ? 1 : 97)
+    {
+        uint32_t newest = 0;
+        uint32_t end = 0;
+
+        test_erase();
+        for (uint32_t word = 1; word <= length; word++)
+        {
+            if ((word % 3) == 0)
+            {
+                test_writeOther(word);
+            }
+            else
+            {
+                test_writeRecord(word, (word & 1) ? FW_UPDATE_TO_TEST : FW_UPDATE_NONE, false);
+                newest = word;
+            }
+        }
+
+        const PersistentData_Record *record = persistentData_find(sectorAddress, TEST_SECTOR_SIZE, &end);
+        TEST_CHECK(end == test_wordAddress(length + 1));
+        TEST_CHECK(record == (const PersistentData_Record *)(uintptr_t)test_wordAddress(newest));
+    }
+}
+
+/* A record torn by a power loss is skipped for the previous one */
+static void test_tornRecord(void)
+{
+    test_erase();
+    test_writeRecord(1, FW_UPDATE_TO_TEST, false);
+    test_writeRecord(2, FW_UPDATE_TESTING, true);
+    TEST_CHECK(persistentData_readState(sectorAddress, TEST_SECTOR_SIZE) == FW_UPDATE_TO_TEST);
+
+    test_erase();
+    test_writeRecord(1, FW_UPDATE_TESTING, true);
+    TEST_CHECK(persistentData_find(sectorAddress, TEST_SECTOR_SIZE, NULL) == NULL);
+}
+
+/* A full sector ends at the sector end, its last record is current */
+static void test_fullSector(void)
+{
+    uint32_t end = 0;
+
+    test_erase();
+    for (uint32_t word = 1; word < TEST_WORDS; word++)
+    {
+        test_writeRecord(word, (word == TEST_WORDS - 1) ? FW_UPDATE_TESTING : FW_UPDATE_TO_TEST, false);
+    }
+
+    TEST_CHECK(persistentData_readState(sectorAddress, TEST_SECTOR_SIZE) == FW_UPDATE_TESTING);
+    TEST_CHECK(persistentData_find(sectorAddress, TEST_SECTOR_SIZE, &end) != NULL);
+    TEST_CHECK(end == sectorAddress + TEST_SECTOR_SIZE);
+}
+
+int main(void)
+{
+    sector = mmap(NULL, TEST_SECTOR_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (sector == MAP_FAILED)
+    {
+        printf("Error: no memory below 4 GB\n");
+        return EXIT_FAILURE;
+    }
+    sectorAddress = (uint32_t)(uintptr_t)sector;
+
+    TEST_RUN(test_emptySector);
+    TEST_RUN(test_bareState);
+    TEST_RUN(test_logLengths);
+    TEST_RUN(test_tornRecord);
+    TEST_RUN(test_fullSector);
+
+    printf("%s: %d failure(s)\n", __FILE__, test_failures);
+    return (test_failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,266 @@
+/**
+ ******************************************************************************
+ * @file           : test_stream_writer.c
+ * @brief          : Host test of the stream writer pipeline, driven from a
+ *                   RAM file through f_read() into RAM-backed internal flash.
+ ******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "stm32_flash.h"
+#include "stream_writer.h"
+
+#include "ram_fatfs.h"
+#include "ram_flash.h"
+#include "test.h"
+
+#define TEST_ADDRESS    (RAMFLASH_BASE + RAMFLASH_BANK_SIZE)   // Bank 2, sector 0
+#define TEST_MAX_SIZE   (3 * RAMFLASH_SECTOR_SIZE)
+
+int test_failures;
+
+static uint8_t image[TEST_MAX_SIZE];
+static uint32_t lastProgress;
+
+/* progress.c drives the GUI, only the reported value matters here */
+void progress_update(ProgressManager* pm, uint32_t step_number, uint32_t current_value, uint32_t total_value)
+{
+    (void)pm;
+    (void)step_number;
+    (void)total_value;
+    lastProgress = current_value;
+}
+
+/**
+ * @brief  Streams `size` bytes of a `fileSize` bytes file to TEST_ADDRESS.
+ */
+static streamWriter_StatusTypeDef test_write(RamFatfs_File *ramFile, uint32_t size, uint32_t fileSize,
+                                             uint32_t failAt, uint32_t skipSectors)
+{
+    static ProgressManager progressManager;
+    FIL file;
+    StreamWriter_FileSource fileSource;
+    StreamWriter_Source source;
+    StreamWriter_Sink sink;
+    StreamWriter writer;
+
+    ramFatfs_open(&file, ramFile, image, fileSize);
+    ramFile->failAt = failAt;
+    lastProgress = 0;
+
+    streamWriter_fileSource(&source, &fileSource, &file, size);
+    streamWriter_flashSink(&sink, skipSectors);
+    streamWriter_init(&writer, &source, &sink, TEST_ADDRESS, size, &progressManager, 0);
+
+    return streamWriter_run(&writer);
+}
+
+static bool test_isErased(uint32_t address, uint32_t length)
+{
+    const uint8_t *data = ramFlash_at(address);
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        if (data[i] != 0xFF)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief  Whole-buffer, partial-buffer and partial-word payloads land intact,
+ *         padded with the erased value up to the next flash word.
+ */
+static void test_sizes(void)
+{
+    static const uint32_t sizes[] = {
+        1, RAMFLASH_WORD_SIZE - 1, RAMFLASH_WORD_SIZE, STREAMWRITER_BUFFER_SIZE - 5, STREAMWRITER_BUFFER_SIZE,
+        STREAMWRITER_BUFFER_SIZE + 1, 7 * STREAMWRITER_BUFFER_SIZE + 100, TEST_MAX_SIZE
+    };
+
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        RamFatfs_File ramFile;
+        uint32_t size = sizes[i];
+        uint32_t padded = (size + RAMFLASH_WORD_SIZE - 1) & ~(RAMFLASH_WORD_SIZE - 1);
+        uint32_t buffers = (size + STREAMWRITER_BUFFER_SIZE - 1) / STREAMWRITER_BUFFER_SIZE;
+
+        ramFlash_reset();
+        TEST_CHECK(test_write(&ramFile, size, size, 0, 0) == STREAMWRITER_OK);
+        TEST_CHECK(memcmp(ramFlash_at(TEST_ADDRESS), image, size) == 0);
+        TEST_CHECK(test_isErased(TEST_ADDRESS + size, padded - size + RAMFLASH_WORD_SIZE));
+        TEST_CHECK(ramFlash_stats.programs == buffers);
+        TEST_CHECK(ramFile.reads == buffers);
+        TEST_CHECK(!ramFlash_stats.busy);
+        TEST_CHECK(lastProgress == size);
+
+        // Every read after the first one overlaps with the programming of the previous buffer
+        TEST_CHECK(ramFile.overlapped == buffers - 1);
+    }
+}
+
+/**
+ * @brief  An empty payload touches neither the file nor the flash.
+ */
+static void test_empty(void)
+{
+    RamFatfs_File ramFile;
+
+    ramFlash_reset();
+    TEST_CHECK(test_write(&ramFile, 0, 0, 0, 0) == STREAMWRITER_OK);
+    TEST_CHECK(ramFile.reads == 0);
+    TEST_CHECK(ramFlash_stats.programs == 0);
+}
+
+/**
+ * @brief  A destination that is not on a flash word boundary is refused.
+ */
+static void test_misaligned(void)
+{
+    static ProgressManager progressManager;
+    RamFatfs_File ramFile;
+    FIL file;
+    StreamWriter_FileSource fileSource;
+    StreamWriter_Source source;
+    StreamWriter_Sink sink;
+    StreamWriter writer;
+
+    ramFlash_reset();
+    ramFatfs_open(&file, &ramFile, image, STREAMWRITER_BUFFER_SIZE);
+    streamWriter_fileSource(&source, &fileSource, &file, STREAMWRITER_BUFFER_SIZE);
+    streamWriter_flashSink(&sink, 0);
+    streamWriter_init(&writer, &source, &sink, TEST_ADDRESS + 16, STREAMWRITER_BUFFER_SIZE, &progressManager, 0);
+
+    TEST_CHECK(streamWriter_run(&writer) == STREAMWRITER_ERROR);
+    TEST_CHECK(ramFile.reads == 0);
+    TEST_CHECK(ramFlash_stats.programs == 0);
+}
+
+/**
+ * @brief  A file shorter than the announced payload fails without leaving a
+ *         buffer in flight.
+ */
+static void test_shortRead(void)
+{
+    static const uint32_t fileSizes[] = { 0, 100, STREAMWRITER_BUFFER_SIZE, 5 * STREAMWRITER_BUFFER_SIZE - 1 };
+
+    for (uint32_t i = 0; i < sizeof(fileSizes) / sizeof(fileSizes[0]); i++)
+    {
+        RamFatfs_File ramFile;
+        uint32_t fullBuffers = fileSizes[i] / STREAMWRITER_BUFFER_SIZE;
+
+        ramFlash_reset();
+        TEST_CHECK(test_write(&ramFile, 8 * STREAMWRITER_BUFFER_SIZE, fileSizes[i], 0, 0) == STREAMWRITER_ERROR);
+        TEST_CHECK(!ramFlash_stats.busy);
+        TEST_CHECK(ramFlash_stats.programs <= fullBuffers);
+        TEST_CHECK(memcmp(ramFlash_at(TEST_ADDRESS), image, ramFlash_stats.programs * STREAMWRITER_BUFFER_SIZE) == 0);
+    }
+}
+
+/**
+ * @brief  A read error in the middle of the payload fails without leaving a
+ *         buffer in flight.
+ */
+static void test_sourceError(void)
+{
+    static const uint32_t failOffsets[] = { 1, STREAMWRITER_BUFFER_SIZE + 1, 6 * STREAMWRITER_BUFFER_SIZE + 7 };
+
+    for (uint32_t i = 0; i < sizeof(failOffsets) / sizeof(failOffsets[0]); i++)
+    {
+        RamFatfs_File ramFile;
+
+        ramFlash_reset();
+        TEST_CHECK(test_write(&ramFile, TEST_MAX_SIZE, TEST_MAX_SIZE, failOffsets[i], 0) == STREAMWRITER_ERROR);
+        TEST_CHECK(!ramFlash_stats.busy);
+        TEST_CHECK(ramFile.position < failOffsets[i]);
+    }
+}
+
+/**
+ * @brief  The sink refusing a buffer, or a word programmed with the wrong
+ *         value, fails the write. A word left erased by a failed program
+ *         operation is repaired by the verification.
+ */
+static void test_sinkError(void)
+{
+    RamFatfs_File ramFile;
+    uint32_t size = 6 * STREAMWRITER_BUFFER_SIZE;
+
+    ramFlash_reset();
+    ramFlash_faults.refuseProgramAt = TEST_ADDRESS + 3 * STREAMWRITER_BUFFER_SIZE;
+    TEST_CHECK(test_write(&ramFile, size, size, 0, 0) == STREAMWRITER_ERROR);
+    TEST_CHECK(!ramFlash_stats.busy);
+    TEST_CHECK(ramFlash_stats.programs == 3);
+    TEST_CHECK(test_isErased(ramFlash_faults.refuseProgramAt, size - 3 * STREAMWRITER_BUFFER_SIZE));
+
+    ramFlash_reset();
+    ramFlash_faults.corruptWordAt = TEST_ADDRESS + 2 * STREAMWRITER_BUFFER_SIZE + 5 * RAMFLASH_WORD_SIZE;
+    TEST_CHECK(test_write(&ramFile, size, size, 0, 0) == STREAMWRITER_ERROR);
+    TEST_CHECK(!ramFlash_stats.busy);
+    TEST_CHECK(ramFlash_stats.programs == 3);
+
+    ramFlash_reset();
+    ramFlash_faults.dropWordAt = TEST_ADDRESS + 4 * STREAMWRITER_BUFFER_SIZE + RAMFLASH_WORD_SIZE;
+    TEST_CHECK(test_write(&ramFile, size, size, 0, 0) == STREAMWRITER_OK);
+    TEST_CHECK(ramFlash_stats.repairs == 1);
+    TEST_CHECK(memcmp(ramFlash_at(TEST_ADDRESS), image, size) == 0);
+}
+
+/**
+ * @brief  Buffers falling in a skipped sector are neither programmed nor
+ *         verified, the other sectors are written as usual.
+ */
+static void test_skipMask(void)
+{
+    RamFatfs_File ramFile;
+    uint32_t sectorBuffers = RAMFLASH_SECTOR_SIZE / STREAMWRITER_BUFFER_SIZE;
+    uint32_t sector0 = stm32Flash_getSector(TEST_ADDRESS);
+
+    // Skip the middle sector, it keeps whatever it held
+    ramFlash_reset();
+    memset(ramFlash_at(TEST_ADDRESS + RAMFLASH_SECTOR_SIZE), 0xA5, RAMFLASH_SECTOR_SIZE);
+    TEST_CHECK(test_write(&ramFile, TEST_MAX_SIZE, TEST_MAX_SIZE, 0, 1UL << (sector0 + 1)) == STREAMWRITER_OK);
+    TEST_CHECK(ramFlash_stats.programs == 2 * sectorBuffers);
+    TEST_CHECK(memcmp(ramFlash_at(TEST_ADDRESS), image, RAMFLASH_SECTOR_SIZE) == 0);
+    TEST_CHECK(ramFlash_at(TEST_ADDRESS + RAMFLASH_SECTOR_SIZE)[0] == 0xA5);
+    TEST_CHECK(ramFlash_at(TEST_ADDRESS + 2 * RAMFLASH_SECTOR_SIZE - 1)[0] == 0xA5);
+    TEST_CHECK(memcmp(ramFlash_at(TEST_ADDRESS + 2 * RAMFLASH_SECTOR_SIZE), image + 2 * RAMFLASH_SECTOR_SIZE,
+                      RAMFLASH_SECTOR_SIZE) == 0);
+    TEST_CHECK(ramFile.reads == 3 * sectorBuffers);
+    TEST_CHECK(lastProgress == TEST_MAX_SIZE);
+
+    // Skipping every sector reads the whole payload and programs nothing
+    ramFlash_reset();
+    TEST_CHECK(test_write(&ramFile, TEST_MAX_SIZE, TEST_MAX_SIZE, 0, 0xFFFFFFFFUL) == STREAMWRITER_OK);
+    TEST_CHECK(ramFlash_stats.programs == 0);
+    TEST_CHECK(test_isErased(TEST_ADDRESS, TEST_MAX_SIZE));
+
+    // A skipped sector after a faulty one does not hide the fault
+    ramFlash_reset();
+    ramFlash_faults.corruptWordAt = TEST_ADDRESS + RAMFLASH_SECTOR_SIZE - RAMFLASH_WORD_SIZE;
+    TEST_CHECK(test_write(&ramFile, TEST_MAX_SIZE, TEST_MAX_SIZE, 0, 1UL << (sector0 + 1)) == STREAMWRITER_ERROR);
+}
+
+int main(void)
+{
+    srand(1);
+    for (uint32_t i = 0; i < sizeof(image); i++)
+    {
+        image[i] = (uint8_t)rand();
+    }
+
+    TEST_RUN(test_sizes);
+    TEST_RUN(test_empty);
+    TEST_RUN(test_misaligned);
+    TEST_RUN(test_shortRead);
+    TEST_RUN(test_sourceError);
+    TEST_RUN(test_sinkError);
+    TEST_RUN(test_skipMask);
+
+    printf("%s: %d failure(s)\n", __FILE__, test_failures);
+    return (test_failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
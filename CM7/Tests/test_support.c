@@ -0,0 +1,65 @@
+/**
+ ******************************************************************************
+ * @file           : test_support.c
+ * @brief          : Helpers shared by the host tests.
+ ******************************************************************************
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "test_support.h"
+
+static streamWriter_StatusTypeDef test_memoryRead(void *context, uint8_t *buffer, uint32_t length, uint32_t *bytesRead)
+{
+    TestMemorySource *memory = (TestMemorySource *)context;
+
+    if (length > memory->size - memory->position)
+    {
+        length = memory->size - memory->position;
+    }
+
+    memcpy(buffer, memory->data + memory->position, length);
+    memory->position += length;
+    *bytesRead = length;
+    return STREAMWRITER_OK;
+}
+
+/**
+ * @brief  Builds a source reading `size` bytes of `data`, short only at the end.
+ */
+void test_memorySource(StreamWriter_Source *source, TestMemorySource *memory, const uint8_t *data, uint32_t size)
+{
+    memory->data = data;
+    memory->size = size;
+    memory->position = 0;
+
+    source->read = test_memoryRead;
+    source->context = memory;
+}
+
+/**
+ * @brief  Silences the error messages of the module under test while
+ *         malformed input is fed to it.
+ */
+void test_quiet(bool quiet)
+{
+    static int savedStdout = -1;
+
+    fflush(stdout);
+    if (quiet && savedStdout < 0)
+    {
+        int devNull = open("/dev/null", O_WRONLY);
+        savedStdout = dup(STDOUT_FILENO);
+        dup2(devNull, STDOUT_FILENO);
+        close(devNull);
+    }
+    else if (!quiet && savedStdout >= 0)
+    {
+        dup2(savedStdout, STDOUT_FILENO);
+        close(savedStdout);
+        savedStdout = -1;
+    }
+}
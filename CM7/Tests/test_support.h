@@ -0,0 +1,28 @@
+/**
+ ******************************************************************************
+ * @file           : test_support.h
+ * @brief          : Helpers shared by the host tests: a stream writer source
+ *                   reading from memory, and a switch silencing the error
+ *                   messages of the modules under test.
+ ******************************************************************************
+ */
+
+#ifndef __TEST_SUPPORT_H__
+#define __TEST_SUPPORT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stream_writer.h"
+
+typedef struct
+{
+    const uint8_t *data;
+    uint32_t size;
+    uint32_t position;
+} TestMemorySource;
+
+void test_memorySource(StreamWriter_Source *source, TestMemorySource *memory, const uint8_t *data, uint32_t size);
+void test_quiet(bool quiet);
+
+#endif /* __TEST_SUPPORT_H__ */
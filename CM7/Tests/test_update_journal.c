@@ -0,0 +1,350 @@
+/**
+ ******************************************************************************
+ * @file           : test_update_journal.c
+ * @brief          : Host test of the update journal, on the persistent data
+ *                   sector mapped at its flash address. The asynchronous
+ *                   flash driver is replaced by a queue run one operation at
+ *                   a time, as the FLASH interrupt would, which can fail
+ *                   programs and leave their word erased or torn.
+ ******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "boot_config.h"
+#include "stm32_flash.h"
+#include "stm32_flash_async.h"
+#include "update_journal.h"
+
+#include "test.h"
+
+#define TEST_WORD(i)        (FLASH_PERSISTENT_DATA_ADDRESS + (i) * STM32FLASH_WORD_SIZE)
+#define TEST_WORDS          (FLASH_SECTOR_SIZE / STM32FLASH_WORD_SIZE)
+#define TEST_PACKAGE_SIZE   123456U
+#define TEST_PACKAGE_CRC    0x0BADC0DEU
+#define TEST_QUEUE_DEPTH    8
+
+typedef struct
+{
+    uint32_t address;
+    const uint8_t *data;
+    uint32_t length;
+    STM32FlashAsync_Callback callback;
+    void *context;
+} TestFlashOp;
+
+int test_failures;
+
+static uint8_t *sector;
+static uint32_t session;
+
+/* Flash driver stand-in */
+static TestFlashOp ops[TEST_QUEUE_DEPTH];
+static uint32_t opsHead;
+static uint32_t opsTail;
+static uint32_t maxQueued;
+static uint32_t programs;
+static uint32_t failPrograms;       // Programs still to fail
+static bool tearFailedWords;        // A failed program leaves its word torn instead of erased
+static uint32_t programsOverData;   // Programs of a word that was not erased
+
+STM32Flash_StatusTypeDef STM32Flash_readPersistentState(STM32Flash_PersistentState* state)
+{
+    memset(state, 0, sizeof(*state));
+    state->updateState = FW_UPDATE_RECEIVED;
+    state->session = session;
+    return STM32FLASH_OK;
+}
+
+STM32Flash_StatusTypeDef STM32FlashAsync_program(uint32_t address, const uint8_t *data, uint32_t length, STM32FlashAsync_Callback callback, void *context)
+{
+    if ((opsTail - opsHead) >= TEST_QUEUE_DEPTH)
+    {
+        return STM32FLASH_ERROR;
+    }
+
+    ops[opsTail % TEST_QUEUE_DEPTH] = (TestFlashOp){ address, data, length, callback, context };
+    opsTail++;
+    if ((opsTail - opsHead) > maxQueued)
+    {
+        maxQueued = opsTail - opsHead;
+    }
+    return STM32FLASH_OK;
+}
+
+static bool test_isErased(uint32_t address)
+{
+    const uint8_t *word = (const uint8_t *)(uintptr_t)address;
+
+    for (uint32_t i = 0; i < STM32FLASH_WORD_SIZE; i++)
+    {
+        if (word[i] != 0xFF)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief  Runs the operation at the head of the queue, as the FLASH interrupt does.
+ */
+static void test_flashStep(void)
+{
+    if (opsHead == opsTail)
+    {
+        return;
+    }
+
+    TestFlashOp op = ops[opsHead % TEST_QUEUE_DEPTH];
+    uint8_t *word = (uint8_t *)(uintptr_t)op.address;
+
+    opsHead++;
+    programs++;
+
+    if (!test_isErased(op.address))
+    {
+        programsOverData++;
+    }
+
+    if (failPrograms > 0)
+    {
+        failPrograms--;
+        if (tearFailedWords)
+        {
+            memcpy(word, op.data, STM32FLASH_WORD_SIZE / 2);
+        }
+        op.callback(STM32FLASH_ERROR, op.address, op.context);
+        return;
+    }
+
+    for (uint32_t i = 0; i < op.length; i++)
+    {
+        word[i] &= op.data[i];
+    }
+    op.callback(STM32FLASH_OK, op.address + op.length - STM32FLASH_WORD_SIZE, op.context);
+}
+
+bool STM32FlashAsync_isBusy(uint32_t flashBank)
+{
+    (void)flashBank;
+    test_flashStep();
+    return opsHead != opsTail;
+}
+
+STM32Flash_StatusTypeDef STM32FlashAsync_wait(uint32_t flashBank)
+{
+    (void)flashBank;
+    while (opsHead != opsTail)
+    {
+        test_flashStep();
+    }
+    return STM32FLASH_OK;
+}
+
+static void test_erase(void)
+{
+    memset(sector, 0xFF, FLASH_SECTOR_SIZE);
+    opsHead = opsTail = 0;
+    maxQueued = 0;
+    programs = 0;
+    failPrograms = 0;
+    tearFailedWords = false;
+    programsOverData = 0;
+    session = 7;
+}
+
+/**
+ * @brief  Tells whether the log ends at its first erased word, the
+ *         invariant persistentData_find() relies on.
+ * @param  end Filled with the index of the first erased word.
+ */
+static bool test_hasNoHole(uint32_t *end)
+{
+    uint32_t word = 1;
+
+    while ((word < TEST_WORDS) && !test_isErased(TEST_WORD(word)))
+    {
+        word++;
+    }
+    *end = word;
+
+    for (; word < TEST_WORDS; word++)
+    {
+        if (!test_isErased(TEST_WORD(word)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Appends the records of a CM7 update up to its flash step, six in all */
+static void test_appendUpdate(UpdateJournal *journal)
+{
+    updateJournal_stepDone(journal, 1);
+    updateJournal_compareDone(journal, UPDATE_JOURNAL_IMAGE_CM7, 0x30);
+    updateJournal_stepDone(journal, 6);
+    updateJournal_sectorDone(journal, UPDATE_JOURNAL_IMAGE_CM7, 4);
+    updateJournal_sectorDone(journal, UPDATE_JOURNAL_IMAGE_CM7, 5);
+    updateJournal_compareDone(journal, UPDATE_JOURNAL_IMAGE_CM4, 0x01);
+}
+
+static void test_checkUpdate(const UpdateJournal *journal)
+{
+    TEST_CHECK(journal->resumed);
+    TEST_CHECK(journal->doneSteps == ((1UL << 1) | (1UL << 6)));
+    TEST_CHECK(journal->compared[UPDATE_JOURNAL_IMAGE_CM7] && journal->compared[UPDATE_JOURNAL_IMAGE_CM4]);
+    TEST_CHECK(journal->changedSectors[UPDATE_JOURNAL_IMAGE_CM7] == 0x30);
+    TEST_CHECK(journal->changedSectors[UPDATE_JOURNAL_IMAGE_CM4] == 0x01);
+    TEST_CHECK(journal->programmedSectors[UPDATE_JOURNAL_IMAGE_CM7] == 0x30);
+    TEST_CHECK(journal->programmedSectors[UPDATE_JOURNAL_IMAGE_CM4] == 0);
+}
+
+/**
+ * @brief  Records are replayed after a reset, only for the same package
+ *         and session, and at most one is in the flash queue at a time.
+ */
+static void test_resume(void)
+{
+    UpdateJournal journal;
+    uint32_t end;
+
+    test_erase();
+    updateJournal_open(&journal, TEST_PACKAGE_SIZE, TEST_PACKAGE_CRC);
+    TEST_CHECK(!journal.resumed);
+    TEST_CHECK(journal.nextRecord == TEST_WORD(1));
+
+    test_appendUpdate(&journal);
+    TEST_CHECK(updateJournal_close(&journal));
+    TEST_CHECK(maxQueued == 1);
+    TEST_CHECK(test_hasNoHole(&end) && end == 7);
+
+    updateJournal_open(&journal, TEST_PACKAGE_SIZE, TEST_PACKAGE_CRC);
+    test_checkUpdate(&journal);
+    TEST_CHECK(journal.nextRecord == TEST_WORD(7));
+
+    updateJournal_open(&journal, TEST_PACKAGE_SIZE, TEST_PACKAGE_CRC + 1);
+    TEST_CHECK(!journal.resumed && journal.doneSteps == 0);
+    TEST_CHECK(journal.nextRecord == TEST_WORD(7));
+
+    session++;
+    updateJournal_open(&journal, TEST_PACKAGE_SIZE, TEST_PACKAGE_CRC);
+    TEST_CHECK(!journal.resumed);
+}
+
+/**
+ * @brief  A record whose program fails with its word still erased is
+ *         programmed again in place before any later record.
+ */
+static void test_failedRecordRetried(void)
+{
+    UpdateJournal journal;
+    uint32_t end;
+
+    test_erase();
+    updateJournal_open(&journal, TEST_PACKAGE_SIZE, TEST_PACKAGE_CRC);
+
+    failPrograms = 2;
+    test_appendUpdate(&journal);
+    TEST_CHECK(updateJournal_close(&journal));
+    TEST_CHECK(programs == 8);
+    TEST_CHECK(programsOverData == 0);
+    TEST_CHECK(test_hasNoHole(&end) && end == 7);
+
+    updateJournal_open(&journal, TEST_PACKAGE_SIZE, TEST_PACKAGE_CRC);
+    test_checkUpdate(&journal);
+}
+
+/**
+ * @brief  A record whose program fails half-way is programmed again in the
+ *         next word; the torn word fails its check on replay.
+ */
+static void test_tornRecordSkipped(void)
+{
+    UpdateJournal journal;
+    uint32_t end;
+
+    test_erase();
+    updateJournal_open(&journal, TEST_PACKAGE_SIZE, TEST_PACKAGE_CRC);
+
+    updateJournal_stepDone(&journal, 1);
+    STM32FlashAsync_wait(FLASH_BANK_1);
+    failPrograms = 1;
+    tearFailedWords = true;
+    updateJournal_compareDone(&journal, UPDATE_JOURNAL_IMAGE_CM7, 0x30);
+    updateJournal_stepDone(&journal, 6);
+    updateJournal_sectorDone(&journal, UPDATE_JOURNAL_IMAGE_CM7, 4);
+    updateJournal_sectorDone(&journal, UPDATE_JOURNAL_IMAGE_CM7, 5);
+    updateJournal_compareDone(&journal, UPDATE_JOURNAL_IMAGE_CM4, 0x01);
+    TEST_CHECK(updateJournal_close(&journal));
+    TEST_CHECK(programsOverData == 0);
+    TEST_CHECK(test_hasNoHole(&end) && end == 8);
+
+    updateJournal_open(&journal, TEST_PACKAGE_SIZE, TEST_PACKAGE_CRC);
+    test_checkUpdate(&journal);
+    TEST_CHECK(journal.nextRecord == TEST_WORD(8));
+}
+
+/**
+ * @brief  A record that cannot be programmed fails the journal: the
+ *         records after it are dropped, so the log still ends at the
+ *         failed word, and close reports the failure.
+ */
+static void test_failedJournal(void)
+{
+    UpdateJournal journal;
+    uint32_t end;
+
+    test_erase();
+    updateJournal_open(&journal, TEST_PACKAGE_SIZE, TEST_PACKAGE_CRC);
+
+    updateJournal_stepDone(&journal, 1);
+    updateJournal_stepDone(&journal, 2);
+    STM32FlashAsync_wait(FLASH_BANK_1);
+
+    failPrograms = 1000;
+    updateJournal_stepDone(&journal, 3);
+    updateJournal_stepDone(&journal, 4);
+    updateJournal_stepDone(&journal, 5);
+    updateJournal_stepDone(&journal, 6);
+    updateJournal_stepDone(&journal, 7);
+
+    uint32_t programsBefore = programs;
+    TEST_CHECK(!updateJournal_close(&journal));
+    TEST_CHECK(programs - programsBefore < 10);
+    TEST_CHECK(programsOverData == 0);
+    TEST_CHECK(test_hasNoHole(&end) && end == 3);
+
+    // Nothing more is queued once the journal has failed
+    programsBefore = programs;
+    updateJournal_stepDone(&journal, 8);
+    STM32FlashAsync_wait(FLASH_BANK_1);
+    TEST_CHECK(programs == programsBefore);
+
+    failPrograms = 0;
+    updateJournal_open(&journal, TEST_PACKAGE_SIZE, TEST_PACKAGE_CRC);
+    TEST_CHECK(journal.doneSteps == ((1UL << 1) | (1UL << 2)));
+    TEST_CHECK(journal.nextRecord == TEST_WORD(3));
+}
+
+int main(void)
+{
+    sector = mmap((void *)(uintptr_t)FLASH_PERSISTENT_DATA_ADDRESS, FLASH_SECTOR_SIZE, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (sector != (void *)(uintptr_t)FLASH_PERSISTENT_DATA_ADDRESS)
+    {
+        printf("Cannot map the persistent data sector at 0x%08lx\n", (unsigned long)FLASH_PERSISTENT_DATA_ADDRESS);
+        return EXIT_FAILURE;
+    }
+
+    TEST_RUN(test_resume);
+    TEST_RUN(test_failedRecordRetried);
+    TEST_RUN(test_tornRecordSkipped);
+    TEST_RUN(test_failedJournal);
+
+    printf("%s: %d failure(s)\n", __FILE__, test_failures);
+    return (test_failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}